@@ -0,0 +1,225 @@
+/*! \file   BoundedQueue.h
+
+    Copyright 2014-2015 Universidad de los Andes, Bogotá, Colombia
+
+    This file is part of Network Quality Manager System (NETQoS).
+
+    NETQoS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    NETQoS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this software; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    Description:
+    bounded lock-free ring buffer used to pass events between threads
+
+    $Id: BoundedQueue.h 748 2016-10-17 10:00:00 amarentes $
+*/
+
+#ifndef _BOUNDEDQUEUE_H_
+#define _BOUNDEDQUEUE_H_
+
+
+#include "stdincpp.h"
+
+
+//! size of a cache line, used to keep producer and consumer indexes apart
+const int QUEUE_CACHELINE_SIZE = 64;
+
+
+/*! \short   bounded lock-free queue
+
+    fixed size ring buffer where every cell carries a sequence number
+    that tells producers and consumers whether the cell is free or
+    filled. Any number of threads may push, and any number may pop,
+    without taking a lock; the QoS processor uses it with several
+    producers and a single consumer.
+
+    Besides the current depth the queue keeps a high-water mark and
+    the number of rejected pushes, to be reported via get_info.
+*/
+
+template <class T>
+class BoundedQueue
+{
+  private:
+
+    struct cell_t
+    {
+        unsigned long seq;
+        T data;
+    };
+
+    cell_t *buffer;        //!< ring buffer cells
+    unsigned long mask;    //!< capacity - 1 (capacity is a power of two)
+
+    char pad0[QUEUE_CACHELINE_SIZE];
+    unsigned long enqueuePos;   //!< next position to be written
+    char pad1[QUEUE_CACHELINE_SIZE];
+    unsigned long dequeuePos;   //!< next position to be read
+    char pad2[QUEUE_CACHELINE_SIZE];
+
+    unsigned long hwm;          //!< maximum depth observed
+    unsigned long rejected;     //!< pushes refused because the queue was full
+
+    // not copyable
+    BoundedQueue(const BoundedQueue &);
+    BoundedQueue &operator=(const BoundedQueue &);
+
+  public:
+
+    /*! \short   construct a queue
+        \arg \c size - requested capacity, rounded up to the next power of two
+    */
+    BoundedQueue(unsigned long size)
+      : enqueuePos(0), dequeuePos(0), hwm(0), rejected(0)
+    {
+        unsigned long cap = 2;
+        while (cap < size) {
+            cap <<= 1;
+        }
+
+        buffer = new cell_t[cap];
+        mask = cap - 1;
+
+        for (unsigned long i = 0; i < cap; i++) {
+            buffer[i].seq = i;
+        }
+    }
+
+    ~BoundedQueue()
+    {
+        saveDeleteArr(buffer);
+    }
+
+    /*! \short   append an element
+        \returns false if the queue is full, true otherwise
+    */
+    bool push(T const &data)
+    {
+        cell_t *cell;
+        unsigned long pos = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+
+        for (;;) {
+            cell = &buffer[pos & mask];
+            unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+            long dif = (long) seq - (long) pos;
+
+            if (dif == 0) {
+                if (__atomic_compare_exchange_n(&enqueuePos, &pos, pos + 1, true,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                __atomic_add_fetch(&rejected, 1, __ATOMIC_RELAXED);
+                return false;
+            } else {
+                pos = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+            }
+        }
+
+        cell->data = data;
+        __atomic_store_n(&cell->seq, pos + 1, __ATOMIC_RELEASE);
+
+        // maintain the high-water mark
+        unsigned long depth = size();
+        unsigned long old = __atomic_load_n(&hwm, __ATOMIC_RELAXED);
+        while ((depth > old) &&
+               !__atomic_compare_exchange_n(&hwm, &old, depth, true,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+        return true;
+    }
+
+    /*! \short   remove the oldest element
+        \returns false if the queue is empty, true otherwise
+    */
+    bool pop(T &data)
+    {
+        cell_t *cell;
+        unsigned long pos = __atomic_load_n(&dequeuePos, __ATOMIC_RELAXED);
+
+        for (;;) {
+            cell = &buffer[pos & mask];
+            unsigned long seq = __atomic_load_n(&cell->seq, __ATOMIC_ACQUIRE);
+            long dif = (long) seq - (long) (pos + 1);
+
+            if (dif == 0) {
+                if (__atomic_compare_exchange_n(&dequeuePos, &pos, pos + 1, true,
+                                                __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                    break;
+                }
+            } else if (dif < 0) {
+                return false;
+            } else {
+                pos = __atomic_load_n(&dequeuePos, __ATOMIC_RELAXED);
+            }
+        }
+
+        data = cell->data;
+        __atomic_store_n(&cell->seq, pos + mask + 1, __ATOMIC_RELEASE);
+
+        return true;
+    }
+
+    /*! \short   remove all elements currently in the queue in one go
+        \arg \c out - the elements are appended to this vector in queue order
+        \returns number of elements removed
+    */
+    unsigned long popAll(vector<T> &out)
+    {
+        unsigned long n = 0;
+        T data;
+
+        out.reserve(out.size() + size());
+
+        while (pop(data)) {
+            out.push_back(data);
+            n++;
+        }
+
+        return n;
+    }
+
+    //! number of elements currently queued (approximate under concurrency)
+    unsigned long size()
+    {
+        unsigned long tail = __atomic_load_n(&enqueuePos, __ATOMIC_RELAXED);
+        unsigned long head = __atomic_load_n(&dequeuePos, __ATOMIC_RELAXED);
+
+        return (tail > head) ? (tail - head) : 0;
+    }
+
+    bool empty()
+    {
+        return (size() == 0);
+    }
+
+    unsigned long capacity()
+    {
+        return mask + 1;
+    }
+
+    //! maximum number of elements that were queued at the same time
+    unsigned long highWaterMark()
+    {
+        return __atomic_load_n(&hwm, __ATOMIC_RELAXED);
+    }
+
+    //! number of pushes refused because the queue was full
+    unsigned long numRejected()
+    {
+        return __atomic_load_n(&rejected, __ATOMIC_RELAXED);
+    }
+};
+
+
+#endif // _BOUNDEDQUEUE_H_
@@ -0,0 +1,113 @@
+/*  \file   BulkRuleParser.h
+
+    Copyright 2014-2015 Universidad de los Andes,
+                        Bogota, Colombia
+
+    This file is part of Network Quality Managing System (NETQoS).
+
+    NETQoS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    NETQoS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this software; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    Description:
+    parser for the length-prefixed binary bulk rule format
+
+    $Id: BulkRuleParser.h 748 2016-10-17 10:00:00 amarentes $
+*/
+
+#ifndef _BULK_RULE_PARSER_H_
+#define _BULK_RULE_PARSER_H_
+
+
+#include "stdincpp.h"
+#include "RuleFileParser.h"
+
+
+//! magic at the start of a bulk rule buffer, followed by the version byte
+const char BULK_RULE_MAGIC[] = "NQRB";
+const unsigned char BULK_RULE_VERSION = 1;
+
+
+/*! \short   parser for the binary bulk rule format of /add_tasks_bulk
+
+    The buffer maps directly onto Rule, filter_t and action_t, there is
+    no XML document and no DTD validation. All integers are in network
+    byte order, a string is a u16 length followed by the bytes.
+
+    \verbatim
+    buffer  := "NQRB" u8(version) rule*
+    rule    := u32(length of the rest of the rule)
+               str(set name) str(rule name)
+               u8(n) filter{n}  u8(n) action{n}  u8(n) pref{n}
+    filter  := str(name) str(value) str(mask, empty for the default)
+    action  := str(name) u8(n) pref{n}
+    pref    := str(name) str(type, empty for String) str(value)
+    \endverbatim
+
+    Filter values use the same syntax as the XML rule files (*, a-b,
+    a,b,c and names from the filter value list).
+*/
+
+class BulkRuleParser
+{
+
+  private:
+
+    Logger *log;
+    int ch;
+    const unsigned char *buf;
+    int len;
+
+    //! read position in buf
+    int pos;
+
+    //! end of the rule being parsed
+    int ruleEnd;
+
+    //! default masks of the filters seen so far
+    map<string, FilterValue> defMasks;
+
+    unsigned int getU8();
+    unsigned int getU16();
+    unsigned int getU32();
+    void getStr(string &s);
+    void getPref(configItem_t &item);
+
+    void parseFilter(filterDefList_t *filterDefs, filterValList_t *filterVals,
+                     filter_t &f);
+
+    void parseFilterValue(filterValList_t *filterVals, const string &value, filter_t *f);
+
+    string lookup(filterValList_t *filterVals, const string &fvalue, filter_t *f);
+
+  public:
+
+    BulkRuleParser(char *b, int l);
+
+    virtual ~BulkRuleParser() {}
+
+    //! parse given rules and add parsed rules to rules
+    virtual void parse(filterDefList_t *filters,
+					   filterValList_t *filterVals,
+					   ruleDB_t *rules,
+					   RuleIdSource *idSource );
+
+    //! append a string in the bulk format to out
+    static void putStr(string &out, const string &s);
+
+    //! append a u8/u16/u32 in the bulk format to out
+    static void putInt(string &out, unsigned int val, int bytes);
+};
+
+
+#endif // _BULK_RULE_PARSER_H_
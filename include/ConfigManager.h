@@ -148,6 +148,15 @@ class ConfigManager
     //! create a C-style param list for the proc modules
     static configParam_t *getParamList( configItemList_t &list );
 
+    /*! \short   create a C-style param list for a flow
+        \arg \c list  - parameters
+        \arg \c block - compiled parameters, copied into the list terminator
+    */
+    static configParam_t *getParamList( configItemList_t &list, const paramBlock_t *block );
+
+    //! free a param list created by getParamList, params is set to NULL
+    static void freeParamList( configParam_t *&params );
+
     /*! merge two C-style param list for the proc modules
      */
     static configParam_t * mergeParamList( configParam_t *list_a, configParam_t *list_b );
@@ -48,11 +48,55 @@ const int LOG_COMMAND = 0x2;
 typedef map<string,string> paramList_t;
 typedef map<string,string>::iterator paramListIter_t;
 
+//! POST parameter, points into the decoded body of the request
+typedef struct
+{
+  char *value;
+  int len;
+} bodyParam_t;
+
+typedef map<string,bodyParam_t> bodyParamList_t;
+typedef map<string,bodyParam_t>::iterator bodyParamListIter_t;
+
+//! POST parameters up to this length are also copied into params
+const int MAX_COPIED_PARAM = 4096;
+
+//! state of an asynchronous add/remove job
+enum {
+    JOB_QUEUED = 0,
+    JOB_DONE,
+    JOB_FAILED
+};
+
+//! request parked in /task_status until its job finishes
+typedef struct
+{
+  struct REQUEST *req;
+  time_t deadline;
+} jobWaiter_t;
+
+//! asynchronous add/remove request and its result
+typedef struct
+{
+  int state;
+  string msg;          //!< result message once finished
+  time_t finished;
+  list<jobWaiter_t> waiters;
+} job_t;
+
+typedef map<unsigned long, job_t> jobList_t;
+typedef map<unsigned long, job_t>::iterator jobListIter_t;
+
+//! finished jobs can be queried for this long [s], unless JobKeepTime is configured
+const time_t JOB_KEEP_TIME = 600;
+
 //! command and parameter contained in a request
 typedef struct
 {
   string comm;
   paramList_t params;
+  bodyParamList_t body;  //!< all POST parameters (not copied)
+  struct REQUEST *req;
 } parseReq_t;
 
 
@@ -81,8 +125,35 @@ class CtrlComm : public QualityManagerComponent
     //! repository for static preloaded response documents
     PageRepository pcache;
 
-    //! preloaded template for replies
-    string rtemplate;
+    //! kind of a reply template segment
+    enum {
+        RT_TEXT = 0,
+        RT_STATUS,
+        RT_MESSAGE
+    };
+
+    //! constant text or variable field of the reply template
+    typedef struct
+    {
+        int type;
+        string text;
+    } replySegment_t;
+
+    //! preloaded template for replies, split at @STATUS@ and @MESSAGE@
+    vector<replySegment_t> rsegments;
+
+    //! split the reply template into rsegments
+    void splitTemplate(string &tmpl);
+
+    /*! \short  point iov at the reply for status and msg
+
+        \returns number of segments used, -1 if more than max are needed
+    */
+    int buildReply(struct iovec *iov, int max, const char *status,
+                   const string &msg, int quote);
+
+    //! build the reply for status and msg as a single string
+    string buildReply(const char *status, const string &msg, int quote);
 
     //! add to accessList all entries from list with host known by DNS
     void checkHosts( configADList_t &list, bool useIPv6 );
@@ -90,6 +161,30 @@ class CtrlComm : public QualityManagerComponent
     //! parse an incoming request
     parseReq_t parseRequest(struct REQUEST *req);
 
+    //! asynchronous jobs by id
+    jobList_t jobs;
+
+    //! id of the next job
+    unsigned long nextJob;
+
+    //! time a finished job is kept for /task_status [s]
+    time_t jobKeepTime;
+
+    //! true if the request asks for asynchronous processing (Async=yes)
+    int isAsync(parseReq_t *preq);
+
+    //! register a new job and answer req with 202 and the job id
+    unsigned long acceptJob(struct REQUEST *req);
+
+    //! answer req with the state of job id
+    void sendJobStatus(unsigned long id, job_t &job, struct REQUEST *req, fd_sets_t *fds);
+
+    //! record the result of job id and answer the requests waiting for it
+    void finishJob(unsigned long id, int state, const string &msg, fd_sets_t *fds);
+
+    //! answer expired /task_status waits and drop old finished jobs
+    void checkJobs(fd_sets_t *fds);
+
   public:
 
     /*! \short   construct and initialize a CtrlComm object
@@ -144,13 +239,30 @@ class CtrlComm : public QualityManagerComponent
     int logError(int eno, int loglevel, char *txt, char *peerhost);
     
     //! handle file descriptor event
-    int handleFDEvent(eventVec_t *e, fd_set *rset, fd_set *wset, fd_sets_t *fds);
+    int handleFDEvent(eventVec_t *e, fd_t *ready, int nready, fd_sets_t *fds);
     
     //! send OK response message
-    void sendMsg(string msg, struct REQUEST *req, fd_sets_t *fds, int quote=1);
+    void sendMsg(const string &msg, struct REQUEST *req, fd_sets_t *fds, int quote=1);
     
     //! send error response message
-    void sendErrMsg(string msg, struct REQUEST *req, fd_sets_t *fds);
+    void sendErrMsg(const string &msg, struct REQUEST *req, fd_sets_t *fds);
+
+    //! send OK response for a ctrlcomm event, or finish its job
+    void sendMsg(const string &msg, CtrlCommEvent *e, fd_sets_t *fds, int quote=1);
+
+    //! send error response for a ctrlcomm event, or fail its job
+    void sendErrMsg(const string &msg, CtrlCommEvent *e, fd_sets_t *fds);
+
+    /*! \short  answer with 304 if the client has the current reply already
+
+        \arg \c req   the request, its reply gets etag as ETag otherwise
+        \arg \c etag  quoted entity tag of the current reply
+        \returns      1 if 304 Not Modified was sent, 0 otherwise
+    */
+    int checkETag(struct REQUEST *req, const string &etag, fd_sets_t *fds);
+
+    //! answer req with a cached page (or 304) from the page repository
+    void sendPage(const page_t *page, struct REQUEST *req);
     
     //! check whether or not a feature has been enabled on startup
     int isEnabled( int feature )
@@ -176,9 +288,15 @@ class CtrlComm : public QualityManagerComponent
     //! add a measurement task to the currently active tasks
     char *processAddTask(parseReq_t *preq );
 
+    //! add the rules of an application/octet-stream body in the bulk format
+    char *processAddTasksBulk(parseReq_t *preq );
+
     //! delete a currently running measurement task
     char *processDelTask(parseReq_t *preq );
 
+    //! return the state of an asynchronous add/remove job
+    char *processTaskStatus(parseReq_t *preq );
+
     //! return meter information (tasklist,status,modlist,metercaps)
     char *processGetInfo(parseReq_t *preq );
 
@@ -33,6 +33,8 @@
 #include "stdincpp.h"
 #include "RuleFileParser.h"
 #include "QualityManagerInfo.h"
+#include "EventPool.h"
+#include "RuleBatch.h"
 
 
 //! event numbers
@@ -54,6 +56,7 @@ typedef enum
       ADD_RULES_CTRLCOMM, //13
       PROC_MODULE_TIMER, //14
       CTRLCOMM_TIMER, //15
+      GROUP_COMMIT, //16
 } event_t;
 
 
@@ -85,6 +88,7 @@ const string eventNames[] =
       "Add-rules-ctrlcomm",
       "Proc-module-timer",
       "Ctrlcomm-timer",
+      "Group-commit",
 };
 
 /* ------------------------- Event class ------------------------- */
@@ -94,8 +98,14 @@ const string eventNames[] =
              of EventScheduler
 */
 
+// slot list of the EventScheduler timing wheel
+struct wheelList_t;
+
+
 class Event {
 
+    friend class TimingWheel;
+
   private:
 
     //! type of the event
@@ -116,6 +126,10 @@ class Event {
     //! parent event that created this event.
     Event *parent;
 
+    //! links of the timing wheel slot list the event is queued in
+    Event *wheelNext, *wheelPrev;
+    wheelList_t *wheelList;
+
 
   public:
 
@@ -222,6 +236,17 @@ class Event {
     {
 	return 0;
     }
+
+    //! delete all rules in uids stored in this event, same return as deleteRule
+    virtual int deleteRules(const ruleUIdSet_t &uids)
+    {
+	return 0;
+    }
+
+    //! append the uids of the rules stored in this event
+    virtual void getRuleUIds(vector<int> &uids)
+    {
+    }
 };
 
 //! base class for all ctrlcomm events, contains pointer to request
@@ -230,10 +255,13 @@ class CtrlCommEvent: public Event
   private:
     struct REQUEST *req;
 
+    //! asynchronous job the result goes to, 0 if answered on req
+    unsigned long job;
+
   public:
     //! ctrlcomm events always expire now
     CtrlCommEvent(event_t type, unsigned long ival=0, int align=0)
-      : Event(type, ival, align) {}
+      : Event(type, ival, align), req(NULL), job(0) {}
 
     virtual ~CtrlCommEvent() {}
 
@@ -248,6 +276,18 @@ class CtrlCommEvent: public Event
     {
 	req = r;
     }
+
+    //! get the job id of an asynchronous request
+    unsigned long getJob()
+    {
+        return job;
+    }
+
+    //! set the job id of an asynchronous request
+    void setJob(unsigned long j)
+    {
+        job = j;
+    }
 };
 
 
@@ -275,45 +315,54 @@ class QoSProcessorEvent : public Event
 {
 
    private:
-      ruleDB_t rules;
+      RuleBatch *batch;
 
    public:
 
       QoSProcessorEvent(event_t type, struct timeval time, ruleDB_t &r)
-		: Event(type, time), rules(r) {}
+		: Event(type, time), batch(RuleBatch::create(r)) {}
 
       QoSProcessorEvent(event_t type, time_t offs_sec, ruleDB_t &r)
-        : Event(type, offs_sec), rules(r) {}
+        : Event(type, offs_sec), batch(RuleBatch::create(r)) {}
 
       QoSProcessorEvent(event_t type, ruleDB_t &r)
-        : Event(type), rules(r) {}
+        : Event(type), batch(RuleBatch::create(r)) {}
 
+      //! takes over the caller's reference to b
+      QoSProcessorEvent(event_t type, RuleBatch *b)
+        : Event(type), batch(b) {}
+
+      virtual ~QoSProcessorEvent()
+      {
+          batch->unref();
+      }
+
+      // all derived events have the same size and share one pool
+      EVENT_POOL_ALLOCATOR(QoSProcessorEvent)
 
 	  ruleDB_t * getRules()
 	  {
-		  return  &rules;
+		  return  batch->getRules();
 	  }
 
+      RuleBatch *getBatch()
+      {
+          return batch;
+      }
 
       int deleteRule(int uid)
       {
-         int ret = 0;
-         ruleDBIter_t iter;
-
-         for (iter=rules.begin(); iter != rules.end(); iter++)
-         {
-            if ((*iter)->getUId() == uid) {
-                rules.erase(iter);
-                ret++;
-                break;
-            }
-         }
+         return RuleBatch::deleteRule(batch, uid);
+      }
 
-         if (rules.empty()) {
-            return ++ret;
-         }
+      int deleteRules(const ruleUIdSet_t &uids)
+      {
+         return RuleBatch::deleteRules(batch, uids);
+      }
 
-         return ret;
+      void getRuleUIds(vector<int> &uids)
+      {
+         batch->getRuleUIds(uids);
       }
 };
 
@@ -346,85 +395,107 @@ class AddRulesEvent : public Event
 class ActivateRulesEvent : public Event
 {
   private:
-    ruleDB_t rules;
+    RuleBatch *batch;
 
   public:
 
     ActivateRulesEvent(struct timeval time, ruleDB_t &r)
-      : Event(ACTIVATE_RULES, time), rules(r) {}
-
-     ActivateRulesEvent(time_t offs_sec, ruleDB_t &r)
-      : Event(ACTIVATE_RULES, offs_sec), rules(r) {}
-
-     ActivateRulesEvent(ruleDB_t &r)
-      : Event(ACTIVATE_RULES), rules(r) {}
-
-     ruleDB_t *getRules()
-     {
-         return &rules;
-     }
-
-     int deleteRule(int uid)
-     {
-         int ret = 0;
-         ruleDBIter_t iter;
-
-         for (iter=rules.begin(); iter != rules.end(); iter++) {
-             if ((*iter)->getUId() == uid) {
-                 rules.erase(iter);
-                 ret++;
-                 break;
-             }
-         }
-
-         if (rules.empty()) {
-             return ++ret;
-         }
-
-         return ret;
-     }
+      : Event(ACTIVATE_RULES, time), batch(RuleBatch::create(r)) {}
+
+    ActivateRulesEvent(time_t offs_sec, ruleDB_t &r)
+      : Event(ACTIVATE_RULES, offs_sec), batch(RuleBatch::create(r)) {}
+
+    ActivateRulesEvent(ruleDB_t &r)
+      : Event(ACTIVATE_RULES), batch(RuleBatch::create(r)) {}
+
+    //! takes over the caller's reference to b
+    ActivateRulesEvent(time_t offs_sec, RuleBatch *b)
+      : Event(ACTIVATE_RULES, offs_sec), batch(b) {}
+
+    virtual ~ActivateRulesEvent()
+    {
+        batch->unref();
+    }
+
+    EVENT_POOL_ALLOCATOR(ActivateRulesEvent)
+
+    ruleDB_t *getRules()
+    {
+        return batch->getRules();
+    }
+
+    RuleBatch *getBatch()
+    {
+        return batch;
+    }
+
+    int deleteRule(int uid)
+    {
+        return RuleBatch::deleteRule(batch, uid);
+    }
+
+    int deleteRules(const ruleUIdSet_t &uids)
+    {
+        return RuleBatch::deleteRules(batch, uids);
+    }
+
+    void getRuleUIds(vector<int> &uids)
+    {
+        batch->getRuleUIds(uids);
+    }
 };
 
 
 class RemoveRulesEvent : public Event
 {
   private:
-    ruleDB_t rules;
+    RuleBatch *batch;
 
   public:
 
     RemoveRulesEvent(struct timeval time, ruleDB_t &r)
-      : Event(REMOVE_RULES, time), rules(r) {}
+      : Event(REMOVE_RULES, time), batch(RuleBatch::create(r)) {}
 
     RemoveRulesEvent(time_t offs_sec, ruleDB_t &r)
-      : Event(REMOVE_RULES, offs_sec), rules(r) {}
+      : Event(REMOVE_RULES, offs_sec), batch(RuleBatch::create(r)) {}
 
     RemoveRulesEvent(ruleDB_t &r)
-      : Event(REMOVE_RULES), rules(r) {}
+      : Event(REMOVE_RULES), batch(RuleBatch::create(r)) {}
+
+    //! takes over the caller's reference to b
+    RemoveRulesEvent(time_t offs_sec, RuleBatch *b)
+      : Event(REMOVE_RULES, offs_sec), batch(b) {}
+
+    virtual ~RemoveRulesEvent()
+    {
+        batch->unref();
+    }
+
+    EVENT_POOL_ALLOCATOR(RemoveRulesEvent)
 
     ruleDB_t *getRules()
     {
-        return &rules;
+        return batch->getRules();
     }
 
-    int deleteRule(int uid)
+    RuleBatch *getBatch()
     {
-        int ret = 0;
-        ruleDBIter_t iter;
+        return batch;
+    }
 
-        for (iter=rules.begin(); iter != rules.end(); iter++) {
-            if ((*iter)->getUId() == uid) {
-                rules.erase(iter);
-                ret++;
-                break;
-            }
-        }
+    int deleteRule(int uid)
+    {
+        return RuleBatch::deleteRule(batch, uid);
+    }
 
-        if (rules.empty()) {
-            return ++ret;
-        }
+    int deleteRules(const ruleUIdSet_t &uids)
+    {
+        return RuleBatch::deleteRules(batch, uids);
+    }
 
-        return ret;
+    void getRuleUIds(vector<int> &uids)
+    {
+        batch->getRuleUIds(uids);
     }
 };
 
@@ -436,14 +507,18 @@ private:
     int rid;
     int actid;
     unsigned int tmID;
+    unsigned int gen; //!< generation of the rule entry the timer belongs to
 
 public:
 
-    ProcTimerEvent( int ruleID, int actID, unsigned int tId, time_t duration_sec, time_t duration_msec, unsigned int flags ) :
+    ProcTimerEvent( int ruleID, int actID, unsigned int tId, time_t duration_sec, time_t duration_msec, unsigned int flags,
+                    unsigned int ruleGen = 0 ) :
       Event( PROC_MODULE_TIMER, duration_sec , duration_msec, (flags & TM_RECURRING ? duration_msec : 0), flags & TM_ALIGNED),
-      rid(ruleID), actid(actID), tmID(tId)
+      rid(ruleID), actid(actID), tmID(tId), gen(ruleGen)
       {}
 
+    EVENT_POOL_ALLOCATOR(ProcTimerEvent)
+
     int getRID()
       {
           return rid;
@@ -459,6 +534,11 @@ public:
           return tmID;
       }
 
+    unsigned int getGen()
+      {
+          return gen;
+      }
+
     int deleteRule(int uid)
     {
         int ret = 0;
@@ -468,6 +548,16 @@ public:
         }
         return ret;
     }
+
+    int deleteRules(const ruleUIdSet_t &uids)
+    {
+        return (uids.find(rid) != uids.end()) ? 2 : 0;
+    }
+
+    void getRuleUIds(vector<int> &uids)
+    {
+        uids.push_back(rid);
+    }
 };
 
 
@@ -526,6 +616,8 @@ class GetModInfoEvent : public CtrlCommEvent
 
 //! add rules flags
 const int ADD_RULES_MAPI   = 0x1;
+//! rules in the binary bulk format (see BulkRuleParser)
+const int ADD_RULES_BULK   = 0x2;
 
 class AddRulesCtrlEvent : public CtrlCommEvent
 {
@@ -534,21 +626,44 @@ class AddRulesCtrlEvent : public CtrlCommEvent
     char *buf;
     int len;
 
+    //! request body taken over from the httpd, buf points into it
+    char *mem;
+
   public:
 
     AddRulesCtrlEvent(char *b, int l, int mapi=0)
-      : CtrlCommEvent(ADD_RULES_CTRLCOMM), type(mapi), len(l)
+      : CtrlCommEvent(ADD_RULES_CTRLCOMM), type(mapi), len(l), mem(NULL)
     {
         buf = new char[len+1];
         memcpy(buf, b, len+1);
+        countEventAlloc(&eventAllocStats.addTasks);
+    }
+
+    //! use the rules at b inside m without a copy, m is freed with free()
+    AddRulesCtrlEvent(char *m, char *b, int l, int mapi=0)
+      : CtrlCommEvent(ADD_RULES_CTRLCOMM), type(mapi), buf(b), len(l), mem(m)
+    {
+        countEventAlloc(&eventAllocStats.addTasks);
     }
 
     ~AddRulesCtrlEvent()
     {
-        saveDeleteArr(buf);
+        if (mem != NULL) {
+            free(mem);
+        } else {
+            saveDeleteArr(buf);
+        }
     }
 
+    EVENT_POOL_ALLOCATOR(AddRulesCtrlEvent)
+
     int isMAPI()
+    {
+        return (type & ADD_RULES_MAPI);
+    }
+
+    //! ADD_RULES_* flags of the buffer, 0 for XML
+    int getFormat()
     {
         return type;
     }
@@ -575,6 +690,8 @@ class RemoveRulesCtrlEvent : public CtrlCommEvent
     RemoveRulesCtrlEvent(string r)
       : CtrlCommEvent(REMOVE_RULES_CTRLCOMM), rule(r) {}
 
+    EVENT_POOL_ALLOCATOR(RemoveRulesCtrlEvent)
+
     string getRule()
     {
         return rule;
@@ -582,6 +699,125 @@ class RemoveRulesCtrlEvent : public CtrlCommEvent
 };
 
 
+/*! \short   ctrlcomm add or remove requests committed together
+
+    requests arriving within the group commit window are merged into
+    a single QoS processor round; the result is then answered to
+    every member request
+
+    the rules of a remove group are stored rules, so they are exposed
+    to the rule index of the event scheduler: a rule deleted while the
+    group is still collecting is dropped from its members. An emptied
+    group stays scheduled, its members still have to be answered.
+*/
+class GroupCommitEvent : public Event
+{
+  public:
+
+    //! a waiting request and the rules it contributed
+    typedef struct
+    {
+        CtrlCommEvent *req;
+        ruleDB_t rules;
+    } member_t;
+
+    typedef list<member_t>            memberList_t;
+    typedef list<member_t>::iterator  memberListIter_t;
+
+  private:
+
+    //! ADD_RULES_CTRLCOMM or REMOVE_RULES_CTRLCOMM
+    event_t reqType;
+
+    memberList_t members;
+
+  public:
+
+    GroupCommitEvent(event_t rtype, struct timeval time)
+      : Event(GROUP_COMMIT, time), reqType(rtype) {}
+
+    event_t getRequestType()
+    {
+        return reqType;
+    }
+
+    //! add a request, takes over the contents of rules
+    void addMember(CtrlCommEvent *req, ruleDB_t &rules)
+    {
+        members.push_back(member_t());
+        members.back().req = req;
+        members.back().rules.swap(rules);
+    }
+
+    memberList_t *getMembers()
+    {
+        return &members;
+    }
+
+    //! the rules of all members, a rule named twice goes in once
+    void getRules(ruleDB_t &rules)
+    {
+        set<Rule *> seen;
+
+        for (memberListIter_t m = members.begin(); m != members.end(); m++) {
+            for (ruleDBIter_t r = m->rules.begin(); r != m->rules.end(); r++) {
+                if (seen.insert(*r).second) {
+                    rules.push_back(*r);
+                }
+            }
+        }
+    }
+
+    int deleteRule(int uid)
+    {
+        ruleUIdSet_t uids;
+
+        uids.insert(uid);
+        return deleteRules(uids);
+    }
+
+    //! returns 1 if a member referenced one of the rules, never 2
+    int deleteRules(const ruleUIdSet_t &uids)
+    {
+        int ret = 0;
+
+        if (reqType != REMOVE_RULES_CTRLCOMM) {
+            return 0;
+        }
+
+        for (memberListIter_t m = members.begin(); m != members.end(); m++) {
+            ruleDB_t kept;
+
+            for (ruleDBIter_t r = m->rules.begin(); r != m->rules.end(); r++) {
+                if (uids.find((*r)->getUId()) == uids.end()) {
+                    kept.push_back(*r);
+                }
+            }
+            if (kept.size() != m->rules.size()) {
+                m->rules.swap(kept);
+                ret = 1;
+            }
+        }
+
+        return ret;
+    }
+
+    //! the rules of an add group are not stored yet and not reported
+    void getRuleUIds(vector<int> &uids)
+    {
+        if (reqType != REMOVE_RULES_CTRLCOMM) {
+            return;
+        }
+
+        for (memberListIter_t m = members.begin(); m != members.end(); m++) {
+            for (ruleDBIter_t r = m->rules.begin(); r != m->rules.end(); r++) {
+                uids.push_back((*r)->getUId());
+            }
+        }
+    }
+};
+
+
 class addRulesQoSProcesorEvent : public QoSProcessorEvent
 {
 
@@ -596,6 +832,9 @@ class addRulesQoSProcesorEvent : public QoSProcessorEvent
       addRulesQoSProcesorEvent(ruleDB_t &r)
         : QoSProcessorEvent(ADD_RULES_QOS_PROCESSOR, r) {}
 
+      addRulesQoSProcesorEvent(RuleBatch *b)
+        : QoSProcessorEvent(ADD_RULES_QOS_PROCESSOR, b) {}
+
 };
 
 class respAddRulesQoSProcesorEvent : public QoSProcessorEvent
@@ -612,6 +851,9 @@ class respAddRulesQoSProcesorEvent : public QoSProcessorEvent
       respAddRulesQoSProcesorEvent(ruleDB_t &r)
         : QoSProcessorEvent(RESP_ADD_RULES_QOS_PROCESSOR, r) {}
 
+      respAddRulesQoSProcesorEvent(RuleBatch *b)
+        : QoSProcessorEvent(RESP_ADD_RULES_QOS_PROCESSOR, b) {}
+
 };
 
 class checkRulesQoSProcessorEvent : public QoSProcessorEvent
@@ -629,6 +871,9 @@ class checkRulesQoSProcessorEvent : public QoSProcessorEvent
       checkRulesQoSProcessorEvent(ruleDB_t &r)
         : QoSProcessorEvent(CHECK_RULES_QOS_PROCESSOR, r) {}
 
+      checkRulesQoSProcessorEvent(RuleBatch *b)
+        : QoSProcessorEvent(CHECK_RULES_QOS_PROCESSOR, b) {}
+
 };
 
 
@@ -646,6 +891,9 @@ class respCheckRulesQoSProcessorEvent : public QoSProcessorEvent
       respCheckRulesQoSProcessorEvent(ruleDB_t &r)
         : QoSProcessorEvent(RESP_CHECK_RULES_QOS_PROCESSOR, r) {}
 
+      respCheckRulesQoSProcessorEvent(RuleBatch *b)
+        : QoSProcessorEvent(RESP_CHECK_RULES_QOS_PROCESSOR, b) {}
+
 };
 
 
@@ -663,6 +911,9 @@ class delRulesQoSProcesorEvent : public QoSProcessorEvent
       delRulesQoSProcesorEvent(ruleDB_t &r)
         : QoSProcessorEvent(DEL_RULES_QOS_PROCESSOR, r) {}
 
+      delRulesQoSProcesorEvent(RuleBatch *b)
+        : QoSProcessorEvent(DEL_RULES_QOS_PROCESSOR, b) {}
+
 };
 
 class respDelRulesQoSProcesorEvent : public QoSProcessorEvent
@@ -679,6 +930,9 @@ class respDelRulesQoSProcesorEvent : public QoSProcessorEvent
       respDelRulesQoSProcesorEvent(ruleDB_t &r)
         : QoSProcessorEvent(RESP_DEL_RULES_QOS_PROCESSOR, r) {}
 
+      respDelRulesQoSProcesorEvent(RuleBatch *b)
+        : QoSProcessorEvent(RESP_DEL_RULES_QOS_PROCESSOR, b) {}
+
 };
 
 
@@ -0,0 +1,156 @@
+/*! \file   EventPool.h
+
+    Copyright 2014-2015 Universidad de los Andes, Bogotá, Colombia
+
+    This file is part of Network Quality Manager System (NETQoS).
+
+    NETQoS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    NETQoS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this software; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    Description:
+    free lists for the event classes created for every request
+
+    $Id: EventPool.h 748 2016-10-17 10:00:00 amarentes $
+*/
+
+#ifndef _EVENTPOOL_H_
+#define _EVENTPOOL_H_
+
+
+#include "stdincpp.h"
+#include <pthread.h>
+
+
+//! allocation counters of the event pools and the rule batches
+typedef struct
+{
+    unsigned long heapAllocs;   //!< events allocated from the heap
+    unsigned long poolReuses;   //!< events recycled from a pool
+    unsigned long batches;      //!< rule batches created
+    unsigned long batchShares;  //!< rule batches passed on without a copy
+    unsigned long batchCopies;  //!< private copies made of a shared batch
+    unsigned long addTasks;     //!< add_task requests received
+} eventAllocStats_t;
+
+//! process wide counters, updated with relaxed atomics
+extern eventAllocStats_t eventAllocStats;
+
+inline void countEventAlloc(unsigned long *counter)
+{
+    __atomic_add_fetch(counter, 1, __ATOMIC_RELAXED);
+}
+
+inline unsigned long getEventAllocCount(unsigned long *counter)
+{
+    return __atomic_load_n(counter, __ATOMIC_RELAXED);
+}
+
+
+/*! \short   free list for one event class
+
+    released objects are kept (up to MAX_FREE) and handed out again by
+    the next allocation of the same class instead of going through
+    the heap. Objects of a derived class with a different size are
+    simply passed on to the global operators.
+
+    The list is shared by the main loop and the QoS processor workers,
+    as events are created and deleted on both sides.
+*/
+
+template <class T>
+class EventPool
+{
+  private:
+
+    struct freeNode_t
+    {
+        freeNode_t *next;
+    };
+
+    static pthread_mutex_t lock;
+    static freeNode_t *head;
+    static unsigned long numFree;
+
+  public:
+
+    //! maximum number of objects kept on the free list
+    static const unsigned long MAX_FREE = 1024;
+
+    static void *alloc(size_t size)
+    {
+        if (size == sizeof(T)) {
+            pthread_mutex_lock(&lock);
+            freeNode_t *n = head;
+            if (n != NULL) {
+                head = n->next;
+                numFree--;
+            }
+            pthread_mutex_unlock(&lock);
+
+            if (n != NULL) {
+                countEventAlloc(&eventAllocStats.poolReuses);
+                return n;
+            }
+        }
+
+        countEventAlloc(&eventAllocStats.heapAllocs);
+        return ::operator new(size);
+    }
+
+    static void release(void *p, size_t size)
+    {
+        if (p == NULL) {
+            return;
+        }
+
+        if (size == sizeof(T)) {
+            pthread_mutex_lock(&lock);
+            if (numFree < MAX_FREE) {
+                freeNode_t *n = (freeNode_t *) p;
+                n->next = head;
+                head = n;
+                numFree++;
+                pthread_mutex_unlock(&lock);
+                return;
+            }
+            pthread_mutex_unlock(&lock);
+        }
+
+        ::operator delete(p);
+    }
+};
+
+template <class T>
+pthread_mutex_t EventPool<T>::lock = PTHREAD_MUTEX_INITIALIZER;
+
+template <class T>
+typename EventPool<T>::freeNode_t *EventPool<T>::head = NULL;
+
+template <class T>
+unsigned long EventPool<T>::numFree = 0;
+
+
+//! route new/delete of an event class through its pool
+#define EVENT_POOL_ALLOCATOR(cls)                                  \
+    static void *operator new(size_t size)                         \
+    {                                                              \
+        return EventPool<cls>::alloc(size);                        \
+    }                                                              \
+    static void operator delete(void *p, size_t size)              \
+    {                                                              \
+        EventPool<cls>::release(p, size);                          \
+    }
+
+
+#endif // _EVENTPOOL_H_
@@ -52,6 +52,125 @@ struct lttv
 typedef multimap<struct timeval, Event*,lttv>            eventList_t;
 typedef multimap<struct timeval, Event*,lttv>::iterator  eventListIter_t;
 
+//! events referencing a rule, indexed by rule uid
+typedef set<Event*>                      eventSet_t;
+typedef set<Event*>::iterator            eventSetIter_t;
+typedef map<int, eventSet_t>             ruleEventIndex_t;
+typedef map<int, eventSet_t>::iterator   ruleEventIndexIter_t;
+
+
+//! doubly linked list of events sharing a slot of the timing wheel
+struct wheelList_t
+{
+    Event *head;
+    Event *tail;
+};
+
+
+//! resolution of the timing wheel [us]
+const int WHEEL_TICK_USEC = 1000;
+
+//! number of bits/slots of the innermost wheel level
+const int WHEEL_ROOT_BITS = 8;
+const int WHEEL_ROOT_SIZE = 1 << WHEEL_ROOT_BITS;
+
+//! number of outer levels and bits/slots per outer level
+const int WHEEL_LEVELS = 4;
+const int WHEEL_LEVEL_BITS = 6;
+const int WHEEL_LEVEL_SIZE = 1 << WHEEL_LEVEL_BITS;
+
+//! tick value returned when nothing is pending
+const unsigned long long WHEEL_NO_TICK = ~0ULL;
+
+
+/*! \short   hierarchical timing wheel holding the scheduled events
+
+    The innermost level has one slot per tick (1ms) and covers the next
+    256 ticks; each of the 4 outer levels has 64 slots covering 64 times
+    the range of the level below. When the inner level wraps, the next
+    slot of the level above is cascaded down (the same scheme the Linux
+    kernel timers use). Events beyond the outermost level are kept in an
+    overflow list that is re-filed whenever the outermost level wraps.
+
+    Events are linked into the slots intrusively, so adding and removing
+    an event is O(1). Events falling into the same tick are delivered in
+    insertion order; an event is never delivered before its expiry time
+    but may be delivered up to one tick late.
+*/
+
+class TimingWheel
+{
+  private:
+
+    unsigned long long current;  //!< next tick to be processed
+
+    wheelList_t root[WHEEL_ROOT_SIZE];
+    wheelList_t levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+    wheelList_t overflow;        //!< events beyond the outermost level
+    wheelList_t ready;           //!< events whose tick has been processed
+
+    //! occupancy bitmaps of the inner and the outer levels
+    uint64_t rootMap[WHEEL_ROOT_SIZE / 64];
+    uint64_t levelMap[WHEEL_LEVELS];
+
+    int pending;    //!< number of events in the slots and the overflow list
+    int due;        //!< number of events in the ready list
+
+    void append(wheelList_t *l, Event *ev);
+    void unlink(Event *ev);
+
+    //! file an event into the slot matching its expiry tick
+    void place(Event *ev);
+
+    //! move all events of a list back into the wheel
+    void refile(wheelList_t *l);
+
+    //! cascade one slot of an outer level, returns the slot index
+    int cascade(int lvl);
+
+    //! process the tick current and move its events to the ready list
+    void processTick();
+
+  public:
+
+    TimingWheel(unsigned long long now);
+
+    //! expiry tick of an event (rounded up)
+    static unsigned long long toTick(struct timeval tv);
+
+    //! add an event
+    void add(Event *ev);
+
+    //! remove an event from the wheel (without deleting it)
+    void remove(Event *ev);
+
+    //! process all ticks up to and including tick target
+    void advance(unsigned long long target);
+
+    //! dequeue the oldest ready event (NULL if none)
+    Event *popReady();
+
+    /*! \short   first tick at which a slot needs processing
+
+        this is either the tick of the next pending event or a tick at
+        which an outer slot is cascaded (WHEEL_NO_TICK if nothing is pending)
+    */
+    unsigned long long nextBound();
+
+    //! collect all events held by the wheel
+    void getEvents(vector<Event*> &out);
+
+    int hasReady()
+    {
+        return (due > 0);
+    }
+
+    int size()
+    {
+        return pending + due;
+    }
+};
+
 
 /*! \short   schedule timed events and execute the corresponding function at the correct time
   
@@ -68,12 +187,28 @@ class EventScheduler
     Logger *log;  //!< link to global logger object
     int ch;       //!< logging channel number used by objects of this class
 
-    eventList_t events;    //!< event list
+    eventList_t events;    //!< event list (used without timing wheel)
+
+    TimingWheel *wheel;    //!< timing wheel (NULL if the event list is used)
+
+    ruleEventIndex_t ruleIndex;  //!< scheduled events by rule uid
+
+    //! add/remove an event to/from the rule index
+    void indexEvent(Event *ev);
+    void unindexEvent(Event *ev);
+
+    //! take an event out of the event list or wheel
+    void unlinkEvent(Event *ev);
+
+    //! current time as wheel tick
+    static unsigned long long nowTick();
     
   public:
     
-    //! construct and initialize an EventScheduler object
-    EventScheduler();
+    /*! \short   construct and initialize an EventScheduler object
+        \arg \c useWheel - keep the events in a timing wheel instead of a sorted list
+    */
+    EventScheduler(int useWheel = 0);
     
 
     //! destroy an EventScheduler object
@@ -91,28 +226,63 @@ class EventScheduler
 
     /*! \short   delete all events for a given rule 
 
-        delete all Events related to the specified rule from the list of events
+        delete all Events related to the specified rule from the list of events;
+        only the events referencing the rule are visited
+
 
         \arg \c uid  - the unique identification number of the rule
     */
     void delRuleEvents(int uid);
 
+
+    /*! \short   delete all events for a group of rules
+
+        like delRuleEvents(uid) but every event referencing any of the
+        rules is visited only once, e.g. when a whole rule set is removed
+
+        \arg \c uids  - the unique identification numbers of the rules
+    */
+    void delRuleEvents(const ruleUIdSet_t &uids);
+
+    /*! \short   update the rule index after the rules of a queued event changed
+
+        \arg \c ev - an event added before, rules may only have been added to it
+    */
+    void reindexEvent(Event *ev);
+
     // get pointer to first/next event
     Event *getNextEvent();
 
-    //! requeus (if recurring) the event ev advancing its expiry time
+    /*! \short  requeus (if recurring) the event ev advancing its expiry time
+
+        an event in EV_PROCESSING is waiting for the QoS processor and is
+        parked instead: it leaves the queue until resumeEvent is called
+    */
     void reschedNextEvent(Event *ev);
 
-    //! return the time of the next event due
+    //! continue a parked event whose work has been completed
+    void resumeEvent(Event *ev);
+
+    //! return the time until the next event is due
     struct timeval getNextEventTime();
 
+    /*! \short   get the absolute time at which the next event is due
+        \returns 0 if no event is scheduled
+    */
+    int getNextEventExpiry(struct timeval *tv);
+
+    /*! \short   dequeue the next event if it is due at time now
+        \returns the event or NULL if no event is due yet
+    */
+    Event *getNextDueEvent(struct timeval now);
+
     //! dump an EventScheduler object
     void dump(ostream &os);
 
     //! get the number of events registered
     inline int getNumEvents()
     {
-        return (int) events.size();
+        return (wheel != NULL) ? wheel->size() : (int) events.size();
     }
 };
 
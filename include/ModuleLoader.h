@@ -190,6 +190,14 @@ class ModuleLoader
     { 
         return modules.size(); 
     }
+
+    //! append the names of the currently loaded modules
+    void getModuleNames( vector<string> &names )
+    {
+        for (moduleListIter_t i = modules.begin(); i != modules.end(); i++) {
+            names.push_back(i->first);
+        }
+    }
 };
 
 
@@ -31,9 +31,24 @@
 
 #include "stdincpp.h"
 
-//! url to page content map
-typedef map<string,string>            repository_t;
-typedef map<string,string>::iterator  repositoryIter_t;
+
+/*! \short a cached page, all members are immutable once the page is added
+
+    the body buffers are handed to the httpd without copying them
+*/
+struct page_t
+{
+    string content;     //!< page as added
+    string gzipped;     //!< gzip encoding of content, empty if not smaller
+    string etag;        //!< quoted entity tag of content
+    string gzEtag;      //!< quoted entity tag of the gzip encoding
+    string fileName;    //!< file the page was read from, if any
+    const char *mime;   //!< mime type of the page
+};
+
+//! url to page map
+typedef map<string,page_t>            repository_t;
+typedef map<string,page_t>::iterator  repositoryIter_t;
 
 
 /*! \short stores HTML pages (i.e. text strings) which can be found
@@ -44,11 +59,11 @@ class PageRepository
 {
   private:
 
-    //! maps url to page content
+    //! maps url to page
     repository_t  pages;
 
-    //! maps url to filename
-    repository_t  fileNames;
+    //! compute gzip variant and entity tags of page
+    static void encodePage( page_t &page );
 
   public:
 
@@ -56,15 +71,19 @@ class PageRepository
 
     ~PageRepository() {}
 
-    //! FIXME document
-    void addPage( string url, string content )
-    { 
-        pages[url] = content; 
-    }
+    //! add page with content under url
+    void addPage( string url, string content, const char *mime = "text/html" );
 
-    void addPageFile( string url, string filename );
+    //! add the content of file filename under url
+    void addPageFile( string url, string filename, const char *mime = "text/html" );
 
-    string getPage( string url );
+    //! get the page stored under url, NULL if there is none
+    const page_t *getPage( const string &url )
+    {
+        repositoryIter_t iter = pages.find(url);
+
+        return (iter != pages.end()) ? &iter->second : NULL;
+    }
 
     string getFileName( string url );
 };
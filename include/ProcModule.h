@@ -65,6 +65,12 @@ class ProcModule : public Module
     
     ConfigManager *cnf; //!< link to configuration manager (for cfg file query)
 
+    //! 1 if the module sets up and dismantles batches of flows in one call
+    int batchSetup;
+
+    //! 1 if the module checks flows without setting them up
+    int validateSetup;
+
   public:
 
     typeInfo_t *getTypeInfo() 
@@ -92,6 +98,18 @@ class ProcModule : public Module
         return funcList->getModuleInfo(i); 
     }
 
+    //! true if initFlowSetupBatch/destroyFlowSetupBatch can be used
+    int hasBatchSetup()
+    {
+        return batchSetup;
+    }
+
+    //! true if validateFlowSetup can be used
+    int hasValidateSetup()
+    {
+        return validateSetup;
+    }
+
     /*! \short   construct and initialize a ProcModule object
 
         take the library handle of an evaluation module and retrieve all the
@@ -40,6 +40,60 @@ typedef struct {
 } configParam_t;
 
 
+/*! \short   flow parameters known to the QoS processor
+
+    they are compiled into a paramBlock_t when the rule is parsed, so
+    modules can read them by key instead of scanning the configParam_t
+    array and parsing the value strings again
+*/
+typedef enum {
+    PARAM_FLOWID = 0,
+    PARAM_RATE,
+    PARAM_BURST,
+    PARAM_DURATION,
+    PARAM_PRIORITY,
+    PARAM_BIDIR,
+    PARAM_NUM_KEYS
+} paramKey_e;
+
+//! parameter names as given in the rules, indexed by paramKey_e
+static const char * const PARAM_KEY_NAMES[PARAM_NUM_KEYS] =
+    { "FlowId", "Rate", "Burst", "Duration", "Priority", "Bidir" };
+
+//! typed flow parameters
+typedef struct {
+    //! bit (1 << key) is set if the parameter is given
+    unsigned int present;
+
+    //! value of each given parameter (bools are 0 or 1)
+    long long value[PARAM_NUM_KEYS];
+} paramBlock_t;
+
+
+/*! \short   get the compiled block of a flow parameter array
+
+    the terminating entry (name == NULL) of the arrays given to the flow
+    functions carries the compiled parameters in its value field. Modules
+    that do not know about it stop at the terminator as before.
+
+    \returns the block, NULL if there is none (e.g. module parameters)
+*/
+inline const paramBlock_t *getParamBlock( configParam_t *params )
+{
+    while (params[0].name != NULL) {
+        params++;
+    }
+
+    return (const paramBlock_t *) params[0].value;
+}
+
+//! true if the parameter is given in the block
+inline int hasParam( const paramBlock_t *block, paramKey_e key )
+{
+    return (block->present >> key) & 1;
+}
+
+
 //! short   the magic number that will be embedded into every action module
 #define PROC_MAGIC   ('N'<<24 | 'M'<<16 | '_'<<8 | 'P')
 
@@ -177,6 +231,33 @@ typedef std::list<filter_t>::iterator  filterListIter_t;
 typedef int (*proc_timeout_func_t)( int timerID, void *flowdata );
 
 
+//! first interface version providing the batch flow setup functions
+#define PROC_BATCH_VERSION   4
+
+//! first interface version providing validateFlowSetup
+#define PROC_VALIDATE_VERSION   5
+
+
+/*! \short   one flow of a batch given to initFlowSetupBatch/destroyFlowSetupBatch
+
+    the arguments are the ones of initFlowSetup/destroyFlowSetup. The
+    module reports the outcome for every flow in status instead of
+    throwing, so one bad flow does not abort the whole batch
+*/
+typedef struct {
+    int rule_id;
+    int action_id;
+    configParam_t *params;
+    filterList_t *filters;
+
+    //! module specific data (set by init, passed to destroy)
+    void *flowdata;
+
+    //! 0 - on success, <0 - error code (see getErrorMsg)
+    int status;
+} flowSetup_t;
+
+
 /*! \short   initialize the action module upon loading
    \returns 0 - on success, <0 - else
 */
@@ -204,6 +285,35 @@ void destroyModule( configParam_t *params );
 void initFlowSetup( int rule_id, int action_id, configParam_t *params, filterList_t *filters, void **flowdata );
 
 
+/*! \short   initialize the router configuration for a batch of flows
+
+    optional, a module not implementing it is called through
+    initFlowSetup for every flow. flowdata is only valid for the flows
+    whose status is 0; the module has already undone the others.
+
+    \arg \c  setups    - flows to set up
+    \arg \c  n         - number of flows
+*/
+void initFlowSetupBatch( flowSetup_t *setups, int n ) __attribute__((weak));
+
+
+/*! \short   check whether a flow could be set up, without setting it up
+
+    parses and checks the parameters and filters of the flow and does
+    the admission control initFlowSetup would do, but leaves the router
+    configuration and the module state untouched. Optional, a module
+    not implementing it is checked through initFlowSetup followed by
+    destroyFlowSetup.
+
+    \arg \c  rule_id    - identifier for the rule
+    \arg \c  action_id  - action identifier for the rule
+    \arg \c  params     - module parameters
+    \arg \c  filters    - filters of the rule
+    \throws ProcError if the flow can not be set up
+*/
+void validateFlowSetup( int rule_id, int action_id, configParam_t *params, filterList_t *filters ) __attribute__((weak));
+
+
 /*! \short   get list of default timers for this proc module
     \arg \c  flowdata  - place for action module specific data from flow table
     \returns   list of timer structs
@@ -222,6 +332,18 @@ timers_t* getTimers( void *flowdata );
 void destroyFlowSetup( int rule_id, int action_id, configParam_t *params, filterList_t *filters, void *flowdata );
 
 
+/*! \short   dismantle the router configuration for a batch of flows
+
+    optional, a module not implementing it is called through
+    destroyFlowSetup for every flow. The flow data of every flow is
+    released, whatever its status.
+
+    \arg \c  setups    - flows to dismantle
+    \arg \c  n         - number of flows
+*/
+void destroyFlowSetupBatch( flowSetup_t *setups, int n ) __attribute__((weak));
+
+
 /*! \short   reset flow data record for a rule
 
     \arg \c  flowdata  - place of action module specific data from flow table
@@ -308,6 +430,13 @@ typedef struct {
     const char* (*getModuleInfo)(int i);
     char* (*getErrorMsg)( int code );
 
+    // since PROC_BATCH_VERSION, NULL if not implemented by the module
+    void (*initFlowSetupBatch)( flowSetup_t *setups, int n );
+    void (*destroyFlowSetupBatch)( flowSetup_t *setups, int n );
+
+    // since PROC_VALIDATE_VERSION, NULL if not implemented by the module
+    void (*validateFlowSetup)( int ruleid, int action_id, configParam_t *params, filterList_t *filters );
+
 } ProcModuleInterface_t;
 
 #endif /* __PROCMODULEINTERFACE_H */
@@ -41,11 +41,16 @@
 #include "Logger.h"
 #include "EventScheduler.h"
 #include "FlowIdSource.h"
+#include "BoundedQueue.h"
+
+
+//! maximum number of actions of a rule
+const int MAX_RULE_ACTIONS = 8;
 
 
 struct ppaction_t
 {
-    ProcModule *module;
+    ProcModule *module;  // NULL means the slot is not used
     ProcModuleInterface_t *mapi; // module API
     void *flowData;
 
@@ -55,14 +60,9 @@ struct ppaction_t
 	// flow id assigned to this action.
 	uint16_t flowid; // 0 means not assigned.
 
-    ppaction_t& operator=( ppaction_t const& rhs);
-
+    ppaction_t() : module(NULL), mapi(NULL), flowData(NULL), params(NULL), flowid(0) {}
 };
 
-//! actions for each rule
-typedef std::map<int, ppaction_t>            ppactionList_t;
-typedef std::map<int, ppaction_t>::iterator  ppactionListIter_t;
-
 
 struct ruleActions_t
 {
@@ -74,8 +74,11 @@ struct ruleActions_t
     //! number of packets and bytes seen by this rule/task
     unsigned long long packets, bytes;
 
-    //! master list of action module data
-    ppactionList_t actions;
+    //! action module data, action id n is kept in actions[n-1]
+    ppaction_t actions[MAX_RULE_ACTIONS];
+
+    //! number of action slots in use (highest action id)
+    int numActions;
 
     //! 1 if flow autocreation enabled for rule
     int auto_flows;
@@ -86,13 +89,276 @@ struct ruleActions_t
 
     Rule *rule;
 
-    ruleActions_t& operator=( ruleActions_t const& rhs);
+    //! generation of the table slot holding this entry
+    unsigned int gen;
+
+    ruleActions_t();
+
+    //! action with the given id, NULL if there is none
+    ppaction_t *getAction( int actId );
+
+    //! store an action under the given id (throws Error if out of range)
+    void setAction( int actId, ppaction_t &a );
+};
+
+
+/*! \short   actions of the active rules, indexed by rule uid
+
+    rule uids are small numbers handed out by RuleIdSource and reused
+    once freed, so the entries are kept in a flat array indexed by uid.
+    Every slot carries a generation counter that is bumped whenever a
+    rule is stored in it, which lets stale references (e.g. timers of a
+    deleted rule whose uid has been reused) be told apart.
+
+    Lookups never create entries: unknown uids are reported as such.
+*/
+class RuleActionTable
+{
+  private:
+
+    struct slot_t
+    {
+        int used;
+        unsigned int gen;
+        ruleActions_t entry;
+
+        slot_t() : used(0), gen(0) {}
+    };
+
+    vector<slot_t> slots;
+
+    //! number of slots in use
+    int count;
+
+  public:
+
+    RuleActionTable() : count(0) {}
+
+    //! entry of the rule, NULL if the uid is unknown
+    ruleActions_t *find( int uid );
+
+    //! generation the entry of the rule will get when it is inserted next
+    unsigned int nextGeneration( int uid );
+
+    /*! \short   give up the generation returned by nextGeneration
+
+        used when a rule that already armed timers with it does not
+        become active, so those timers do not match the next rule
+        stored under the uid. Slots in use are left alone.
+    */
+    void skipGeneration( int uid );
+
+    /*! \short   store the entry of a rule
+
+        \returns the stored entry, its generation set
+        \throws Error if the uid is invalid or already in use
+    */
+    ruleActions_t *insert( int uid, ruleActions_t &entry );
+
+    /*! \short   remove the entry of a rule
+        \arg \c out - receives the removed entry if not NULL
+        \returns 1 if the rule was found, 0 otherwise
+    */
+    int erase( int uid, ruleActions_t *out = NULL );
+
+    //! append the uids of all rules in the table
+    void getUIds( vector<int> &uids );
+
+    int size()
+    {
+        return count;
+    }
+};
+
+
+//! an action of a rule set up or removed as part of a batch
+struct batchAction_t
+{
+    //! index of the rule within the batch
+    unsigned int rule;
+
+    int actionId;
+
+    ppaction_t a;
+
+    //! 0 if the module call succeeded, error code otherwise
+    int status;
+};
+
+typedef vector<batchAction_t>            batchActionList_t;
+typedef vector<batchAction_t>::iterator  batchActionListIter_t;
+
+//! actions of a batch (indexes into a batchActionList_t) per module
+typedef map<ProcModule *, vector<int> >            moduleBatchList_t;
+typedef map<ProcModule *, vector<int> >::iterator  moduleBatchListIter_t;
+
+
+//! length of a tick of the module timer wheel [msec]
+const int PROC_TIMER_TICK_MSEC = 10;
+
+//! number of slots of the module timer wheel (one revolution is 5.12 s)
+const int PROC_TIMER_SLOTS = 512;
+
+
+//! a module timer kept by a QoS processor worker
+struct procTimer_t
+{
+    int rid;
+    int actid;
+    unsigned int tmID;
+
+    //! generation of the rule entry the timer was created for
+    unsigned int gen;
+
+    //! tick the timer expires in
+    unsigned long long expiry;
+};
+
+typedef vector<procTimer_t>            procTimerList_t;
+typedef vector<procTimer_t>::iterator  procTimerListIter_t;
+
+
+/*! \short   hashed timing wheel for the module timers of a worker
+
+    a timer expiring in tick t is kept in slot t % PROC_TIMER_SLOTS.
+    Advancing the wheel only looks at the slots of the ticks that passed,
+    timers further away than one revolution are skipped until their
+    round comes. All timers due in the passed ticks are handed out
+    together so they can be torn down in one go. The earliest expiry of
+    each slot and a bitmap of the occupied slots let nextTimeout find
+    the next timer without looking at the timers themselves.
+*/
+class ProcTimerWheel
+{
+  private:
+
+    vector<procTimerList_t> slots;
+
+    //! earliest expiry in each slot, valid for the occupied slots
+    vector<unsigned long long> slotMin;
+
+    //! occupancy bitmap of the slots
+    uint64_t used[PROC_TIMER_SLOTS / 64];
+
+    //! last tick that has been expired
+    unsigned long long current;
+
+    //! number of timers in the wheel
+    int count;
+
+    //! tick a point in time [usec] falls in
+    static unsigned long long toTick( unsigned long long usec )
+    {
+        return usec / (PROC_TIMER_TICK_MSEC * 1000ULL);
+    }
+
+  public:
+
+    //! \arg \c now - current time [usec]
+    ProcTimerWheel( unsigned long long now );
+
+    /*! \short   add a timer
+        \arg \c t    - timer, its expiry is computed from ival
+        \arg \c ival - time until the timer expires [msec]
+        \arg \c now  - current time [usec]
+    */
+    void add( procTimer_t &t, unsigned long ival, unsigned long long now );
+
+    //! move all timers due at time now [usec] to expired, returns their number
+    int expire( unsigned long long now, procTimerList_t &expired );
+
+    //! msec until the earliest timer expires, -1 if empty
+    int nextTimeout( unsigned long long now );
 
+    int size()
+    {
+        return count;
+    }
 };
 
-//! action list for each rule
-typedef map<int, ruleActions_t>            ruleActionList_t;
-typedef map<int, ruleActions_t>::iterator  ruleActionListIter_t;
+
+//! wakeup statistics of the QoS processor thread
+struct wakeupStats_t
+{
+    //! number of times the thread was woken up with pending work
+    unsigned long long wakeups;
+
+    //! accumulated wakeup-to-dequeue latency [usec]
+    unsigned long long totalLatency;
+
+    //! maximum wakeup-to-dequeue latency [usec]
+    unsigned long long maxLatency;
+};
+
+
+//! number of queued events per rule uid
+typedef map<int, int>            ruleRefCount_t;
+typedef map<int, int>::iterator  ruleRefCountIter_t;
+
+
+// forward declaration
+class QOSProcessor;
+
+/*! \short   worker of the QoS processor
+
+    rule batches are distributed over the workers by the hash of the
+    rule set of their first rule, a batch whose rules are still queued
+    or being handled by a worker follows them there so that adding and
+    deleting a rule keep their order. Calls into a module are serialised
+    by the lock of the shard owning the module, so a slow kernel call in
+    one module does not block the rules of the other shards
+*/
+struct procShard_t
+{
+    int id;
+
+    //! pending input events of this shard
+    BoundedQueue<Event *> *queue;
+
+    //! eventfd used to wake up the worker when events are queued
+    int wakeFd;
+
+    //! time [usec] the first pending event was signalled (0 if none)
+    unsigned long long signalTime;
+
+    //! number of queued events referencing each rule uid
+    ruleRefCount_t queuedRules;
+
+    //! number of events being handled that reference each rule uid
+    ruleRefCount_t busyRules;
+
+    //! wakeup statistics (threaded mode only)
+    wakeupStats_t wstats;
+
+    //! number of events handled by this shard
+    unsigned long long processed;
+
+    //! module timers of the flows owned by this shard (threaded mode only)
+    ProcTimerWheel *timers;
+
+    //! number of module timers expired by this shard
+    unsigned long long expired;
+
+    //! processor the shard belongs to
+    QOSProcessor *proc;
+
+#ifdef ENABLE_THREADS
+    thread_t thread;  //!< worker thread
+    mutex_t lock;     //!< serialises the calls into the modules of the shard
+    int running;
+
+    //! set by stop(), the worker leaves its loop after the current event
+    int stopping;
+#endif
+};
+
+//! list of shards
+typedef vector<procShard_t *>            procShardList_t;
+typedef vector<procShard_t *>::iterator  procShardListIter_t;
+
+//! module name to shard index
+typedef map<string, int>            moduleShardList_t;
+typedef map<string, int>::iterator  moduleShardListIter_t;
 
 
 /*! \short   manage and apply Action Modules, retrieve flow data
@@ -113,23 +379,104 @@ class QOSProcessor : public QualityManagerComponent
     ModuleLoader *loader;
 
     //! action list for rules
-    ruleActionList_t  rules;
+    RuleActionTable  rules;
 
     //! pool of unique Flow ids
     FlowIdSource idSource;
 
     //! add timer events to scheduler
-    void addTimerEvents( int ruleID, int actID, ppaction_t &act, EventScheduler &es );
+    void addTimerEvents( int ruleID, unsigned int gen, int actID, ppaction_t &act, EventScheduler &es );
 
     //! add timer events to the output queue
-    void addTimerEvents( int ruleID, int actID, ppaction_t &act );
+    void addTimerEvents( int ruleID, unsigned int gen, int actID, ppaction_t &act );
+
+    /*! \short   set up the actions of a batch of rules
+
+        all flows of a module are handed over in a single call if the
+        module supports it. Rules whose actions cannot all be set up go
+        to RS_ERROR, the others to RS_ACTIVE.
+
+        \arg \c batch - rules to add
+        \arg \c e     - event scheduler for the timers (NULL: output queue)
+    */
+    void addRuleBatch( ruleDB_t &batch, EventScheduler *e );
+
+    //! batch for the response to evt, shared with evt if it holds rules
+    RuleBatch *getResponseBatch( ruleDB_t *rules, Event *evt );
+
+    //! module parameters of an action: the configured ones plus the flow id
+    configParam_t *getActionParams( configItemList_t &items, const paramBlock_t &compiled,
+                                    uint16_t flowid );
+
+    //! remove the actions of a batch of rules, one call per module if supported
+    void delRuleBatch( ruleDB_t &batch );
+
+    /*! \short   dismantle actions already taken out of the rule table
+
+        \arg \c owners - rules the actions belong to
+        \arg \c acts   - the actions, batchAction_t::rule indexes owners
+    */
+    void destroyActions( ruleDB_t &owners, batchActionList_t &acts );
+
+    //! expire the module timers of a shard that are due
+    void runTimers( procShard_t *shard );
+
+    //! dismantle the actions of a batch of expired module timers
+    void expireTimers( procTimerList_t &due );
 
     void createFlowKey(unsigned char *mvalues, unsigned short len, ruleActions_t *ra);
 
+    //! workers, there is exactly one without threads
+    procShardList_t shards;
+
+    //! shard assigned to each module loaded at start up (read only afterwards)
+    moduleShardList_t moduleShards;
+
+    //! shard owning the given module, takes no lock
+    procShard_t *getModuleShard( const string &modname );
+
+    //! shard that has to handle the given event with rules uids, maccess must be held
+    procShard_t *getEventShard( Event *ev, vector<int> &uids );
+
+    //! block until new events are signalled for the shard or its next timer is due
+    void waitForEvents( procShard_t *shard );
+
+    //! handle all events pending for a shard
+    void processShard( procShard_t *shard );
+
+    //! worker loop of a shard
+    void shardMain( procShard_t *shard );
+
+    //! whether stop() asked the worker of the shard to leave its loop
+    int shardStopping( procShard_t *shard )
+    {
+#ifdef ENABLE_THREADS
+        return __atomic_load_n(&shard->stopping, __ATOMIC_ACQUIRE);
+#else
+        return 0;
+#endif
+    }
+
+    //! thread function of the workers
+    static void *shardThreadFunc( void *arg );
+
+    //! queue a response event for the main loop, waiting while the queue is full
+    void pushOutEvent( Event *evt );
+
+    //! tell the main loop that responses are queued
+    void signalMainLoop();
+
+    //! responses that did not fit into out_events (without threads only)
+    eventVec_t outSpill;
+
+#ifdef ENABLE_THREADS
+    //! signalled when the main loop has collected the queued responses
+    thread_cond_t outCond;
+#endif
+
   protected:
 
-	eventVec_t in_events;  //!< Pending input event list (to be processes)
-	eventVec_t out_events;  //!< Pending output event list (response to events processed)
+	BoundedQueue<Event *> *out_events;  //!< Pending output event list (response to events processed)
 
   public:
 
@@ -145,27 +492,34 @@ class QOSProcessor : public QualityManagerComponent
     virtual ~QOSProcessor();
 
 
+    //! true if no events are pending on any queue
+    bool isIdle();
+
+
     /*! \short   add an Event to the event queue
 
         \arg \c ev - an event (or an object derived from Event) that is
                      schdeuled for a particular time (possibly repeatedly
                      at a given interval)
+        \returns 0 - if queued, -1 - if the queue is full; ev is then
+                 still owned by the caller
     */
-    void addEvent( Event *ev );
-
+    int addEvent( Event *ev );
 
-    /*! \short   delete all events for a given rule
 
-        delete all Events related to the specified rule from the list of events
+    /*! \short   return the next event to be executed by a shard.
 
-        \arg \c uid  - the unique identification number of the rule
     */
-    void delRuleEvents( int uid );
+	Event * getNextEvent( procShard_t *shard );
 
-    /*! \short   return the next event to be executed.
+    //! account (delta=1) or unaccount (delta=-1) the rules of a queued event, maccess must be held
+    void countQueuedRules( procShard_t *shard, vector<int> &uids, int delta );
 
-    */
-	Event * getNextEvent();
+    //! move the rules of a dequeued event from the queued to the busy ones
+    void releaseQueuedRules( procShard_t *shard, Event *ev );
+
+    //! unaccount the rules of an event that has been handled
+    void releaseBusyRules( procShard_t *shard, Event *ev );
 
     //! check a ruleset (the action part) - to be used in the scenario of no threads.
     virtual void checkRules( ruleDB_t *rules, EventScheduler *e  );
@@ -212,10 +566,23 @@ class QOSProcessor : public QualityManagerComponent
     int delRule( Rule *r );
 
     //! handle file descriptor event
-    virtual int handleFDEvent(eventVec_t *e, fd_set *rset, fd_set *wset, fd_sets_t *fds);
+    virtual int handleFDEvent(eventVec_t *e, fd_t *ready, int nready, fd_sets_t *fds);
+
+    //! start the worker threads (if threaded)
+    virtual void run();
 
-    //! thread main function
-    void main();
+    /*! \short   stop the worker threads
+
+        every worker finishes the event it is handling, so no lock is
+        left held, and is joined before the call returns
+    */
+    virtual void stop();
+
+    //! number of workers
+    int getNumShards()
+    {
+        return (int) shards.size();
+    }
 
     /*! \short return -1 (no packet seen), 0 (timeout), >0 (no timeout; adjust last time)
 
@@ -240,8 +607,12 @@ class QOSProcessor : public QualityManagerComponent
         return loader->numModules();
     }
 
-    // handle module timeouts
-    void timeout(int rid, int actid, unsigned int tmID);
+    /*! \short   handle module timeouts
+        \arg \c gen - generation of the rule the timer was created for,
+                      the timer is dropped if the rule uid has been reused
+                      meanwhile (0 - do not check)
+    */
+    void timeout(int rid, int actid, unsigned int tmID, unsigned int gen = 0);
 
     //! get xml info for a specific module
     string getModuleInfoXML( string modname );
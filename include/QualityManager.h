@@ -82,9 +82,32 @@ class QualityManager
      // FD list (from QualityManagerComponent.h)
     fdList_t fdList;
 
+    //! timerfd armed with the expiry of the next scheduled event
+    int timerFd;
+
+    //! expiry the timer fd is currently armed with ({0,0} if disarmed)
+    struct timeval timerArmed;
+
+    //! (re)arm the timer fd with the expiry of the next scheduled event
+    void armTimer();
+
     // 1 if the procedure for applying quality rules runs in a separate thread
     int pprocThread;
 
+    //! window for merging ctrlcomm add/remove requests [ms], 0 = off
+    unsigned long groupWindow;
+
+    //! add and remove groups still collecting requests (NULL if none)
+    GroupCommitEvent *addGroup;
+    GroupCommitEvent *removeGroup;
+
+    //! add request e with its rules to the open group, opening one if needed
+    void joinGroupCommit(GroupCommitEvent *&group, event_t type,
+                         CtrlCommEvent *e, ruleDB_t &rules);
+
+    //! requeue scheduled event e, its work was refused by a full QoS processor queue
+    void retryEvent(Event *e);
+
     // 1 if remote control interface is enabled
     static int enableCtrl;
 
@@ -99,8 +122,8 @@ class QualityManager
     //! return 1 if a Quality Manager is already running on the host
     int alreadyRunning();
 
-    //! get info string for get_info response
-    string getInfo(infoType_t what, string param);
+    //! get info string for get_info response, limit pages the tasklist
+    string getInfo(infoType_t what, string param, int limit = 0);
 
     string getHelloMsg();
 
@@ -193,15 +216,24 @@ class QualityManager
     
     //! handle the reponse from an event delete rules coming from the QoS processor.
     void handlerResponseDelRulesQoSProcessor(Event *e, fd_sets_t *fds);
+
+    //! hand the requests collected in a group to the QoS processor in one event.
+    void handlerGroupCommit(Event *e, fd_sets_t *fds);
+
+    //! answer the members of an add group once their rules have been checked.
+    void completeAddGroup(GroupCommitEvent *group, fd_sets_t *fds);
+
+    //! answer the members of a remove group once their rules have been deleted.
+    void completeRemoveGroup(GroupCommitEvent *group, ruleDB_t *rules, fd_sets_t *fds);
     
     //! schedule events within the vector given as parameter.
     void scheduleEvents(eventVec_t *retEvents);
 
     //! check for all descriptor events given.
-    int checkFileDescriptorEvents(eventVec_t *retEvents, fd_set *rset, fd_set *wset, fd_sets_t *fds);
+    int checkFileDescriptorEvents(eventVec_t *retEvents, fd_t *ready, int nready, fd_sets_t *fds);
     
-    //! Process events staged in the file descriptor.
-    int processOverdueEvents(eventVec_t *retEvents, fd_set *rset, fd_set *wset, fd_sets_t *fds);
+    //! process all scheduled events that are due, returns their number
+    int processOverdueEvents(eventVec_t *retEvents, fd_sets_t *fds);
     
 };
 
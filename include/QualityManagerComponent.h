@@ -166,9 +166,9 @@ class QualityManagerComponent
              inserter(*list, list->begin()));
     }
     
-    //! callback in case of a file descriptor event
+    //! callback in case of file descriptor events (nready entries in ready)
     
-    virtual int handleFDEvent(eventVec_t *e, fd_set *wset, fd_set *rset, fd_sets_t *fds)
+    virtual int handleFDEvent(eventVec_t *e, fd_t *ready, int nready, fd_sets_t *fds)
     {
         // To be implemented in derived classes
         return 0;
@@ -45,6 +45,8 @@ enum infoType_t {
     I_HELLO,
     I_TASKLIST,
     I_TASK,
+    I_QOSPROCESSOR,
+    I_SSL_HANDSHAKES,
     // insert new items here
     I_NUMQUALITYMANAGERINFOS
 };
@@ -54,10 +56,12 @@ struct info_t
 {
     infoType_t type;
     string     param;
+    int        limit;  //!< page size of the tasklist, 0 for all
     
-    info_t( infoType_t t, string p = "" ) {
+    info_t( infoType_t t, string p = "", int l = 0 ) {
         type = t;
         param = p;
+        limit = l;
     }
 };
 
@@ -93,10 +97,13 @@ public:
     static infoType_t getInfoType (string item);
 
     //! add info by type
-    void addInfo( infoType_t type, string param = "");
+    void addInfo( infoType_t type, string param = "", int limit = 0);
 
-    //! add info by name
-    void addInfo( string item, string param = "");
+    //! add info by name, for the tasklist param is the paging cursor
+    void addInfo( string item, string param = "", int limit = 0);
+
+    //! check whether the items only depend on the rule database
+    static int isRuleInfo( infoList_t *l );
 
     /*! \brief release list of added info_t items.
                caller is responsible for the disposal of this list
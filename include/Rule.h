@@ -59,11 +59,14 @@ typedef enum
 } ruleState_t;
 
 
-//! FIXME document!
+//! action of a rule: module name and module parameters
 typedef struct
 {
     string name;
     configItemList_t conf;
+
+    //! parameters known to the QoS processor, compiled from conf
+    paramBlock_t compiled;
 } action_t;
 
 
@@ -98,6 +101,9 @@ class Rule
     //! state of this rule
     ruleState_t state;
 
+    //! state changes of all rules, the qos processor changes states too
+    static unsigned long stateChanges;
+
     //! name of the rule for the external system calling the QoS Manager
     string ruleName;
 
@@ -139,12 +145,22 @@ class Rule
     //! get a value by name from the misc rule attributes
     string getMiscVal(string name);
 
+    //! compile the known action parameters into typed blocks
+    void compileActionParams();
+
 
   public:
     
     void setState(ruleState_t s) 
     { 
         state = s;
+        __atomic_add_fetch(&stateChanges, 1, __ATOMIC_RELAXED);
+    }
+
+    //! number of state changes of all rules so far
+    static unsigned long getStateChanges()
+    {
+        return __atomic_load_n(&stateChanges, __ATOMIC_RELAXED);
     }
 
     ruleState_t getState()
@@ -0,0 +1,192 @@
+/*! \file   RuleBatch.h
+
+    Copyright 2014-2015 Universidad de los Andes, Bogotá, Colombia
+
+    This file is part of Network Quality Manager System (NETQoS).
+
+    NETQoS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    NETQoS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this software; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    Description:
+    reference counted list of rules shared by the rule events
+
+    $Id: RuleBatch.h 748 2016-10-17 10:00:00 amarentes $
+*/
+
+#ifndef _RULEBATCH_H_
+#define _RULEBATCH_H_
+
+
+#include "stdincpp.h"
+#include "RuleFileParser.h"
+#include "EventPool.h"
+
+
+//! uids of rules removed together
+typedef set<int>            ruleUIdSet_t;
+typedef set<int>::iterator  ruleUIdSetIter_t;
+
+
+/*! \short   reference counted, immutable list of rules
+
+    a batch travels through check -> add -> activate -> response as
+    the same object: every event holding it owns one reference, and
+    handing it on to the next event only takes another one. The
+    rules themselves are not owned by the batch.
+
+    The list is never changed while it is shared. Removing a rule from
+    an event (deleteRule) first gives that event a private copy.
+*/
+
+class RuleBatch
+{
+  private:
+
+    ruleDB_t rules;
+
+    //! number of references (events) to this batch
+    int refs;
+
+    RuleBatch() : refs(1)
+    {
+        countEventAlloc(&eventAllocStats.batches);
+    }
+
+    ~RuleBatch() {}
+
+  public:
+
+    //! create a batch with a copy of r, the caller owns the reference
+    static RuleBatch *create(ruleDB_t &r)
+    {
+        RuleBatch *b = new RuleBatch();
+        b->rules = r;
+        return b;
+    }
+
+    //! create a batch taking over the contents of r (r is left empty)
+    static RuleBatch *adopt(ruleDB_t &r)
+    {
+        RuleBatch *b = new RuleBatch();
+        b->rules.swap(r);
+        return b;
+    }
+
+    //! take another reference, to be passed on to the next event
+    RuleBatch *ref()
+    {
+        __atomic_add_fetch(&refs, 1, __ATOMIC_RELAXED);
+        countEventAlloc(&eventAllocStats.batchShares);
+        return this;
+    }
+
+    //! drop a reference, the last one frees the batch
+    void unref()
+    {
+        if (__atomic_sub_fetch(&refs, 1, __ATOMIC_ACQ_REL) == 0) {
+            delete this;
+        }
+    }
+
+    //! get the rules, must not be modified
+    ruleDB_t *getRules()
+    {
+        return &rules;
+    }
+
+    int size()
+    {
+        return rules.size();
+    }
+
+    //! append the uids of the rules in the batch
+    void getRuleUIds(vector<int> &uids)
+    {
+        ruleDBIter_t iter;
+
+        for (iter = rules.begin(); iter != rules.end(); iter++) {
+            uids.push_back((*iter)->getUId());
+        }
+    }
+
+    /*! \short  remove the rule uid from the batch held in b
+
+        b is replaced by a private copy if it is shared
+        \returns 0 if not found, 1 if removed, 2 if the batch is empty now
+    */
+    static int deleteRule(RuleBatch *&b, int uid)
+    {
+        int ret = 0;
+        ruleDBIter_t iter;
+
+        for (iter = b->rules.begin(); iter != b->rules.end(); iter++) {
+            if ((*iter)->getUId() == uid) {
+                break;
+            }
+        }
+
+        if (iter != b->rules.end()) {
+            if (__atomic_load_n(&b->refs, __ATOMIC_ACQUIRE) > 1) {
+                RuleBatch *copy = create(b->rules);
+                countEventAlloc(&eventAllocStats.batchCopies);
+                iter = copy->rules.begin() + (iter - b->rules.begin());
+                b->unref();
+                b = copy;
+            }
+            b->rules.erase(iter);
+            ret++;
+        }
+
+        if (b->rules.empty()) {
+            return ++ret;
+        }
+
+        return ret;
+    }
+
+    /*! \short  remove all rules in uids from the batch held in b in one pass
+
+        b is replaced by a private copy if it is shared
+        \returns 0 if none found, 1 if removed, 2 if the batch is empty now
+    */
+    static int deleteRules(RuleBatch *&b, const ruleUIdSet_t &uids)
+    {
+        ruleDB_t kept;
+        ruleDBIter_t iter;
+
+        kept.reserve(b->rules.size());
+        for (iter = b->rules.begin(); iter != b->rules.end(); iter++) {
+            if (uids.find((*iter)->getUId()) == uids.end()) {
+                kept.push_back(*iter);
+            }
+        }
+
+        if (kept.size() == b->rules.size()) {
+            return 0;
+        }
+
+        if (__atomic_load_n(&b->refs, __ATOMIC_ACQUIRE) > 1) {
+            countEventAlloc(&eventAllocStats.batchCopies);
+            b->unref();
+            b = adopt(kept);
+        } else {
+            b->rules.swap(kept);
+        }
+
+        return b->rules.empty() ? 2 : 1;
+    }
+};
+
+
+#endif // _RULEBATCH_H_
@@ -39,6 +39,8 @@
 #include "FilterValParser.h"
 #include "RuleFileParser.h"
 #include "MAPIRuleParser.h"
+#include "BulkRuleParser.h"
+#include "RuleNameIndex.h"
 #include "EventScheduler.h"
 
 
@@ -82,9 +84,15 @@ class RuleManager
     //!< number of tasks in the database
     int tasks;
 
-    //! index to rules via setID and name
+    //! incremented whenever a rule is added to or removed from the database
+    unsigned long version;
+
+    //! index to rules via setID and name, ordered for the rule listings
     ruleSetIndex_t ruleSetIndex;
 
+    //! hash index to rules via setID and name for the lookups by name
+    RuleNameIndex nameIndex;
+
     //! stores all rules indexed by setID, ruleID
     ruleDB_t  ruleDB;
 
@@ -122,6 +130,16 @@ class RuleManager
         return tasks; 
     }
 
+    /*! \short   version of the rule database
+
+        changes whenever rules are added or removed or a rule changes
+        its state, i.e. whenever the task list would look different
+    */
+    unsigned long getVersion()
+    {
+        return version + Rule::getStateChanges();
+    }
+
     filterDefList_t *getFilterDefs()
     { 
         return &filterDefs; 
@@ -153,19 +171,25 @@ class RuleManager
     Rule *getRule(int uid);
 
     //! get rule rname from ruleset sname 
-    Rule *getRule(string sname, string rname);
+    Rule *getRule(const string &sname, const string &rname);
 
     //! get all rules in ruleset with name sname 
     ruleIndex_t *getRules(string sname);
 
+    //! append all rules in ruleset sname to rules, throws if there is no such set
+    void getRules(string sname, ruleDB_t &rules);
+
     //! get all rules
     ruleDB_t getRules();
 
     //! parse XML rules from file 
     ruleDB_t *parseRules(string fname);
 
-    //! parse XML or Meter API rules from buffer
-    ruleDB_t *parseRulesBuffer(char *buf, int len, int mapi);
+    //! parse XML, Meter API or bulk rules (ADD_RULES_* format) from buffer
+    ruleDB_t *parseRulesBuffer(char *buf, int len, int format);
+
+    //! free parsed rules that were never added and release their uids
+    void discardRules(ruleDB_t *rules);
    
     /*! \short   add a filter rule description 
 
@@ -179,6 +203,20 @@ class RuleManager
     */
     void addRules(ruleDB_t *rules, EventScheduler *e);
 
+    /*! \short   store rules without scheduling them yet
+
+        the valid rules are added to the database and grouped by their
+        start and stop times in start and stop, to be handed to
+        scheduleRules later. Several calls may collect into the same
+        indexes, so that rules of different requests share events.
+
+        \throws an Error exception like addRules
+    */
+    void storeRules(ruleDB_t *rules, ruleTimeIndex_t &start, ruleTimeIndex_t &stop);
+
+    //! schedule activation and removal of the rules collected by storeRules
+    void scheduleRules(ruleTimeIndex_t &start, ruleTimeIndex_t &stop, EventScheduler *e);
+
     //! add a single rule
     void addRule(Rule *r);
 
@@ -194,8 +232,14 @@ class RuleManager
     */
     void delRule(int uid, EventScheduler *e);
     void delRule(string rname, string sname, EventScheduler *e);
-    void delRules(string sname, EventScheduler *e);
     void delRule(Rule *r, EventScheduler *e);
+
+    /*! \short   delete a group of rules at once
+
+        the index entries of all rules are freed in one pass, a rule set
+        losing all its rules is dropped as a whole and the events of the
+        rules are cancelled together
+    */
     void delRules(ruleDB_t *rules, EventScheduler *e);
    
     /*! \short   get information from the rule manager
@@ -208,6 +252,16 @@ class RuleManager
     string getInfo(string sname, string rname);
     string getInfo(string sname);
 
+    /*! \short   get one page of the rule list
+
+        \arg \c cursor  'set.name' of the last rule of the previous page,
+                         empty for the first page
+        \arg \c limit   maximum number of rules, 0 for all
+        \arg \c next    set to the cursor of the next page, empty if
+                         this is the last page
+    */
+    string getInfo(const string &cursor, int limit, string &next);
+
     //! dump a RuleManager object
     void dump( ostream &os );
 };
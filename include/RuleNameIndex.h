@@ -0,0 +1,326 @@
+/*! \file   RuleNameIndex.h
+
+    Copyright 2014-2015 Universidad de los Andes, Bogotá, Colombia
+
+    This file is part of Network Quality Manager System (NETQoS).
+
+    NETQoS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    NETQoS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this software; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    Description:
+    hash index of the installed rules by rule set and rule name
+
+    $Id: RuleNameIndex.h 748 2016-10-17 10:00:00 amarentes $
+*/
+
+#ifndef _RULENAMEINDEX_H_
+#define _RULENAMEINDEX_H_
+
+
+#include "stdincpp.h"
+
+
+/*! \short   hash index from 'set.name' to rule uid
+
+    Both tables use open addressing with linear probing and keep the
+    full hash of every entry, so a probe only compares names when the
+    hashes match. Set names are interned: a set gets a small id while
+    it has rules and the rule entries store that id instead of the set
+    name. Resolving a name costs one hash of each name part.
+*/
+
+class RuleNameIndex
+{
+  private:
+
+    //! an interned set name, unused while rules == 0
+    struct setEntry_t
+    {
+        string name;
+        unsigned int hash;
+        int rules;
+    };
+
+    //! a rule, uid is SLOT_FREE or SLOT_DELETED for unused slots
+    struct ruleSlot_t
+    {
+        unsigned int hash;
+        int set;
+        int uid;
+        string name;
+    };
+
+    enum {
+        SLOT_FREE = -1,
+        SLOT_DELETED = -2,
+        //! initial number of slots, always a power of two
+        MIN_SLOTS = 64
+    };
+
+    //! interned set names by set id
+    vector<setEntry_t> sets;
+
+    //! ids of unused set entries
+    vector<int> freeSets;
+
+    //! set name -> set id, SLOT_FREE or SLOT_DELETED
+    vector<int> setTable;
+    unsigned int setsUsed;  //!< used set table slots, deleted ones included
+
+    //! (set id, rule name) -> uid
+    vector<ruleSlot_t> ruleTable;
+    unsigned int rulesUsed; //!< used rule table slots, deleted ones included
+
+    //! live entries in both tables
+    unsigned int nsets, nrules;
+
+    // FNV-1a
+    static unsigned int hashName(const string &s)
+    {
+        unsigned int h = 2166136261U;
+
+        for (string::const_iterator i = s.begin(); i != s.end(); i++) {
+            h = (h ^ (unsigned char) *i) * 16777619U;
+        }
+        return h;
+    }
+
+    static unsigned int hashRule(int set, const string &rname)
+    {
+        unsigned int h = hashName(rname) ^ ((unsigned int) set * 0x9e3779b9U);
+
+        // mix the set id into the low bits used for the slot
+        return h ^ (h >> 16);
+    }
+
+    //! slot of set sname in setTable, or the free slot to insert it
+    unsigned int findSetSlot(const string &sname, unsigned int h)
+    {
+        unsigned int mask = setTable.size() - 1;
+        unsigned int i = h & mask;
+        int ins = -1;
+
+        for (;;) {
+            int id = setTable[i];
+            if (id == SLOT_FREE) {
+                return (ins >= 0) ? ins : i;
+            }
+            if (id == SLOT_DELETED) {
+                if (ins < 0) {
+                    ins = i;
+                }
+            } else if ((sets[id].hash == h) && (sets[id].name == sname)) {
+                return i;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    //! slot of rule (set, rname) in ruleTable, or the free slot to insert it
+    unsigned int findRuleSlot(int set, const string &rname, unsigned int h)
+    {
+        unsigned int mask = ruleTable.size() - 1;
+        unsigned int i = h & mask;
+        int ins = -1;
+
+        for (;;) {
+            ruleSlot_t &s = ruleTable[i];
+            if (s.uid == SLOT_FREE) {
+                return (ins >= 0) ? ins : i;
+            }
+            if (s.uid == SLOT_DELETED) {
+                if (ins < 0) {
+                    ins = i;
+                }
+            } else if ((s.hash == h) && (s.set == set) && (s.name == rname)) {
+                return i;
+            }
+            i = (i + 1) & mask;
+        }
+    }
+
+    //! rebuild the set table with n slots, dropping deleted slots
+    void resizeSets(unsigned int n)
+    {
+        setTable.assign(n, SLOT_FREE);
+        setsUsed = 0;
+        for (unsigned int id = 0; id < sets.size(); id++) {
+            if (sets[id].rules > 0) {
+                setTable[findSetSlot(sets[id].name, sets[id].hash)] = id;
+                setsUsed++;
+            }
+        }
+    }
+
+    //! rebuild the rule table with n slots, dropping deleted slots
+    void resizeRules(unsigned int n)
+    {
+        vector<ruleSlot_t> old(n);
+
+        old.swap(ruleTable);
+        for (unsigned int i = 0; i < n; i++) {
+            ruleTable[i].uid = SLOT_FREE;
+        }
+        rulesUsed = 0;
+        for (unsigned int i = 0; i < old.size(); i++) {
+            if (old[i].uid >= 0) {
+                ruleSlot_t &s = ruleTable[findRuleSlot(old[i].set, old[i].name, old[i].hash)];
+                s.hash = old[i].hash;
+                s.set = old[i].set;
+                s.uid = old[i].uid;
+                s.name.swap(old[i].name);
+                rulesUsed++;
+            }
+        }
+    }
+
+    //! check whether a table with used slots is full (3/4) for one more entry
+    static bool isFull(unsigned int size, unsigned int used)
+    {
+        return (used + 1) * 4 > size * 3;
+    }
+
+    //! slots of a full table: grow if the live entries fill half of it,
+    //! else only drop the deleted slots
+    static unsigned int newSize(unsigned int size, unsigned int live)
+    {
+        return ((live + 1) * 2 > size) ? size * 2 : size;
+    }
+
+  public:
+
+    RuleNameIndex() : setsUsed(0), rulesUsed(0), nsets(0), nrules(0)
+    {
+        setTable.assign(MIN_SLOTS, SLOT_FREE);
+        resizeRules(MIN_SLOTS);
+    }
+
+    //! id of the interned set sname, -1 if the set has no rules
+    int findSet(const string &sname)
+    {
+        int id = setTable[findSetSlot(sname, hashName(sname))];
+
+        return (id >= 0) ? id : -1;
+    }
+
+    //! uid of rule sname.rname, -1 if it is not indexed
+    int find(const string &sname, const string &rname)
+    {
+        int set = findSet(sname);
+
+        if (set < 0) {
+            return -1;
+        }
+
+        int uid = ruleTable[findRuleSlot(set, rname, hashRule(set, rname))].uid;
+        return (uid >= 0) ? uid : -1;
+    }
+
+    //! number of rules in set sname
+    int getSetSize(const string &sname)
+    {
+        int set = findSet(sname);
+
+        return (set >= 0) ? sets[set].rules : 0;
+    }
+
+    //! add rule sname.rname with uid, returns 0 if the name is taken already
+    int insert(const string &sname, const string &rname, int uid)
+    {
+        unsigned int sh = hashName(sname);
+        unsigned int i = findSetSlot(sname, sh);
+        int set = setTable[i];
+
+        if (set < 0) {
+            // intern the set name
+            if (isFull(setTable.size(), setsUsed)) {
+                resizeSets(newSize(setTable.size(), nsets));
+                i = findSetSlot(sname, sh);
+            }
+            if (freeSets.empty()) {
+                set = sets.size();
+                sets.push_back(setEntry_t());
+            } else {
+                set = freeSets.back();
+                freeSets.pop_back();
+            }
+            sets[set].name = sname;
+            sets[set].hash = sh;
+            sets[set].rules = 0;
+            if (setTable[i] == SLOT_FREE) {
+                setsUsed++;
+            }
+            setTable[i] = set;
+            nsets++;
+        }
+
+        unsigned int rh = hashRule(set, rname);
+        unsigned int j = findRuleSlot(set, rname, rh);
+
+        if (ruleTable[j].uid >= 0) {
+            return 0;
+        }
+        if (isFull(ruleTable.size(), rulesUsed)) {
+            resizeRules(newSize(ruleTable.size(), nrules));
+            j = findRuleSlot(set, rname, rh);
+        }
+
+        ruleSlot_t &s = ruleTable[j];
+        if (s.uid == SLOT_FREE) {
+            rulesUsed++;
+        }
+        s.hash = rh;
+        s.set = set;
+        s.uid = uid;
+        s.name = rname;
+        sets[set].rules++;
+        nrules++;
+
+        return 1;
+    }
+
+    //! remove rule sname.rname, returns its uid or -1 if it is not indexed
+    int erase(const string &sname, const string &rname)
+    {
+        unsigned int i = findSetSlot(sname, hashName(sname));
+        int set = setTable[i];
+
+        if (set < 0) {
+            return -1;
+        }
+
+        ruleSlot_t &s = ruleTable[findRuleSlot(set, rname, hashRule(set, rname))];
+        int uid = s.uid;
+
+        if (uid < 0) {
+            return -1;
+        }
+        s.uid = SLOT_DELETED;
+        s.name.clear();
+        nrules--;
+
+        if (--sets[set].rules == 0) {
+            // the set name is not interned any more
+            setTable[i] = SLOT_DELETED;
+            sets[set].name.clear();
+            freeSets.push_back(set);
+            nsets--;
+        }
+
+        return uid;
+    }
+};
+
+
+#endif // _RULENAMEINDEX_H_
@@ -107,6 +107,11 @@ inline int threadCondSignal(thread_cond_t *cond)
 	return pthread_cond_signal(cond);
 }
 
+inline int threadCondBroadcast(thread_cond_t *cond)
+{
+	return pthread_cond_broadcast(cond);
+}
+
 inline int threadCondWait(thread_cond_t *cond, mutex_t *mutex)
 {
 	return pthread_cond_wait(cond, mutex);
@@ -68,6 +68,11 @@ extern const string XSL_PAGE_FILE;
 extern const int    EXPIRY_TIME;    //!< expiry time for web pages served from cache
 extern const int    DEF_PORT;   //!< default TCP port to connect to
 
+// QOSProcessor.cc
+extern const int    DEF_EVENT_QUEUE_SIZE; //!< default capacity of the QoS processor event queues
+extern const int    MAX_PROC_SHARDS;      //!< maximum number of QoS processor workers
+extern const int    PROC_QUEUE_RETRY;     //!< retry delay for scheduled work refused by a full queue [msec]
+
 // ConfigParser.h
 extern const string CONFIGFILE_DTD;
 
@@ -49,6 +49,7 @@
 #include <netinet/tcp.h>
 #include <arpa/inet.h>
 #include <netdb.h>
+#include <sys/epoll.h>
 
 #include "httpd.h"
 
@@ -62,6 +63,8 @@ static int     timeout        = 60; /* network timeout */
 static int     keepalive_time = 5;  /* keepalive time for connections */
 static char    *mimetypes     = MIMEFILE;
 static int     max_conn       = 32; /* max simulatneous connections */
+static int     max_peer_conn  = 32; /* max connections of a single peer */
+static int     listen_backlog = 0;  /* listen queue length, 0: 2*max_conn */
 
 /* globals */
 static int     tcp_port       = 0;  /* port number */
@@ -71,6 +74,21 @@ static int     slisten = -1;
 static struct REQUEST *conns = NULL;
 /* number of connections */
 static int curr_conn = 0;
+/* connections indexed by socket descriptor */
+static struct REQUEST **conn_by_fd = NULL;
+static int conn_by_fd_len = 0;
+/* 1 while new connections are not accepted (connection limit reached) */
+static int listen_paused = 0;
+
+/* connection count per peer address */
+struct PEER {
+    char        host[65];
+    int         conns;
+    struct PEER *next;
+};
+
+#define PEER_BUCKETS 256
+static struct PEER *peers[PEER_BUCKETS];
 
 #ifdef HTTPD_USE_THREADS
 static int       nthreads = 1;
@@ -93,380 +111,732 @@ log_request_func_t log_request_func = NULL;
 log_error_func_t log_error_func = NULL;
 
 
-/* queue a OK response for request req
+/* --- reactor ------------------------------------------------- */
 
-*/
-int httpd_send_response(struct REQUEST *req, fd_sets_t *fds)
+int reactor_init(fd_sets_t *fds)
 {
-    time_t now;
-
-	fprintf(stdout,"httpd_send_response: req state %d\n",req->state);
+    fds->epfd = epoll_create1(EPOLL_CLOEXEC);
+    return fds->epfd;
+}
 
-    if (req->body != NULL) {
-        now = time(NULL);
-        req->lbody = strlen(req->body);
-        /* 200 OK */
-        mkheader(req,200,now);
-    } else {
-        mkerror(req,500,1);
+void reactor_close(fd_sets_t *fds)
+{
+    if (fds->epfd >= 0) {
+        close(fds->epfd);
+        fds->epfd = -1;
     }
+}
 
-    char buff[100];
-    strftime (buff, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now));
-	fprintf(stdout,"%s - httpd_send_response - after mkheader: req state %d \n",buff, req->state);
+static int reactor_ctl(fd_sets_t *fds, int op, int fd, int mode, int edge)
+{
+    struct epoll_event ev;
 
-    if (req->state == STATE_WRITE_HEADER) {
-        // switch to writing
-        FD_CLR(req->fd, &fds->rset);
-        FD_SET(req->fd, &fds->wset);
+    memset(&ev, 0, sizeof(ev));
+    ev.data.fd = fd;
+    if (mode & FD_RD) {
+        ev.events |= EPOLLIN | EPOLLRDHUP;
+    }
+    if (mode & FD_WT) {
+        ev.events |= EPOLLOUT;
+    }
+    if (edge) {
+        ev.events |= EPOLLET;
     }
 
-    return 0;
+    return epoll_ctl(fds->epfd, op, fd, &ev);
 }
 
-/* immediatly send back an OK response to request req
-   can be used for short transactions which require no
-   further processing of the app
- */
-int httpd_send_immediate_response(struct REQUEST *req)
+int reactor_add(fd_sets_t *fds, int fd, int mode, int edge)
 {
-    time_t now;
+    return reactor_ctl(fds, EPOLL_CTL_ADD, fd, mode, edge);
+}
 
-    if (req->body != NULL) {
-        now = time(NULL);
-        req->lbody = strlen(req->body);
-        /* 200 OK */
-        mkheader(req,200,now);
-    } else {
-        mkerror(req,500,1);
-    }
+int reactor_mod(fd_sets_t *fds, int fd, int mode, int edge)
+{
+    return reactor_ctl(fds, EPOLL_CTL_MOD, fd, mode, edge);
+}
 
-    return 0;
+int reactor_del(fd_sets_t *fds, int fd)
+{
+    struct epoll_event ev;
+
+    /* kernels before 2.6.9 require a non-NULL event */
+    return epoll_ctl(fds->epfd, EPOLL_CTL_DEL, fd, &ev);
 }
 
-/* handle a file descriptor event */
-int httpd_handle_event(fd_set *rset, fd_set *wset, fd_sets_t *fds)
+int reactor_wait(fd_sets_t *fds, fd_t *ready, int max, int timeout)
 {
+    struct epoll_event evs[REACTOR_MAX_EVENTS];
+    int i, n;
 
-    struct REQUEST      *req, *prev, *tmp;
-    int                 length;
-    int opt = 0;
+    if (max > REACTOR_MAX_EVENTS) {
+        max = REACTOR_MAX_EVENTS;
+    }
 
-    now = time(NULL);
+    n = epoll_wait(fds->epfd, evs, max, timeout);
 
-    char buff[100];
-    strftime (buff, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now));
-    fprintf(stdout, "%s - Starting httpd_handle_event: \n", buff );
+    for (i = 0; i < n; i++) {
+        ready[i].fd = evs[i].data.fd;
+        ready[i].mode = 0;
+        /* hangups and errors are reported as readable, read() then fails */
+        if (evs[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            ready[i].mode |= FD_RD;
+        }
+        if (evs[i].events & EPOLLOUT) {
+            ready[i].mode |= FD_WT;
+        }
+    }
 
+    return n;
+}
 
-    /* new connection ? */
-    if ((rset != NULL) && FD_ISSET(slisten, rset)) {
-        req = malloc(sizeof(struct REQUEST));
-        if (NULL == req) {
-            /* oom: let the request sit in the listen queue */
-#ifdef DEBUG
-            fprintf(stderr,"oom\n");
-#endif
-        } else {
-            memset(req,0,sizeof(struct REQUEST));
-            if ((req->fd = accept(slisten,NULL,&opt)) == -1) {
-                if (EAGAIN != errno) {
-                    log_error_func(1, LOG_WARNING,"accept",NULL);
-                }
-                free(req);
-            } else {
-                fcntl(req->fd,F_SETFL,O_NONBLOCK);
-                req->bfd = -1;
-                req->state = STATE_READ_HEADER;
-                req->ping = now;
-                req->lifespan = -1;
-                req->next = conns;
-                conns = req;
-                curr_conn++;
-#ifdef DEBUG
-                fprintf(stderr,"%03d/%d: new request (%d)\n",req->fd,req->state,curr_conn);
-#endif
-#ifdef USE_SSL
-                if (with_ssl) {
-					//TODO AM: remove this line.
-					fprintf(stdout, "opening a ssl session");
-					// END TODO AM
-                    open_ssl_session(req);
-                }
-#endif
-                length = sizeof(req->peer);
-                if (getpeername(req->fd,(struct sockaddr*)&(req->peer),&length) == -1) {
-                    log_error_func(1, LOG_WARNING,"getpeername",NULL);
-                    req->state = STATE_CLOSE;
-                }
-                getnameinfo((struct sockaddr*)&req->peer,length,
-                            req->peerhost,64,req->peerserv,8,
-                            NI_NUMERICHOST | NI_NUMERICSERV);
-#ifdef DEBUG
-                fprintf(stderr,"%03d/%d: connect from (%s)\n",
-                        req->fd,req->state,req->peerhost);
-#endif
 
-                /* host auth callback */
-                if (access_check_func != NULL) {
-					fprintf(stdout, "parameter:" );
-					fprintf(stdout, req->peerhost );
-                    if (access_check_func(req->peerhost, NULL) < 0) {
-						fprintf(stdout, "func return negative number \n");
-                        /* read request */
-                        read_header(req,0);
-                        req->ping = now;
-                        /* reply with access denied and close connection */
-                        mkerror(req,403,0);
-                        write_request(req);
-                        req->state = STATE_CLOSE;
-                    }
-                    fprintf(stdout, "func return a postive number \n");
-                }
+/* --- connection table ----------------------------------------- */
 
-				fprintf(stdout, "put the file descriptor ready to read \n");
-                FD_SET(req->fd, &fds->rset);
-                if (req->fd > fds->max) {
-                    fds->max = req->fd;
-                }
-            }
+/* connection by socket descriptor */
+static void conn_set(int fd, struct REQUEST *req)
+{
+    if (fd >= conn_by_fd_len) {
+        int len = (conn_by_fd_len > 0) ? conn_by_fd_len : 64;
+        struct REQUEST **tab;
+
+        while (len <= fd) {
+            len *= 2;
         }
+        tab = realloc(conn_by_fd, len * sizeof(struct REQUEST *));
+        if (tab == NULL) {
+            return;
+        }
+        memset(tab + conn_by_fd_len, 0, (len - conn_by_fd_len) * sizeof(struct REQUEST *));
+        conn_by_fd = tab;
+        conn_by_fd_len = len;
     }
+    conn_by_fd[fd] = req;
+}
 
-    /* check active connections */
-    for (req = conns, prev = NULL; req != NULL;) {
+static struct REQUEST *conn_get(int fd)
+{
+    if ((fd < 0) || (fd >= conn_by_fd_len)) {
+        return NULL;
+    }
+    return conn_by_fd[fd];
+}
 
-        /* I/O */
-        if ((rset != NULL) && FD_ISSET(req->fd, rset)) {
-            if (req->state == STATE_KEEPALIVE) {
-                req->state = STATE_READ_HEADER;
-            }
+/* --- peers -------------------------------------------------- */
 
-            if (req->state == STATE_READ_HEADER) {
-                while (read_header(req,0) > 0);
-            }
+static unsigned int peer_hash(const char *host)
+{
+    unsigned int h = 2166136261u;
 
-            if (req->state == STATE_READ_BODY) {
-                fprintf(stdout, "state read body - it is going to read the body \n");
-                while (read_body(req, 0) >0);
-            }
+    while (*host) {
+        h = (h ^ (unsigned char) *host++) * 16777619u;
+    }
+    return h % PEER_BUCKETS;
+}
+
+/* get the entry of host, create it if not present */
+static struct PEER *peer_get(const char *host)
+{
+    unsigned int h = peer_hash(host);
+    struct PEER *p;
+
+    for (p = peers[h]; p != NULL; p = p->next) {
+        if (strcmp(p->host, host) == 0) {
+            return p;
+        }
+    }
+
+    p = malloc(sizeof(struct PEER));
+    if (p == NULL) {
+        return NULL;
+    }
+    strncpy(p->host, host, sizeof(p->host) - 1);
+    p->host[sizeof(p->host) - 1] = 0;
+    p->conns = 0;
+    p->next = peers[h];
+    peers[h] = p;
+    return p;
+}
+
+/* drop a connection of peer p, free the entry with the last one */
+static void peer_put(struct PEER *p)
+{
+    struct PEER **pp;
 
-            req->ping = now;
+    if ((p == NULL) || (--p->conns > 0)) {
+        return;
+    }
+
+    for (pp = &peers[peer_hash(p->host)]; *pp != NULL; pp = &(*pp)->next) {
+        if (*pp == p) {
+            *pp = p->next;
+            free(p);
+            return;
         }
+    }
+}
+
+/* the idle keepalive connection (of peer p if not NULL) waiting longest */
+static struct REQUEST *idle_conn(struct PEER *p)
+{
+    struct REQUEST *req, *oldest = NULL;
 
-        if ((wset != NULL) && FD_ISSET(req->fd, wset))
-        {
-		    now = time(NULL);
-		    strftime (buff, 100, "%Y-%m-%d %H:%M:%S.000", localtime (&now));
-			fprintf(stdout, "%s - ready to write response request \n", buff);
-            write_request(req);
-            req->ping = now;
+    for (req = conns; req != NULL; req = req->next) {
+        if ((req->state == STATE_KEEPALIVE) && ((p == NULL) || (req->peer_entry == p)) &&
+            ((oldest == NULL) || (req->ping < oldest->ping))) {
+            oldest = req;
         }
+    }
+    return oldest;
+}
 
-        /* check timeouts */
-        if (req->state == STATE_KEEPALIVE) {
-            if (now > req->ping + keepalive_time ||
-                curr_conn > max_conn * 9 / 10) {
+/* stop watching the listening socket until a connection is closed */
+static void pause_listen(fd_sets_t *fds)
+{
+    if (!listen_paused && (fds != NULL)) {
+        reactor_mod(fds, slisten, 0, 0);
+        listen_paused = 1;
+    }
+}
+
+static void resume_listen(fd_sets_t *fds)
+{
+    if (listen_paused && (fds != NULL)) {
+        reactor_mod(fds, slisten, FD_RD, 0);
+        listen_paused = 0;
+    }
+}
+
+/* release all per-request resources of a finished request */
+static void reset_request(struct REQUEST *req)
+{
+    req->auth[0]       = 0;
+    req->if_modified   = 0;
+    req->if_unmodified = 0;
+    req->if_range      = 0;
+    req->if_none_match = NULL;
+    req->accept_gzip   = 0;
+    req->etag[0]       = 0;
+    req->encoding      = NULL;
+    req->vary_encoding = 0;
+    req->range_hdr     = NULL;
+    req->ranges        = 0;
+    if (req->r_start) {
+        free(req->r_start);
+        req->r_start = NULL;
+    }
+    if (req->r_end) {
+        free(req->r_end);
+        req->r_end   = NULL;
+    }
+    if (req->r_head) {
+        free(req->r_head);
+        req->r_head  = NULL;
+    }
+    if (req->r_hlen) {
+        free(req->r_hlen);
+        req->r_hlen  = NULL;
+    }
+    list_free(&req->header);
+
+    if (req->bfd != -1) {
+        close(req->bfd);
+        req->bfd  = -1;
+    }
+
+    /* free memory of response body */
+    if (req->body_static) {
+        req->body = NULL;
+        req->body_static = 0;
+    } else if ((req->status<400) && (req->body != NULL)) {
+        free(req->body);
+        req->body = NULL;
+    }
+
+    /* and of the request body */
+    if (req->post_body != NULL) {
+        free(req->post_body);
+        req->post_body = NULL;
+    }
+    req->lpost     = 0;
+    req->body_raw  = 0;
+    req->body_read = 0;
+    req->dec_state = 0;
+    req->dec_field = 0;
+    req->dec_value = 0;
+    req->clen      = 0;
+    req->ctype     = NULL;
+    req->written   = 0;
+    req->head_only = 0;
+    req->rh        = 0;
+    req->rb        = 0;
+    req->hostname[0] = 0;
+    req->path[0]     = 0;
+    req->query[0]    = 0;
+    req->lifespan = -1;
+}
+
+/* close a connection and free it */
+static void close_conn(struct REQUEST *req, fd_sets_t *fds)
+{
 #ifdef DEBUG
-                fprintf(stderr,"%03d/%d: keepalive timeout\n",req->fd,req->state);
+    fprintf(stderr,"%03d/%d: done (%d)\n",req->fd,req->state,curr_conn-1);
 #endif
-                req->state = STATE_CLOSE;
-            }
-        } else {
-            if (now > req->ping + timeout) {
-                if ((req->state == STATE_READ_HEADER) ||
-                    (req->state == STATE_READ_BODY)) {
-                    mkerror(req,408,0);
-                } else {
-                    log_error_func(0,LOG_INFO,"network timeout",req->peerhost);
-                    req->state = STATE_CLOSE;
-                }
-            }
-        }
 
-        /* parsing */
-      parsing:
+    if (fds != NULL) {
+        reactor_del(fds, req->fd);
+    }
+    conn_set(req->fd, NULL);
 
-        if (req->state == STATE_PARSE_HEADER) {
-            fprintf(stdout,"In State Parse Header \n");
-            parse_request(req, server_host);
+    /* cleanup */
+    close(req->fd);
+#ifdef USE_SSL
+    if (with_ssl) {
+        close_ssl_session(req);
+    }
+#endif
+    if (req->bfd != -1) {
+        close(req->bfd);
+#ifdef USE_SSL
+        if (with_ssl) {
+            BIO_vfree(req->bio_in);
         }
+#endif
+    }
 
-        /* body parsing */
-        if (req->state == STATE_PARSE_BODY) {
-            fprintf(stdout,"In State Parse Body \n");
-            parse_request_body(req);
-        }
+    curr_conn--;
+    peer_put(req->peer_entry);
 
-        if (req->state == STATE_WRITE_HEADER) {
-            /* switch to writing */
-            FD_CLR(req->fd, &fds->rset);
-            FD_SET(req->fd, &fds->wset);
-			fprintf(stdout,"In State Write header \n");
-            write_request(req);
-        }
+    /* there is room again for new connections */
+    if (curr_conn < max_conn) {
+        resume_listen(fds);
+    }
 
-        /* handle finished requests */
-        if (req->state == STATE_FINISHED && !req->keep_alive) {
-            req->state = STATE_CLOSE;
-        }
-        if (req->state == STATE_FINISHED) {
+    /* unlink from list */
+    if (req->prev != NULL) {
+        req->prev->next = req->next;
+    } else {
+        conns = req->next;
+    }
+    if (req->next != NULL) {
+        req->next->prev = req->prev;
+    }
 
-			fprintf(stdout, "to manage state finished \n");
+    /* free memory  */
+    if (req->r_start) {
+        free(req->r_start);
+    }
+    if (req->r_end) {
+        free(req->r_end);
+    }
+    if (req->r_head) {
+        free(req->r_head);
+    }
+    if (req->r_hlen) {
+        free(req->r_hlen);
+    }
+    if (req->post_body) {
+        free(req->post_body);
+    }
+    list_free(&req->header);
+    free(req);
+}
 
-            /* access log hook */
-            if (log_request_func != NULL) {
-                log_request_func(req, now);
-            }
+/* write as much of the response as the socket takes; the connection
+   is edge-triggered, so stop only when the socket would block */
+static void write_all(struct REQUEST *req)
+{
+    int bc;
+
+    do {
+        bc = req->bc;
+        write_request(req);
+    } while ((req->state >= STATE_WRITE_HEADER) &&
+             (req->state <= STATE_WRITE_RANGES) &&
+             (req->bc != bc));
+}
 
-            /* switch to reading */
-            FD_CLR(req->fd, &fds->wset);
-            FD_SET(req->fd, &fds->rset);
-
-            /* cleanup */
-            req->auth[0]       = 0;
-            req->if_modified   = 0;
-            req->if_unmodified = 0;
-            req->if_range      = 0;
-            req->range_hdr     = NULL;
-            req->ranges        = 0;
-            if (req->r_start) {
-                free(req->r_start);
-                req->r_start = NULL;
-            }
-            if (req->r_end) {
-                free(req->r_end);
-                req->r_end   = NULL;
-            }
-            if (req->r_head) {
-                free(req->r_head);
-                req->r_head  = NULL;
-            }
-            if (req->r_hlen) {
-                free(req->r_hlen);
-                req->r_hlen  = NULL;
-            }
-            list_free(&req->header);
+/* advance the state machine of a connection as far as possible without
+   blocking; the connection is freed if it ends up closed */
+static void process_conn(struct REQUEST *req, fd_sets_t *fds)
+{
+    req->busy = 1;
 
-            if (req->bfd != -1) {
-                close(req->bfd);
-                req->bfd  = -1;
-            }
+  parsing:
 
-            /* free memory of response body */
-            if ((req->status<400) && (req->body != NULL)) {
-                free(req->body);
-                req->body = NULL;
-            }
-            req->written   = 0;
-            req->head_only = 0;
-            req->rh        = 0;
-            req->rb        = 0;
-            req->hostname[0] = 0;
-            req->path[0]     = 0;
-            req->query[0]    = 0;
-            req->lifespan = -1;
-
-            if (req->hdata == (req->lreq + req->lbreq)) {
-                /* ok, wait for the next one ... */
+    if (req->state == STATE_PARSE_HEADER) {
+        parse_request(req, server_host);
+    }
+
+    /* body parsing */
+    if (req->state == STATE_PARSE_BODY) {
+        parse_request_body(req);
+    }
+
+    if (req->state == STATE_WRITE_HEADER) {
+        write_all(req);
+    }
+
+    /* handle finished requests */
+    if (req->state == STATE_FINISHED && !req->keep_alive) {
+        req->state = STATE_CLOSE;
+    }
+    if (req->state == STATE_FINISHED) {
+
+        /* access log hook */
+        if (log_request_func != NULL) {
+            log_request_func(req, now);
+        }
+
+        reset_request(req);
+
+        if (req->hdata == (req->lreq + req->lbreq)) {
+            /* ok, wait for the next one ... */
 #ifdef DEBUG
-                fprintf(stderr,"%03d/%d: keepalive wait\n",req->fd,req->state);
+            fprintf(stderr,"%03d/%d: keepalive wait\n",req->fd,req->state);
 #endif
-                req->state = STATE_KEEPALIVE;
-                req->hdata = 0;
-                req->lreq  = 0;
-                req->lbreq = 0;
+            req->state = STATE_KEEPALIVE;
+            req->hdata = 0;
+            req->lreq  = 0;
+            req->lbreq = 0;
 
 #ifdef TCP_CORK
-                if (req->tcp_cork == 1) {
-                    req->tcp_cork = 0;
+            if (req->tcp_cork == 1) {
+                req->tcp_cork = 0;
 #ifdef DEBUG
-                    fprintf(stderr,"%03d/%d: tcp_cork=%d\n",req->fd,req->state,req->tcp_cork);
+                fprintf(stderr,"%03d/%d: tcp_cork=%d\n",req->fd,req->state,req->tcp_cork);
 #endif
-                    setsockopt(req->fd,SOL_TCP,TCP_CORK,&req->tcp_cork,sizeof(int));
-                }
+                setsockopt(req->fd,SOL_TCP,TCP_CORK,&req->tcp_cork,sizeof(int));
+            }
 #endif
+            /* the next request may have arrived while we were writing,
+               its read edge is gone already */
+            req->state = STATE_READ_HEADER;
+            while (read_header(req,0) > 0);
+            if ((req->state == STATE_READ_HEADER) && (req->hdata == 0)) {
+                req->state = STATE_KEEPALIVE;
             } else {
-                /* there is a pipelined request in the queue ... */
-#ifdef DEBUG
-                fprintf(stderr,"%03d/%d: keepalive pipeline\n",req->fd,req->state);
-#endif
-                req->state = STATE_READ_HEADER;
-                memmove(req->hreq,req->hreq + req->lreq + req->lbreq,
-                        req->hdata - (req->lreq + req->lbreq));
-                req->hdata -= req->lreq + req->lbreq;
-                req->lreq  =  0;
-                read_header(req,1);
                 goto parsing;
             }
+        } else {
+            /* there is a pipelined request in the queue ... */
+#ifdef DEBUG
+            fprintf(stderr,"%03d/%d: keepalive pipeline\n",req->fd,req->state);
+#endif
+            req->state = STATE_READ_HEADER;
+            memmove(req->hreq,req->hreq + req->lreq + req->lbreq,
+                    req->hdata - (req->lreq + req->lbreq));
+            req->hdata -= req->lreq + req->lbreq;
+            req->lreq  =  0;
+            read_header(req,1);
+            goto parsing;
         }
+    }
 
+    req->busy = 0;
 
-        /* connections to close */
-        if (req->state == STATE_CLOSE) {
+    /* connections to close */
+    if (req->state == STATE_CLOSE) {
+        close_conn(req, fds);
+    }
+}
 
-			fprintf(stdout, "to close connection \n");
+/* check the network and keepalive timeouts of a connection */
+static void check_timeout(struct REQUEST *req)
+{
+    if (req->state == STATE_KEEPALIVE) {
+        /* idle connections are also evicted when a slot is needed,
+           see accept_conns */
+        if (now > req->ping + keepalive_time) {
+#ifdef DEBUG
+            fprintf(stderr,"%03d/%d: keepalive timeout\n",req->fd,req->state);
+#endif
+            req->state = STATE_CLOSE;
+        }
+    } else {
+        if (now > req->ping + timeout) {
+            if ((req->state == STATE_READ_HEADER) ||
+                (req->state == STATE_READ_BODY)) {
+                mkerror(req,408,0);
+            } else {
+                log_error_func(0,LOG_INFO,"network timeout",req->peerhost);
+                req->state = STATE_CLOSE;
+            }
+        }
+    }
+}
 
-            /* access log hook */
-            /*if (log_request_func != NULL) {
-                log_request_func(req, now);
-                }*/
+/* accept all pending connections */
+static void accept_conns(fd_sets_t *fds)
+{
+    struct REQUEST *req;
+    socklen_t length;
+
+    for (;;) {
+        if (curr_conn >= max_conn) {
+            /* make room by closing the connection idle for the longest time,
+               if there is none leave new connections in the listen queue */
+            req = idle_conn(NULL);
+            if (req == NULL) {
+                pause_listen(fds);
+                return;
+            }
+            close_conn(req, fds);
+        }
 
-            FD_CLR(req->fd, &fds->rset);
-            FD_CLR(req->fd, &fds->wset);
-            /* leave max as is */
+        req = malloc(sizeof(struct REQUEST));
+        if (NULL == req) {
+            /* oom: let the request sit in the listen queue */
+#ifdef DEBUG
+            fprintf(stderr,"oom\n");
+#endif
+            return;
+        }
 
-            /* cleanup */
-            close(req->fd);
-#ifdef USE_SSL
-            if (with_ssl) {
-                SSL_free(req->ssl_s);
+        memset(req,0,sizeof(struct REQUEST));
+        if ((req->fd = accept(slisten,NULL,NULL)) == -1) {
+            if ((EAGAIN != errno) && (EWOULDBLOCK != errno)) {
+                log_error_func(1, LOG_WARNING,"accept",NULL);
+            }
+            if ((EMFILE == errno) || (ENFILE == errno)) {
+                /* out of descriptors, retry after a connection is gone */
+                pause_listen(fds);
             }
+            free(req);
+            return;
+        }
+
+        fcntl(req->fd,F_SETFL,O_NONBLOCK);
+        req->bfd = -1;
+        req->state = STATE_READ_HEADER;
+        req->ping = now;
+        req->lifespan = -1;
+        req->next = conns;
+        if (conns != NULL) {
+            conns->prev = req;
+        }
+        conns = req;
+        curr_conn++;
+        conn_set(req->fd, req);
+#ifdef DEBUG
+        fprintf(stderr,"%03d/%d: new request (%d)\n",req->fd,req->state,curr_conn);
 #endif
-            if (req->bfd != -1) {
-                close(req->bfd);
 #ifdef USE_SSL
-                if (with_ssl) {
-                    BIO_vfree(req->bio_in);
-                }
+        if (with_ssl) {
+            open_ssl_session(req);
+        }
 #endif
-            }
-
-            curr_conn--;
+        length = sizeof(req->peer);
+        if (getpeername(req->fd,(struct sockaddr*)&(req->peer),&length) == -1) {
+            log_error_func(1, LOG_WARNING,"getpeername",NULL);
+            req->state = STATE_CLOSE;
+        }
+        getnameinfo((struct sockaddr*)&req->peer,length,
+                    req->peerhost,64,req->peerserv,8,
+                    NI_NUMERICHOST | NI_NUMERICSERV);
 #ifdef DEBUG
-            fprintf(stderr,"%03d/%d: done (%d)\n",req->fd,req->state,curr_conn);
+        fprintf(stderr,"%03d/%d: connect from (%s)\n",
+                req->fd,req->state,req->peerhost);
 #endif
-            /* unlink from list */
-            tmp = req;
-            if (prev == NULL) {
-                conns = req->next;
-                req = conns;
-            } else {
-                prev->next = req->next;
-                req = req->next;
-            }
-            /* free memory  */
-            if (tmp->r_start) {
-                free(tmp->r_start);
-            }
-            if (tmp->r_end) {
-                free(tmp->r_end);
+
+        /* per peer limit: a peer over its share first gives up one of its
+           own idle connections, without one the new connection is refused */
+        req->peer_entry = peer_get(req->peerhost);
+        if (req->peer_entry != NULL) {
+            req->peer_entry->conns++;
+            if ((req->peer_entry->conns > max_peer_conn) && (req->state != STATE_CLOSE)) {
+                struct REQUEST *idle = idle_conn(req->peer_entry);
+
+                if (idle != NULL) {
+                    close_conn(idle, fds);
+                } else {
+                    log_error_func(0,LOG_INFO,"too many connections",req->peerhost);
+                    mkerror(req,503,0);
+                    write_request(req);
+                    req->state = STATE_CLOSE;
+                }
             }
-            if (tmp->r_head) {
-                free(tmp->r_head);
+        }
+
+        /* one registration for the lifetime of the connection:
+           edge-triggered for both directions */
+        if ((req->state != STATE_CLOSE) && (reactor_add(fds, req->fd, FD_RW, 1) < 0)) {
+            log_error_func(1, LOG_WARNING,"epoll_ctl",req->peerhost);
+            req->state = STATE_CLOSE;
+        }
+
+        /* host auth callback */
+        if ((req->state != STATE_CLOSE) && (access_check_func != NULL)) {
+            if (access_check_func(req->peerhost, NULL) < 0) {
+                /* read request */
+                read_header(req,0);
+                req->ping = now;
+                /* reply with access denied and close connection */
+                mkerror(req,403,0);
+                write_request(req);
+                req->state = STATE_CLOSE;
             }
-            if (tmp->r_hlen) {
-                free(tmp->r_hlen);
+        }
+
+        if (req->state == STATE_CLOSE) {
+            close_conn(req, fds);
+        }
+    }
+}
+
+
+/* queue a OK response for request req
+
+*/
+int httpd_send_response(struct REQUEST *req, fd_sets_t *fds)
+{
+    return httpd_send_status_response(req, 200, fds);
+}
+
+/* queue a response with status for request req */
+int httpd_send_status_response(struct REQUEST *req, int status, fd_sets_t *fds)
+{
+    time_t now;
+
+    if (req->body != NULL) {
+        now = time(NULL);
+        req->lbody = strlen(req->body);
+        mkheader(req,status,now);
+    } else {
+        mkerror(req,500,1);
+    }
+
+    /* the socket is most likely writable already and being edge-triggered
+       it will not be reported again, so start writing right away */
+    if (!req->busy) {
+        process_conn(req, fds);
+    }
+
+    return 0;
+}
+
+/* send a 200 OK response made of segments without copying them first */
+int httpd_send_response_iov(struct REQUEST *req, struct iovec *iov, int niov,
+                            fd_sets_t *fds)
+{
+    int i;
+
+    if (niov > HTTPD_MAX_IOV) {
+        return -1;
+    }
+
+    req->body  = NULL;
+    req->lbody = 0;
+    for (i = 0; i < niov; i++) {
+        req->lbody += iov[i].iov_len;
+    }
+    mkheader(req,200,time(NULL));
+
+    /* a request still being parsed is written out here as well, the
+       state machine continues with the finished or partial reply */
+    write_response_iov(req, iov, niov);
+
+    if (!req->busy) {
+        process_conn(req, fds);
+    }
+
+    return 0;
+}
+
+/* immediatly send back an OK response to request req
+   can be used for short transactions which require no
+   further processing of the app
+ */
+int httpd_send_immediate_response(struct REQUEST *req)
+{
+    time_t now;
+
+    if (req->body != NULL) {
+        now = time(NULL);
+        req->lbody = strlen(req->body);
+        /* 200 OK */
+        mkheader(req,200,now);
+    } else {
+        mkerror(req,500,1);
+    }
+
+    return 0;
+}
+
+/* send a body that is shared between requests: it is written straight
+   from the caller's buffer and never freed by the httpd */
+int httpd_send_static_response(struct REQUEST *req, int status,
+                               const char *body, int len)
+{
+    req->body        = (char *) body;
+    req->lbody       = len;
+    req->body_static = 1;
+    mkheader(req,status,time(NULL));
+
+    return 0;
+}
+
+/* handle a file descriptor event */
+int httpd_handle_event(fd_t *ready, fd_sets_t *fds)
+{
+    struct REQUEST      *req, *next;
+
+    now = time(NULL);
+
+    /* periodic call: only check the timeouts */
+    if (ready == NULL) {
+        /* accepting may have stopped for lack of descriptors */
+        if (curr_conn < max_conn) {
+            resume_listen(fds);
+        }
+
+        for (req = conns; req != NULL; req = next) {
+            next = req->next;
+            check_timeout(req);
+            if (req->state == STATE_CLOSE) {
+                close_conn(req, fds);
+            } else if (req->state == STATE_WRITE_HEADER) {
+                /* timeout error reply */
+                process_conn(req, fds);
             }
-            list_free(&tmp->header);
-            free(tmp);
-        } else {
-            prev = req;
-            req = req->next;
         }
+        return 0;
+    }
+
+    /* new connection ? */
+    if (ready->fd == slisten) {
+        accept_conns(fds);
+        return 0;
+    }
+
+    if ((req = conn_get(ready->fd)) == NULL) {
+        return 0;
     }
 
-    fprintf(stdout, "end httpd_handle_event abc \n");
+    /* I/O */
+    if (ready->mode & FD_RD) {
+        if (req->state == STATE_KEEPALIVE) {
+            req->state = STATE_READ_HEADER;
+        }
+
+        if (req->state == STATE_READ_HEADER) {
+            while (read_header(req,0) > 0);
+        }
+
+        if (req->state == STATE_READ_BODY) {
+            while (read_body(req, 0) >0);
+        }
+
+        req->ping = now;
+    }
+
+    if ((ready->mode & FD_WT) &&
+        (req->state >= STATE_WRITE_HEADER) && (req->state <= STATE_WRITE_RANGES)) {
+        write_all(req);
+        req->ping = now;
+    }
+
+    process_conn(req, fds);
 
     return 0;
 }
@@ -609,7 +979,7 @@ int httpd_init(int sport, char *sname, int use_ssl,  const char *certificate,
         log_error_func(1, LOG_ERR,"bind",NULL);
         return -1;
     }
-    if (listen(slisten, 2*max_conn) == -1) {
+    if (listen(slisten, (listen_backlog > 0) ? listen_backlog : 2*max_conn) == -1) {
         log_error_func(1, LOG_ERR,"listen",NULL);
         return -1;
     }
@@ -666,6 +1036,7 @@ int httpd_init(int sport, char *sname, int use_ssl,  const char *certificate,
 void httpd_shutdown()
 {
     struct REQUEST *req, *tmp;
+    int i;
 
     close(slisten);
 
@@ -676,7 +1047,7 @@ void httpd_shutdown()
         if (req->bfd != -1) {
             close(req->bfd);
         }
-        if (req->body != NULL) {
+        if ((req->body != NULL) && !req->body_static) {
             free(req->body);
         }
         if (req->r_start) {
@@ -691,12 +1062,28 @@ void httpd_shutdown()
         if (req->r_hlen) {
             free(req->r_hlen);
         }
+        if (req->post_body) {
+            free(req->post_body);
+        }
         list_free(&req->header);
 
         free(req);
 
         req = tmp;
     }
+    conns = NULL;
+
+    free(conn_by_fd);
+    conn_by_fd = NULL;
+    conn_by_fd_len = 0;
+
+    for (i = 0; i < PEER_BUCKETS; i++) {
+        while (peers[i] != NULL) {
+            struct PEER *p = peers[i];
+            peers[i] = p->next;
+            free(p);
+        }
+    }
 
     shutdown_mime();
 }
@@ -738,7 +1125,33 @@ int httpd_register_parse_request(parse_request_func_t f)
     return 0;
 }
 
+int httpd_set_limits(int maxconn, int maxpeerconn, int backlog, int keepalive, int nettimeout)
+{
+    if (maxconn > 0) {
+        max_conn = maxconn;
+    }
+    if (maxpeerconn > 0) {
+        max_peer_conn = maxpeerconn;
+    }
+    if (backlog > 0) {
+        listen_backlog = backlog;
+    }
+    if (keepalive > 0) {
+        keepalive_time = keepalive;
+    }
+    if (nettimeout > 0) {
+        timeout = nettimeout;
+    }
+
+    return 0;
+}
+
 int httpd_get_keepalive()
 {
     return keepalive_time;
 }
+
+int httpd_get_timeout()
+{
+    return timeout;
+}
@@ -47,6 +47,7 @@
 #include <sys/signal.h>
 #include <sys/utsname.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <sys/un.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
@@ -84,8 +85,8 @@ extern "C" {
 
 /* max header length */
 #define MAX_HEADER 4096
-/* max header + body */
-#define MAX_REQ 128000  
+/* max form body length, the body is kept in memory */
+#define MAX_BODY (64*1024*1024)
 #define BR_HEADER 512
 
 /* timeout for dns queries */
@@ -103,7 +104,7 @@ struct REQUEST {
     char        peerserv[9];
     
     /* request */
-    char	hreq[MAX_REQ+1];  /* request header */
+    char	hreq[MAX_HEADER+1];  /* request header */
     int 	lreq;		     /* request length */
     int         hdata;               /* data in hreq */
     char        type[16];            /* req type */
@@ -117,6 +118,8 @@ struct REQUEST {
     time_t      if_modified;
     time_t      if_unmodified;
     time_t      if_range;
+    char        *if_none_match;      /* If-None-Match header value */
+    int         accept_gzip;         /* client accepts gzip encoding */
     char        *range_hdr;
     int         ranges;
     off_t       *r_start;
@@ -126,10 +129,18 @@ struct REQUEST {
     char        *ctype; /* content type in request */
     int         clen;  /* content length */
     char        *breq; /* pointer to request body (POST) */
-    char        post_body[MAX_REQ+1];
-    int         lbreq;
+    int         lbreq; /* body bytes read together with the header */
+    char        *post_body; /* decoded form body: name\0value\0name\0... */
+    int         lpost;      /* length of post_body */
+    int         body_raw;   /* octet-stream body, post_body is not decoded */
+    int         body_read;  /* body bytes received */
+    int         dec_state;  /* form decoder: in %xx escape */
+    int         dec_hex;    /* form decoder: first escaped digit */
+    int         dec_field;  /* form decoder: start of current field */
+    int         dec_value;  /* form decoder: field has a value part */
 
     /* response */
+    char        etag[64];            /* ETag of the response, empty if none */
     int         status;              /* status code (log) */
     int         bc;                  /* byte counter (log) */
     char	hres[MAX_HEADER+1];  /* response header */
@@ -137,6 +148,9 @@ struct REQUEST {
     char        *mime;               /* mime type */
     char	*body;
     int         lbody;
+    int         body_static;         /* body is not owned by the request */
+    const char  *encoding;           /* Content-Encoding, NULL for identity */
+    int         vary_encoding;       /* body depends on Accept-Encoding */
     int         bfd;                 /* file descriptor */
     struct stat bst;                 /* file info */
     off_t       written;
@@ -150,10 +164,18 @@ struct REQUEST {
     SSL		*ssl_s;
     BIO		*io;
     BIO		*bio_in;
+    int         ssl_done;            /* handshake finished and counted */
 #endif
 
+    /* set while the connection is being processed */
+    int         busy;
+
+    /* connection count of the peer */
+    struct PEER *peer_entry;
+
     /* linked list */
     struct REQUEST *next;
+    struct REQUEST *prev;
 };
 
 /* --- string lists --------------------------------------------- */
@@ -234,13 +256,18 @@ enum mode
     FD_RW = 0x03
   };
 
+/* epoll reactor */
 typedef struct
 {
-    int max;
-    fd_set rset;
-    fd_set wset;
+    int epfd;
 } fd_sets_t;
 
+/* maximum number of events returned by one reactor_wait call */
+#define REACTOR_MAX_EVENTS 64
+
+/* maximum number of body segments of httpd_send_response_iov */
+#define HTTPD_MAX_IOV 64
+
 
 
 /* register access check callback */
@@ -251,22 +278,66 @@ int httpd_register_log_request(log_request_func_t f);
 int httpd_register_log_error(log_error_func_t f);
 /* register parse request callback */
 int httpd_register_parse_request(parse_request_func_t f);
+/* set connection limits, listen backlog and keepalive/network timeouts [s]
+   (call before httpd_init, values <= 0 keep the defaults) */
+int httpd_set_limits(int max_conn, int max_peer_conn, int backlog,
+                     int keepalive, int timeout);
 /* get keepalive timeout */
 int httpd_get_keepalive();
+/* get network timeout */
+int httpd_get_timeout();
 /* return 1 if httpd uses SSL */
 int httpd_uses_ssl();
+
+/* TLS handshake counters of the control connections */
+struct ssl_stats
+{
+    unsigned long full;     /* full handshakes */
+    unsigned long resumed;  /* abbreviated handshakes (session cache or ticket) */
+    unsigned long failed;   /* connections closed before the handshake finished */
+};
+
+/* set TLS (<= 1.2) cipher list, session cache size and session lifetime [s]
+   before httpd_init, NULL/0 keeps the defaults */
+int httpd_set_ssl_params(const char *ciphers, int cache_size, int session_timeout);
+/* get the TLS handshake counters, all 0 without SSL */
+void httpd_get_ssl_stats(struct ssl_stats *stats);
 /* initialize http server */
 int httpd_init(int sport, char *sname, int use_ssl, const char *certificate, 
 	       const char *password, int use_v6);
-/* handle file descriptor event */
-int httpd_handle_event(fd_set *rset, fd_set *wset, fd_sets_t *fds);
+/* handle file descriptor event, NULL checks the connection timeouts */
+int httpd_handle_event(fd_t *ready, fd_sets_t *fds);
 /* send response */
 int httpd_send_response(struct REQUEST *req, fd_sets_t *fds);
+/* send response with the given status (e.g. 202), fds may be NULL
+   inside the parse request callback */
+int httpd_send_status_response(struct REQUEST *req, int status, fd_sets_t *fds);
+/* send response made of niov segments (<= HTTPD_MAX_IOV), the segments
+   need to stay valid only until the call returns */
+int httpd_send_response_iov(struct REQUEST *req, struct iovec *iov, int niov,
+                            fd_sets_t *fds);
 /* send response immediatly */
 int httpd_send_immediate_response(struct REQUEST *req);
+/* send len bytes of body immediatly without copying them, the body must
+   stay unchanged for the lifetime of the server */
+int httpd_send_static_response(struct REQUEST *req, int status,
+                               const char *body, int len);
 /* shutdown http server */
 void httpd_shutdown();
 
+/* create the epoll instance */
+int reactor_init(fd_sets_t *fds);
+/* close the epoll instance */
+void reactor_close(fd_sets_t *fds);
+/* watch fd for mode (FD_RD, FD_WT), edge-triggered if edge != 0 */
+int reactor_add(fd_sets_t *fds, int fd, int mode, int edge);
+/* change the watched mode of fd */
+int reactor_mod(fd_sets_t *fds, int fd, int mode, int edge);
+/* stop watching fd */
+int reactor_del(fd_sets_t *fds, int fd);
+/* wait up to timeout ms (-1 forever), return the number of ready fds */
+int reactor_wait(fd_sets_t *fds, fd_t *ready, int max, int timeout);
+
 /* --- ssl.c ---------------------------------------------------- */
 
 #ifdef USE_SSL
@@ -275,6 +346,7 @@ int ssl_write(struct REQUEST *req, char *buf, int len);
 int ssl_blk_write(struct REQUEST *req, int offset, int len);
 void init_ssl(const char *certificate, const char *password);
 void open_ssl_session(struct REQUEST *req);
+void close_ssl_session(struct REQUEST *req);
 #endif
 
 /* --- request.c ------------------------------------------------ */
@@ -290,6 +362,7 @@ void mkerror(struct REQUEST *req, int status, int ka);
 void mkredirect(struct REQUEST *req, int tcp_port);
 void mkheader(struct REQUEST *req, int status, time_t mtime);
 void write_request(struct REQUEST *req);
+void write_response_iov(struct REQUEST *req, struct iovec *iov, int niov);
 
 /* --- quote.c ----------------------------------------------------- */
 
@@ -297,6 +370,8 @@ void init_quote(void);
 char*  quote(unsigned char *path, int maxlength);
 void unquote(unsigned char *path, unsigned char *qs, unsigned char *src);
 void unquote2(unsigned char *dst, unsigned char *src);
+void unquote_body(struct REQUEST *req, char *src, int len);
+void unquote_body_end(struct REQUEST *req);
 
 /* --- mime.c --------------------------------------------------- */
 
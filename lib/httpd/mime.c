@@ -112,4 +112,9 @@ void shutdown_mime()
 {
     free(mime_default);
     free(mime_types);
+
+    /* the table is built again by the next httpd_init */
+    mime_default = NULL;
+    mime_types = NULL;
+    mime_count = 0;
 }
@@ -138,3 +138,118 @@ void unquote2(unsigned char *dst, unsigned char *src)
     *dst = 0;
 
 }
+
+/* decode a form body (a=b&c=d) piece by piece into req->post_body as
+   a list of name\0value\0 pairs, fields without a value are dropped;
+   src may point into post_body itself at or behind the decoded part */
+static const unsigned char body_special[256] = {
+    ['%'] = 1, ['+'] = 1, ['='] = 1, ['&'] = 1
+};
+
+static void body_put(struct REQUEST *req, char c)
+{
+    req->post_body[req->lpost++] = c;
+}
+
+static void body_flush(struct REQUEST *req)
+{
+    if (req->dec_state > 0) {
+        body_put(req, '%');
+    }
+    if (req->dec_state > 1) {
+        body_put(req, req->dec_hex);
+    }
+    req->dec_state = 0;
+}
+
+static void body_end_field(struct REQUEST *req)
+{
+    if (req->dec_value) {
+        body_put(req, 0);
+    } else {
+        req->lpost = req->dec_field;
+    }
+    req->dec_field = req->lpost;
+    req->dec_value = 0;
+}
+
+void unquote_body(struct REQUEST *req, char *src, int len)
+{
+    unsigned char c;
+    char *end = src + len;
+    char *dst;
+
+    while (src < end) {
+        /* plain characters and complete escapes are handled in one go */
+        if (req->dec_state == 0) {
+            dst = req->post_body + req->lpost;
+            while (src < end) {
+                c = *src;
+                if (!body_special[c]) {
+                    *dst++ = c;
+                    src++;
+                } else if (c == '+') {
+                    *dst++ = ' ';
+                    src++;
+                } else if ((c == '%') && (end - src > 2) &&
+                           isxdigit(src[1]) && isxdigit(src[2])) {
+                    *dst++ = (unhex(src[1]) << 4) | unhex(src[2]);
+                    src += 3;
+                } else {
+                    break;
+                }
+            }
+            req->lpost = dst - req->post_body;
+            if (src == end) {
+                break;
+            }
+        }
+
+        c = *src++;
+
+        if (req->dec_state == 1) {
+            if (isxdigit(c)) {
+                req->dec_hex = c;
+                req->dec_state = 2;
+                continue;
+            }
+            body_flush(req);
+        } else if (req->dec_state == 2) {
+            if (isxdigit(c)) {
+                body_put(req, (unhex(req->dec_hex) << 4) | unhex(c));
+                req->dec_state = 0;
+                continue;
+            }
+            body_flush(req);
+        }
+
+        switch (c) {
+        case '%':
+            req->dec_state = 1;
+            break;
+        case '+':
+            body_put(req, ' ');
+            break;
+        case '=':
+            if (req->dec_value) {
+                body_put(req, '=');
+            } else {
+                body_put(req, 0);
+                req->dec_value = 1;
+            }
+            break;
+        case '&':
+            body_end_field(req);
+            break;
+        default:
+            body_put(req, c);
+        }
+    }
+}
+
+void unquote_body_end(struct REQUEST *req)
+{
+    body_flush(req);
+    body_end_field(req);
+    req->post_body[req->lpost] = 0;
+}
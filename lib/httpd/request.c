@@ -68,7 +68,6 @@ int read_header(struct REQUEST *req, int pipelined)
             if (pipelined) {
                 break; /* check if there is already a full request */
             } else {
-				fprintf(stdout,"Ending read_header In rc -1 err= EAGAIN \n");
                 return rc;
             }
         }
@@ -78,16 +77,13 @@ int read_header(struct REQUEST *req, int pipelined)
         log_error_func(1,LOG_INFO,"read",req->peerhost);
         /* fall through */
     case 0:
-    	fprintf(stdout,"Ending read_header In rc=0 \n");
         req->state = STATE_CLOSE;
         return rc;
     default:
-    	fprintf(stdout,"Ending read_header In rc:%d \n", rc);
         req->hdata += rc;
         req->hreq[req->hdata] = 0;
     }
 
-	fprintf(stdout,"read_header data read:%s \n", req->hreq);
 
     /* check if this looks like a http request after
        the first few bytes... */
@@ -110,20 +106,19 @@ int read_header(struct REQUEST *req, int pipelined)
             *(h-1) = 0;
         }
 
-		fprintf(stdout,"Read header - header complete \n");
         /* header length */
         req->lreq  = h - req->hreq;
         req->state = STATE_PARSE_HEADER;
 
         /* pointer to body */
         req->breq = h;
-        /* first part of body */
-        req->lbreq = req->hdata - req->lreq;
+        /* first part of body, see parse_request */
+        req->lbreq = 0;
 
         return 0;
     }
 
-    if (req->hdata == MAX_REQ) {
+    if (req->hdata == MAX_HEADER) {
         /* oops: buffer full, but found no complete request ... */
         mkerror(req,400,0);
         return -1;
@@ -133,62 +128,54 @@ int read_header(struct REQUEST *req, int pipelined)
 
 int read_body(struct REQUEST *req, int pipelined)
 {
-    int rc;
-
-	fprintf(stdout,"read body\n");
-
-
-  restart:
+    int rc = 0;
+    char *dst;
+
+    /* the body is read straight into post_body behind the part decoded
+       so far and decoded in place */
+    if (req->body_read < req->clen) {
+      restart:
+        dst = req->post_body + req->body_read;
 #ifdef USE_SSL
-    if (with_ssl) {
-        rc = ssl_read(req, req->hreq + req->hdata, MAX_REQ - req->hdata);
-    } else
+        if (with_ssl) {
+            rc = ssl_read(req, dst, req->clen - req->body_read);
+        } else
 #endif
-      {
-          rc = read(req->fd, req->hreq + req->hdata, MAX_REQ - req->hdata);
-      }
-    switch (rc) {
-    case -1:
-        if (errno == EAGAIN) {
-            if (pipelined) {
-                break; /* check if there is already a full request */
-            } else {
-				fprintf(stdout,"In errno == EAGAIN, return %d\n", rc);
+          {
+              rc = read(req->fd, dst, req->clen - req->body_read);
+          }
+        switch (rc) {
+        case -1:
+            if (errno == EAGAIN) {
                 return rc;
             }
+            if (errno == EINTR) {
+                goto restart;
+            }
+            log_error_func(1,LOG_INFO,"read",req->peerhost);
+            /* fall through */
+        case 0:
+            req->state = STATE_CLOSE;
+            return rc;
+        default:
+            if (!req->body_raw) {
+                unquote_body(req, dst, rc);
+            }
+            req->body_read += rc;
         }
-        if (errno == EINTR) {
-            goto restart;
-        }
-        log_error_func(1,LOG_INFO,"read",req->peerhost);
-        /* fall through */
-    case 0:
-    	fprintf(stdout,"Ending read_body In rc=0 \n");
-        req->state = STATE_CLOSE;
-        return rc;
-    default:
-    	fprintf(stdout,"in read_body case default rc:%d\n", rc);
-        req->hdata += rc;
-        req->hreq[req->hdata] = 0;
     }
 
-	fprintf(stdout,"End reading the body, it is going to see if everthing is ok \n");
-
     /* body complete */
-    if ((req->hdata - req->lreq) == req->clen) {
-		fprintf(stderr,"Complete body\n");
+    if (req->body_read == req->clen) {
+        if (req->body_raw) {
+            req->post_body[req->clen] = 0;
+            req->lpost = req->clen;
+        } else {
+            unquote_body_end(req);
+        }
         req->state = STATE_PARSE_BODY;
-        req->breq[req->clen] = 0;
-        req->lbreq = req->clen;
-
         return 0;
     }
-
-    if (req->hdata == MAX_REQ) {
-        /* oops: buffer full, but found no complete request ... */
-        mkerror(req,400,0);
-        return -1;
-    }
     return rc;
 }
 
@@ -390,7 +377,6 @@ void parse_request(struct REQUEST *req, char *server_host)
     time_t t;
     /*struct passwd *pw=NULL;*/
 
-	fprintf(stdout,"starting parse_request \n");
 
 #ifdef DEBUG
 	fprintf(stderr,"%s\n",req->hreq);
@@ -449,7 +435,6 @@ void parse_request(struct REQUEST *req, char *server_host)
         return;
     }
 
-	fprintf(stdout,"before parsing header lines \n");
 
     /* parse header lines */
     req->keep_alive = req->minor;
@@ -464,7 +449,6 @@ void parse_request(struct REQUEST *req, char *server_host)
         h[-1] = 0;
         list_add(&req->header,h,0);
 
-        fprintf(stdout, h);
         if (strncasecmp(h,"Connection: ",12) == 0) {
             req->keep_alive = (strncasecmp(h+12,"Keep-Alive",10)== 0);
 
@@ -497,6 +481,13 @@ void parse_request(struct REQUEST *req, char *server_host)
 #endif
             }
 
+        } else if (strncasecmp(h,"If-None-Match: ",15) == 0) {
+            req->if_none_match = h+15;
+
+        } else if (strncasecmp(h,"Accept-Encoding: ",17) == 0) {
+            req->accept_gzip = (strstr(h+17,"gzip") != NULL) &&
+                (strstr(h+17,"gzip;q=0") == NULL);
+
         } else if (strncasecmp(h,"Authorization: Basic ",21) == 0) {
             decode_base64(req->auth,h+21,63);
 #ifdef DEBUG
@@ -514,7 +505,6 @@ void parse_request(struct REQUEST *req, char *server_host)
         }
     }
 
-	fprintf(stdout,"after parsing header lines \n");
 
     /* take care about the hostname */
     if (req->hostname[0] == '\0') {
@@ -530,40 +520,58 @@ void parse_request(struct REQUEST *req, char *server_host)
 
     /* check basic user auth */
     if (access_check_func != NULL) {
-		fprintf(stdout, "user given:%s \n", req->auth );
         if (access_check_func(NULL, req->auth) < 0) {
             mkerror(req,401,1);
             return;
         }
     }
 
-	fprintf(stdout,"access granted \n");
 
     /* generate the resource name */
     h = filename -1 +sprintf(filename,"%s", req->path);
 
-	fprintf(stdout, "It is going to read the body \n");
-
-    /* immediatly read available body (part) */
-    while (read_body(req, 0) > 0);
-
-	fprintf(stdout, "parse request - after reading the body \n");
 
     if (strcmp(req->type,"POST") == 0) {
-        if (strcmp(req->ctype,"application/x-www-form-urlencoded") == 0) {
-            if (req->lbreq < req->clen) {
-                /* read rest of body */
-                fprintf(stdout, "parse request - we need to read the rest of the body \n");
-                req->state = STATE_READ_BODY;
-                return;
-            }
-            /* else unquote body and proceed */
-            unquote2(req->post_body,req->breq);
-            req->state = STATE_PROCESS;
-        } else {
+        if (req->ctype == NULL) {
             mkerror(req,500,1);
             return;
         }
+        if (strcmp(req->ctype,"application/octet-stream") == 0) {
+            /* binary body, handed to the callback as it is */
+            req->body_raw = 1;
+        } else if (strcmp(req->ctype,"application/x-www-form-urlencoded") != 0) {
+            mkerror(req,500,1);
+            return;
+        }
+        if ((req->clen < 0) || (req->clen > MAX_BODY)) {
+            mkerror(req,413,0);
+            return;
+        }
+        if ((req->post_body = malloc(req->clen + 1)) == NULL) {
+            mkerror(req,500,0);
+            return;
+        }
+
+        /* decode the part that came with the header */
+        req->lbreq = req->hdata - req->lreq;
+        if (req->lbreq > req->clen) {
+            req->lbreq = req->clen;
+        }
+        if (req->body_raw) {
+            memcpy(req->post_body, req->breq, req->lbreq);
+        } else {
+            unquote_body(req, req->breq, req->lbreq);
+        }
+        req->body_read = req->lbreq;
+
+        /* immediatly read available body (part) */
+        req->state = STATE_READ_BODY;
+        while (read_body(req, 0) > 0);
+        if (req->state != STATE_PARSE_BODY) {
+            /* read rest of body later */
+            return;
+        }
+        req->state = STATE_PROCESS;
     }
 
     /* FIXME: support validation? */
@@ -597,9 +605,7 @@ void parse_request(struct REQUEST *req, char *server_host)
 
 void parse_request_body(struct REQUEST *req)
 {
-    /* unquote body */
-    unquote2(req->post_body,req->breq);
-
+    /* body has been decoded while reading */
     /* request callback */
     if (parse_request_func != NULL) {
         if (parse_request_func(req) < 0) {
@@ -39,6 +39,7 @@
 #include <sys/time.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
 
@@ -185,6 +186,7 @@ static struct HTTP_STATUS {
     char *body;
 } http[] = {
     { 200, "200 OK",                       NULL },
+    { 202, "202 Accepted",                 NULL },
     { 206, "206 Partial Content",          NULL },
     { 304, "304 Not Modified",             NULL },
     { 400, "400 Bad Request",              "*PLONK*\n" },
@@ -193,8 +195,10 @@ static struct HTTP_STATUS {
     { 404, "404 Not Found",                "File or directory not found\n" },
     { 408, "408 Request Timeout",          "Request Timeout\n" },
     { 412, "412 Precondition failed.",     "Precondition failed\n" },
+    { 413, "413 Request Entity Too Large", "Request body too large\n" },
     { 500, "500 Internal Server Error",    "Sorry folks\n" },
     { 501, "501 Not Implemented",          "Sorry folks\n" },
+    { 503, "503 Service Unavailable",      "Too many connections\n" },
     {   0, NULL,                        NULL }
 };
 
@@ -322,7 +326,7 @@ void mkheader(struct REQUEST *req, int status, time_t mtime)
                              "Content-Length: %lld\r\n",
 #endif
                              req->mime,
-                             req->body ? req->lbody : req->bst.st_size);
+                             (req->body || req->bfd == -1) ? req->lbody : req->bst.st_size);
 
     } else if (req->ranges == 1) {
         req->lres += sprintf(req->hres+req->lres,
@@ -367,6 +371,18 @@ void mkheader(struct REQUEST *req, int status, time_t mtime)
                                   gmtime(&expires));
         }
     }
+    if (req->etag[0] != 0) {
+        req->lres += sprintf(req->hres+req->lres,
+                             "ETag: %s\r\n", req->etag);
+    }
+    if (req->encoding != NULL) {
+        req->lres += sprintf(req->hres+req->lres,
+                             "Content-Encoding: %s\r\n", req->encoding);
+    }
+    if (req->vary_encoding) {
+        req->lres += sprintf(req->hres+req->lres,
+                             "Vary: Accept-Encoding\r\n");
+    }
     req->lres += strftime(req->hres+req->lres,80,
                           "Date: " RFCTIME "\r\n\r\n",
                           gmtime(&now));
@@ -379,6 +395,65 @@ void mkheader(struct REQUEST *req, int status, time_t mtime)
 }
 
 
+/* write header and body in one writev call, the body segments are only
+   used during the call: what does not fit into the socket is copied to
+   req->body and written by write_request later */
+void write_response_iov(struct REQUEST *req, struct iovec *iov, int niov)
+{
+    struct iovec vec[HTTPD_MAX_IOV+1];
+    ssize_t rc = -1;
+    size_t  off;
+    int     i;
+
+    vec[0].iov_base = req->hres;
+    vec[0].iov_len  = req->lres;
+    for (i = 0; i < niov; i++) {
+        vec[i+1] = iov[i];
+    }
+
+#ifdef USE_SSL
+    if (!with_ssl)
+#endif
+    {
+        do {
+            rc = writev(req->fd, vec, niov+1);
+        } while ((rc == -1) && (errno == EINTR));
+
+        if (rc == -1 && errno != EAGAIN) {
+            log_error_func(1,LOG_INFO,"writev",req->peerhost);
+            req->state = STATE_CLOSE;
+            return;
+        }
+        if (rc == (ssize_t) req->lres + req->lbody) {
+            req->bc += rc;
+            req->state = STATE_FINISHED;
+            return;
+        }
+    }
+
+    /* keep the rest of the body for write_request */
+    if ((req->body = malloc(req->lbody + 1)) == NULL) {
+        req->state = STATE_CLOSE;
+        return;
+    }
+    for (i = 0, off = 0; i < niov; i++) {
+        memcpy(req->body + off, iov[i].iov_base, iov[i].iov_len);
+        off += iov[i].iov_len;
+    }
+    req->body[req->lbody] = 0;
+
+    if (rc <= 0) {
+        req->written = 0;
+    } else if (rc < req->lres) {
+        req->bc += rc;
+        req->written = rc;
+    } else {
+        req->bc += rc;
+        req->written = rc - req->lres;
+        req->state = STATE_WRITE_BODY;
+    }
+}
+
 void write_request(struct REQUEST *req)
 {
     int rc;
@@ -419,7 +494,8 @@ void write_request(struct REQUEST *req)
                 }
             }
             req->written = 0;
-            if (req->head_only) {
+            if (req->head_only || (req->body && req->lbody == 0)) {
+                /* nothing to write, e.g. 304 Not Modified */
                 req->state = STATE_FINISHED;
                 return;
             } else if (req->body) {
@@ -45,17 +45,64 @@
 static pthread_mutex_t lock_ssl = PTHREAD_MUTEX_INITIALIZER;
 #endif
 
+/* cipher preferences: forward secret AEADs, AES128-GCM first as it is
+   hardware accelerated on most hosts, then ChaCha20 for hosts without */
+#define SSL_DEFAULT_CIPHERS "ECDHE+AESGCM+AES128:ECDHE+CHACHA20:ECDHE+AESGCM:" \
+                            "DHE+AESGCM:DHE+CHACHA20:ECDHE+AES:!aNULL:!eNULL:!MD5:!RC4:!3DES"
+#define SSL_TLS13_CIPHERS   "TLS_AES_128_GCM_SHA256:TLS_CHACHA20_POLY1305_SHA256:" \
+                            "TLS_AES_256_GCM_SHA384"
+
+static char *ssl_ciphers        = NULL;
+static int  ssl_cache_size      = 1024;  /* cached sessions */
+static int  ssl_session_timeout = 3600;  /* lifetime of a session [s] */
+static struct ssl_stats stats;
+
+int httpd_set_ssl_params(const char *ciphers, int cache_size, int session_timeout)
+{
+    if ((ciphers != NULL) && (ciphers[0] != 0)) {
+        free(ssl_ciphers);
+        ssl_ciphers = strdup(ciphers);
+    }
+    if (cache_size > 0) {
+        ssl_cache_size = cache_size;
+    }
+    if (session_timeout > 0) {
+        ssl_session_timeout = session_timeout;
+    }
+
+    return 0;
+}
+
+void httpd_get_ssl_stats(struct ssl_stats *s)
+{
+    *s = stats;
+}
+
 #ifdef USE_SSL
 
 static SSL_CTX *ctx;
 static BIO	*sbio;
 static const char *password = NULL;
 
+/* count the handshake once it is finished */
+static void check_handshake(struct REQUEST *req)
+{
+    if (!req->ssl_done && SSL_is_init_finished(req->ssl_s)) {
+        req->ssl_done = 1;
+        if (SSL_session_reused(req->ssl_s)) {
+            stats.resumed++;
+        } else {
+            stats.full++;
+        }
+    }
+}
+
 int ssl_read(struct REQUEST *req, char *buf, int len)
 {
     int rc;
 
     rc = BIO_read(req->io, buf, len);
+    check_handshake(req);
     if ((rc == 0 && BIO_should_retry(req->io)) ||
         (rc < 0  && SSL_get_error(req->ssl_s, rc) == SSL_ERROR_WANT_READ)) {
         errno = EAGAIN;
@@ -82,6 +129,7 @@ int ssl_write(struct REQUEST *req, char *buf, int len)
     int rc;
 
     rc = BIO_write(req->io, buf, len);
+    check_handshake(req);
 #ifdef DEBUG
     if (!BIO_flush(req->io)) {
         fprintf(stderr, "%03d: BIO_flush() failed",req->fd);
@@ -181,7 +229,30 @@ void init_ssl(const char *certificate, const char *pwd)
         break;
     }
 
-    SSL_CTX_set_options(ctx, SSL_OP_ALL | SSL_OP_NO_SSLv2);
+    SSL_CTX_set_options(ctx, SSL_OP_ALL | SSL_OP_NO_SSLv2 | SSL_OP_NO_SSLv3 |
+                        SSL_OP_CIPHER_SERVER_PREFERENCE);
+#ifdef SSL_OP_NO_COMPRESSION
+    SSL_CTX_set_options(ctx, SSL_OP_NO_COMPRESSION);
+#endif
+
+    /* cipher preferences */
+    if (SSL_CTX_set_cipher_list(ctx, ssl_ciphers ? ssl_ciphers : SSL_DEFAULT_CIPHERS) != 1) {
+        fprintf(stderr, "SSL cipher list error [%s]\n",
+                ERR_error_string(ERR_get_error(), NULL));
+    }
+#if OPENSSL_VERSION_NUMBER >= 0x10101000L
+    SSL_CTX_set_ciphersuites(ctx, SSL_TLS13_CIPHERS);
+#elif OPENSSL_VERSION_NUMBER >= 0x10002000L
+    SSL_CTX_set_ecdh_auto(ctx, 1);
+#endif
+
+    /* reconnecting clients resume their session from the server side
+       cache or a session ticket instead of a full handshake */
+    SSL_CTX_set_session_id_context(ctx, (const unsigned char *) "NetQoS", 6);
+    SSL_CTX_set_session_cache_mode(ctx, SSL_SESS_CACHE_SERVER);
+    SSL_CTX_sess_set_cache_size(ctx, ssl_cache_size);
+    SSL_CTX_set_timeout(ctx, ssl_session_timeout);
+    SSL_CTX_clear_options(ctx, SSL_OP_NO_TICKET);
 }
 
 void open_ssl_session(struct REQUEST *req)
@@ -211,4 +282,12 @@ void open_ssl_session(struct REQUEST *req)
     DO_UNLOCK(lock_ssl);
 }
 
+void close_ssl_session(struct REQUEST *req)
+{
+    if (!req->ssl_done) {
+        stats.failed++;
+    }
+    SSL_free(req->ssl_s);
+}
+
 #endif
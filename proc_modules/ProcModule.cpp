@@ -38,7 +38,7 @@ int magic = PROC_MAGIC;
 /*! \short   declaration of struct containing all function pointers of a module */
 ProcModuleInterface_t func = 
 { 
-    3, 
+    PROC_VALIDATE_VERSION, 
     initModule, 
     destroyModule, 
     initFlowSetup, 
@@ -48,7 +48,11 @@ ProcModuleInterface_t func =
     checkBandWidth,
     timeout, 
     getModuleInfo, 
-    getErrorMsg };
+    getErrorMsg,
+    // weak symbols, NULL for modules not implementing them
+    initFlowSetupBatch,
+    destroyFlowSetupBatch,
+    validateFlowSetup };
 
 
 /*! \short   global state variable used within data export macros */
@@ -137,6 +137,20 @@ typedef struct {
 
 struct timeval zerotime = {0,0};
 
+
+/* flow parameters given to initFlowSetup and destroyFlowSetup */
+
+typedef struct {
+    int64_t rate;
+    int duration;
+    uint32_t burst;
+    uint32_t flowId;
+    uint32_t priority;
+    int bidir;
+    bool hasRate;
+    bool hasFlowId;
+} flowParams_t;
+
 int string_to_number(const char *s, unsigned int min, unsigned int max,
 		     unsigned int *ret)
 {
@@ -288,6 +302,10 @@ void initModule( configParam_t *params )
 		 if ((err = nl_connect(sk, NETLINK_ROUTE)) < 0)
 			throw ProcError(err, "Unable to connect socket");
 
+		 // the flow batches keep a window of requests in flight
+		 if ((err = nl_setup_pipelined(sk)) < 0)
+			throw ProcError(err, "Unable to set up socket buffer");
+
 		 if ((err = rtnl_link_alloc_cache(sk, AF_UNSPEC, &link_cache))< 0)
 			throw ProcError(err, "Unable to allocate cache");
 
@@ -489,8 +507,12 @@ int create_hask_key(filterList_t *filters)
 	return -1; // We must to assign the filter to the non hashed table.
 }
 
-void modify_filter( int flowId, filterList_t *filters,
-					int bidir, TcFilterAction_e action )
+/*! \short  build the u32 classifier for a flow without sending it
+    \returns the classifier, to be given to save_add_u32_filter/save_delete_u32_filter
+              or u32_build_add_filter/u32_build_delete_filter
+*/
+struct rtnl_cls *prepare_filter( int flowId, filterList_t *filters,
+								 int bidir, TcFilterAction_e action )
 {
 	int err = 0;
 	int hashkey = -1;
@@ -538,7 +560,7 @@ void modify_filter( int flowId, filterList_t *filters,
 					(uint32_t) NET_ROOT_HANDLE_MAJOR, (uint32_t) flowId));
 
 		if (err < 0)
-			throw ProcError(err, "Error establishing class id for the classifier");
+			goto fail;
 
 		filterListIter_t iter;
 		for ( iter = filters->begin() ; iter != filters->end() ; iter++ )
@@ -596,12 +618,6 @@ void modify_filter( int flowId, filterList_t *filters,
 					break;
 			}
 		}
-
-		err = save_add_u32_filter(sk, cls);
-		if ( err == NET_TC_CLASSIFIER_ESTABLISH_ERROR )
-			goto fail;
-		else
-			goto ok;
 	}
 	else // action delete
 	{
@@ -616,26 +632,37 @@ void modify_filter( int flowId, filterList_t *filters,
             fprintf( stdout, "Error deleting classifier %d \n", err);
 			throw ProcError(err, "classifier allocate error during deleting");
         }
-
-		err = save_delete_u32_filter(sk, cls);
-		if ( err == NET_TC_CLASSIFIER_ESTABLISH_ERROR ){
-			fprintf( stdout, "Error deleting filter %d \n", err);
-			goto fail;
-
-		}
-		else{
-			goto ok;
-        }
 	}
 
+	return cls;
+
 fail:
     if (cls != NULL){
 		rtnl_cls_put(cls);
 	}
 	throw ProcError(err, "Error setting up Filters");
+}
+
+
+void modify_filter( int flowId, filterList_t *filters,
+					int bidir, TcFilterAction_e action )
+{
+	int err = 0;
+
+	struct rtnl_cls *cls = prepare_filter(flowId, filters, bidir, action);
+
+	if (action == TC_FILTER_ADD)
+		err = save_add_u32_filter(sk, cls);
+	else
+		err = save_delete_u32_filter(sk, cls);
+
+	if ( err == NET_TC_CLASSIFIER_ESTABLISH_ERROR )
+	{
+		fprintf( stdout, "Error modifying filter %d \n", err);
+		rtnl_cls_put(cls);
+		throw ProcError(err, "Error setting up Filters");
+	}
 
-ok:
-	err = 0;
 	fprintf( stdout, "htb: end modify filter \n" );
 
 }
@@ -643,67 +670,116 @@ ok:
 
 
 
-void initFlowSetup( int rule_id,
-					int action_id, configParam_t *params,
-					filterList_t *filters, void **flowdata)
+/*! \short  read the parameters of a flow
+    \returns number of flow parameters found
+*/
+int parseFlowParams( configParam_t *params, flowParams_t *fp )
 {
-
-    accData_t *data;
-    int err;
-    int64_t rate = 0;
-    int duration = 0;
-    uint32_t burst = 0;
-    uint32_t flowId = 0;
-    uint32_t priority = 0;
     int numparams = 0;
-    int bidir = 0;
+    const paramBlock_t *block = getParamBlock(params);
 
+    memset(fp, 0, sizeof(flowParams_t));
 
-    data = (accData_t *) malloc( sizeof(accData_t) );
+    // parameters already compiled by the QoS processor
+    if (block != NULL) {
+        if (hasParam(block, PARAM_RATE)) {
+            fp->rate = block->value[PARAM_RATE];
+            fp->hasRate = true;
+            numparams++;
+        }
 
-    if (data == NULL )
-        throw ProcError(NET_TC_PARAMETER_ERROR,
-							"HTB Flow init - allocation flow data error");
+        if (hasParam(block, PARAM_DURATION)) {
+            fp->duration = (int) block->value[PARAM_DURATION];
+            numparams++;
+        }
 
-    /* copy default timers to current timers array for a specific task */
-    memcpy(data->currTimers, timers, sizeof(timers));
+        if (hasParam(block, PARAM_FLOWID)) {
+            fp->flowId = (uint32_t) block->value[PARAM_FLOWID];
+            fp->hasFlowId = true;
+            numparams++;
+        }
 
+        if (hasParam(block, PARAM_BURST)) {
+            fp->burst = (uint32_t) block->value[PARAM_BURST];
+            numparams++;
+        }
+
+        if (hasParam(block, PARAM_PRIORITY)) {
+            fp->priority = (uint32_t) block->value[PARAM_PRIORITY];
+            numparams++;
+        }
+
+        if (hasParam(block, PARAM_BIDIR)) {
+            fp->bidir = (int) block->value[PARAM_BIDIR];
+            numparams++;
+        }
+
+        return numparams;
+    }
 
     while (params[0].name != NULL) {
 
         if (!strcmp(params[0].name, "Rate")) {
-            rate = parseLong(params[0].value);
+            fp->rate = parseLong(params[0].value);
+            fp->hasRate = true;
 			numparams++;
         }
 
         if (!strcmp(params[0].name, "Duration")) {
-            duration = parseInt( params[0].value );
+            fp->duration = parseInt( params[0].value );
             numparams++;
         }
 
         if (!strcmp(params[0].name, "FlowId")) {
-            flowId = (uint32_t) parseInt( params[0].value );
+            fp->flowId = (uint32_t) parseInt( params[0].value );
+            fp->hasFlowId = true;
             numparams++;
         }
 
         if (!strcmp(params[0].name, "Burst")) {
-            burst = (uint32_t) parseInt( params[0].value );
+            fp->burst = (uint32_t) parseInt( params[0].value );
             numparams++;
         }
 
         if (!strcmp(params[0].name, "Priority")) {
-            priority = (uint32_t) parseInt( params[0].value );
+            fp->priority = (uint32_t) parseInt( params[0].value );
             numparams++;
         }
 
         if (!strcmp(params[0].name, "Bidir")) {
-            bidir = (uint32_t) parseBool( params[0].value );
+            fp->bidir = (uint32_t) parseBool( params[0].value );
             numparams++;
         }
 
         params++;
      }
 
+    return numparams;
+}
+
+
+void initFlowSetup( int rule_id,
+					int action_id, configParam_t *params,
+					filterList_t *filters, void **flowdata)
+{
+
+    accData_t *data;
+    int err;
+    flowParams_t fp;
+    int numparams = 0;
+
+
+    data = (accData_t *) malloc( sizeof(accData_t) );
+
+    if (data == NULL )
+        throw ProcError(NET_TC_PARAMETER_ERROR,
+							"HTB Flow init - allocation flow data error");
+
+    /* copy default timers to current timers array for a specific task */
+    memcpy(data->currTimers, timers, sizeof(timers));
+
+    numparams = parseFlowParams(params, &fp);
+
 #ifdef DEBUG
 		fprintf( stdout, "htb module: number of parameters given: %d \n", numparams );
 #endif
@@ -712,14 +788,14 @@ void initFlowSetup( int rule_id,
 	 if ( numparams == MOD_INI_FLOW_REQUIRED_PARAMS )
 	 {
 		 uint32_t quantum = 10;
-		 err = class_add_HTB(sk, nllink, flowId, rate, rate,
-							 burst, burst, priority, quantum);
+		 err = class_add_HTB(sk, nllink, fp.flowId, fp.rate, fp.rate,
+							 fp.burst, fp.burst, fp.priority, quantum);
 
 	     if ( err == NET_TC_SUCCESS )
 	     {
-			data->currTimers[0].ival_msec = 1000 * duration;
-			modify_filter(flowId, filters, bidir, TC_FILTER_ADD);
-			bandwidth_available = bandwidth_available - rate;
+			data->currTimers[0].ival_msec = 1000 * fp.duration;
+			modify_filter(fp.flowId, filters, fp.bidir, TC_FILTER_ADD);
+			bandwidth_available = bandwidth_available - fp.rate;
 			*flowdata = data;
 		 }
 		 else
@@ -737,6 +813,129 @@ void initFlowSetup( int rule_id,
 }
 
 
+void validateFlowSetup( int rule_id, int action_id,
+						configParam_t *params, filterList_t *filters )
+{
+    flowParams_t fp;
+
+    if ( parseFlowParams(params, &fp) != MOD_INI_FLOW_REQUIRED_PARAMS )
+		 throw ProcError(NET_TC_PARAMETER_ERROR,
+							"HTB Flow validate - not enought parameters");
+
+    if ( (fp.rate <= 0) || (fp.duration < 0) )
+		 throw ProcError(NET_TC_PARAMETER_ERROR,
+							"HTB Flow validate - invalid rate or duration");
+
+    if ( (bandwidth_available - fp.rate) < 0 )
+		 throw ProcError(NET_TC_RATE_AVAILABLE_ERROR,
+							"HTB Flow validate - not enought bandwidth");
+
+    // build the classifier as initFlowSetup would, but do not send it
+    struct rtnl_cls *cls = prepare_filter(fp.flowId, filters, fp.bidir, TC_FILTER_ADD);
+    rtnl_cls_put(cls);
+
+#ifdef DEBUG
+		fprintf( stdout, "htb: flow %d of rule %d is valid \n", fp.flowId, rule_id );
+#endif
+}
+
+
+/*! \short  error code to report for a failed flow of a batch */
+inline int batchError( ProcError &e, int def )
+{
+    return (e.getErrorNo() < 0) ? e.getErrorNo() : def;
+}
+
+
+void initFlowSetupBatch( flowSetup_t *setups, int n )
+{
+    int i, err;
+
+    if (n <= 0)
+        return;
+
+    // two requests per flow: the class and the filter pointing to it
+    vector<flowParams_t> fp(n);
+    vector<struct nl_msg *> msgs(2 * n, (struct nl_msg *) NULL);
+    vector<int> status(2 * n, 0);
+
+    // 1. check the flows and prepare the requests
+    for (i = 0; i < n; i++) {
+        setups[i].status = NET_TC_SUCCESS;
+        setups[i].flowdata = NULL;
+
+        try {
+            if (parseFlowParams(setups[i].params, &fp[i]) != MOD_INI_FLOW_REQUIRED_PARAMS)
+                throw ProcError(NET_TC_PARAMETER_ERROR,
+                                "HTB Flow init - not enought parameters");
+
+            uint32_t quantum = 10;
+            err = class_build_add_HTB(nllink, fp[i].flowId, fp[i].rate, fp[i].rate,
+                                      fp[i].burst, fp[i].burst, fp[i].priority,
+                                      quantum, &msgs[2*i]);
+            if (err != NET_TC_SUCCESS)
+                throw ProcError(err, "Error adding HTB class");
+
+            err = u32_build_add_filter(prepare_filter(fp[i].flowId, setups[i].filters,
+                                                      fp[i].bidir, TC_FILTER_ADD),
+                                       &msgs[2*i + 1]);
+            if (err != NET_TC_SUCCESS)
+                throw ProcError(err, "Error setting up Filters");
+
+        } catch (ProcError &e) {
+            setups[i].status = batchError(e, NET_TC_PARAMETER_ERROR);
+            if (msgs[2*i] != NULL) {
+                nlmsg_free(msgs[2*i]);
+                msgs[2*i] = NULL;
+            }
+        }
+    }
+
+    // 2. send everything in one go, then read the acknowledgements
+    nl_send_pipelined(sk, &msgs[0], &status[0], 2 * n);
+
+    // 3. record the flows that were set up, undo the half done ones
+    for (i = 0; i < n; i++) {
+        if (setups[i].status != NET_TC_SUCCESS)
+            continue;
+
+        accData_t *data = NULL;
+        if ((status[2*i] == 0) && (status[2*i + 1] == 0)) {
+            data = (accData_t *) malloc( sizeof(accData_t) );
+        }
+
+        if (data != NULL) {
+            memcpy(data->currTimers, timers, sizeof(timers));
+            data->currTimers[0].ival_msec = 1000 * fp[i].duration;
+            bandwidth_available = bandwidth_available - fp[i].rate;
+            setups[i].flowdata = data;
+        } else {
+#ifdef DEBUG
+            fprintf( stdout, "htb: batch flow %d failed class:%d filter:%d \n",
+                     fp[i].flowId, status[2*i], status[2*i + 1] );
+#endif
+
+            if (status[2*i + 1] == 0) {
+                try {
+                    modify_filter(fp[i].flowId, setups[i].filters, fp[i].bidir, TC_FILTER_DELETE);
+                } catch (ProcError &e) { }
+            }
+            if (status[2*i] == 0) {
+                class_delete_HTB(sk, nllink, fp[i].flowId);
+            }
+
+            if (status[2*i] != 0) {
+                setups[i].status = NET_TC_CLASS_ESTABLISH_ERROR;
+            } else if (status[2*i + 1] != 0) {
+                setups[i].status = NET_TC_CLASSIFIER_ESTABLISH_ERROR;
+            } else {
+                setups[i].status = NET_TC_PARAMETER_ERROR;
+            }
+        }
+    }
+}
+
+
 void resetFlowSetup( configParam_t *params )
 {
     // NOT implemented, the user have to destroy and recreate the flow.
@@ -753,23 +952,16 @@ void resetFlowSetup( configParam_t *params )
 int checkBandWidth( configParam_t *params )
 {
 	int64_t rate;
-	int numparams = 0;
+	flowParams_t fp;
 
 #ifdef DEBUG
 	fprintf( stdout, "check bandwidth - Current value:%f \n", (double) bandwidth_available);
 #endif
 
-    while (params[0].name != NULL) {
+    parseFlowParams(params, &fp);
+    rate = fp.rate;
 
-        if (!strcmp(params[0].name, "Rate")) {
-            rate = parseLong(params[0].value);
-			numparams++;
-			break;
-        }
-        params++;
-     }
-
-	if (numparams == 1){
+	if (fp.hasRate){
 
 #ifdef DEBUG
         fprintf( stdout, "check bandwidth - rate:%f \n", (double) rate);
@@ -809,6 +1001,7 @@ void destroyFlowSetup( int rule_id, int action_id,
     int err;
     int bidir = 0;
     int64_t rate = 0;
+    flowParams_t fp;
 
 #ifdef DEBUG
 		fprintf( stdout, "init destroy FlowSetup \n" );
@@ -816,32 +1009,10 @@ void destroyFlowSetup( int rule_id, int action_id,
 
 	free( data );
 
-    while (params[0].name != NULL) {
-		fprintf( stdout, "Evaluating parameter %s value %s \n", params[0].name, params[0].value );
-
-		if (!strcmp(params[0].name, "Rate")) {
-
-            rate = parseLong(params[0].value);
-			numparams++;
-
-#ifdef DEBUG
-			fprintf( stdout, "rate: %d \n", rate );
-#endif
-
-        }
-
-        if (!strcmp(params[0].name, "FlowId")) {
-            flowId = (uint32_t) parseInt( params[0].value );
-            numparams++;
-
-#ifdef DEBUG
-			fprintf( stdout, "Flowid: %d \n", flowId );
-#endif
-
-        }
-
-        params++;
-    }
+    parseFlowParams(params, &fp);
+    rate = fp.rate;
+    flowId = fp.flowId;
+    numparams = (fp.hasRate ? 1 : 0) + (fp.hasFlowId ? 1 : 0);
 
     fprintf( stdout, "Flow Id to delete: %d - num parameters:%d \n", flowId, numparams );
 
@@ -873,6 +1044,75 @@ void destroyFlowSetup( int rule_id, int action_id,
 }
 
 
+void destroyFlowSetupBatch( flowSetup_t *setups, int n )
+{
+    int i, err;
+
+    if (n <= 0)
+        return;
+
+    // two requests per flow: the filter and then the class it points to
+    vector<flowParams_t> fp(n);
+    vector<struct nl_msg *> msgs(2 * n, (struct nl_msg *) NULL);
+    vector<int> status(2 * n, 0);
+
+    // 1. prepare the requests
+    for (i = 0; i < n; i++) {
+        setups[i].status = NET_TC_SUCCESS;
+
+        free( setups[i].flowdata );
+        setups[i].flowdata = NULL;
+
+        try {
+            parseFlowParams(setups[i].params, &fp[i]);
+            if (!fp[i].hasRate || !fp[i].hasFlowId)
+                throw ProcError(NET_TC_PARAMETER_ERROR,
+                                "HTB Flow destroy - not enought parameters");
+
+            err = u32_build_delete_filter(prepare_filter(fp[i].flowId, setups[i].filters,
+                                                         0, TC_FILTER_DELETE),
+                                          &msgs[2*i]);
+            if (err != NET_TC_SUCCESS)
+                throw ProcError(err, "Error deleting filter");
+
+            err = class_build_delete_HTB(nllink, fp[i].flowId, &msgs[2*i + 1]);
+            if (err != NET_TC_SUCCESS)
+                throw ProcError(err, "Error deleting HTB class");
+
+        } catch (ProcError &e) {
+            setups[i].status = batchError(e, NET_TC_PARAMETER_ERROR);
+            if (msgs[2*i] != NULL) {
+                nlmsg_free(msgs[2*i]);
+                msgs[2*i] = NULL;
+            }
+        }
+    }
+
+    // 2. send everything in one go, then read the acknowledgements
+    nl_send_pipelined(sk, &msgs[0], &status[0], 2 * n);
+
+    // 3. give back the bandwidth of the removed classes
+    for (i = 0; i < n; i++) {
+        if (setups[i].status != NET_TC_SUCCESS)
+            continue;
+
+        if (status[2*i + 1] == 0) {
+            bandwidth_available = bandwidth_available + fp[i].rate;
+        }
+
+        if (status[2*i] != 0) {
+            setups[i].status = NET_TC_CLASSIFIER_ESTABLISH_ERROR;
+        } else if (status[2*i + 1] != 0) {
+            setups[i].status = NET_TC_CLASS_ESTABLISH_ERROR;
+        }
+    }
+
+#ifdef DEBUG
+    fprintf( stdout, "end destroy FlowSetup batch of %d flows \n", n );
+#endif
+}
+
+
 const char* getModuleInfo(int i)
 {
     /* fprintf( stderr, "count : getModuleInfo(%d)\n",i ); */
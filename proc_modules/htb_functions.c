@@ -50,8 +50,17 @@
 #include <netlink/route/qdisc/sfq.h>
 #include <linux/if_ether.h>
 #include <netlink/attr.h>
+#include <sys/socket.h>
 #include "htb_functions.h"
 
+#ifndef SOL_NETLINK
+#define SOL_NETLINK 270
+#endif
+
+#ifndef NETLINK_CAP_ACK
+#define NETLINK_CAP_ACK 10
+#endif
+
 
 uint32_t NET_ROOT_HANDLE_MAJOR 		= 0x00000001U;
 uint32_t NET_ROOT_HANDLE_MINOR 		= 0x00000001U;
@@ -292,6 +301,97 @@ int class_delete_HTB(struct nl_sock *sock, struct rtnl_link *rtnlLink,
     return NET_TC_SUCCESS;
 }
 
+/*
+* function that prepares the request adding a HTB class, the request
+* is sent later together with others (see nl_send_pipelined)
+*/
+int class_build_add_HTB(struct rtnl_link *rtnlLink, uint32_t childMin,
+						uint64_t rate, uint64_t ceil, uint32_t burst,
+						uint32_t cburst, uint32_t prio, uint32_t quantum,
+						struct nl_msg **msg)
+{
+    int err;
+    struct rtnl_class *class;
+
+    if (!(class = rtnl_class_alloc())) {
+        return NET_TC_CLASS_ALLOC_ERROR;
+    }
+
+    rtnl_tc_set_link(TC_CAST(class), rtnlLink);
+
+    rtnl_tc_set_parent(TC_CAST(class), NET_HANDLE(NET_ROOT_HANDLE_MAJOR,
+												 NET_ROOT_HANDLE_MINOR));
+
+    rtnl_tc_set_handle(TC_CAST(class), NET_HANDLE(NET_ROOT_HANDLE_MAJOR,
+												 childMin));
+
+    if ((err = rtnl_tc_set_kind(TC_CAST(class), "htb"))) {
+        rtnl_class_put(class);
+        return NET_TC_CLASS_SETUP_ERROR;
+    }
+
+    rtnl_htb_set_prio(class, prio);
+
+    if (rate) {
+	rtnl_htb_set_rate(class, rate);
+    }
+    if (ceil) {
+	rtnl_htb_set_ceil(class, ceil);
+    }
+    if (burst) {
+        rtnl_htb_set_rbuffer(class, burst);
+    }
+    if (cburst) {
+        rtnl_htb_set_cbuffer(class, cburst);
+    }
+    if (quantum){
+		rtnl_htb_set_quantum(class, quantum);
+	}
+
+    err = rtnl_class_build_add_request(class, NLM_F_CREATE, msg);
+    rtnl_class_put(class);
+
+    if (err < 0) {
+        return NET_TC_CLASS_SETUP_ERROR;
+    }
+    return NET_TC_SUCCESS;
+}
+
+/*
+* function that prepares the request deleting a HTB class
+*/
+int class_build_delete_HTB(struct rtnl_link *rtnlLink, uint32_t childMin,
+						   struct nl_msg **msg)
+{
+    int err;
+    struct rtnl_class *class;
+
+    if (!(class = rtnl_class_alloc())) {
+        return NET_TC_CLASS_ALLOC_ERROR;
+    }
+
+    rtnl_tc_set_link(TC_CAST(class), rtnlLink);
+
+    rtnl_tc_set_parent(TC_CAST(class), NET_HANDLE(NET_ROOT_HANDLE_MAJOR,
+												 NET_ROOT_HANDLE_MINOR));
+
+    rtnl_tc_set_handle(TC_CAST(class), NET_HANDLE(NET_ROOT_HANDLE_MAJOR,
+												 childMin));
+
+    if ((err = rtnl_tc_set_kind(TC_CAST(class), "htb"))) {
+        rtnl_class_put(class);
+        return NET_TC_CLASS_SETUP_ERROR;
+    }
+
+    err = rtnl_class_build_delete_request(class, msg);
+    rtnl_class_put(class);
+
+    if (err < 0) {
+        return NET_TC_CLASS_SETUP_ERROR;
+    }
+    return NET_TC_SUCCESS;
+}
+
 /*
 * function that adds a new SFQ qdisc as a leaf for a HTB class
 */
@@ -945,3 +1045,174 @@ int save_delete_u32_filter(struct nl_sock *sock, struct rtnl_cls *cls)
 
 }
 
+/**
+ * Prepares the request adding a classifier built with create_u32_classifier,
+ * the classifier object is released.
+ */
+int u32_build_add_filter(struct rtnl_cls *cls, struct nl_msg **msg)
+{
+    int err;
+
+    rtnl_u32_set_cls_terminal(cls);
+
+    err = rtnl_cls_build_add_request(cls, NLM_F_CREATE, msg);
+    rtnl_cls_put(cls);
+
+    if (err < 0) {
+        return NET_TC_CLASSIFIER_SETUP_ERROR;
+    }
+    return NET_TC_SUCCESS;
+}
+
+/**
+ * Prepares the request deleting a classifier built with delete_u32_classifier,
+ * the classifier object is released.
+ */
+int u32_build_delete_filter(struct rtnl_cls *cls, struct nl_msg **msg)
+{
+    int err;
+
+    err = rtnl_cls_build_delete_request(cls, 0, msg);
+    rtnl_cls_put(cls);
+
+    if (err < 0) {
+        return NET_TC_CLASSIFIER_SETUP_ERROR;
+    }
+    return NET_TC_SUCCESS;
+}
+
+/**
+ * The kernel's limit on the buffer size may leave less room than
+ * requested, older kernels do not know NETLINK_CAP_ACK; both only
+ * make the windows of nl_send_pipelined smaller.
+ */
+int nl_setup_pipelined(struct nl_sock *sock)
+{
+    int one = 1;
+    int err;
+
+    err = nl_socket_set_buffer_size(sock, NET_PIPELINE_WINDOW * NET_PIPELINE_ACK_SIZE, 0);
+    if (err < 0) {
+        return err;
+    }
+
+    setsockopt(nl_socket_get_fd(sock), SOL_NETLINK, NETLINK_CAP_ACK, &one, sizeof(one));
+    return 0;
+}
+
+/**
+ * Number of requests whose acknowledgements fit into the receive
+ * buffer of the socket at once
+ */
+static int nl_pipeline_window(struct nl_sock *sock)
+{
+    int rcvbuf = 0;
+    socklen_t len = sizeof(rcvbuf);
+    int window = NET_PIPELINE_WINDOW;
+
+    if (getsockopt(nl_socket_get_fd(sock), SOL_SOCKET, SO_RCVBUF, &rcvbuf, &len) == 0) {
+        if (rcvbuf / NET_PIPELINE_ACK_SIZE < window) {
+            window = rcvbuf / NET_PIPELINE_ACK_SIZE;
+        }
+    }
+
+    return (window > 0) ? window : 1;
+}
+
+/**
+ * A request whose sending failed used up a sequence number that is
+ * never acknowledged, and libnl expects the acknowledgements in strict
+ * order. The gap is closed with an empty request carrying that number,
+ * which the kernel just acknowledges.
+ */
+static int nl_skip_seq(struct nl_sock *sock, uint32_t seq)
+{
+    struct nl_msg *msg;
+    int err;
+
+    msg = nlmsg_alloc_simple(NLMSG_NOOP, NLM_F_ACK);
+    if (msg == NULL) {
+        return -NLE_NOMEM;
+    }
+    nlmsg_hdr(msg)->nlmsg_seq = seq;
+
+    err = nl_send_auto(sock, msg);
+    nlmsg_free(msg);
+    if (err < 0) {
+        return err;
+    }
+
+    return nl_wait_for_ack(sock);
+}
+
+/**
+ * Sends the requests without waiting for the answer of each one and
+ * collects the acknowledgements afterwards. The kernel handles the
+ * requests of a socket in order, so the i-th acknowledgement belongs
+ * to the i-th request. Requests are sent in windows whose
+ * acknowledgements fit into the socket buffer (see nl_setup_pipelined).
+ *
+ * If a request cannot be sent, the acknowledgements of the requests
+ * sent before it are still collected, but no further request is sent:
+ * the rest fail with the same error.
+ *
+ * NULL entries in msgs are skipped, all messages are freed.
+ * status[i] receives 0 or the (negative) netlink error of request i.
+ */
+void nl_send_pipelined(struct nl_sock *sock, struct nl_msg **msgs,
+					   int *status, int n)
+{
+    int window = nl_pipeline_window(sock);
+    int first = 0;
+    int sendErr = 0;
+    int last, i;
+
+    while ((first < n) && (sendErr == 0)) {
+        last = first + window;
+        if (last > n) {
+            last = n;
+        }
+
+        for (i = first; i < last; i++) {
+            if (msgs[i] == NULL) {
+                continue;
+            }
+
+            status[i] = nl_send_auto(sock, msgs[i]);
+            if (status[i] < 0) {
+                sendErr = status[i];
+                break;
+            }
+        }
+
+        /* only the requests sent have an acknowledgement coming */
+        for (i = first; i < last; i++) {
+            if (msgs[i] == NULL) {
+                continue;
+            }
+            if (status[i] < 0) {
+                break;
+            }
+
+            status[i] = nl_wait_for_ack(sock);
+            nlmsg_free(msgs[i]);
+            msgs[i] = NULL;
+        }
+
+        if (sendErr != 0) {
+            /* msgs[i] is the request that could not be sent */
+            nl_skip_seq(sock, nlmsg_hdr(msgs[i])->nlmsg_seq);
+        }
+
+        first = last;
+    }
+
+    /* the requests not sent */
+    for (i = 0; i < n; i++) {
+        if (msgs[i] != NULL) {
+            status[i] = sendErr;
+            nlmsg_free(msgs[i]);
+            msgs[i] = NULL;
+        }
+    }
+}
@@ -88,6 +88,14 @@ int class_add_HTB(struct nl_sock *sock, struct rtnl_link *rtnlLink,
 int class_delete_HTB(struct nl_sock *sock, struct rtnl_link *rtnlLink,
 			         uint32_t childMin );
 
+int class_build_add_HTB(struct rtnl_link *rtnlLink, uint32_t childMin,
+						uint64_t rate, uint64_t ceil, uint32_t burst,
+						uint32_t cburst, uint32_t prio, uint32_t quantum,
+						struct nl_msg **msg);
+
+int class_build_delete_HTB(struct rtnl_link *rtnlLink, uint32_t childMin,
+						   struct nl_msg **msg);
+
 int qdisc_add_SFQ_leaf(struct nl_sock *sock, struct rtnl_link *rtnlLink,
 					   uint32_t childMin, int quantum, int limit,
 					   int perturb);
@@ -206,6 +214,36 @@ int save_add_u32_filter(struct nl_sock *sock,
 int save_delete_u32_filter(struct nl_sock *sock,
 					struct rtnl_cls *cls);
 
+int u32_build_add_filter(struct rtnl_cls *cls, struct nl_msg **msg);
+
+int u32_build_delete_filter(struct rtnl_cls *cls, struct nl_msg **msg);
+
+/**
+ * Number of requests sent by nl_send_pipelined before collecting
+ * their acknowledgements
+ */
+#define NET_PIPELINE_WINDOW 64
+
+/**
+ * Receive buffer space reserved for one pending acknowledgement,
+ * including the kernel's per message overhead
+ */
+#define NET_PIPELINE_ACK_SIZE 4096
+
+/**
+ * Prepares a socket for nl_send_pipelined: enlarges its receive
+ * buffer to hold the acknowledgements of a whole window and asks the
+ * kernel not to copy the requests into error acknowledgements
+ */
+int nl_setup_pipelined(struct nl_sock *sock);
+
+/**
+ * Sends a list of prepared requests in a pipelined way and returns
+ * the outcome of each of them in status
+ */
+void nl_send_pipelined(struct nl_sock *sock, struct nl_msg **msgs,
+					   int *status, int n);
+
 
 #ifdef __cplusplus
 }
@@ -122,6 +122,15 @@ void initFlowSetup( int rule_id, int action_id, configParam_t *params, filterLis
 }
 
 
+void validateFlowSetup( int rule_id, int action_id, configParam_t *params, filterList_t *filters )
+{
+    // there is nothing in a priority flow setup that can fail
+#ifdef DEBUG
+	std::cout << "priority validate flow setup" << std::endl;
+#endif
+}
+
+
 void resetFlowSetup( configParam_t *params )
 {
 	std::cout << "priority reset flow setup" << std::endl;
@@ -0,0 +1,347 @@
+/*  \file   BulkRuleParser.cpp
+
+    Copyright 2014-2015 Universidad de los Andes,
+                        Bogota, Colombia
+
+    This file is part of Network Quality Managing System (NETQoS).
+
+    NETQoS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    NETQoS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this software; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    Description:
+    parser for the length-prefixed binary bulk rule format
+
+    $Id: BulkRuleParser.cpp 748 2016-10-17 10:00:00 amarentes $
+*/
+
+#include "BulkRuleParser.h"
+#include "ParserFcts.h"
+
+
+BulkRuleParser::BulkRuleParser(char *b, int l)
+    : buf((const unsigned char *) b), len(l), pos(0), ruleEnd(l)
+{
+    log = Logger::getInstance();
+    ch = log->createChannel("BulkRuleParser" );
+}
+
+
+unsigned int BulkRuleParser::getU8()
+{
+    if (pos + 1 > ruleEnd) {
+        throw Error("Bulk Rule Parser Error: truncated rule at offset %d", pos);
+    }
+    return buf[pos++];
+}
+
+
+unsigned int BulkRuleParser::getU16()
+{
+    if (pos + 2 > ruleEnd) {
+        throw Error("Bulk Rule Parser Error: truncated rule at offset %d", pos);
+    }
+    unsigned int val = (buf[pos] << 8) | buf[pos+1];
+    pos += 2;
+    return val;
+}
+
+
+unsigned int BulkRuleParser::getU32()
+{
+    if (pos + 4 > ruleEnd) {
+        throw Error("Bulk Rule Parser Error: truncated rule at offset %d", pos);
+    }
+    unsigned int val = ((unsigned int) buf[pos] << 24) | (buf[pos+1] << 16) |
+                       (buf[pos+2] << 8) | buf[pos+3];
+    pos += 4;
+    return val;
+}
+
+
+void BulkRuleParser::getStr(string &s)
+{
+    unsigned int l = getU16();
+
+    if (pos + (int) l > ruleEnd) {
+        throw Error("Bulk Rule Parser Error: truncated string at offset %d", pos);
+    }
+    s.assign((const char *) buf + pos, l);
+    pos += l;
+}
+
+
+void BulkRuleParser::getPref(configItem_t &item)
+{
+    getStr(item.name);
+    getStr(item.type);
+    getStr(item.value);
+
+    if (item.name.empty()) {
+        throw Error("Bulk Rule Parser Error: missing name at offset %d", pos);
+    }
+    if (item.value.empty()) {
+        throw Error("Bulk Rule Parser Error: missing value for %s", item.name.c_str());
+    }
+
+    if (item.type.empty()) {
+        item.type = "String";
+    } else {
+        // check if item can be parsed
+        try {
+            ParserFcts::parseItem(item.type, item.value);
+        } catch (Error &e) {
+            throw Error("Bulk Rule Parser Error: parse value error for %s: %s",
+                        item.name.c_str(), e.getError().c_str());
+        }
+    }
+}
+
+
+string BulkRuleParser::lookup(filterValList_t *filterVals, const string &fvalue, filter_t *f)
+{
+    filterValListIter_t iter2 = filterVals->find(fvalue);
+    if (iter2 != filterVals->end()) {
+        if (iter2->second.type == f->type) {
+            // substitute filter value
+            return iter2->second.svalue;
+        } else {
+            throw Error("filter value type mismatch: %s given but %s expected",
+                        iter2->second.type.c_str(), f->type.c_str());
+        }
+    }
+
+    return fvalue;
+}
+
+
+void BulkRuleParser::parseFilterValue(filterValList_t *filterVals, const string &value,
+                                      filter_t *f)
+{
+    int n;
+
+    if (value == "*") {
+        f->mtype = FT_WILD;
+        f->cnt = 1;
+    } else if ((n = value.find("-")) > 0) {
+        f->mtype = FT_RANGE;
+        f->value[0] = FilterValue(f->type, lookup(filterVals, value.substr(0,n),f));
+        f->value[1] = FilterValue(f->type, lookup(filterVals, value.substr(n+1),f));
+        f->cnt = 2;
+    } else if ((n = value.find(",")) > 0) {
+        int lastn = 0;
+        int c = 0;
+
+        f->mtype = FT_SET;
+        while (((n = value.find(",", lastn)) > 0) && (c<(MAX_FILTER_SET_SIZE-1))) {
+            f->value[c] = FilterValue(f->type, lookup(filterVals, value.substr(lastn, n-lastn),f));
+            c++;
+            lastn = n+1;
+        }
+        f->value[c] = FilterValue(f->type, lookup(filterVals, value.substr(lastn, n-lastn),f));
+        f->cnt = c+1;
+        if ((n > 0) && (f->cnt == MAX_FILTER_SET_SIZE)) {
+            throw Error("more than %d filters specified in set", MAX_FILTER_SET_SIZE);
+        }
+    } else {
+        f->mtype = FT_EXACT;
+        f->value[0] = FilterValue(f->type, lookup(filterVals, value,f));
+        f->cnt = 1;
+    }
+}
+
+
+void BulkRuleParser::parseFilter(filterDefList_t *filterDefs, filterValList_t *filterVals,
+                                 filter_t &f)
+{
+    filterDefListIter_t iter, iter2;
+    string fvalue, mask;
+
+    getStr(f.name);
+    getStr(fvalue);
+    getStr(mask);
+
+    if (f.name.empty()) {
+        throw Error("Bulk Rule Parser Error: missing filter name at offset %d", pos);
+    }
+    if (fvalue.empty()) {
+        throw Error("Bulk Rule Parser Error: missing value for filter %s", f.name.c_str());
+    }
+
+    // use lower case internally
+    transform(f.name.begin(), f.name.end(), f.name.begin(), ToLower());
+
+    // lookup in filter definitions list
+    iter = filterDefs->find(f.name);
+    if (iter == filterDefs->end()) {
+        throw Error("Bulk Rule Parser Error: no filter definition found: %s", f.name.c_str());
+    }
+
+    // set according to definition
+    f.offs = iter->second.offs;
+    f.refer = iter->second.refer;
+    f.len = iter->second.len;
+    f.type = iter->second.type;
+    f.fdmask = iter->second.mask;
+    f.fdshift = iter->second.shift;
+
+    // lookup reverse attribute
+    if (!iter->second.rname.empty()) {
+        f.rname = iter->second.rname;
+        iter2 = filterDefs->find(f.rname);
+        if (iter2 != filterDefs->end()) {
+            f.roffs = iter2->second.offs;
+            f.rrefer = iter2->second.refer;
+        }
+    }
+
+    try {
+        parseFilterValue(filterVals, fvalue, &f);
+    } catch (Error &e) {
+        throw Error("Bulk Rule Parser Error: filter value parse error for %s: %s",
+                    f.name.c_str(), e.getError().c_str());
+    }
+
+    try {
+        if (mask.empty() || (mask == "0xFF")) {
+            // the default mask only depends on the filter definition
+            map<string, FilterValue>::iterator m = defMasks.find(f.name);
+            if (m == defMasks.end()) {
+                if (f.type == "IPAddr") {
+                    mask = DEF_MASK_IP;
+                } else if (f.type == "IP6Addr") {
+                    mask = DEF_MASK_IP6;
+                } else {
+                    // make default mask as wide as data
+                    mask = "0x" + string(2*f.len, 'F');
+                }
+                m = defMasks.insert(make_pair(f.name, FilterValue(f.type, mask))).first;
+            }
+            f.mask = m->second;
+        } else {
+            f.mask = FilterValue(f.type, mask);
+        }
+    } catch (Error &e) {
+        throw Error("Bulk Rule Parser Error: mask parse error for %s: %s",
+                    f.name.c_str(), e.getError().c_str());
+    }
+}
+
+
+void BulkRuleParser::parse(filterDefList_t *filterDefs,
+						   filterValList_t *filterVals,
+						   ruleDB_t *rules,
+						   RuleIdSource *idSource )
+{
+    string sname, rname;
+    time_t now = time(NULL);
+    unsigned int i, j, n, m;
+    int nrules = 0;
+
+    if ((len < (int) sizeof(BULK_RULE_MAGIC)) ||
+        (memcmp(buf, BULK_RULE_MAGIC, sizeof(BULK_RULE_MAGIC) - 1) != 0)) {
+        throw Error("Bulk Rule Parser Error: not a bulk rule buffer");
+    }
+    if (buf[sizeof(BULK_RULE_MAGIC) - 1] != BULK_RULE_VERSION) {
+        throw Error("Bulk Rule Parser Error: unsupported version %d",
+                    buf[sizeof(BULK_RULE_MAGIC) - 1]);
+    }
+    pos = sizeof(BULK_RULE_MAGIC);
+
+    while (pos < len) {
+        filterList_t filters;
+        actionList_t actions;
+        miscList_t miscs;
+
+        ruleEnd = len;
+        n = getU32();
+        if (n > (unsigned int) (len - pos)) {
+            throw Error("Bulk Rule Parser Error: truncated rule %d", nrules);
+        }
+        ruleEnd = pos + n;
+
+        getStr(sname);
+        getStr(rname);
+
+        // filters
+        n = getU8();
+        for (i = 0; i < n; i++) {
+            filters.push_back(filter_t());
+            parseFilter(filterDefs, filterVals, filters.back());
+        }
+
+        // actions
+        n = getU8();
+        for (i = 0; i < n; i++) {
+            action_t a;
+
+            getStr(a.name);
+            if (a.name.empty()) {
+                throw Error("Bulk Rule Parser Error: missing action name in rule %s",
+                            rname.c_str());
+            }
+
+            m = getU8();
+            for (j = 0; j < m; j++) {
+                configItem_t item;
+                getPref(item);
+                a.conf.push_back(item);
+            }
+
+            actions.push_back(a);
+        }
+
+        // rule preferences
+        n = getU8();
+        for (i = 0; i < n; i++) {
+            configItem_t item;
+            getPref(item);
+            miscs[item.name] = item;
+        }
+
+        if (pos != ruleEnd) {
+            throw Error("Bulk Rule Parser Error: length mismatch in rule %s", rname.c_str());
+        }
+
+        // add rule
+        try {
+            unsigned short uid = idSource->newId();
+            Rule *r = new Rule((int) uid, now, sname, rname, filters, actions, miscs);
+            rules->push_back(r);
+        } catch (Error &e) {
+            log->elog(ch, e);
+            throw e;
+        }
+
+        nrules++;
+    }
+
+#ifdef DEBUG
+    log->dlog(ch, "%d rules parsed", nrules);
+#endif
+}
+
+
+void BulkRuleParser::putStr(string &out, const string &s)
+{
+    putInt(out, s.length(), 2);
+    out += s;
+}
+
+
+void BulkRuleParser::putInt(string &out, unsigned int val, int bytes)
+{
+    for (int i = bytes - 1; i >= 0; i--) {
+        out += (char) ((val >> (8 * i)) & 0xff);
+    }
+}
@@ -225,6 +225,44 @@ configParam_t *ConfigManager::getParamList( configItemList_t &list )
     return params;
 }
 
+
+configParam_t *ConfigManager::getParamList( configItemList_t &list, const paramBlock_t *block )
+{
+    configParam_t *params = getParamList(list);
+
+    if (block != NULL) {
+        params[list.size()].value = (char *) new paramBlock_t(*block);
+    }
+
+    return params;
+}
+
+
+/* -------------------- freeParamList -------------------- */
+
+void ConfigManager::freeParamList( configParam_t *&params )
+{
+    configParam_t *p = params;
+
+    if (params == NULL) {
+        return;
+    }
+
+    while (p->name != NULL) {
+        saveDeleteArr(p->name);
+        saveDeleteArr(p->value);
+        p++;
+    }
+
+    // the terminator holds the compiled block, if any
+    if (p->value != NULL) {
+        delete (paramBlock_t *) p->value;
+    }
+
+    delete [] params;
+    params = NULL;
+}
+
 configParam_t * ConfigManager::mergeParamList( configParam_t *list_a, configParam_t *list_b )
 {
 	int size_a = 0;
@@ -31,17 +31,30 @@ $Id: CtrlComm.cpp 748 2015-03-05 18:08:00 amarentes $
 #include "CtrlComm.h"
 #include "QualityManager.h"
 #include "Rule.h"
+#include "ParserFcts.h"
 #include "constants.h"
 
 
 CtrlComm *CtrlComm::s_instance = NULL;
 
 
+//! get a limit from the CONTROL config group, 0 if not configured
+static int getLimit(ConfigManager *cnf, string name)
+{
+    string txt = cnf->getValue(name, "CONTROL");
+
+    if (txt.empty()) {
+        return 0;
+    }
+    return ParserFcts::parseInt(txt, 1, 1048576);
+}
+
+
 /* ------------------------- CtrlComm ------------------------- */
 
 CtrlComm::CtrlComm(ConfigManager *cnf, int threaded)
     : QualityManagerComponent(cnf, "CtrlComm",threaded),
-      portnum(0), flags(0)
+      portnum(0), flags(0), nextJob(1), jobKeepTime(JOB_KEEP_TIME)
 {
     int ret;
 
@@ -73,6 +86,30 @@ CtrlComm::CtrlComm(ConfigManager *cnf, int threaded)
     httpd_register_log_error    (s_log_error);
     httpd_register_parse_request(s_parse_request);
 
+    // connection limits, <= 0 keeps the httpd defaults
+    httpd_set_limits(getLimit(cnf, "MaxConnections"),
+                     getLimit(cnf, "MaxConnectionsPerPeer"),
+                     getLimit(cnf, "ListenBacklog"),
+                     getLimit(cnf, "KeepAliveTime"),
+                     getLimit(cnf, "NetTimeout"));
+
+    // parked /task_status requests are answered from the keepalive timer,
+    // at the latest two intervals before the network timeout
+    if (httpd_get_timeout() - 2 * httpd_get_keepalive() <= 0) {
+        log->wlog(ch, "NetTimeout (%d s) is not more than twice KeepAliveTime (%d s), "
+                  "/task_status cannot wait for jobs", httpd_get_timeout(),
+                  httpd_get_keepalive());
+    }
+
+    if (getLimit(cnf, "JobKeepTime") > 0) {
+        jobKeepTime = getLimit(cnf, "JobKeepTime");
+    }
+
+    // tls cipher preferences and session resumption, unset keeps the defaults
+    httpd_set_ssl_params(cnf->getValue("SSLCiphers", "CONTROL").c_str(),
+                         getLimit(cnf, "SSLSessionCacheSize"),
+                         getLimit(cnf, "SSLSessionTimeout"));
+
     // init server
 #ifdef USE_SSL
     ret = httpd_init(portnum, "NetQoS",
@@ -102,12 +139,14 @@ CtrlComm::CtrlComm(ConfigManager *cnf, int threaded)
     }
 
     // load html/xsl files
-    pcache.addPageFile("/",             MAIN_PAGE_FILE );
-    pcache.addPageFile("/help",         MAIN_PAGE_FILE );
-    pcache.addPageFile("/xsl/reply.xsl", XSL_PAGE_FILE );
+    const char *mainMime = get_mime((char *) MAIN_PAGE_FILE.c_str());
+    pcache.addPageFile("/",             MAIN_PAGE_FILE, mainMime );
+    pcache.addPageFile("/help",         MAIN_PAGE_FILE, mainMime );
+    pcache.addPageFile("/xsl/reply.xsl", XSL_PAGE_FILE,
+                       get_mime((char *) XSL_PAGE_FILE.c_str()) );
 
     // load reply template
-    string line;
+    string line, rtemplate;
     ifstream in(REPLY_TEMPLATE.c_str());
 
     if (!in) {
@@ -119,6 +158,8 @@ CtrlComm::CtrlComm(ConfigManager *cnf, int threaded)
         rtemplate += "\n";
     }
 
+    splitTemplate(rtemplate);
+
 }
 
 
@@ -327,32 +368,170 @@ string CtrlComm::xmlQuote(string s)
 }
 
 
-void CtrlComm::sendMsg(string msg, struct REQUEST *req, fd_sets_t *fds, int quote)
+void CtrlComm::splitTemplate(string &tmpl)
 {
-    string rep = rtemplate;
+    const string fields[] = { "@STATUS@", "@MESSAGE@" };
+    const int types[] = { RT_STATUS, RT_MESSAGE };
+    string::size_type pos = 0;
+    int found = 0;
+
+    rsegments.clear();
+
+    while (pos < tmpl.length()) {
+        string::size_type next = string::npos;
+        int f = -1;
+
+        for (int i = 0; i < 2; i++) {
+            string::size_type p = tmpl.find(fields[i], pos);
+            if (p < next) {
+                next = p;
+                f = i;
+            }
+        }
 
-    rep.replace(rep.find("@STATUS@"), strlen("@STATUS@"), "OK");
-    rep.replace(rep.find("@MESSAGE@"), strlen("@MESSAGE@"), (quote) ? xmlQuote(msg) : msg);
+        replySegment_t seg;
+        seg.type = RT_TEXT;
+        seg.text = tmpl.substr(pos, next - pos);
+        if (!seg.text.empty()) {
+            rsegments.push_back(seg);
+        }
+        if (f < 0) {
+            break;
+        }
 
-    log->dlog(ch, "send Msg: %s", rep.c_str());
+        seg.type = types[f];
+        seg.text = "";
+        rsegments.push_back(seg);
+        found |= 1 << f;
+        pos = next + fields[f].length();
+    }
 
-    req->body = strdup(rep.c_str());
-    req->mime = "text/xml";
-    httpd_send_response(req, fds);
+    if (found != 3) {
+        throw Error("reply template '%s' lacks @STATUS@ or @MESSAGE@",
+                    REPLY_TEMPLATE.c_str());
+    }
 }
 
 
-void CtrlComm::sendErrMsg(string msg, struct REQUEST *req, fd_sets_t *fds)
+int CtrlComm::buildReply(struct iovec *iov, int max, const char *status,
+                         const string &msg, int quote)
 {
-    string rep = rtemplate;
+    vector<replySegment_t>::iterator iter;
+    int n = 0;
+
+    for (iter = rsegments.begin(); iter != rsegments.end(); iter++) {
+        if (iter->type == RT_TEXT) {
+            if (n == max) {
+                return -1;
+            }
+            iov[n].iov_base = (void *) iter->text.data();
+            iov[n++].iov_len = iter->text.length();
+        } else if (iter->type == RT_STATUS) {
+            if (n == max) {
+                return -1;
+            }
+            iov[n].iov_base = (void *) status;
+            iov[n++].iov_len = strlen(status);
+        } else {
+            const char *p = msg.data();
+            const char *end = p + msg.length();
+            const char *run = p;
+
+            // runs of plain text are sent from msg, quoted characters
+            // from constant entities
+            for (; quote && p < end; p++) {
+                const char *ent;
+
+                switch (*p) {
+                case '<':
+                    ent = "&lt;";
+                    break;
+                case '>':
+                    ent = "&gt;";
+                    break;
+                case '&':
+                    ent = "&amp;";
+                    break;
+                default:
+                    continue;
+                }
+
+                if (n + 2 > max) {
+                    return -1;
+                }
+                if (p > run) {
+                    iov[n].iov_base = (void *) run;
+                    iov[n++].iov_len = p - run;
+                }
+                iov[n].iov_base = (void *) ent;
+                iov[n++].iov_len = strlen(ent);
+                run = p + 1;
+            }
+
+            if (end > run) {
+                if (n == max) {
+                    return -1;
+                }
+                iov[n].iov_base = (void *) run;
+                iov[n++].iov_len = end - run;
+            }
+        }
+    }
+
+    return n;
+}
+
+
+string CtrlComm::buildReply(const char *status, const string &msg, int quote)
+{
+    vector<replySegment_t>::iterator iter;
+    string rep;
+
+    for (iter = rsegments.begin(); iter != rsegments.end(); iter++) {
+        if (iter->type == RT_TEXT) {
+            rep += iter->text;
+        } else if (iter->type == RT_STATUS) {
+            rep += status;
+        } else {
+            rep += (quote) ? xmlQuote(msg) : msg;
+        }
+    }
+
+    return rep;
+}
+
+
+void CtrlComm::sendMsg(const string &msg, struct REQUEST *req, fd_sets_t *fds, int quote)
+{
+    struct iovec iov[HTTPD_MAX_IOV];
+    int n;
+
+    log->dlog(ch, "send Msg: %s", msg.c_str());
+
+    req->mime = (char *) "text/xml";
 
-    rep.replace(rep.find("@STATUS@"), strlen("@STATUS@"), "Error");
-    rep.replace(rep.find("@MESSAGE@"), strlen("@MESSAGE@"), xmlQuote(msg));
+    // the reply is written straight from the template and msg, only
+    // messages with many quoted characters go through a copy
+    n = buildReply(iov, HTTPD_MAX_IOV, "OK", msg, quote);
+    if (n >= 0) {
+        httpd_send_response_iov(req, iov, n, fds);
+    } else {
+        req->body = strdup(buildReply("OK", msg, quote).c_str());
+        httpd_send_response(req, fds);
+    }
+}
+
+
+void CtrlComm::sendErrMsg(const string &msg, struct REQUEST *req, fd_sets_t *fds)
+{
+    string rep = buildReply("Error", msg, 1);
 
 	log->dlog(ch, "send Error Msg: %s", rep.c_str());
 
+    // errors are never cached
+    req->etag[0] = 0;
     req->body = strdup(rep.c_str());
-    req->mime = "text/xml";
+    req->mime = (char *) "text/xml";
     if (fds != NULL) {
         httpd_send_response(req, fds);
     } else {
@@ -361,9 +540,194 @@ void CtrlComm::sendErrMsg(string msg, struct REQUEST *req, fd_sets_t *fds)
 }
 
 
+void CtrlComm::sendMsg(const string &msg, CtrlCommEvent *e, fd_sets_t *fds, int quote)
+{
+    if (e->getJob() != 0) {
+        finishJob(e->getJob(), JOB_DONE, msg, fds);
+    } else {
+        sendMsg(msg, e->getReq(), fds, quote);
+    }
+}
+
+
+void CtrlComm::sendErrMsg(const string &msg, CtrlCommEvent *e, fd_sets_t *fds)
+{
+    if (e->getJob() != 0) {
+        finishJob(e->getJob(), JOB_FAILED, msg, fds);
+    } else {
+        sendErrMsg(msg, e->getReq(), fds);
+    }
+}
+
+
+//! If-None-Match holds '*' or a list of entity tags, weak tags match as well
+static int matchETag(const char *list, const string &etag)
+{
+    const char *p = list, *e;
+
+    while (*p != 0) {
+        while ((*p == ' ') || (*p == ',')) {
+            p++;
+        }
+        if (strncmp(p, "W/", 2) == 0) {
+            p += 2;
+        }
+        for (e = p; (*e != 0) && (*e != ',') && (*e != ' '); e++);
+
+        if (((e - p == 1) && (*p == '*')) ||
+            (etag.compare(0, string::npos, p, e - p) == 0)) {
+            return 1;
+        }
+        p = e;
+    }
+
+    return 0;
+}
+
+
+int CtrlComm::checkETag(struct REQUEST *req, const string &etag, fd_sets_t *fds)
+{
+    if (etag.length() >= sizeof(req->etag)) {
+        return 0;
+    }
+
+    if ((req->if_none_match != NULL) && matchETag(req->if_none_match, etag)) {
+        log->dlog(ch, "not modified: %s", etag.c_str());
+
+        strcpy(req->etag, etag.c_str());
+        req->body = strdup("");
+        req->mime = (char *) "text/xml";
+        httpd_send_status_response(req, 304, fds);
+        return 1;
+    }
+
+    strcpy(req->etag, etag.c_str());
+    return 0;
+}
+
+
+void CtrlComm::sendPage(const page_t *page, struct REQUEST *req)
+{
+    int gz = req->accept_gzip && !page->gzipped.empty();
+    const string &body = gz ? page->gzipped : page->content;
+    const string &etag = gz ? page->gzEtag : page->etag;
+
+    req->mime = (char *) page->mime;
+    // generate Expires header
+    req->lifespan = EXPIRY_TIME;
+    req->encoding = gz ? "gzip" : NULL;
+    req->vary_encoding = !page->gzipped.empty();
+    strcpy(req->etag, etag.c_str());
+
+    // immediatly send response
+    if ((req->if_none_match != NULL) && matchETag(req->if_none_match, etag)) {
+        httpd_send_static_response(req, 304, "", 0);
+    } else {
+        httpd_send_static_response(req, 200, body.data(), body.length());
+    }
+}
+
+
+/* -------------------- jobs -------------------- */
+
+int CtrlComm::isAsync(parseReq_t *preq)
+{
+    paramListIter_t async = preq->params.find("Async");
+
+    if (async == preq->params.end()) {
+        return 0;
+    }
+    return ParserFcts::parseBool(async->second);
+}
+
+
+unsigned long CtrlComm::acceptJob(struct REQUEST *req)
+{
+    unsigned long id = nextJob++;
+    job_t &job = jobs[id];
+    char txt[32];
+
+    job.state = JOB_QUEUED;
+    job.finished = 0;
+
+    log->dlog(ch, "accepted job %lu", id);
+
+    // the request is done here, the result is fetched with /task_status
+    sprintf(txt, "%lu", id);
+    req->body = strdup(buildReply("Accepted", txt, 0).c_str());
+    req->mime = (char *) "text/xml";
+    httpd_send_status_response(req, 202, NULL);
+
+    return id;
+}
+
+
+void CtrlComm::sendJobStatus(unsigned long id, job_t &job, struct REQUEST *req,
+                             fd_sets_t *fds)
+{
+    const char *status[] = { "Queued", "OK", "Error" };
+
+    log->dlog(ch, "send status of job %lu: %s", id, status[job.state]);
+
+    req->body = strdup(buildReply(status[job.state],
+                                  (job.state == JOB_QUEUED) ? "queued" : job.msg, 1).c_str());
+    req->mime = (char *) "text/xml";
+    httpd_send_response(req, fds);
+}
+
+
+void CtrlComm::finishJob(unsigned long id, int state, const string &msg, fd_sets_t *fds)
+{
+    jobListIter_t iter = jobs.find(id);
+    list<jobWaiter_t> waiters;
+
+    if (iter == jobs.end()) {
+        return;
+    }
+
+    iter->second.state = state;
+    iter->second.msg = msg;
+    iter->second.finished = time(NULL);
+
+    // answering a waiter may parse the next request on its connection
+    waiters.swap(iter->second.waiters);
+    for (list<jobWaiter_t>::iterator w = waiters.begin(); w != waiters.end(); w++) {
+        sendJobStatus(id, iter->second, w->req, fds);
+    }
+}
+
+
+void CtrlComm::checkJobs(fd_sets_t *fds)
+{
+    time_t now = time(NULL);
+    jobListIter_t iter = jobs.begin();
+
+    while (iter != jobs.end()) {
+        job_t &job = iter->second;
+        list<jobWaiter_t>::iterator w = job.waiters.begin();
+
+        while (w != job.waiters.end()) {
+            if (now >= w->deadline) {
+                struct REQUEST *req = w->req;
+                w = job.waiters.erase(w);
+                sendJobStatus(iter->first, job, req, fds);
+            } else {
+                w++;
+            }
+        }
+
+        if ((job.state != JOB_QUEUED) && (now > job.finished + jobKeepTime)) {
+            jobs.erase(iter++);
+        } else {
+            iter++;
+        }
+    }
+}
+
+
 /* -------------------- handleFDEvent -------------------- */
 
-int CtrlComm::handleFDEvent(eventVec_t *e, fd_set *rset, fd_set *wset, fd_sets_t *fds)
+int CtrlComm::handleFDEvent(eventVec_t *e, fd_t *ready, int nready, fd_sets_t *fds)
 {
     assert(e != NULL);
 
@@ -372,12 +736,22 @@ int CtrlComm::handleFDEvent(eventVec_t *e, fd_set *rset, fd_set *wset, fd_sets_t
     retEvent = NULL;
 
 
-    // check for incoming message
-    int http_handle = httpd_handle_event(rset, wset, fds);
+    // without ready descriptors only the connection timeouts are checked,
+    // parked /task_status requests are answered before the httpd would
+    // time them out
+    if (ready == NULL) {
+        checkJobs(fds);
+        if (httpd_handle_event(NULL, fds) < 0) {
+            throw Error("ctrlcomm handle event error");
+        }
+    }
 
-    if (http_handle < 0) {
-		throw Error("ctrlcomm handle event error");
-	}
+    // check for incoming message
+    for (int i = 0; i < nready; i++) {
+        if (httpd_handle_event(&ready[i], fds) < 0) {
+            throw Error("ctrlcomm handle event error");
+        }
+    }
 
 
     // processCmd callback funtion is called in case of new request
@@ -394,6 +768,7 @@ parseReq_t CtrlComm::parseRequest(struct REQUEST *req)
     parseReq_t preq;
 
     preq.comm = req->path;
+    preq.req = req;
 
     log->dlog(ch, "parsing request");
 
@@ -401,7 +776,6 @@ parseReq_t CtrlComm::parseRequest(struct REQUEST *req)
     struct strlist *hdr = req->header;
     while (hdr) {
         string l = hdr->line;
-        cout << l << endl;
         int p = l.find(":");
         if (p > 0) {
             preq.params[l.substr(0,p)] = l.substr(p+1, l.length());
@@ -414,10 +788,8 @@ parseReq_t CtrlComm::parseRequest(struct REQUEST *req)
     // parse URL parameters
     if (req->query != NULL) {
         string q = req->query;
-        cout << q << endl;
         int p1 = 0, p2 = q.length(), p3 = 0;
         while((p2 = q.find("&",p1)) > 0) {
-            cerr << p2 << endl;
             p3 = q.find("=",p1);
             if (p3 > 0) {
                 preq.params[q.substr(p1,p3-p1)] = q.substr(p3+1, p2-p3-1);
@@ -434,25 +806,25 @@ parseReq_t CtrlComm::parseRequest(struct REQUEST *req)
 
     log->dlog(ch, "parsing post parameters in body");
 
-    // parse POST parameters in body
-    if (req->lbreq != 0) {
-        string q = req->post_body;
-        cout << q << endl;
-
-        int p1 = 0, p2 = q.length(), p3 = 0;
-        while((p2 = q.find("&",p1)) > 0) {
-            p3 = q.find("=",p1);
-            if (p3 > 0) {
-                preq.params[q.substr(p1,p3-p1)] = q.substr(p3+1, p2-p3-1);
+    // the httpd has split and decoded the body into name\0value\0 pairs
+    // (binary bodies are left to the command)
+    if ((req->post_body != NULL) && !req->body_raw) {
+        char *p = req->post_body;
+        char *end = req->post_body + req->lpost;
+
+        while (p < end) {
+            bodyParam_t val;
+            string name = p;
+
+            val.value = p + name.length() + 1;
+            val.len = strlen(val.value);
+            preq.body[name] = val;
+            if (val.len <= MAX_COPIED_PARAM) {
+                preq.params[name] = string(val.value, val.len);
             }
 
-            p1 = p2+1;
+            p = val.value + val.len + 1;
         }
-        p3 = q.find("=",p1);
-        if (p3 > 0) {
-            preq.params[q.substr(p1,p3-p1)] = q.substr(p3+1, p2-p3-1);
-        }
-
     }
 
     for (paramListIter_t iter=preq.params.begin(); iter != preq.params.end(); iter++) {
@@ -466,55 +838,62 @@ parseReq_t CtrlComm::parseRequest(struct REQUEST *req)
 int CtrlComm::processCmd(struct REQUEST *req)
 {
     parseReq_t preq;
+    int async = 0;
 
 #ifdef PROFILING
     unsigned long long ini, end;
 #endif
 
+    // several requests can be handled within one handleFDEvent
+    retEvent = NULL;
+
 #ifdef PROFILING
     ini = PerfTimer::readTSC();
 #endif
 
-    log->dlog(ch, "client requested cmd:%s Params: %s Body:%s",
-						req->path, req->query, req->post_body);
+    log->dlog(ch, "client requested cmd:%s Params: %s Body: %d bytes",
+						req->path, req->query, req->lpost);
 
     if (isEnabled(LOG_COMMAND)) {
-        log->log(ch, "client requested cmd: '%s' and params '%s%s'", req->path, req->query,
-                 req->post_body);
+        log->log(ch, "client requested cmd: '%s' and params '%s' (body %d bytes)",
+                 req->path, req->query, req->lpost);
     }
 
     if ((req->path == NULL) || (strlen(req->path) == 0)) {
         return -1;
     }
 
-    preq = parseRequest(req);
+    // try lookup in repository of static meter pages, they are answered
+    // before the request is parsed and without copying the page
+    const page_t *page = pcache.getPage(req->path);
 
-    // try lookup in repository of static meter pages
-    string page = pcache.getPage(preq.comm);
+    if (page != NULL) {
+        sendPage(page, req);
+        return 0;
+    }
 
+    preq = parseRequest(req);
 
     try {
 
-        log->dlog(ch, "Command:%s Page:%s", (preq.comm).c_str(), page.c_str() );
+        log->dlog(ch, "Command:%s", (preq.comm).c_str() );
 
-        if (page != "") {
-            // send page
-            req->body = strdup(page.c_str());  // FIXME not very performant
-            req->mime = get_mime((char *) pcache.getFileName(preq.comm).c_str());
-            // generate Expires header
-            req->lifespan = EXPIRY_TIME;
-            // immediatly send response
-            httpd_send_immediate_response(req);
-
-            // FIXME  better register those callback funtions onto the command name
-        } else if (preq.comm == "/get_info") {
+        // FIXME  better register those callback funtions onto the command name
+        if (preq.comm == "/get_info") {
             processGetInfo(&preq);
         } else if (preq.comm == "/get_modinfo") {
             processGetModInfo(&preq);
         } else if (preq.comm == "/add_task") {
+            async = isAsync(&preq);
             processAddTask(&preq);
+        } else if (preq.comm == "/add_tasks_bulk") {
+            async = isAsync(&preq);
+            processAddTasksBulk(&preq);
         } else if (preq.comm == "/rm_task") {
+            async = isAsync(&preq);
             processDelTask(&preq);
+        } else if (preq.comm == "/task_status") {
+            processTaskStatus(&preq);
         } else {
             // unknown command will produce a 404 http error
             return -1;
@@ -532,7 +911,12 @@ int CtrlComm::processCmd(struct REQUEST *req)
 
     if (retEvent != NULL)
     {
-        retEvent->setReq(req);
+        if (async) {
+            // answered with the job id now, the result goes to the job
+            retEvent->setJob(acceptJob(req));
+        } else {
+            retEvent->setReq(req);
+        }
         retEventVec->push_back(retEvent);
         log->dlog(ch, "New Event Control Command");
     }
@@ -545,15 +929,26 @@ int CtrlComm::processCmd(struct REQUEST *req)
 
 char *CtrlComm::processAddTask(parseReq_t *preq)
 {
-    paramListIter_t rule = preq->params.find("Rule");
+    bodyParamListIter_t body = preq->body.find("Rule");
 
-    log->dlog(ch, "starting processAddTask rule:%s", rule->second.c_str());
+    if (body != preq->body.end()) {
+        log->dlog(ch, "starting processAddTask rule: %d bytes", body->second.len);
 
-    if (rule == preq->params.end()) {
-        throw Error("add_task: missing parameter 'Rule'" );
-    }
+        // the event takes over the request body, the rules are parsed in place
+        retEvent = new AddRulesCtrlEvent(preq->req->post_body, body->second.value,
+                                         body->second.len, 0);
+        preq->req->post_body = NULL;
+    } else {
+        paramListIter_t rule = preq->params.find("Rule");
+
+        if (rule == preq->params.end()) {
+            throw Error("add_task: missing parameter 'Rule'" );
+        }
 
-    retEvent = new AddRulesCtrlEvent((char *) rule->second.c_str(), rule->second.size(), 0);
+        log->dlog(ch, "starting processAddTask rule:%s", rule->second.c_str());
+
+        retEvent = new AddRulesCtrlEvent((char *) rule->second.c_str(), rule->second.size(), 0);
+    }
 
     log->dlog(ch, "ending processAddTask");
 
@@ -561,6 +956,27 @@ char *CtrlComm::processAddTask(parseReq_t *preq)
 }
 
 
+/* ------------------------- processAddTasksBulk ------------------------- */
+
+char *CtrlComm::processAddTasksBulk(parseReq_t *preq)
+{
+    struct REQUEST *req = preq->req;
+
+    if (!req->body_raw || (req->post_body == NULL)) {
+        throw Error("add_tasks_bulk: expecting an application/octet-stream body");
+    }
+
+    log->dlog(ch, "starting processAddTasksBulk: %d bytes", req->lpost);
+
+    // the event takes over the request body, no copy
+    retEvent = new AddRulesCtrlEvent(req->post_body, req->post_body, req->lpost,
+                                     ADD_RULES_BULK);
+    req->post_body = NULL;
+
+    return NULL;
+}
+
+
 /* ------------------------- processDelTaskCmd ------------------------- */
 
 char *CtrlComm::processDelTask(parseReq_t *preq )
@@ -577,6 +993,44 @@ char *CtrlComm::processDelTask(parseReq_t *preq )
 }
 
 
+/* ------------------------- processTaskStatus ------------------------- */
+
+char *CtrlComm::processTaskStatus(parseReq_t *preq )
+{
+    paramListIter_t id = preq->params.find("job");
+    paramListIter_t wait = preq->params.find("wait");
+    int secs = 0;
+
+    if (id == preq->params.end()) {
+        throw Error("task_status: missing parameter 'job'" );
+    }
+
+    jobListIter_t job = jobs.find(ParserFcts::parseULong(id->second));
+    if (job == jobs.end()) {
+        throw Error("task_status: unknown job %s", id->second.c_str());
+    }
+
+    if (wait != preq->params.end()) {
+        secs = ParserFcts::parseInt(wait->second, 0, 3600);
+        // the waits are checked every keepalive interval and need to be
+        // answered before the httpd network timeout closes the connection
+        secs = min(secs, httpd_get_timeout() - 2 * httpd_get_keepalive());
+    }
+
+    if ((job->second.state == JOB_QUEUED) && (secs > 0)) {
+        // long-poll: answered by finishJob or checkJobs
+        jobWaiter_t w;
+        w.req = preq->req;
+        w.deadline = time(NULL) + secs;
+        job->second.waiters.push_back(w);
+    } else {
+        sendJobStatus(job->first, job->second, preq->req, NULL);
+    }
+
+    return NULL;
+}
+
+
 /* ------------------------- processGetInfo ------------------------- */
 
 char *CtrlComm::processGetInfo( parseReq_t *preq )
@@ -585,15 +1039,21 @@ char *CtrlComm::processGetInfo( parseReq_t *preq )
 
     paramListIter_t type = preq->params.find("IType");
     paramListIter_t param = preq->params.find("IParam");
+    paramListIter_t limit = preq->params.find("ILimit");
+    int n = 0;
 
     if (type == preq->params.end()) {
         throw Error("get_info: missing parameter 'IType'" );
     }
 
+    if (limit != preq->params.end()) {
+        n = ParserFcts::parseInt(limit->second, 1, 1048576);
+    }
+
     if (param == preq->params.end()) {
-        infos.addInfo(type->second);
+        infos.addInfo(type->second, "", n);
     } else {
-        infos.addInfo(type->second, param->second);
+        infos.addInfo(type->second, param->second, n);
     }
 
     retEvent = new GetInfoEvent(infos.getList());
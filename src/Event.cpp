@@ -33,8 +33,12 @@
 #include "QualityManager.h"
 
 
+eventAllocStats_t eventAllocStats = { 0, 0, 0, 0, 0, 0 };
+
+
 Event::Event(event_t typ, unsigned long ival, int align, eventState_t state, Event *parent)
-    : type(typ), interval(ival), state(state), parent(parent)
+    : type(typ), interval(ival), state(state), parent(parent),
+      wheelNext(NULL), wheelPrev(NULL), wheelList(NULL)
 {
     Timeval::gettimeofdayown(&when, NULL);
 
@@ -46,7 +50,8 @@ Event::Event(event_t typ, unsigned long ival, int align, eventState_t state, Eve
 
 Event::Event(event_t typ, time_t offs_sec, time_t offs_usec,
               unsigned long ival, int align, eventState_t state, Event *parent)
-    : type(typ), interval(ival), state(state), parent(parent)
+    : type(typ), interval(ival), state(state), parent(parent),
+      wheelNext(NULL), wheelPrev(NULL), wheelList(NULL)
 {
     Timeval::gettimeofdayown(&when, NULL);
 
@@ -61,7 +66,8 @@ Event::Event(event_t typ, time_t offs_sec, time_t offs_usec,
 
 Event::Event(event_t typ, struct timeval time, unsigned long ival,
 	     int align, eventState_t state, Event *parent)
-    : type(typ), when(time), interval(ival), state(state), parent(parent)
+    : type(typ), when(time), interval(ival), state(state), parent(parent),
+      wheelNext(NULL), wheelPrev(NULL), wheelList(NULL)
 {
 
     if (align) {
@@ -27,7 +27,6 @@
 
 #include "Error.h"
 #include "EventScheduler.h"
-#include "QualityManager.h"
 #include "Timeval.h"
 
 
@@ -41,9 +40,345 @@
 const int MIN_TIMEOUT = 10000;
 
 
+/* ------------------------- TimingWheel ------------------------- */
+
+TimingWheel::TimingWheel(unsigned long long now)
+  : current(now), pending(0), due(0)
+{
+    memset(root, 0, sizeof(root));
+    memset(levels, 0, sizeof(levels));
+    memset(rootMap, 0, sizeof(rootMap));
+    memset(levelMap, 0, sizeof(levelMap));
+    overflow.head = overflow.tail = NULL;
+    ready.head = ready.tail = NULL;
+}
+
+
+unsigned long long TimingWheel::toTick(struct timeval tv)
+{
+    unsigned long long us = (unsigned long long) tv.tv_sec * 1000000ULL + tv.tv_usec;
+
+    return (us + WHEEL_TICK_USEC - 1) / WHEEL_TICK_USEC;
+}
+
+
+void TimingWheel::append(wheelList_t *l, Event *ev)
+{
+    ev->wheelList = l;
+    ev->wheelNext = NULL;
+    ev->wheelPrev = l->tail;
+
+    if (l->tail != NULL) {
+        l->tail->wheelNext = ev;
+    } else {
+        l->head = ev;
+    }
+    l->tail = ev;
+}
+
+
+void TimingWheel::unlink(Event *ev)
+{
+    wheelList_t *l = ev->wheelList;
+
+    if (ev->wheelPrev != NULL) {
+        ev->wheelPrev->wheelNext = ev->wheelNext;
+    } else {
+        l->head = ev->wheelNext;
+    }
+    if (ev->wheelNext != NULL) {
+        ev->wheelNext->wheelPrev = ev->wheelPrev;
+    } else {
+        l->tail = ev->wheelPrev;
+    }
+
+    ev->wheelNext = ev->wheelPrev = NULL;
+    ev->wheelList = NULL;
+
+    if (l == &ready) {
+        due--;
+        return;
+    }
+
+    pending--;
+
+    // keep the occupancy bitmaps in sync
+    if (l->head == NULL) {
+        if ((l >= root) && (l < root + WHEEL_ROOT_SIZE)) {
+            int idx = l - root;
+            rootMap[idx >> 6] &= ~(1ULL << (idx & 63));
+        } else if (l != &overflow) {
+            int lvl = (l - &levels[0][0]) / WHEEL_LEVEL_SIZE;
+            int idx = (l - &levels[0][0]) % WHEEL_LEVEL_SIZE;
+            levelMap[lvl] &= ~(1ULL << idx);
+        }
+    }
+}
+
+
+void TimingWheel::place(Event *ev)
+{
+    unsigned long long t = toTick(ev->getTime());
+    unsigned long long d;
+    int lvl;
+
+    if (t < current) {
+        append(&ready, ev);
+        due++;
+        return;
+    }
+
+    pending++;
+    d = t - current;
+
+    if (d < (unsigned long long) WHEEL_ROOT_SIZE) {
+        int idx = t & (WHEEL_ROOT_SIZE - 1);
+        append(&root[idx], ev);
+        rootMap[idx >> 6] |= (1ULL << (idx & 63));
+        return;
+    }
+
+    for (lvl = 0; lvl < WHEEL_LEVELS; lvl++) {
+        int shift = WHEEL_ROOT_BITS + (lvl + 1) * WHEEL_LEVEL_BITS;
+
+        if (d < (1ULL << shift)) {
+            int idx = (t >> (shift - WHEEL_LEVEL_BITS)) & (WHEEL_LEVEL_SIZE - 1);
+            append(&levels[lvl][idx], ev);
+            levelMap[lvl] |= (1ULL << idx);
+            return;
+        }
+    }
+
+    append(&overflow, ev);
+}
+
+
+void TimingWheel::refile(wheelList_t *l)
+{
+    Event *ev = l->head;
+
+    l->head = l->tail = NULL;
+
+    while (ev != NULL) {
+        Event *next = ev->wheelNext;
+        pending--;
+        place(ev);
+        ev = next;
+    }
+}
+
+
+int TimingWheel::cascade(int lvl)
+{
+    int shift = WHEEL_ROOT_BITS + lvl * WHEEL_LEVEL_BITS;
+    int idx = (current >> shift) & (WHEEL_LEVEL_SIZE - 1);
+
+    if (levelMap[lvl] & (1ULL << idx)) {
+        levelMap[lvl] &= ~(1ULL << idx);
+        refile(&levels[lvl][idx]);
+    }
+
+    return idx;
+}
+
+
+void TimingWheel::processTick()
+{
+    int idx = current & (WHEEL_ROOT_SIZE - 1);
+
+    if (idx == 0) {
+        int lvl = 0;
+        while ((lvl < WHEEL_LEVELS) && (cascade(lvl) == 0)) {
+            lvl++;
+        }
+        if ((lvl == WHEEL_LEVELS) && (overflow.head != NULL)) {
+            refile(&overflow);
+        }
+    }
+
+    if (rootMap[idx >> 6] & (1ULL << (idx & 63))) {
+        wheelList_t *l = &root[idx];
+        Event *ev;
+
+        for (ev = l->head; ev != NULL; ev = ev->wheelNext) {
+            ev->wheelList = &ready;
+            pending--;
+            due++;
+        }
+
+        // splice the slot onto the ready list
+        if (ready.tail != NULL) {
+            ready.tail->wheelNext = l->head;
+            l->head->wheelPrev = ready.tail;
+        } else {
+            ready.head = l->head;
+        }
+        ready.tail = l->tail;
+
+        l->head = l->tail = NULL;
+        rootMap[idx >> 6] &= ~(1ULL << (idx & 63));
+    }
+
+    current++;
+}
+
+
+/*! returns the distance from bit start to the next bit set in map,
+    searching circularly over 64 bits, or -1 if map is empty
+*/
+static inline int nextSetBit(uint64_t map, int start)
+{
+    uint64_t rot;
+
+    if (map == 0) {
+        return -1;
+    }
+    rot = (start == 0) ? map : ((map >> start) | (map << (64 - start)));
+    return __builtin_ctzll(rot);
+}
+
+
+unsigned long long TimingWheel::nextBound()
+{
+    unsigned long long bound = WHEEL_NO_TICK;
+    int i, lvl;
+
+    if (pending == 0) {
+        return bound;
+    }
+
+    // inner level: first occupied slot from current on
+    int idx = current & (WHEEL_ROOT_SIZE - 1);
+    int word = idx >> 6;
+    int bit = idx & 63;
+    for (i = 0; i <= WHEEL_ROOT_SIZE / 64; i++) {
+        int w = (word + i) % (WHEEL_ROOT_SIZE / 64);
+        uint64_t map = rootMap[w];
+
+        if (i == 0) {
+            map &= (~0ULL << bit);
+        } else if (i == WHEEL_ROOT_SIZE / 64) {
+            map &= (bit > 0) ? ((1ULL << bit) - 1) : 0;
+        }
+        if (map != 0) {
+            int slot = (w << 6) + __builtin_ctzll(map);
+            bound = current + ((slot - idx) & (WHEEL_ROOT_SIZE - 1));
+            break;
+        }
+    }
+
+    // outer levels: tick at which the nearest occupied slot gets cascaded
+    for (lvl = 0; lvl < WHEEL_LEVELS; lvl++) {
+        int shift = WHEEL_ROOT_BITS + lvl * WHEEL_LEVEL_BITS;
+        int cur = (current >> shift) & (WHEEL_LEVEL_SIZE - 1);
+        int aligned = ((current & ((1ULL << shift) - 1)) == 0);
+
+        // the slot at cur is only still due if current sits on its boundary
+        int start = aligned ? cur : ((cur + 1) & (WHEEL_LEVEL_SIZE - 1));
+        int delta = nextSetBit(levelMap[lvl], start);
+
+        if (delta >= 0) {
+            unsigned long long at;
+
+            delta += aligned ? 0 : 1;
+            at = ((current >> shift) + delta) << shift;
+            if (at < bound) {
+                bound = at;
+            }
+        }
+    }
+
+    // overflow: next wrap of the outermost level
+    if (overflow.head != NULL) {
+        int shift = WHEEL_ROOT_BITS + WHEEL_LEVELS * WHEEL_LEVEL_BITS;
+        unsigned long long at = current;
+
+        if (current & ((1ULL << shift) - 1)) {
+            at = ((current >> shift) + 1) << shift;
+        }
+        if (at < bound) {
+            bound = at;
+        }
+    }
+
+    return bound;
+}
+
+
+void TimingWheel::add(Event *ev)
+{
+    place(ev);
+}
+
+
+void TimingWheel::remove(Event *ev)
+{
+    if (ev->wheelList != NULL) {
+        unlink(ev);
+    }
+}
+
+
+void TimingWheel::advance(unsigned long long target)
+{
+    while (current <= target) {
+        // skip ticks without work
+        unsigned long long bound = nextBound();
+
+        if (bound > target) {
+            current = target + 1;
+            break;
+        }
+
+        current = bound;
+        processTick();
+    }
+}
+
+
+Event *TimingWheel::popReady()
+{
+    Event *ev = ready.head;
+
+    if (ev != NULL) {
+        unlink(ev);
+    }
+    return ev;
+}
+
+
+void TimingWheel::getEvents(vector<Event*> &out)
+{
+    Event *ev;
+    int i, lvl;
+
+    out.reserve(out.size() + size());
+
+    for (ev = ready.head; ev != NULL; ev = ev->wheelNext) {
+        out.push_back(ev);
+    }
+    for (i = 0; i < WHEEL_ROOT_SIZE; i++) {
+        for (ev = root[i].head; ev != NULL; ev = ev->wheelNext) {
+            out.push_back(ev);
+        }
+    }
+    for (lvl = 0; lvl < WHEEL_LEVELS; lvl++) {
+        for (i = 0; i < WHEEL_LEVEL_SIZE; i++) {
+            for (ev = levels[lvl][i].head; ev != NULL; ev = ev->wheelNext) {
+                out.push_back(ev);
+            }
+        }
+    }
+    for (ev = overflow.head; ev != NULL; ev = ev->wheelNext) {
+        out.push_back(ev);
+    }
+}
+
+
 /* ------------------------- EventScheduler ------------------------- */
 
-EventScheduler::EventScheduler()
+EventScheduler::EventScheduler(int useWheel)
+  : wheel(NULL)
 {
 
     log = Logger::getInstance();
@@ -51,6 +386,22 @@ EventScheduler::EventScheduler()
 #ifdef DEBUG
     log->dlog(ch, "Starting");
 #endif
+
+    if (useWheel) {
+        wheel = new TimingWheel(nowTick());
+        log->log(ch, "using timing wheel with %d us ticks", WHEEL_TICK_USEC);
+    }
+}
+
+
+unsigned long long EventScheduler::nowTick()
+{
+    struct timeval now;
+
+    Timeval::gettimeofdayown(&now, NULL);
+
+    // round down so that an event never becomes due early
+    return ((unsigned long long) now.tv_sec * 1000000ULL + now.tv_usec) / WHEEL_TICK_USEC;
 }
 
 
@@ -68,6 +419,75 @@ EventScheduler::~EventScheduler()
     for (iter = events.begin(); iter != events.end(); iter++) {
         saveDelete(iter->second);
     }
+
+    if (wheel != NULL) {
+        vector<Event*> evs;
+        vector<Event*>::iterator i;
+
+        wheel->getEvents(evs);
+        for (i = evs.begin(); i != evs.end(); i++) {
+            wheel->remove(*i);
+            saveDelete(*i);
+        }
+        saveDelete(wheel);
+    }
+}
+
+
+/* ------------------------- indexEvent ------------------------- */
+
+void EventScheduler::indexEvent(Event *ev)
+{
+    vector<int> uids;
+    vector<int>::iterator i;
+
+    ev->getRuleUIds(uids);
+    for (i = uids.begin(); i != uids.end(); i++) {
+        ruleIndex[*i].insert(ev);
+    }
+}
+
+
+void EventScheduler::unindexEvent(Event *ev)
+{
+    vector<int> uids;
+    vector<int>::iterator i;
+
+    ev->getRuleUIds(uids);
+    for (i = uids.begin(); i != uids.end(); i++) {
+        ruleEventIndexIter_t iter = ruleIndex.find(*i);
+        if (iter != ruleIndex.end()) {
+            iter->second.erase(ev);
+            if (iter->second.empty()) {
+                ruleIndex.erase(iter);
+            }
+        }
+    }
+}
+
+
+void EventScheduler::unlinkEvent(Event *ev)
+{
+    if (wheel != NULL) {
+        wheel->remove(ev);
+    } else {
+        pair<eventListIter_t, eventListIter_t> range = events.equal_range(ev->getTime());
+        eventListIter_t iter;
+
+        for (iter = range.first; iter != range.second; iter++) {
+            if (iter->second == ev) {
+                events.erase(iter);
+                break;
+            }
+        }
+    }
+}
+
+
+void EventScheduler::reindexEvent(Event *ev)
+{
+    // the sets of the uids it had before keep it, the new ones get it
+    indexEvent(ev);
 }
 
 
@@ -80,40 +500,78 @@ void EventScheduler::addEvent(Event *ev)
     log->dlog(ch,"new event %s", eventNames[ev->getType()].c_str());
 #endif
 
-    events.insert(make_pair(ev->getTime(),ev));
+    if (wheel != NULL) {
+        wheel->add(ev);
+    } else {
+        events.insert(make_pair(ev->getTime(),ev));
+    }
+
+    indexEvent(ev);
 }
 
 
-/*! deleting is costly but it should occur much less than exporting
-    data or flow timeouts assuming the lifetimes of rules are reasonably large
+/*! only the events that reference the rule are visited, via the rule index
 */
 void EventScheduler::delRuleEvents(int uid)
 {
     int ret = 0;
-    eventListIter_t iter, tmp;
+    ruleEventIndexIter_t found = ruleIndex.find(uid);
+
+    if (found == ruleIndex.end()) {
+        return;
+    }
+
+    // the rule is gone from all its events afterwards
+    eventSet_t evs;
+    evs.swap(found->second);
+    ruleIndex.erase(found);
 
-    // search linearly through list for rule with given ID and delete entries
-    iter = events.begin();
-    while (iter != events.end()) {
-        tmp = iter;
-        iter++;
+    for (eventSetIter_t iter = evs.begin(); iter != evs.end(); iter++) {
+        Event *ev = *iter;
 
-        ret = tmp->second->deleteRule(uid);
+        ret = ev->deleteRule(uid);
         if (ret == 1) {
             // ret = 1 means rule was present in event but other rules are still in
             // the event
 #ifdef DEBUG
             log->dlog(ch,"remove rule %d from event %s", uid,
-                      eventNames[tmp->second->getType()].c_str());
+                      eventNames[ev->getType()].c_str());
 #endif
         } else if (ret == 2) {
             // ret=2 means the event is now empty and therefore can be deleted
 #ifdef DEBUG
-            log->dlog(ch,"remove event %s", eventNames[tmp->second->getType()].c_str());
+            log->dlog(ch,"remove event %s", eventNames[ev->getType()].c_str());
 #endif
+            unindexEvent(ev);
+            unlinkEvent(ev);
+            saveDelete(ev);
+        }
+    }
+}
 
-            saveDelete(tmp->second);
-            events.erase(tmp);
+
+void EventScheduler::delRuleEvents(const ruleUIdSet_t &uids)
+{
+    eventSet_t evs;
+
+    for (ruleUIdSet_t::const_iterator i = uids.begin(); i != uids.end(); i++) {
+        ruleEventIndexIter_t found = ruleIndex.find(*i);
+
+        if (found != ruleIndex.end()) {
+            evs.insert(found->second.begin(), found->second.end());
+            ruleIndex.erase(found);
+        }
+    }
+
+    for (eventSetIter_t iter = evs.begin(); iter != evs.end(); iter++) {
+        Event *ev = *iter;
+
+        if (ev->deleteRules(uids) == 2) {
+#ifdef DEBUG
+            log->dlog(ch,"remove event %s", eventNames[ev->getType()].c_str());
+#endif
+            unlinkEvent(ev);
+            saveDelete(ev);
         }
     }
 }
@@ -123,10 +581,29 @@ Event *EventScheduler::getNextEvent()
 {
     Event *ev;
 
+    if (wheel != NULL) {
+        unsigned long long bound;
+
+        // ready events are always older than the ones still in the slots
+        if (!wheel->hasReady()) {
+            wheel->advance(nowTick());
+        }
+        // like the event list, hand out the earliest event even if not yet due
+        while (!wheel->hasReady() && ((bound = wheel->nextBound()) != WHEEL_NO_TICK)) {
+            wheel->advance(bound);
+        }
+        ev = wheel->popReady();
+        if (ev != NULL) {
+            unindexEvent(ev);
+        }
+        return ev;
+    }
+
     if (events.begin() != events.end()) {
         ev = events.begin()->second;
         // dequeue event
         events.erase(events.begin());
+        unindexEvent(ev);
         // the receiver is responsible for
         // returning or freeing the event
         return ev;
@@ -140,6 +617,14 @@ void EventScheduler::reschedNextEvent(Event *ev)
 {
     assert(ev != NULL);
 
+    if (ev->getState() == EV_PROCESSING) {
+        // owned by its pending child event, resumed by the response
+#ifdef DEBUG
+        log->dlog(ch,"park event %s", eventNames[ev->getType()].c_str());
+#endif
+        return;
+    }
+
     if (ev->getIval() > 0) {
 
 #ifdef DEBUG
@@ -158,7 +643,7 @@ void EventScheduler::reschedNextEvent(Event *ev)
 #endif
 
         // and requeue it
-        events.insert(make_pair(ev->getTime(),ev));
+        addEvent(ev);
     } else {
 #ifdef DEBUG
         log->dlog(ch,"remove event %s", eventNames[ev->getType()].c_str());
@@ -168,25 +653,89 @@ void EventScheduler::reschedNextEvent(Event *ev)
 }
 
 
+/* -------------------- resumeEvent -------------------- */
+
+void EventScheduler::resumeEvent(Event *ev)
+{
+    assert(ev != NULL);
+
+    // the work the event waited for is done, there is nothing to requeue
+    ev->setState(EV_DONE);
+    ev->setInterval(0);
+    reschedNextEvent(ev);
+}
+
+
 struct timeval EventScheduler::getNextEventTime()
 {
     struct timeval rv = {0, MIN_TIMEOUT};
-    struct timeval now;
-    char c = 'A';
+    struct timeval now, expiry;
+
+    if (getNextEventExpiry(&expiry)) {
+        Timeval::gettimeofdayown(&now, NULL);
+        rv = Timeval::sub0(expiry, now);
+    }
+    return rv;
+}
+
 
-    if (events.begin() != events.end())
-    {
-        Event *ev = events.begin()->second;
-		Timeval::gettimeofdayown(&now, NULL);
+int EventScheduler::getNextEventExpiry(struct timeval *tv)
+{
+    if (wheel != NULL) {
+        unsigned long long bound;
+
+        if (wheel->hasReady()) {
+            // due already, any time in the past will do
+            tv->tv_sec = 0;
+            tv->tv_usec = 1;
+            return 1;
+        }
 
-        rv = Timeval::sub0(ev->getTime(), now);
-        // be 100us fuzzy
-        if ((rv.tv_sec == 0) && (rv.tv_usec<100)) {
-            log->log(ch,"expired event %s", eventNames[ev->getType()].c_str());
-            write(QualityManager::s_sigpipe[1], &c, 1);
+        // events can only become due at a tick boundary
+        bound = wheel->nextBound();
+        if (bound == WHEEL_NO_TICK) {
+            return 0;
         }
+        bound *= WHEEL_TICK_USEC;
+        tv->tv_sec = bound / 1000000;
+        tv->tv_usec = bound % 1000000;
+        return 1;
     }
-    return rv;
+
+    if (events.begin() == events.end()) {
+        return 0;
+    }
+
+    *tv = events.begin()->first;
+    return 1;
+}
+
+
+Event *EventScheduler::getNextDueEvent(struct timeval now)
+{
+    Event *ev;
+
+    if (wheel != NULL) {
+        if (!wheel->hasReady()) {
+            wheel->advance(((unsigned long long) now.tv_sec * 1000000ULL + now.tv_usec) / WHEEL_TICK_USEC);
+        }
+        ev = wheel->popReady();
+    } else {
+        if ((events.begin() == events.end()) ||
+            (Timeval::cmp(events.begin()->first, now) > 0)) {
+            return NULL;
+        }
+        ev = events.begin()->second;
+        events.erase(events.begin());
+    }
+
+    if (ev != NULL) {
+        unindexEvent(ev);
+#ifdef DEBUG
+        log->dlog(ch,"expired event %s", eventNames[ev->getType()].c_str());
+#endif
+    }
+    return ev;
 }
 
 
@@ -201,6 +750,23 @@ void EventScheduler::dump(ostream &os)
 
     os << "EventScheduler dump : \n";
 
+    if (wheel != NULL) {
+        vector<Event*> evs;
+        multimap<struct timeval, Event*, lttv> sorted;
+        vector<Event*>::iterator i;
+
+        wheel->getEvents(evs);
+        for (i = evs.begin(); i != evs.end(); i++) {
+            sorted.insert(make_pair((*i)->getTime(), *i));
+        }
+        for (iter = sorted.begin(); iter != sorted.end(); iter++) {
+            struct timeval rv = Timeval::sub0(iter->first, now);
+            os << "at t = " << rv.tv_sec * 1e6 + rv.tv_usec << " -> "
+               << eventNames[iter->second->getType()] << endl;
+        }
+        return;
+    }
+
     // output all scheduled Events to ostream
     for (iter = events.begin(); iter != events.end(); iter++) {
         struct timeval rv = Timeval::sub0(iter->first, now);
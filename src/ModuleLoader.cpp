@@ -258,6 +258,11 @@ Module *ModuleLoader::loadModule( string libname, int preload )
         
         s_log->log(ch, "loaded %s module '%s'",
 		   module->getModuleType().c_str(), libname.c_str());
+
+        ProcModule *pmod = dynamic_cast<ProcModule*>(module);
+        if ((pmod != NULL) && pmod->hasBatchSetup()) {
+            s_log->log(ch, "module '%s' supports batch flow setup", libname.c_str());
+        }
         
         return module;
         
@@ -29,9 +29,71 @@
 
 #include "Error.h"
 #include "PageRepository.h"
+#include <zlib.h>
 
 
-void PageRepository::addPageFile( string url, string fname )
+//! hash of the page content used as entity tag
+static string hashTag( const string &data, const char *suffix )
+{
+    unsigned long long h = 14695981039346656037ULL;
+    char tag[40];
+
+    // FNV-1a
+    for (string::const_iterator i = data.begin(); i != data.end(); i++) {
+        h = (h ^ (unsigned char) *i) * 1099511628211ULL;
+    }
+
+    sprintf(tag, "\"%016llx%s\"", h, suffix);
+    return tag;
+}
+
+
+void PageRepository::encodePage( page_t &page )
+{
+    z_stream z;
+    string out;
+
+    page.etag = hashTag(page.content, "");
+    page.gzipped = "";
+    page.gzEtag = "";
+
+    memset(&z, 0, sizeof(z));
+    // windowBits 15 + 16 writes a gzip header
+    if (deflateInit2(&z, Z_BEST_COMPRESSION, Z_DEFLATED, 15 + 16, 8,
+                     Z_DEFAULT_STRATEGY) != Z_OK) {
+        return;
+    }
+
+    out.resize(deflateBound(&z, page.content.length()));
+    z.next_in = (Bytef *) page.content.data();
+    z.avail_in = page.content.length();
+    z.next_out = (Bytef *) &out[0];
+    z.avail_out = out.length();
+
+    if (deflate(&z, Z_FINISH) == Z_STREAM_END) {
+        out.resize(z.total_out);
+        // small pages do not get smaller
+        if (out.length() < page.content.length()) {
+            page.gzipped = out;
+            page.gzEtag = hashTag(page.content, "-gz");
+        }
+    }
+
+    deflateEnd(&z);
+}
+
+
+void PageRepository::addPage( string url, string content, const char *mime )
+{
+    page_t &page = pages[url];
+
+    page.content = content;
+    page.mime = mime;
+    encodePage(page);
+}
+
+
+void PageRepository::addPageFile( string url, string fname, const char *mime )
 {
     string line;
     string content;
@@ -46,30 +108,18 @@ void PageRepository::addPageFile( string url, string fname )
         content += "\n";
     }
 
-    addPage(url, content);
+    addPage(url, content, mime);
 
-    fileNames[url] = fname;
+    pages[url].fileName = fname;
 }
 
 
-string PageRepository::getPage( string url )
+string PageRepository::getFileName( string url )
 {
     repositoryIter_t iter = pages.find(url);
     
     if (iter != pages.end()) {
-        return iter->second;
-    } else {
-        return "";
-    }
-}
-
-
-string PageRepository::getFileName( string url )
-{
-    repositoryIter_t iter = fileNames.find(url);
-    
-    if (iter != fileNames.end()) {
-        return iter->second;
+        return iter->second.fileName;
     } else {
         return "";
     }
@@ -61,7 +61,8 @@ string ProcModule::INFOLABEL[] =
 
 ProcModule::ProcModule( ConfigManager *_cnf, string libname, string libfile, 
                         libHandle_t libhandle, string confgroup ) :
-    Module( libname, libfile, libhandle ), confgroup(confgroup), cnf(_cnf)
+    Module( libname, libfile, libhandle ), confgroup(confgroup), cnf(_cnf),
+    batchSetup(0), validateSetup(0)
 {    
     if (s_log == NULL ) {
         s_log = Logger::getInstance();
@@ -73,6 +74,18 @@ ProcModule::ProcModule( ConfigManager *_cnf, string libname, string libfile,
     checkMagic(PROC_MAGIC);
 
     funcList = (ProcModuleInterface_t *) loadAPI( "func" );
+
+    // older modules do not even have the batch function slots
+    if ((funcList->version >= PROC_BATCH_VERSION) &&
+        (funcList->initFlowSetupBatch != NULL) &&
+        (funcList->destroyFlowSetupBatch != NULL)) {
+        batchSetup = 1;
+    }
+
+    if ((funcList->version >= PROC_VALIDATE_VERSION) &&
+        (funcList->validateFlowSetup != NULL)) {
+        validateSetup = 1;
+    }
  
 	setOwnName(libname); // TODO (change): read ownName from module properties XML file
 
@@ -242,6 +255,8 @@ string ProcModule::typeLabel( int i )
 void ProcModule::dump( ostream &os )
 {
     Module::dump(os);
+    os << "batch flow setup: " << (batchSetup ? "yes" : "no") << endl;
+    os << "flow validation: " << (validateSetup ? "yes" : "no") << endl;
 }
 
 
@@ -29,6 +29,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <sys/eventfd.h>
+#include <poll.h>
 
 
 #include "ProcError.h"
@@ -38,48 +40,342 @@
 #include "QualityManager.h"
 
 
-ppaction_t& ppaction_t::operator=( ppaction_t const& rhs)
+//! serialise the calls into the modules of a shard
+#ifdef ENABLE_THREADS
+#define SHARDLOCK(threaded, shard)    autoLock _shardLock((threaded), &((shard)->lock));
+#else
+#define SHARDLOCK(threaded, shard)    // empty
+#endif
+
+
+/* ------------------------- ruleActions_t ------------------------- */
+
+ruleActions_t::ruleActions_t()
+  : lastPkt(0), packets(0), bytes(0), numActions(0), auto_flows(0),
+    bidir(0), seppaths(0), rule(NULL), gen(0)
+{
+}
+
+
+ppaction_t *ruleActions_t::getAction( int actId )
+{
+    if ((actId < 1) || (actId > numActions) || (actions[actId - 1].module == NULL)) {
+        return NULL;
+    }
+
+    return &actions[actId - 1];
+}
+
+
+void ruleActions_t::setAction( int actId, ppaction_t &a )
+{
+    if ((actId < 1) || (actId > MAX_RULE_ACTIONS)) {
+        throw Error("rule has too many actions (maximum is %d)", MAX_RULE_ACTIONS);
+    }
+
+    actions[actId - 1] = a;
+
+    if (actId > numActions) {
+        numActions = actId;
+    }
+}
+
+
+/* ------------------------- RuleActionTable ------------------------- */
+
+ruleActions_t *RuleActionTable::find( int uid )
+{
+    if ((uid < 0) || (uid >= (int) slots.size()) || !slots[uid].used) {
+        return NULL;
+    }
+
+    return &slots[uid].entry;
+}
+
+
+unsigned int RuleActionTable::nextGeneration( int uid )
+{
+    if ((uid < 0) || (uid >= (int) slots.size())) {
+        return 1;
+    }
+
+    return slots[uid].gen + 1;
+}
+
+
+void RuleActionTable::skipGeneration( int uid )
+{
+    if (uid < 0) {
+        return;
+    }
+
+    if (uid >= (int) slots.size()) {
+        slots.resize(uid + 1);
+    }
+
+    if (!slots[uid].used) {
+        slots[uid].gen++;
+    }
+}
+
+
+ruleActions_t *RuleActionTable::insert( int uid, ruleActions_t &entry )
+{
+    if (uid < 0) {
+        throw Error("invalid rule uid %d", uid);
+    }
+
+    if (uid >= (int) slots.size()) {
+        slots.resize(uid + 1);
+    }
+
+    slot_t &slot = slots[uid];
+
+    if (slot.used) {
+        throw Error("rule uid %d is already in use", uid);
+    }
+
+    slot.used = 1;
+    slot.gen++;
+    slot.entry = entry;
+    slot.entry.gen = slot.gen;
+    count++;
+
+    return &slot.entry;
+}
+
+
+int RuleActionTable::erase( int uid, ruleActions_t *out )
+{
+    ruleActions_t *entry = find(uid);
+
+    if (entry == NULL) {
+        return 0;
+    }
+
+    if (out != NULL) {
+        *out = *entry;
+    }
+
+    slots[uid].used = 0;
+    slots[uid].entry = ruleActions_t();
+    count--;
+
+    return 1;
+}
+
+
+void RuleActionTable::getUIds( vector<int> &uids )
+{
+    for (unsigned int i = 0; i < slots.size(); i++) {
+        if (slots[i].used) {
+            uids.push_back(i);
+        }
+    }
+}
+
+
+/* ------------------------- ProcTimerWheel ------------------------- */
+
+ProcTimerWheel::ProcTimerWheel( unsigned long long now )
+  : slots(PROC_TIMER_SLOTS), slotMin(PROC_TIMER_SLOTS), current(toTick(now)), count(0)
+{
+    memset(used, 0, sizeof(used));
+}
+
+
+void ProcTimerWheel::add( procTimer_t &t, unsigned long ival, unsigned long long now )
 {
+    // round up, a timer never fires early
+    t.expiry = toTick(now + ival * 1000ULL + PROC_TIMER_TICK_MSEC * 1000ULL - 1);
+    if (t.expiry <= current) {
+        t.expiry = current + 1;
+    }
 
-	cout << "ppaction Operator=" << endl;
+    int idx = t.expiry % PROC_TIMER_SLOTS;
 
-	module = rhs.module;
-	mapi = rhs.mapi;
-	flowData = rhs.flowData;
-	params = rhs.params;
-	flowid = rhs.flowid;
+    if (!(used[idx >> 6] & (1ULL << (idx & 63)))) {
+        used[idx >> 6] |= (1ULL << (idx & 63));
+        slotMin[idx] = t.expiry;
+    } else if (t.expiry < slotMin[idx]) {
+        slotMin[idx] = t.expiry;
+    }
 
-	return *this;
+    slots[idx].push_back(t);
+    count++;
 }
 
 
-ruleActions_t& ruleActions_t::operator=( ruleActions_t const& rhs)
+int ProcTimerWheel::expire( unsigned long long now, procTimerList_t &expired )
 {
+    unsigned long long target = toTick(now);
+    unsigned long long ticks;
+    int n = 0;
+
+    if ((target <= current) || (count == 0)) {
+        current = (target > current) ? target : current;
+        return 0;
+    }
+
+    // each slot has to be visited once at most
+    ticks = target - current;
+    if (ticks > (unsigned long long) PROC_TIMER_SLOTS) {
+        ticks = PROC_TIMER_SLOTS;
+    }
+
+    for (unsigned long long t = current + 1; t <= current + ticks; t++) {
+        int idx = t % PROC_TIMER_SLOTS;
+        procTimerList_t &slot = slots[idx];
+        unsigned int keep = 0;
 
-	cout << "ruleActions Operator=" << endl;
+        if (!(used[idx >> 6] & (1ULL << (idx & 63)))) {
+            continue;
+        }
+
+        slotMin[idx] = ~0ULL;
+        for (unsigned int i = 0; i < slot.size(); i++) {
+            if (slot[i].expiry <= target) {
+                expired.push_back(slot[i]);
+                n++;
+            } else {
+                if (slot[i].expiry < slotMin[idx]) {
+                    slotMin[idx] = slot[i].expiry;
+                }
+                slot[keep++] = slot[i];
+            }
+        }
+        slot.resize(keep);
+
+        if (keep == 0) {
+            used[idx >> 6] &= ~(1ULL << (idx & 63));
+        }
+    }
 
-	lastPkt = rhs.lastPkt;
-	packets = rhs.packets;
-	auto_flows = rhs.auto_flows;
-	bidir = rhs.bidir;
-	seppaths = rhs.seppaths;
-	rule = rhs.rule;
-	actions = rhs.actions;
-	return *this;
+    current = target;
+    count -= n;
+
+    return n;
+}
+
+
+int ProcTimerWheel::nextTimeout( unsigned long long now )
+{
+    const int words = PROC_TIMER_SLOTS / 64;
+    unsigned long long nowTick = toTick(now);
+    unsigned long long next = ~0ULL;
+    int start = (current + 1) % PROC_TIMER_SLOTS;
+    int found = 0;
+
+    if (count == 0) {
+        return -1;
+    }
+
+    /* visit the occupied slots in tick order from current + 1 on: the
+       first slot whose earliest timer falls into this revolution holds
+       the next timer, otherwise the earliest of all slots does */
+    for (int i = 0; (i <= words) && !found; i++) {
+        int w = ((start >> 6) + i) % words;
+        uint64_t map = used[w];
+
+        if (i == 0) {
+            map &= (~0ULL << (start & 63));
+        } else if (i == words) {
+            map &= (start & 63) ? ((1ULL << (start & 63)) - 1) : 0;
+        }
+
+        while (map != 0) {
+            int idx = (w << 6) + __builtin_ctzll(map);
+            unsigned long long t = current + 1 +
+                ((idx - start + PROC_TIMER_SLOTS) % PROC_TIMER_SLOTS);
+
+            if (slotMin[idx] < next) {
+                next = slotMin[idx];
+            }
+            if (slotMin[idx] == t) {
+                found = 1;
+                break;
+            }
+            map &= map - 1;
+        }
+    }
+
+    // t has already started
+    if (next <= nowTick) {
+        return 0;
+    }
+    return (int) ((next - nowTick) * PROC_TIMER_TICK_MSEC);
 }
 
 
 /* ------------------------- QoSProcessor ------------------------- */
 
 QOSProcessor::QOSProcessor(ConfigManager *cnf, int threaded, string moduleDir )
-    : QualityManagerComponent(cnf, "QOS_PROCESSOR", threaded), numRules(0), idSource(0)
+    : QualityManagerComponent(cnf, "QOS_PROCESSOR", threaded), numRules(0), idSource(0),
+      out_events(NULL)
 {
     string txt;
+    unsigned long qsize = DEF_EVENT_QUEUE_SIZE;
+    int nshards = 1;
 
 #ifdef DEBUG
     log->dlog(ch,"Starting");
 #endif
 
+    txt = cnf->getValue("EventQueueSize", "QOS_PROCESSOR");
+    if (txt != "") {
+        qsize = ParserFcts::parseULong(txt, 1, 1048576);
+    }
+
+    // number of workers, only meaningful when running threaded
+    txt = cnf->getValue("Threads", "QOS_PROCESSOR");
+    if ((txt != "") && threaded) {
+        nshards = ParserFcts::parseInt(txt, 1, MAX_PROC_SHARDS);
+    }
+
+    out_events = new BoundedQueue<Event *>(qsize);
+
+#ifdef ENABLE_THREADS
+    if (threaded) {
+        threadCondInit(&outCond);
+    }
+#endif
+
+    for (int i = 0; i < nshards; i++) {
+        procShard_t *shard = new procShard_t;
+
+        shard->id = i;
+        shard->queue = new BoundedQueue<Event *>(qsize);
+        shard->wakeFd = -1;
+        shard->signalTime = 0;
+        memset(&shard->wstats, 0, sizeof(shard->wstats));
+        shard->processed = 0;
+        shard->timers = NULL;
+        shard->expired = 0;
+        shard->proc = this;
+        shards.push_back(shard);
+
+#ifdef ENABLE_THREADS
+        shard->running = 0;
+        shard->stopping = 0;
+        mutexInit(&shard->lock);
+
+        if (threaded) {
+            // the worker sleeps on this descriptor until addEvent signals it
+            shard->wakeFd = eventfd(0, 0);
+            if (shard->wakeFd < 0) {
+                throw Error("cannot create QoS processor wakeup descriptor: %s", strerror(errno));
+            }
+
+            // the worker expires the timers of its flows itself
+            struct timeval now;
+            Timeval::gettimeofdayown(&now, NULL);
+            shard->timers = new ProcTimerWheel(now.tv_sec * 1000000ULL + now.tv_usec);
+        }
+#endif
+    }
+
+    log->log(ch, "QoS processor running with %d worker(s)", nshards);
+
     if (moduleDir.empty()) {
 		txt = cnf->getValue("ModuleDir", "QOS_PROCESSOR");
         if ( txt != "") {
@@ -100,6 +396,17 @@ QOSProcessor::QOSProcessor(ConfigManager *cnf, int threaded, string moduleDir )
     } catch (Error &e) {
         throw e;
     }
+
+    // spread the modules loaded at start up over the worker locks
+    if (nshards > 1) {
+        vector<string> mods;
+        loader->getModuleNames(mods);
+
+        for (unsigned int i = 0; i < mods.size(); i++) {
+            moduleShards[mods[i]] = i % nshards;
+            log->log(ch, "module %s assigned to worker %d", mods[i].c_str(), i % nshards);
+        }
+    }
 }
 
 
@@ -110,23 +417,24 @@ QOSProcessor::~QOSProcessor()
 
     log->dlog(ch,"Shutdown");
 
+    // the workers must not touch the rules while they are destroyed
+    stop();
+
     // destroy Flow setups for all rules
 
     log->dlog(ch, "Active rules:%d", (int) rules.size());
 
-    ruleActionListIter_t it = rules.begin();
-    while ( it != rules.end())
+    vector<int> uids;
+    rules.getUIds(uids);
+
+    for (vector<int>::iterator it = uids.begin(); it != uids.end(); it++)
     {
-        Rule *r = NULL;
-        r = (it->second).rule;
+        Rule *r = rules.find(*it)->rule;
 
         if (r == NULL){
-			log->dlog(ch, "ruleId:%d with Null rule", it->first ) ;
-            it++;
+			log->dlog(ch, "ruleId:%d with Null rule", *it ) ;
         }
 		else{
-            // To avoid making the iterator invalid, we increase it before deleting.
-            ++it;
 			delRule(r);
         }
     }
@@ -134,90 +442,302 @@ QOSProcessor::~QOSProcessor()
     // discard the Module Loader
     saveDelete(loader);
 
+    // discard events nobody collected
+    Event *evt;
+    for (procShardListIter_t i = shards.begin(); i != shards.end(); i++) {
+        procShard_t *shard = *i;
+
+        while (shard->queue->pop(evt)) {
+            saveDelete(evt);
+        }
+        saveDelete(shard->queue);
+        saveDelete(shard->timers);
+
+        if (shard->wakeFd >= 0) {
+            close(shard->wakeFd);
+        }
+#ifdef ENABLE_THREADS
+        mutexDestroy(&shard->lock);
+#endif
+        saveDelete(shard);
+    }
+    shards.clear();
+
+    while (out_events->pop(evt)) {
+        saveDelete(evt);
+    }
+    saveDelete(out_events);
+
+    for (eventVecIter_t i = outSpill.begin(); i != outSpill.end(); i++) {
+        saveDelete(*i);
+    }
+
+#ifdef ENABLE_THREADS
+    if (threaded) {
+        threadCondDestroy(&outCond);
+    }
+#endif
+
     log->dlog(ch,"End Shutdown");
 
 }
 
 
+/* ------------------------- getModuleShard ------------------------- */
+
+// FNV-1a
+static inline unsigned int shardHash(const string &s)
+{
+    unsigned int h = 2166136261U;
+
+    for (string::const_iterator i = s.begin(); i != s.end(); i++) {
+        h = (h ^ (unsigned char) *i) * 16777619U;
+    }
+    return h;
+}
+
+
+/*! moduleShards is only written in the constructor, modules loaded
+    later are placed by the hash of their name
+*/
+procShard_t *QOSProcessor::getModuleShard(const string &modname)
+{
+    if (shards.size() == 1) {
+        return shards[0];
+    }
+
+    moduleShardListIter_t i = moduleShards.find(modname);
+    if (i != moduleShards.end()) {
+        return shards[i->second];
+    }
+
+    return shards[shardHash(modname) % shards.size()];
+}
+
+
+/* ------------------------- getEventShard ------------------------- */
+
+procShard_t *QOSProcessor::getEventShard(Event *ev, vector<int> &uids)
+{
+    if (shards.size() == 1) {
+        return shards[0];
+    }
+
+    switch (ev->getType()) {
+    case ADD_RULES_QOS_PROCESSOR:
+    case CHECK_RULES_QOS_PROCESSOR:
+    case DEL_RULES_QOS_PROCESSOR:
+      {
+        // follow rules still queued or being handled by a worker, so
+        // that deleting a rule never overtakes its activation
+        for (vector<int>::iterator u = uids.begin(); u != uids.end(); u++) {
+            for (procShardListIter_t i = shards.begin(); i != shards.end(); i++) {
+                if (((*i)->queuedRules.count(*u) > 0) || ((*i)->busyRules.count(*u) > 0)) {
+                    return *i;
+                }
+            }
+        }
+
+        // a batch stays together, rule sets are spread over the workers
+        ruleDB_t *r = ((QoSProcessorEvent *) ev)->getRules();
+        if (!r->empty()) {
+            return shards[shardHash(r->front()->getSetName()) % shards.size()];
+        }
+      }
+      break;
+    default:
+      break;
+    }
+
+    return shards[0];
+}
+
+
 /* ------------------------- addEvent ------------------------- */
 
-void QOSProcessor::addEvent(Event *ev)
+int QOSProcessor::addEvent(Event *ev)
 {
 
 #ifdef DEBUG
     log->dlog(ch,"new event %s", eventNames[ev->getType()].c_str());
 #endif
 
-    AUTOLOCK(threaded, &maccess);
-    in_events.push_back(ev);
-    log->log(ch, "Adding event NumEventsIn:%d", (int) in_events.size() );
+    procShard_t *shard = shards[0];
+    vector<int> uids;
+
+    ev->getRuleUIds(uids);
+    if (!uids.empty()) {
+        AUTOLOCK(threaded, &maccess);
+
+        shard = getEventShard(ev, uids);
+
+        // accounted before the push, the worker may dequeue the event right away
+        countQueuedRules(shard, uids, 1);
+    }
+
+    // the queue is lock-free, producers never wait for the processor thread
+    if (!shard->queue->push(ev)) {
+        if (!uids.empty()) {
+            AUTOLOCK(threaded, &maccess);
+            countQueuedRules(shard, uids, -1);
+        }
+        log->wlog(ch, "QoS processor event queue of worker %d full (%lu events)",
+                  shard->id, shard->queue->capacity());
+        return -1;
+    }
+
+    log->log(ch, "Adding event worker:%d NumEventsIn:%lu", shard->id, shard->queue->size() );
+
+#ifdef ENABLE_THREADS
+    if (threaded) {
+        // remember when the oldest pending event was signalled
+        if (__atomic_load_n(&shard->signalTime, __ATOMIC_RELAXED) == 0) {
+            struct timeval now;
+            unsigned long long expected = 0;
+            Timeval::gettimeofdayown(&now, NULL);
+            __atomic_compare_exchange_n(&shard->signalTime, &expected,
+                                        now.tv_sec * 1000000ULL + now.tv_usec, false,
+                                        __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+        }
+
+        // wake up the worker
+        uint64_t one = 1;
+        if (write(shard->wakeFd, &one, sizeof(one)) < 0) {
+            log->elog(ch, "cannot signal QoS processor thread: %s", strerror(errno));
+        }
+    }
+#endif
+
+    return 0;
 }
 
 
-/*! deleting is costly but it should occur much less than exporting
-    data or flow timeouts assuming the lifetimes of rules are reasonably large
-*/
-void QOSProcessor::delRuleEvents(int uid)
+void QOSProcessor::countQueuedRules(procShard_t *shard, vector<int> &uids, int delta)
 {
-    int ret = 0;
-    eventVecIter_t iter, tmp;
+    vector<int>::iterator i;
 
-	AUTOLOCK(threaded, &maccess);
+    for (i = uids.begin(); i != uids.end(); i++) {
+        int &n = shard->queuedRules[*i];
+        n += delta;
+        if (n <= 0) {
+            shard->queuedRules.erase(*i);
+        }
+    }
+}
 
-    // search linearly through list for rule with given ID and delete entries
-    iter = in_events.begin();
-    while (iter != in_events.end()) {
-        tmp = iter;
-        iter++;
 
-        ret = (*tmp)->deleteRule(uid);
-        if (ret == 1) {
-            // ret = 1 means rule was present in event but other rules are still in
-            // the event
-#ifdef DEBUG
-            log->dlog(ch,"remove rule %d from event %s", uid,
-                      eventNames[(*tmp)->getType()].c_str());
-#endif
-        } else if (ret == 2) {
-            // ret=2 means the event is now empty and therefore can be deleted
-#ifdef DEBUG
-            log->dlog(ch,"remove event %s", eventNames[(*tmp)->getType()].c_str());
-#endif
+void QOSProcessor::releaseQueuedRules(procShard_t *shard, Event *ev)
+{
+    vector<int> uids;
+    vector<int>::iterator i;
+
+    ev->getRuleUIds(uids);
+    if (uids.empty()) {
+        return;
+    }
+
+    AUTOLOCK(threaded, &maccess);
 
-            saveDelete(*tmp);
-            in_events.erase(tmp);
+    for (i = uids.begin(); i != uids.end(); i++) {
+        ruleRefCountIter_t q = shard->queuedRules.find(*i);
+        if ((q != shard->queuedRules.end()) && (--q->second <= 0)) {
+            shard->queuedRules.erase(q);
         }
+
+        shard->busyRules[*i]++;
     }
 }
 
 
-Event *QOSProcessor::getNextEvent()
+void QOSProcessor::releaseBusyRules(procShard_t *shard, Event *ev)
+{
+    vector<int> uids;
+    vector<int>::iterator i;
+
+    ev->getRuleUIds(uids);
+    if (uids.empty()) {
+        return;
+    }
+
+    AUTOLOCK(threaded, &maccess);
+
+    for (i = uids.begin(); i != uids.end(); i++) {
+        ruleRefCountIter_t b = shard->busyRules.find(*i);
+        if ((b != shard->busyRules.end()) && (--b->second <= 0)) {
+            shard->busyRules.erase(b);
+        }
+    }
+}
+
+
+Event *QOSProcessor::getNextEvent(procShard_t *shard)
 {
 
     Event *ev;
 
+    // the receiver is responsible for
+    // returning or freeing the event
+    if (!shard->queue->pop(ev)) {
+        return NULL;
+    }
 
-#ifdef ENABLE_THREADS
-    mutexLock(&maccess);
-#endif
+    releaseQueuedRules(shard, ev);
 
-    if (in_events.begin() != in_events.end()) {
-        ev = in_events.front();
-        // dequeue event
-        in_events.erase(in_events.begin());
-        // the receiver is responsible for
-        // returning or freeing the event
-#ifdef ENABLE_THREADS
-        mutexUnlock(&maccess);
-#endif
-        return ev;
+    // account the latency between the signal and the first dequeue
+    unsigned long long signalled = __atomic_exchange_n(&shard->signalTime, 0, __ATOMIC_RELAXED);
+    if (signalled != 0) {
+        struct timeval now;
+        Timeval::gettimeofdayown(&now, NULL);
+        unsigned long long nowUsec = now.tv_sec * 1000000ULL + now.tv_usec;
+        unsigned long long usec = (nowUsec > signalled) ? (nowUsec - signalled) : 0;
+
+        AUTOLOCK(threaded, &maccess);
+        shard->wstats.wakeups++;
+        shard->wstats.totalLatency += usec;
+        if (usec > shard->wstats.maxLatency) {
+            shard->wstats.maxLatency = usec;
+        }
     }
-    else
-    {
+
+    return ev;
+}
+
+
+void QOSProcessor::pushOutEvent(Event *evt)
+{
+    if (out_events->push(evt)) {
+        signalMainLoop();
+        return;
+    }
+
+    if (!threaded) {
+        // we are the main loop, it collects the response with the others
+        outSpill.push_back(evt);
+        return;
+    }
+
 #ifdef ENABLE_THREADS
-        mutexUnlock(&maccess);
+    // responses must not be lost, so if the main loop is lagging behind
+    // sleep until it has emptied the queue; handleFDEvent signals outCond
+    // under maccess after collecting, so the wakeup cannot be missed
+    AUTOLOCK(threaded, &maccess);
+
+    while (!out_events->push(evt)) {
+        signalMainLoop();
+        threadCondWait(&outCond, &maccess);
+    }
+    signalMainLoop();
 #endif
-        return NULL;
+}
+
+
+void QOSProcessor::signalMainLoop()
+{
+    const char c = 'P';
+
+    // the pipe does not block; if it is full a wakeup is pending anyway
+    if ((write(QualityManager::s_sigpipe[1], &c, 1) < 0) && (errno != EAGAIN)) {
+        log->elog(ch, "cannot signal main loop: %s", strerror(errno));
     }
 }
 
@@ -243,7 +763,6 @@ void QOSProcessor::checkRules(ruleDB_t *_rules, Event *evt)
 {
 
     ruleDBIter_t iter;
-    ruleDB_t response;
 
     log->log(ch, "starting checking rules");
 
@@ -254,16 +773,12 @@ void QOSProcessor::checkRules(ruleDB_t *_rules, Event *evt)
 			    (rule->getState() == RS_ERROR )){
 			checkRule(rule);
         }
-
-        response.push_back(rule);
     }
 
-    AUTOLOCK(threaded, &maccess);
-    Event * newEvt = new respCheckRulesQoSProcessorEvent(response);
+    // the response carries the same batch back
+    Event * newEvt = new respCheckRulesQoSProcessorEvent(getResponseBatch(_rules, evt));
     newEvt->setParent( evt->getParent());
-    out_events.push_back( newEvt );
-    const char c = 'P';
-    write(QualityManager::s_sigpipe[1], &c, 1);
+    pushOutEvent( newEvt );
 
     log->log(ch, "ending checking rules");
 }
@@ -275,6 +790,7 @@ void QOSProcessor::addRules( ruleDB_t *_rules, EventScheduler *e )
 
     log->dlog(ch, "starting add rules");
 
+    ruleDB_t batch;
     ruleDBIter_t iter;
     for (iter = _rules->begin(); iter != _rules->end(); iter++)
     {
@@ -283,7 +799,7 @@ void QOSProcessor::addRules( ruleDB_t *_rules, EventScheduler *e )
         if ((rule->getState() == RS_VALID) ||  (rule->getState() == RS_SCHEDULED))
         {
 			log->dlog(ch, "it is going to add  Rule %s.%s - Status:%d", rule->getSetName().c_str(), rule->getRuleName().c_str(), (int) rule->getState());
-			addRule(rule, e);
+			batch.push_back(rule);
 		}
 		else
 		{
@@ -292,6 +808,8 @@ void QOSProcessor::addRules( ruleDB_t *_rules, EventScheduler *e )
 
     }
 
+    addRuleBatch(batch, e);
+
     log->dlog(ch, "ending add rules");
 }
 
@@ -303,27 +821,24 @@ void QOSProcessor::addRules( ruleDB_t *rules, Event *evt )
     log->log(ch, "starting add rules");
 
     ruleDBIter_t iter;
-    ruleDB_t response;
+    ruleDB_t batch;
 
     for (iter = rules->begin(); iter != rules->end(); iter++) {
 		Rule *rule = *iter;
 
         if ((rule->getState() == RS_VALID) ||
 			 (rule->getState() == RS_SCHEDULED)){
-			addRule(rule);
+			batch.push_back(rule);
 		}
-
-        response.push_back(rule);
     }
 
-    AUTOLOCK(threaded, &maccess);
-    Event *newEvt = new respAddRulesQoSProcesorEvent(response);
+    addRuleBatch(batch, NULL);
+
+    Event *newEvt = new respAddRulesQoSProcesorEvent(getResponseBatch(rules, evt));
     newEvt->setParent(evt->getParent());
-    out_events.push_back( newEvt );
-    const char c = 'P';
-    write(QualityManager::s_sigpipe[1], &c, 1);
+    pushOutEvent( newEvt );
 
-    log->log(ch, "ending add rules NumEvents:%d", (int) out_events.size() );
+    log->log(ch, "ending add rules NumEvents:%lu", out_events->size() );
 }
 
 
@@ -331,34 +846,424 @@ void QOSProcessor::addRules( ruleDB_t *rules, Event *evt )
 // delete rules single thread.
 void QOSProcessor::delRules(ruleDB_t *_rules, EventScheduler *e)
 {
-    ruleDBIter_t iter;
-
-    for (iter = _rules->begin(); iter != _rules->end(); iter++) {
-        delRule(*iter);
-    }
+    delRuleBatch(*_rules);
 }
 
 // delete rules by the Qos Processor Event Interface.
 void QOSProcessor::delRules( ruleDB_t *_rules, Event *evt )
 {
-    ruleDBIter_t iter;
-    ruleDB_t response;
+    delRuleBatch(*_rules);
+
+    Event *newEvt = new respDelRulesQoSProcesorEvent(getResponseBatch(_rules, evt));
+    newEvt->setParent(evt->getParent());
+    pushOutEvent( newEvt );
+
+    log->log(ch, "ending add rules NumEvents:%lu", out_events->size() );
+
+}
+
+
+/* ------------------------- getResponseBatch ------------------------- */
+
+RuleBatch *QOSProcessor::getResponseBatch( ruleDB_t *rules, Event *evt )
+{
+    QoSProcessorEvent *qevt = dynamic_cast<QoSProcessorEvent *>(evt);
+
+    // share the batch of the request if the rules came from it
+    if ((qevt != NULL) && (qevt->getRules() == rules)) {
+        return qevt->getBatch()->ref();
+    }
+
+    return RuleBatch::create(*rules);
+}
+
+
+/* ------------------------- addRuleBatch ------------------------- */
+
+void QOSProcessor::addRuleBatch( ruleDB_t &batch, EventScheduler *e )
+{
+    unsigned int nrules = batch.size();
+    vector<int> failed(nrules, 0);
+    vector<unsigned int> gens(nrules, 0);
+    batchActionList_t acts;
+    moduleBatchList_t perModule;
+    unsigned int k, j;
+
+    if (nrules == 0) {
+        return;
+    }
+
+    // 1. load the modules and build the parameters of every action
+    for (k = 0; k < nrules; k++) {
+        Rule *r = batch[k];
+        actionList_t *actions = r->getActions();
+        int cnt = 1;
+
+        log->dlog(ch, "adding Rule #%d", r->getUId());
+
+        try {
+            {
+                AUTOLOCK(threaded, &maccess);
+
+                if (rules.find(r->getUId()) != NULL) {
+                    throw Error("rule uid %d is already active", r->getUId());
+                }
+                gens[k] = rules.nextGeneration(r->getUId());
+            }
+
+            for (actionListIter_t iter = actions->begin(); iter != actions->end(); iter++) {
+                batchAction_t ba;
+                string mname = iter->name;
+
+                if (cnt > MAX_RULE_ACTIONS) {
+                    throw Error("rule has too many actions (maximum is %d)", MAX_RULE_ACTIONS);
+                }
+
+                ba.rule = k;
+                ba.actionId = cnt;
+                ba.status = 0;
+
+                {
+                    AUTOLOCK(threaded, &maccess);
+
+                    // load Action Module used by this rule
+                    Module *mod = loader->getModule(mname.c_str());
+                    ba.a.module = dynamic_cast<ProcModule*> (mod);
+
+                    if (ba.a.module == NULL) {
+                        continue;
+                    }
+
+                    // The flowid is made of the rule id and the action id.
+                    ba.a.flowid = idSource.newId();
+                }
+
+                ba.a.mapi = ba.a.module->getAPI();
+
+                // Define the Flow id to be used.
+                configItemList_t itmConf = iter->conf;
+                configItem_t flowId;
+                flowId.group = getConfigGroup();
+                flowId.module = mname;
+                flowId.name = "FlowId";
+
+                std::stringstream ss;
+                ss << ba.a.flowid;
+                flowId.value = ss.str();
+                flowId.type = "UInt16";
+
+                itmConf.push_front(flowId);
+
+                // from here on the action is cleaned up with the batch
+                acts.push_back(ba);
+                acts.back().a.params = getActionParams(itmConf, iter->compiled, ba.a.flowid);
+                cnt++;
+            }
+        } catch (Error &err) {
+            log->elog(ch, err);
+            failed[k] = 1;
+        }
+    }
+
+    for (j = 0; j < acts.size(); j++) {
+        if (!failed[acts[j].rule]) {
+            perModule[acts[j].a.module].push_back(j);
+        }
+    }
+
+    // 2. hand all flows of a module over at once
+    for (moduleBatchListIter_t m = perModule.begin(); m != perModule.end(); m++) {
+        ProcModule *mod = m->first;
+        vector<int> &idx = m->second;
+
+        SHARDLOCK(threaded, getModuleShard(mod->getModName()));
+
+        if (mod->hasBatchSetup()) {
+            vector<flowSetup_t> setups(idx.size());
+
+            for (j = 0; j < idx.size(); j++) {
+                batchAction_t &ba = acts[idx[j]];
+                setups[j].rule_id = batch[ba.rule]->getUId();
+                setups[j].action_id = ba.actionId;
+                setups[j].params = ba.a.params;
+                setups[j].filters = batch[ba.rule]->getFilter();
+                setups[j].flowdata = NULL;
+                setups[j].status = 0;
+            }
+
+            log->log(ch, "setting up %d flows with module %s",
+                     (int) setups.size(), mod->getModName().c_str());
+
+            mod->getAPI()->initFlowSetupBatch(&setups[0], (int) setups.size());
+
+            for (j = 0; j < idx.size(); j++) {
+                acts[idx[j]].a.flowData = setups[j].flowdata;
+                acts[idx[j]].status = setups[j].status;
+            }
+        } else {
+            for (j = 0; j < idx.size(); j++) {
+                batchAction_t &ba = acts[idx[j]];
+                Rule *r = batch[ba.rule];
+
+                try {
+                    ba.a.mapi->initFlowSetup(r->getUId(), ba.actionId, ba.a.params,
+                                             r->getFilter(), &ba.a.flowData);
+                } catch (ProcError &pe) {
+                    log->elog(ch, pe);
+                    ba.status = (pe.getErrorNo() != 0) ? pe.getErrorNo() : -1;
+                }
+            }
+        }
+
+        // init timers
+        for (j = 0; j < idx.size(); j++) {
+            batchAction_t &ba = acts[idx[j]];
+
+            if (ba.status == 0) {
+                if (e != NULL) {
+                    addTimerEvents(batch[ba.rule]->getUId(), gens[ba.rule], ba.actionId, ba.a, *e);
+                } else {
+                    addTimerEvents(batch[ba.rule]->getUId(), gens[ba.rule], ba.actionId, ba.a);
+                }
+            } else {
+                failed[ba.rule] = 1;
+            }
+        }
+    }
+
+    // 3. a rule only becomes active if all its actions were set up
+    vector<ruleActions_t> entries(nrules);
+
+    for (j = 0; j < acts.size(); j++) {
+        batchAction_t &ba = acts[j];
+        Rule *r = batch[ba.rule];
+
+        if (!failed[ba.rule]) {
+            entries[ba.rule].setAction(ba.actionId, ba.a);
+            continue;
+        }
+
+        if ((ba.status == 0) && (ba.a.flowData != NULL)) {
+            try {
+                SHARDLOCK(threaded, getModuleShard(ba.a.module->getModName()));
+                ba.a.mapi->destroyFlowSetup(r->getUId(), ba.actionId, ba.a.params,
+                                            r->getFilter(), ba.a.flowData);
+            } catch (ProcError &pe) {
+                log->elog(ch, pe);
+            }
+        }
+
+        if (ba.a.params != NULL) {
+            ConfigManager::freeParamList(ba.a.params);
+        }
+
+        AUTOLOCK(threaded, &maccess);
+
+        // Free the flow id assigned if any
+        if (ba.a.flowid != 0) {
+            idSource.freeId(ba.a.flowid);
+        }
+
+        //release packet processing modules already loaded for this rule
+        loader->releaseModule(ba.a.module);
+    }
+
+    AUTOLOCK(threaded, &maccess);
+
+    for (k = 0; k < nrules; k++) {
+        Rule *r = batch[k];
+
+        if (failed[k]) {
+            log->elog(ch, "Rule %s.%s - Id:%d could not be set up", r->getSetName().c_str(),
+                      r->getRuleName().c_str(), r->getUId());
+            r->setState(RS_ERROR);
+
+            // timers of the actions that were set up carry gens[k]
+            if (gens[k] != 0) {
+                rules.skipGeneration(r->getUId());
+            }
+            continue;
+        }
+
+        entries[k].bidir = r->isBidir();
+        entries[k].seppaths = r->sepPaths();
+        entries[k].rule = r;
+
+        // success ->enter struct into internal table
+        rules.insert(r->getUId(), entries[k]);
+
+        // Set the rule as active.
+        r->setState(RS_ACTIVE);
+    }
+}
+
+
+/* ------------------------- getActionParams ------------------------- */
+
+configParam_t *QOSProcessor::getActionParams( configItemList_t &items, const paramBlock_t &compiled,
+                                              uint16_t flowid )
+{
+    paramBlock_t block = compiled;
+
+    block.value[PARAM_FLOWID] = flowid;
+    block.present |= (1 << PARAM_FLOWID);
+
+    return ConfigManager::getParamList(items, &block);
+}
+
+
+/* ------------------------- delRuleBatch ------------------------- */
+
+void QOSProcessor::delRuleBatch( ruleDB_t &batch )
+{
+    batchActionList_t acts;
+    unsigned int k;
+
+    // take the rules out of the table, their actions are torn down below
+    {
+        AUTOLOCK(threaded, &maccess);
+
+        for (k = 0; k < batch.size(); k++) {
+            ruleActions_t entry;
+
+            if (!rules.erase(batch[k]->getUId(), &entry)) {
+                continue;
+            }
+
+            for (int i = 1; i <= entry.numActions; i++) {
+                ppaction_t *a = entry.getAction(i);
+                if (a == NULL) {
+                    continue;
+                }
+
+                batchAction_t ba;
+                ba.rule = k;
+                ba.actionId = i;
+                ba.status = 0;
+                ba.a = *a;
+                acts.push_back(ba);
+            }
+        }
+    }
+
+    destroyActions(batch, acts);
+
+    for (k = 0; k < batch.size(); k++) {
+        // Set the rule as done.
+        batch[k]->setState(RS_DONE);
+    }
+}
+
+
+/* ------------------------- destroyActions ------------------------- */
+
+void QOSProcessor::destroyActions( ruleDB_t &owners, batchActionList_t &acts )
+{
+    moduleBatchList_t perModule;
+    unsigned int j;
+
+    for (j = 0; j < acts.size(); j++) {
+        perModule[acts[j].a.module].push_back(j);
+    }
+
+    // dismantle all flows of a module at once
+    for (moduleBatchListIter_t m = perModule.begin(); m != perModule.end(); m++) {
+        ProcModule *mod = m->first;
+        vector<int> &idx = m->second;
+
+        SHARDLOCK(threaded, getModuleShard(mod->getModName()));
+
+        if (mod->hasBatchSetup()) {
+            vector<flowSetup_t> setups(idx.size());
+
+            for (j = 0; j < idx.size(); j++) {
+                batchAction_t &ba = acts[idx[j]];
+                setups[j].rule_id = owners[ba.rule]->getUId();
+                setups[j].action_id = ba.actionId;
+                setups[j].params = ba.a.params;
+                setups[j].filters = owners[ba.rule]->getFilter();
+                setups[j].flowdata = ba.a.flowData;
+                setups[j].status = 0;
+            }
+
+            log->log(ch, "removing %d flows with module %s",
+                     (int) setups.size(), mod->getModName().c_str());
+
+            mod->getAPI()->destroyFlowSetupBatch(&setups[0], (int) setups.size());
+
+            for (j = 0; j < idx.size(); j++) {
+                if (setups[j].status != 0) {
+                    log->elog(ch, "Rule:%d action %d - error %d destroying the flow setup",
+                              setups[j].rule_id, setups[j].action_id, setups[j].status);
+                }
+            }
+        } else {
+            for (j = 0; j < idx.size(); j++) {
+                batchAction_t &ba = acts[idx[j]];
+                Rule *r = owners[ba.rule];
+
+                try {
+                    // dismantle flow data structure with module function
+                    ba.a.mapi->destroyFlowSetup(r->getUId(), ba.actionId, ba.a.params,
+                                                r->getFilter(), ba.a.flowData);
+                } catch (ProcError &err) {
+                    log->elog(ch, err);
+                }
+            }
+        }
+    }
+
+    for (j = 0; j < acts.size(); j++) {
+        batchAction_t &ba = acts[j];
+
+        if (ba.a.params != NULL) {
+            ConfigManager::freeParamList(ba.a.params);
+        }
+
+        AUTOLOCK(threaded, &maccess);
+
+        idSource.freeId(ba.a.flowid);
+
+        // release modules loaded for this rule
+        loader->releaseModule(ba.a.module);
+    }
+}
+
+
+/* ------------------------- expireTimers ------------------------- */
+
+void QOSProcessor::expireTimers( procTimerList_t &due )
+{
+    ruleDB_t owners;
+    batchActionList_t acts;
 
-    for (iter = _rules->begin(); iter != _rules->end(); iter++) {
-        delRule(*iter);
-        response.push_back(*iter);
-    }
+    // take the actions of the timers out of the rule table
+    {
+        AUTOLOCK(threaded, &maccess);
 
-    AUTOLOCK(threaded, &maccess);
-    Event *newEvt = new respDelRulesQoSProcesorEvent(response);
-    newEvt->setParent(evt->getParent());
-    out_events.push_back( newEvt );
+        for (procTimerListIter_t t = due.begin(); t != due.end(); t++) {
+            ruleActions_t *ra = rules.find(t->rid);
+            ppaction_t *a = (ra != NULL) ? ra->getAction(t->actid) : NULL;
 
-    const char c = 'P';
-    write(QualityManager::s_sigpipe[1], &c, 1);
+            if ((a == NULL) || ((t->gen != 0) && (t->gen != ra->gen))) {
+                // the rule or action is gone already, or the uid was reused
+                log->dlog(ch, "dropping timer of rule %d action %d", t->rid, t->actid);
+                continue;
+            }
 
-    log->log(ch, "ending add rules NumEvents:%d", (int) out_events.size() );
+            batchAction_t ba;
+            ba.rule = owners.size();
+            ba.actionId = t->actid;
+            ba.status = 0;
+            ba.a = *a;
+            acts.push_back(ba);
+            owners.push_back(ra->rule);
 
+            a->module = NULL;
+        }
+    }
+
+    destroyActions(owners, acts);
 }
 
 
@@ -372,13 +1277,16 @@ int QOSProcessor::checkRule(Rule *r)
     bool exThrown = false;
     int cnt = 1;
 
-	AUTOLOCK(threaded, &maccess);
-
     ruleId  = r->getUId();
     actions = r->getActions();
 
     log->log(ch, "checking Rule %s.%s - Id:%d", r->getSetName().c_str(), r->getRuleName().c_str(), ruleId);
 
+    a.module = NULL;
+    a.params = NULL;
+    a.flowData = NULL;
+    a.flowid = 0;
+
     try {
 
 
@@ -391,9 +1299,18 @@ int QOSProcessor::checkRule(Rule *r)
             a.flowData = NULL;
             a.flowid = 0; // 0 means not
 
-            // load Action Module used by this rule
-            mod = loader->getModule(mname.c_str());
-            a.module = dynamic_cast<ProcModule*> (mod);
+            {
+                AUTOLOCK(threaded, &maccess);
+
+                // load Action Module used by this rule
+                mod = loader->getModule(mname.c_str());
+                a.module = dynamic_cast<ProcModule*> (mod);
+
+                if (a.module != NULL) {
+                    // The flowid is an sequence number.
+                    a.flowid = idSource.newId();
+                }
+            }
 
             if (a.module != NULL) { // is it a processing kind of module
 
@@ -406,50 +1323,62 @@ int QOSProcessor::checkRule(Rule *r)
                 flowId.module = mname;
                 flowId.name = "FlowId";
 
-			    // The flowid is an sequence number.
-			    a.flowid = idSource.newId();
-
 				std::stringstream ss;
 				ss << a.flowid;
 				flowId.value = ss.str();
                 flowId.type = "UInt16";
 
                 itmConf.push_front(flowId);
-                a.params = ConfigManager::getParamList(itmConf);
+                a.params = getActionParams(itmConf, iter->compiled, a.flowid);
 
-				errNo = (a.mapi)->checkBandWidth(a.params);
+                {
+                    SHARDLOCK(threaded, getModuleShard(mname));
 
-				log->log(ch, "bandwidth checking %s.%s - return:%d", r->getSetName().c_str(), r->getRuleName().c_str(), errNo);
+                    errNo = (a.mapi)->checkBandWidth(a.params);
 
-				if ( errNo < 0 ){
-					 errStr = "Not available bandwidth";
-					 exThrown = true;
-					 break;
-				}
+                    log->log(ch, "bandwidth checking %s.%s - return:%d", r->getSetName().c_str(), r->getRuleName().c_str(), errNo);
 
-				log->log(ch, "pass bandwidth checking rule:%s.%s Nbr Filters:%d", r->getSetName().c_str(), r->getRuleName().c_str(), (int) r->getFilter()->size());
+                    if ( errNo < 0 ){
+                         errStr = "Not available bandwidth";
+                         exThrown = true;
+                         break;
+                    }
 
-                (a.mapi)->initFlowSetup(ruleId, cnt, a.params, r->getFilter(), &a.flowData);
+                    log->log(ch, "pass bandwidth checking rule:%s.%s Nbr Filters:%d", r->getSetName().c_str(), r->getRuleName().c_str(), (int) r->getFilter()->size());
 
-                (a.mapi)->destroyFlowSetup(ruleId, cnt,  a.params, r->getFilter(), a.flowData);
-                saveDeleteArr(a.params);
-                a.params = NULL;
+                    if (a.module->hasValidateSetup()) {
+                        (a.mapi)->validateFlowSetup(ruleId, cnt, a.params, r->getFilter());
+                    } else {
+                        // the module can only tell by really setting up the flow
+                        (a.mapi)->initFlowSetup(ruleId, cnt, a.params, r->getFilter(), &a.flowData);
 
-			    // The free the sequence number assigned for the flow id.
-			    idSource.freeId(a.flowid);
+                        (a.mapi)->destroyFlowSetup(ruleId, cnt,  a.params, r->getFilter(), a.flowData);
+                    }
+                }
 
+                ConfigManager::freeParamList(a.params);
+                a.params = NULL;
                 a.flowData = NULL;
-                a.flowid = 0;
 
-                //release packet processing modules already loaded for this rule
-                loader->releaseModule(a.module);
-                a.module = NULL;
+                {
+                    AUTOLOCK(threaded, &maccess);
+
+                    // The free the sequence number assigned for the flow id.
+                    idSource.freeId(a.flowid);
+                    a.flowid = 0;
+
+                    //release packet processing modules already loaded for this rule
+                    loader->releaseModule(a.module);
+                    a.module = NULL;
+                }
                 cnt = cnt+ 1;
             }
         }
 
-    	log->log(ch, "checking Rule %s.%s - Id:%d - Pass the check", r->getSetName().c_str(), r->getRuleName().c_str(), ruleId);
-    	r->setState(RS_VALID);
+        if (!exThrown) {
+            log->log(ch, "checking Rule %s.%s - Id:%d - Pass the check", r->getSetName().c_str(), r->getRuleName().c_str(), ruleId);
+            r->setState(RS_VALID);
+        }
     }
     catch (Error &e) {
         log->elog(ch, e);
@@ -470,22 +1399,23 @@ int QOSProcessor::checkRule(Rule *r)
 
 		log->elog(ch, "Rule %s.%s - Id:%d has errors", r->getSetName().c_str(), r->getRuleName().c_str(), ruleId);
 
-		// Free the flow id assigned if any
-		if (a.flowid != 0){
-			idSource.freeId(a.flowid);
-		}
-
         // free memory
         if (a.flowData != NULL) {
-
+            SHARDLOCK(threaded, getModuleShard(a.module->getModName()));
             (a.mapi)->destroyFlowSetup(ruleId, cnt, a.params, r->getFilter(), a.flowData);
+        }
 
-			if (a.params != NULL) {
-				saveDeleteArr(a.params);
-			}
-
+        if (a.params != NULL) {
+            ConfigManager::freeParamList(a.params);
         }
 
+        AUTOLOCK(threaded, &maccess);
+
+		// Free the flow id assigned if any
+		if (a.flowid != 0){
+			idSource.freeId(a.flowid);
+		}
+
         //release packet processing modules already loaded for this rule
         if (a.module) {
             loader->releaseModule(a.module);
@@ -517,28 +1447,31 @@ int QOSProcessor::addRule( Rule *r, EventScheduler *e )
     log->log(ch, "adding Rule %d", ruleId);
 
 
-    entry.lastPkt = 0;
-    entry.packets = 0;
-    entry.bytes = 0;
     entry.bidir = r->isBidir();
     entry.seppaths = r->sepPaths();
     entry.rule = r;
 
+    unsigned int gen = 0;
+
     try {
 
+        if (rules.find(ruleId) != NULL) {
+            throw Error("rule uid %d is already active", ruleId);
+        }
+        gen = rules.nextGeneration(ruleId);
+
         int cnt = 1;
         for (actionListIter_t iter = actions->begin(); iter != actions->end(); iter++)
         {
             ppaction_t a;
 
-            a.module = NULL;
-            a.params = NULL;
-            a.flowData = NULL;
-            a.flowid = 0;
-
             Module *mod;
             string mname = iter->name;
 
+            if (cnt > MAX_RULE_ACTIONS) {
+                throw Error("rule has too many actions (maximum is %d)", MAX_RULE_ACTIONS);
+            }
+
 			log->log(ch, "it is going to load module %s", mname.c_str());
 
 
@@ -572,15 +1505,17 @@ int QOSProcessor::addRule( Rule *r, EventScheduler *e )
                 flowId.type = "UInt16";
 
                 itmConf.push_front(flowId);
-                a.params = ConfigManager::getParamList(itmConf);
+                a.params = getActionParams(itmConf, iter->compiled, a.flowid);
 
-                a.flowData = NULL;
-                (a.mapi)->initFlowSetup(ruleId, cnt, a.params, r->getFilter(), &a.flowData);
+                // from here on the action is cleaned up with the entry
+                entry.setAction(cnt, a);
+
+                (a.mapi)->initFlowSetup(ruleId, cnt, a.params, r->getFilter(),
+                                        &(entry.getAction(cnt)->flowData));
 
                 // init timers
-                addTimerEvents(ruleId, cnt, a, *e);
+                addTimerEvents(ruleId, gen, cnt, *entry.getAction(cnt), *e);
 
-                (entry.actions)[cnt] = a;
 	            cnt++;
 
             }
@@ -588,7 +1523,7 @@ int QOSProcessor::addRule( Rule *r, EventScheduler *e )
         }
 
         // success ->enter struct into internal table
-        rules[ruleId] = entry;
+        rules.insert(ruleId, entry);
 
         // Set the rule as active.
         r->setState(RS_ACTIVE);
@@ -620,19 +1555,20 @@ int QOSProcessor::addRule( Rule *r, EventScheduler *e )
 
 	if (exThrown)
 	{
-        for (ppactionListIter_t i = entry.actions.begin(); i != entry.actions.end(); i++) {
-			ppaction_t a = i->second;
-			int action_id = i->first;
+        for (int action_id = 1; action_id <= entry.numActions; action_id++) {
+			ppaction_t a = entry.actions[action_id - 1];
 
 			// Free the flow id assigned if any
 			if (a.flowid != 0){
 				idSource.freeId(a.flowid);
 			}
 
-            (a.mapi)->destroyFlowSetup( ruleId, action_id, a.params, r->getFilter(), a.flowData );
+            if (a.flowData != NULL) {
+                (a.mapi)->destroyFlowSetup( ruleId, action_id, a.params, r->getFilter(), a.flowData );
+            }
 
 			if (a.params != NULL) {
-				saveDeleteArr(a.params);
+				ConfigManager::freeParamList(a.params);
 			}
 
             //release packet processing modules already loaded for this rule
@@ -640,8 +1576,13 @@ int QOSProcessor::addRule( Rule *r, EventScheduler *e )
                 loader->releaseModule(a.module);
             }
         }
-        // empty the map itself
-        entry.actions.clear();
+        // empty the list itself
+        entry.numActions = 0;
+
+        // the timers already armed must not match the next rule of the uid
+        if (gen != 0) {
+            rules.skipGeneration(ruleId);
+        }
 
         throw Error(errNo, errStr);
 	}
@@ -662,41 +1603,54 @@ int QOSProcessor::addRule( Rule *r )
     string errStr;
     bool exThrown = false;
 
-    AUTOLOCK(threaded, &maccess);
-
     ruleId  = r->getUId();
     actions = r->getActions();
 
     log->dlog(ch, "adding Rule #%d", ruleId);
 
 
-    entry.lastPkt = 0;
-    entry.packets = 0;
-    entry.bytes = 0;
     entry.bidir = r->isBidir();
     entry.seppaths = r->sepPaths();
     entry.rule = r;
 
+    unsigned int gen = 0;
+
     try {
 
+        {
+            AUTOLOCK(threaded, &maccess);
+
+            if (rules.find(ruleId) != NULL) {
+                throw Error("rule uid %d is already active", ruleId);
+            }
+            gen = rules.nextGeneration(ruleId);
+        }
+
         int cnt = 1;
         for (actionListIter_t iter = actions->begin(); iter != actions->end(); iter++) {
             ppaction_t a;
 
-            a.module = NULL;
-            a.params = NULL;
-            a.flowData = NULL;
-            a.flowid = 0;
-
             Module *mod;
             string mname = iter->name;
 
+            if (cnt > MAX_RULE_ACTIONS) {
+                throw Error("rule has too many actions (maximum is %d)", MAX_RULE_ACTIONS);
+            }
+
 			log->dlog(ch, "it is going to load module %s", mname.c_str());
 
+            {
+                AUTOLOCK(threaded, &maccess);
 
-            // load Action Module used by this rule
-            mod = loader->getModule(mname.c_str());
-            a.module = dynamic_cast<ProcModule*> (mod);
+                // load Action Module used by this rule
+                mod = loader->getModule(mname.c_str());
+                a.module = dynamic_cast<ProcModule*> (mod);
+
+                if (a.module != NULL) {
+                    // The flowid is made of the rule id and the action id.
+                    a.flowid = idSource.newId();
+                }
+            }
 
             if (a.module != NULL) { // is it a processing kind of module
 
@@ -712,24 +1666,27 @@ int QOSProcessor::addRule( Rule *r )
                 flowId.module = mname;
                 flowId.name = "FlowId";
 
-			    // The flowid is made of the rule id and the action id.
-			    a.flowid = idSource.newId();
-
 				std::stringstream ss;
 				ss << a.flowid;
 				flowId.value = ss.str();
                 flowId.type = "UInt16";
 
                 itmConf.push_front(flowId);
-                a.params = ConfigManager::getParamList(itmConf);
+                a.params = getActionParams(itmConf, iter->compiled, a.flowid);
 
-                a.flowData = NULL;
-                (a.mapi)->initFlowSetup(ruleId, cnt, a.params, r->getFilter(), &a.flowData);
+                // from here on the action is cleaned up with the entry
+                entry.setAction(cnt, a);
 
-                // init timers
-                addTimerEvents(ruleId, cnt, a);
+                {
+                    SHARDLOCK(threaded, getModuleShard(mname));
+
+                    (a.mapi)->initFlowSetup(ruleId, cnt, a.params, r->getFilter(),
+                                            &(entry.getAction(cnt)->flowData));
+
+                    // init timers
+                    addTimerEvents(ruleId, gen, cnt, *entry.getAction(cnt));
+                }
 
-                (entry.actions)[cnt] = a;
 	            cnt++;
 
             }
@@ -737,7 +1694,10 @@ int QOSProcessor::addRule( Rule *r )
         }
 
         // success ->enter struct into internal table
-        rules[ruleId] = entry;
+        {
+            AUTOLOCK(threaded, &maccess);
+            rules.insert(ruleId, entry);
+        }
 
         // Set the rule as active.
         r->setState(RS_ACTIVE);
@@ -761,20 +1721,24 @@ int QOSProcessor::addRule( Rule *r )
 
 	if (exThrown)
 	{
-        for (ppactionListIter_t i = entry.actions.begin(); i != entry.actions.end(); i++)
+        for (int action_id = 1; action_id <= entry.numActions; action_id++)
         {
-			ppaction_t a = i->second;
-			int action_id = i->first;
+			ppaction_t a = entry.actions[action_id - 1];
 
-			// Free the flow id assigned if any
-			if (a.flowid != 0){
-				idSource.freeId(a.flowid);
+            if (a.flowData != NULL) {
+                SHARDLOCK(threaded, getModuleShard(a.module->getModName()));
+                (a.mapi)->destroyFlowSetup( ruleId, action_id, a.params, r->getFilter(), a.flowData );
+            }
+
+			if (a.params != NULL) {
+				ConfigManager::freeParamList(a.params);
 			}
 
-            (a.mapi)->destroyFlowSetup( ruleId, action_id, a.params, r->getFilter(), a.flowData );
+            AUTOLOCK(threaded, &maccess);
 
-			if (a.params != NULL) {
-				saveDeleteArr(a.params);
+			// Free the flow id assigned if any
+			if (a.flowid != 0){
+				idSource.freeId(a.flowid);
 			}
 
             //release packet processing modules already loaded for this rule
@@ -783,7 +1747,13 @@ int QOSProcessor::addRule( Rule *r )
             }
         }
         // empty the list itself
-        entry.actions.clear();
+        entry.numActions = 0;
+
+        // the timers already armed must not match the next rule of the uid
+        if (gen != 0) {
+            AUTOLOCK(threaded, &maccess);
+            rules.skipGeneration(ruleId);
+        }
 
         throw Error(errNo, errStr);;
 	}
@@ -797,13 +1767,16 @@ int QOSProcessor::addRule( Rule *r )
 int QOSProcessor::delRule( Rule *r )
 {
     int ruleId = r->getUId();
-    ruleActions_t *ra =NULL;
+    ruleActions_t entry;
 
     log->log(ch, "deleting Rule: %d", ruleId);
 
-    AUTOLOCK(threaded, &maccess);
+    {
+        AUTOLOCK(threaded, &maccess);
 
-    ra = &rules[ruleId];
+        // Remove the rule from the container, its actions are torn down below
+        rules.erase(ruleId, &entry);
+    }
 
 	log->log(ch, "Num filters for rule: %d - %d", ruleId, (int) r->getFilter()->size());
 
@@ -815,26 +1788,35 @@ int QOSProcessor::delRule( Rule *r )
 	}
 
     // now free flow data and release used Modules
-    for (ppactionListIter_t i = ra->actions.begin(); i != ra->actions.end(); i++)
+    for (int action_id = 1; action_id <= entry.numActions; action_id++)
     {
-		int action_id = i->first;
-		ppaction_t a = i->second;
+		if (entry.getAction(action_id) == NULL) {
+			continue;
+		}
+
+		ppaction_t a = *entry.getAction(action_id);
 
 		try
 		{
 
 			// dismantle flow data structure with module function
-			a.mapi->destroyFlowSetup( ruleId, action_id, a.params, r->getFilter(), a.flowData );
+			{
+			    SHARDLOCK(threaded, getModuleShard(a.module->getModName()));
+			    a.mapi->destroyFlowSetup( ruleId, action_id, a.params, r->getFilter(), a.flowData );
+			}
 
 			log->log(ch, "Sucessfully destroy the flow setup");
 
 			assert (a.flowid > 1);
 			log->log(ch, "Rule:%d action %d - Flow id to destroy:%d",ruleId, action_id, a.flowid);
-			idSource.freeId(a.flowid);
 
+			{
+			    AUTOLOCK(threaded, &maccess);
+			    idSource.freeId(a.flowid);
+			}
 
 			if (a.params != NULL) {
-				saveDeleteArr(a.params);
+				ConfigManager::freeParamList(a.params);
 				a.params = NULL;
 			}
 		} catch (ProcError &err){
@@ -843,7 +1825,10 @@ int QOSProcessor::delRule( Rule *r )
 
 
         // release modules loaded for this rule
-        loader->releaseModule(a.module);
+        {
+            AUTOLOCK(threaded, &maccess);
+            loader->releaseModule(a.module);
+        }
 
 
         log->log(ch, "After sucessfully release the module");
@@ -851,16 +1836,6 @@ int QOSProcessor::delRule( Rule *r )
         // FIXME disable timers
     }
 
-    ra->actions.clear();
-    ra->lastPkt = 0;
-    ra->auto_flows = 0;
-    ra->bidir = 0;
-    ra->seppaths = 0;
-    ra->rule = NULL;
-
-    // Remove the rule from the container
-    rules.erase(ruleId);
-
 	// Set the rule as done.
     r->setState(RS_DONE);
 
@@ -868,61 +1843,230 @@ int QOSProcessor::delRule( Rule *r )
 }
 
 
-int QOSProcessor::handleFDEvent(eventVec_t *e, fd_set *rset, fd_set *wset, fd_sets_t *fds)
+int QOSProcessor::handleFDEvent(eventVec_t *e, fd_t *ready, int nready, fd_sets_t *fds)
 {
 
+    // without threads the caller does the work of the (single) shard,
+    // otherwise the workers do it and we only collect their responses
+    if (!threaded) {
+        for (procShardListIter_t i = shards.begin(); i != shards.end(); i++) {
+            processShard(*i);
+        }
+    }
+
+	// This part returns the events created during execution.
+	if (e != NULL){
+		out_events->popAll(*e);
+
+        if (!outSpill.empty()) {
+            e->insert(e->end(), outSpill.begin(), outSpill.end());
+            outSpill.clear();
+        }
+
+#ifdef ENABLE_THREADS
+        if (threaded) {
+            // there is room again for the workers waiting in pushOutEvent
+            AUTOLOCK(threaded, &maccess);
+            threadCondBroadcast(&outCond);
+        }
+#endif
+	}
+
+#ifdef ENABLE_THREADS
+	if (threaded && isIdle()) {
+	  AUTOLOCK(threaded, &maccess);
+	  threadCondSignal(&doneCond);
+	}
+#endif
+
+    return 0;
+}
+
+
+void QOSProcessor::processShard(procShard_t *shard)
+{
     Event *evn;
 
     // get next entry from event queue
-    while ((evn = getNextEvent()) != NULL)
+    while (!shardStopping(shard) && ((evn = getNextEvent(shard)) != NULL))
     {
         handleEvent(evn);
+        releaseBusyRules(shard, evn);
         saveDelete(evn);
 
+        __atomic_add_fetch(&shard->processed, 1, __ATOMIC_RELAXED);
 	}
+}
 
-	// This part returns the events created during execution.
-	if (e != NULL){
-        AUTOLOCK(threaded, &maccess);
-		eventVecIter_t it;
-		for (it = out_events.begin(); it != out_events.end(); it++){
-			evn = *it;
-			e->push_back(evn);
-		}
 
-		out_events.clear();
-	}
+bool QOSProcessor::isIdle()
+{
+    if (!out_events->empty() || !outSpill.empty()) {
+        return false;
+    }
+
+    for (procShardListIter_t i = shards.begin(); i != shards.end(); i++) {
+        if (!(*i)->queue->empty()) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+
+void QOSProcessor::waitForEvents(procShard_t *shard)
+{
+    uint64_t cnt;
+    int timeout;
+    struct pollfd pfd;
+    struct timeval now;
+
+    {
+        SHARDLOCK(threaded, shard);
+        Timeval::gettimeofdayown(&now, NULL);
+        timeout = shard->timers->nextTimeout(now.tv_sec * 1000000ULL + now.tv_usec);
+    }
+
+    pfd.fd = shard->wakeFd;
+    pfd.events = POLLIN;
+    pfd.revents = 0;
+
+    // blocks until addEvent writes to the descriptor or the next timer
+    // is due; several signals issued before we get here are collapsed
+    // into a single wakeup
+    while (poll(&pfd, 1, timeout) < 0) {
+        if (errno != EINTR) {
+            throw Error("QoS processor wakeup error: %s", strerror(errno));
+        }
+    }
+
+    if ((pfd.revents & POLLIN) && (read(shard->wakeFd, &cnt, sizeof(cnt)) < 0)) {
+        throw Error("QoS processor wakeup error: %s", strerror(errno));
+    }
+}
+
+
+void QOSProcessor::runTimers(procShard_t *shard)
+{
+    procTimerList_t due;
+    struct timeval now;
+
+    {
+        SHARDLOCK(threaded, shard);
+        Timeval::gettimeofdayown(&now, NULL);
+        shard->timers->expire(now.tv_sec * 1000000ULL + now.tv_usec, due);
+    }
+
+    if (!due.empty()) {
+        log->log(ch, "worker %d: %d module timer(s) expired", shard->id, (int) due.size());
+
+        expireTimers(due);
+        __atomic_add_fetch(&shard->expired, due.size(), __ATOMIC_RELAXED);
+    }
+}
+
+
+void QOSProcessor::shardMain(procShard_t *shard)
+{
+    log->log(ch, "QoS Processor worker %d running", shard->id);
+
+    while (!shardStopping(shard)) {
+        waitForEvents(shard);
+        processShard(shard);
+        runTimers(shard);
 
 #ifdef ENABLE_THREADS
-	if (threaded && ((out_events.size() == 0) && (in_events.size() == 0))) {
-	  threadCondSignal(&doneCond);
-	}
+        if (isIdle()) {
+            AUTOLOCK(threaded, &maccess);
+            threadCondSignal(&doneCond);
+        }
 #endif
+    }
 
-    return 0;
+    log->log(ch, "QoS Processor worker %d stopped", shard->id);
+}
+
+
+void *QOSProcessor::shardThreadFunc(void *arg)
+{
+#ifdef ENABLE_THREADS
+    procShard_t *shard = (procShard_t *) arg;
+
+    try {
+        shard->proc->shardMain(shard);
+    } catch (Error &e) {
+        shard->proc->log->elog(shard->proc->ch, e);
+    }
+#endif
+    return NULL;
+}
+
+
+void QOSProcessor::run()
+{
+#ifdef ENABLE_THREADS
+    // the workers are not cancelled but stopped and joined by stop(),
+    // so they use their own threads instead of the component thread
+    if (threaded) {
+        for (unsigned int i = 0; i < shards.size(); i++) {
+            procShard_t *shard = shards[i];
+
+            if (!shard->running) {
+                __atomic_store_n(&shard->stopping, 0, __ATOMIC_RELEASE);
+                int res = threadCreate(&shard->thread, shardThreadFunc, shard);
+                if (res != 0) {
+                    throw Error("Cannot create QoS processor worker %d: %s",
+                                shard->id, strerror(res));
+                }
+                shard->running = 1;
+            }
+        }
+    }
+#endif
 }
 
-void QOSProcessor::main()
+
+void QOSProcessor::stop()
 {
+#ifdef ENABLE_THREADS
+    if (threaded) {
+        for (unsigned int i = 0; i < shards.size(); i++) {
+            procShard_t *shard = shards[i];
+
+            if (shard->running) {
+                __atomic_store_n(&shard->stopping, 1, __ATOMIC_RELEASE);
 
-    // this function will be run as a single thread inside the QOS processor
-    log->log(ch, "QoS Processor thread running");
+                // wake up the worker if it is waiting for events
+                uint64_t one = 1;
+                if (write(shard->wakeFd, &one, sizeof(one)) < 0) {
+                    log->elog(ch, "cannot signal QoS processor thread: %s", strerror(errno));
+                }
+            }
+        }
 
-    // Sleeps 10 milliseconds.
-    unsigned int microseconds = 10000;
-    for (;;) {
-        handleFDEvent(NULL, NULL,NULL, NULL);
-        usleep(microseconds);
+        for (unsigned int i = 0; i < shards.size(); i++) {
+            procShard_t *shard = shards[i];
+
+            if (shard->running) {
+                threadJoin(shard->thread);
+                shard->running = 0;
+            }
+        }
     }
+#endif
+
+    QualityManagerComponent::stop();
 }
 
+
 void QOSProcessor::waitUntilDone(void)
 {
 #ifdef ENABLE_THREADS
     AUTOLOCK(threaded, &maccess);
 
     if (threaded) {
-      while ((out_events.size() > 0) || (in_events.size() > 0) ) {
+      while (!isIdle()) {
         threadCondWait(&doneCond, &maccess);
       }
     }
@@ -937,10 +2081,14 @@ unsigned long QOSProcessor::ruleTimeout(int ruleID, unsigned long ival, time_t n
 {
     AUTOLOCK(threaded, &maccess);
 
-    time_t last = rules[ruleID].lastPkt;
+    ruleActions_t *ra = rules.find(ruleID);
 
-    if (last > 0) {
-        ruleActions_t *ra = &rules[ruleID];
+    if (ra == NULL) {
+        log->dlog(ch, "rule uid %d is not active", ruleID);
+        return 1;
+    }
+
+    if (ra->lastPkt > 0) {
 		 log->dlog(ch,"auto flow idle, export: YES");
          return 0;
     }
@@ -977,12 +2125,49 @@ string QOSProcessor::getInfo()
 
     s << loader->getInfo();  // get the list of loaded modules
 
+    for (procShardListIter_t i = shards.begin(); i != shards.end(); i++) {
+        procShard_t *shard = *i;
+
+        s << "worker " << shard->id << ": processed events: " << shard->processed << endl;
+
+        if (threaded) {
+            s << "wakeups: " << shard->wstats.wakeups
+              << ", avg wakeup latency: "
+              << ((shard->wstats.wakeups > 0) ? (shard->wstats.totalLatency / shard->wstats.wakeups) : 0) << " us"
+              << ", max wakeup latency: " << shard->wstats.maxLatency << " us" << endl;
+
+            s << "module timers pending: " << shard->timers->size()
+              << ", expired: " << shard->expired << endl;
+        }
+
+        s << "input queue depth: " << shard->queue->size()
+          << ", high-water mark: " << shard->queue->highWaterMark()
+          << ", capacity: " << shard->queue->capacity()
+          << ", rejected: " << shard->queue->numRejected() << endl;
+    }
+
+    s << "output queue depth: " << out_events->size()
+      << ", high-water mark: " << out_events->highWaterMark()
+      << ", capacity: " << out_events->capacity()
+      << ", rejected: " << out_events->numRejected() << endl;
+
+    unsigned long heap = getEventAllocCount(&eventAllocStats.heapAllocs);
+    unsigned long tasks = getEventAllocCount(&eventAllocStats.addTasks);
+
+    s << "event allocations: " << heap
+      << ", pool reuses: " << getEventAllocCount(&eventAllocStats.poolReuses)
+      << ", per add_task: " << ((tasks > 0) ? (double) heap / tasks : 0) << endl;
+
+    s << "rule batches: " << getEventAllocCount(&eventAllocStats.batches)
+      << ", shared: " << getEventAllocCount(&eventAllocStats.batchShares)
+      << ", copied on delete: " << getEventAllocCount(&eventAllocStats.batchCopies) << endl;
+
     return s.str();
 }
 
 /* -------------------- addTimerEvents -------------------- */
 
-void QOSProcessor::addTimerEvents( int ruleID, int actID, ppaction_t &act, EventScheduler &es )
+void QOSProcessor::addTimerEvents( int ruleID, unsigned int gen, int actID, ppaction_t &act, EventScheduler &es )
 {
     timers_t *timers = (act.mapi)->getTimers(act.flowData);
 
@@ -992,7 +2177,7 @@ void QOSProcessor::addTimerEvents( int ruleID, int actID, ppaction_t &act, Event
 			log->log(ch, "ival:%d", (int) timers->ival_msec);
 			unsigned int duration = (timers->ival_msec / 1000);
 			unsigned int duration_msec = (timers->ival_msec % 1000);
-			Event *evt = new ProcTimerEvent(ruleID, actID, timers->id, (time_t) duration, (time_t) duration_msec, timers->flags);
+			Event *evt = new ProcTimerEvent(ruleID, actID, timers->id, (time_t) duration, (time_t) duration_msec, timers->flags, gen);
 			struct timeval tv = evt->getTime();
 			log->log(ch, "Creating a new timer event %s", ctime((const time_t *) &tv.tv_sec) );
             es.addEvent(evt);
@@ -1002,19 +2187,50 @@ void QOSProcessor::addTimerEvents( int ruleID, int actID, ppaction_t &act, Event
 }
 
 
-void QOSProcessor::addTimerEvents( int ruleID, int actID, ppaction_t &act )
+void QOSProcessor::addTimerEvents( int ruleID, unsigned int gen, int actID, ppaction_t &act )
 {
     timers_t *timers = (act.mapi)->getTimers(act.flowData);
 
+#ifdef ENABLE_THREADS
+    if (threaded && (timers != NULL)) {
+        // the timers go to the worker owning the flow data, whose lock
+        // the caller holds
+        procShard_t *shard = getModuleShard(act.module->getModName());
+        struct timeval now;
+        Timeval::gettimeofdayown(&now, NULL);
+
+        while (timers->flags != TM_END)
+        {
+            procTimer_t t;
+            t.rid = ruleID;
+            t.actid = actID;
+            t.tmID = timers->id;
+            t.gen = gen;
+
+            shard->timers->add(t, timers->ival_msec, now.tv_sec * 1000000ULL + now.tv_usec);
+            log->dlog(ch, "worker %d: timer for rule %d action %d in %d msec",
+                      shard->id, ruleID, actID, (int) timers->ival_msec);
+            timers++;
+        }
+
+        // the worker may be sleeping until a later timer
+        uint64_t one = 1;
+        if (write(shard->wakeFd, &one, sizeof(one)) < 0) {
+            log->elog(ch, "cannot signal QoS processor thread: %s", strerror(errno));
+        }
+        return;
+    }
+#endif
+
     if (timers != NULL) {
         while (timers->flags != TM_END)
         {
 			unsigned int duration = (timers->ival_msec / 1000);
 			unsigned int duration_msec = (timers->ival_msec % 1000);
-			Event *evt = new ProcTimerEvent(ruleID, actID, timers->id, (time_t) duration, (time_t) duration_msec, timers->flags);
+			Event *evt = new ProcTimerEvent(ruleID, actID, timers->id, (time_t) duration, (time_t) duration_msec, timers->flags, gen);
 			struct timeval tv = evt->getTime();
 			log->log(ch, "Creating a new timer event %s", ctime((const time_t *) &tv.tv_sec) );
-            out_events.push_back(evt);
+            pushOutEvent(evt);
             timers++;
         }
     }
@@ -1023,47 +2239,66 @@ void QOSProcessor::addTimerEvents( int ruleID, int actID, ppaction_t &act )
 
 
 // handle module timeouts
-void QOSProcessor::timeout(int rid, int actid, unsigned int tmID)
+void QOSProcessor::timeout(int rid, int actid, unsigned int tmID, unsigned int gen)
 {
-    ppaction_t *a;
-    ruleActions_t *ra;
+    ppaction_t a;
+    Rule *r = NULL;
 
     log->log(ch, "starting timeout");
 
+    {
+        AUTOLOCK(threaded, &maccess);
 
-    AUTOLOCK(threaded, &maccess);
+        ruleActions_t *ra = rules.find(rid);
+        ppaction_t *ai = (ra != NULL) ? ra->getAction(actid) : NULL;
 
-    ra = &rules[rid];
-	Rule *r = ra->rule;
-    a = &(ra->actions[actid]);
+        if ((ai != NULL) && (gen != 0) && (gen != ra->gen)) {
+            // the uid belongs to a newer rule by now
+            log->dlog(ch, "dropping timer of an old rule with uid %d", rid);
+            ai = NULL;
+        }
+
+        if (ai != NULL) {
+            r = ra->rule;
+            a = *ai;
+            ai->module = NULL;
+        }
+    }
 
-	if ((r != NULL) and (a != NULL))
+	if (r != NULL)
 	{
 
 		try
 		{
-			assert (a->flowid > 0);
-			idSource.freeId(a->flowid);
+			assert (a.flowid > 0);
+			{
+			    AUTOLOCK(threaded, &maccess);
+			    idSource.freeId(a.flowid);
+			}
 
 			// dismantle flow data structure with module function
-			a->mapi->destroyFlowSetup(rid, actid, a->params, r->getFilter(), a->flowData );
+			{
+			    SHARDLOCK(threaded, getModuleShard(a.module->getModName()));
+			    a.mapi->destroyFlowSetup(rid, actid, a.params, r->getFilter(), a.flowData );
+			}
 
 			log->log(ch, "Sucessfully destroy the flow setup");
 
-			if (a->params != NULL) {
-				saveDeleteArr(a->params);
-				a->params = NULL;
+			if (a.params != NULL) {
+				ConfigManager::freeParamList(a.params);
+				a.params = NULL;
 			}
 		} catch (ProcError &err){
 			log->elog(ch, err);
 		}
 
 		// release modules loaded for this rule
-		loader->releaseModule(a->module);
+		{
+		    AUTOLOCK(threaded, &maccess);
+		    loader->releaseModule(a.module);
+		}
 
 		log->log(ch, "After sucessfully release the module");
-
-		(ra->actions).erase(actid);
 	}
 
 	log->log(ch, "Ending timeout");
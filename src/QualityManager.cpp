@@ -28,6 +28,7 @@
 #include "QualityManager.h"
 #include "ParserFcts.h"
 #include "constants_qos.h"
+#include <sys/timerfd.h>
 
 
 // globals in QualityManager class
@@ -51,7 +52,7 @@ static inline char *noNewline( char* s )
 /* ------------------------- QualityManager ------------------------- */
 
 QualityManager::QualityManager( int argc, char *argv[])
-    :  pprocThread(0)
+    :  timerFd(-1), pprocThread(0), groupWindow(0), addGroup(NULL), removeGroup(NULL)
 {
 
     // record meter start time for later output
@@ -65,8 +66,19 @@ QualityManager::QualityManager( int argc, char *argv[])
 
         fdList[make_fd(s_sigpipe[0], FD_RD)] = NULL;
 
-        // the read fd must not block
+        // neither end must block, the QoS processor workers signal
+        // through it while holding their locks
         fcntl(s_sigpipe[0], F_SETFL, O_NONBLOCK);
+        fcntl(s_sigpipe[1], F_SETFL, O_NONBLOCK);
+
+        // scheduled events are signalled by a timer fd armed with the
+        // absolute expiry of the next event
+        timerFd = timerfd_create(CLOCK_REALTIME, TFD_NONBLOCK | TFD_CLOEXEC);
+        if (timerFd < 0) {
+            throw Error("failed to create event timer: %s", strerror(errno));
+        }
+        timerArmed.tv_sec = timerArmed.tv_usec = 0;
+        fdList[make_fd(timerFd, FD_RD)] = NULL;
 
         // install signal handlers
         signal(SIGINT, sigint_handler);
@@ -185,7 +197,7 @@ QualityManager::QualityManager( int argc, char *argv[])
         auto_ptr<RuleManager> _rulm(new RuleManager(conf->getValue("FilterDefFile", "MAIN"),
                                                     conf->getValue("FilterConstFile", "MAIN")));
         rulm = _rulm;
-        auto_ptr<EventScheduler> _evnt(new EventScheduler());
+        auto_ptr<EventScheduler> _evnt(new EventScheduler(conf->isTrue("TimerWheel", "MAIN")));
         evnt = _evnt;
 
         // startup Quality components
@@ -220,6 +232,12 @@ QualityManager::QualityManager( int argc, char *argv[])
         }
 		enableCtrl = conf->isTrue("Enable", "CONTROL");
 
+        // merging requests only pays off with a processor thread
+        string gcw = conf->getValue("GroupCommitWindow", "MAIN");
+        if (!gcw.empty() && pprocThread) {
+            groupWindow = ParserFcts::parseULong(gcw, 0, 10000);
+        }
+
 		if (enableCtrl) {
 			// ctrlcomm can never be a separate thread
 			auto_ptr<CtrlComm> _comm(new CtrlComm(conf.get(), 0));
@@ -242,6 +260,10 @@ QualityManager::QualityManager( int argc, char *argv[])
 QualityManager::~QualityManager()
 {
     // objects are destroyed by their auto ptrs
+
+    if (timerFd >= 0) {
+        close(timerFd);
+    }
 }
 
 
@@ -276,12 +298,12 @@ string QualityManager::getHelloMsg()
 
 /* -------------------- getInfo -------------------- */
 
-string QualityManager::getInfo(infoType_t what, string param)
+string QualityManager::getInfo(infoType_t what, string param, int limit)
 {
     time_t uptime;
     ostringstream s;
+    string next;
 
-    s << "<info name=\"" << QualityManagerInfo::getInfoString(what) << "\" >";
 
     switch (what) {
     case I_QUALITYMANAGER_VERSION:
@@ -304,7 +326,8 @@ string QualityManager::getInfo(infoType_t what, string param)
         s << getHelloMsg();
         break;
     case I_TASKLIST:
-        s << CtrlComm::xmlQuote(rulm->getInfo());
+        // param is the cursor returned as next with the previous page
+        s << CtrlComm::xmlQuote(rulm->getInfo(param, limit, next));
         break;
     case I_TASK:
         if (param.empty()) {
@@ -318,6 +341,18 @@ string QualityManager::getInfo(infoType_t what, string param)
             }
         }
         break;
+    case I_QOSPROCESSOR:
+        s << CtrlComm::xmlQuote(proc->getInfo());
+        break;
+    case I_SSL_HANDSHAKES:
+        {
+            struct ssl_stats stats;
+
+            httpd_get_ssl_stats(&stats);
+            s << "full " << stats.full << ", resumed " << stats.resumed
+              << ", failed " << stats.failed;
+        }
+        break;
     case I_NUMQUALITYMANAGERINFOS:
     default:
         return string();
@@ -325,7 +360,11 @@ string QualityManager::getInfo(infoType_t what, string param)
 
     s << "</info>" << endl;
 
-    return s.str();
+    if (!next.empty()) {
+        return "<info name=\"" + QualityManagerInfo::getInfoString(what) +
+            "\" next=\"" + CtrlComm::xmlQuote(next) + "\" >" + s.str();
+    }
+    return "<info name=\"" + QualityManagerInfo::getInfoString(what) + "\" >" + s.str();
 }
 
 
@@ -337,7 +376,7 @@ string QualityManager::getQualityManagerInfo(infoList_t *i)
     s << "<QualityManagerInfos>\n";
 
     for (iter = i->begin(); iter != i->end(); iter++) {
-        s << getInfo(iter->type, iter->param);
+        s << getInfo(iter->type, iter->param, iter->limit);
     }
 
     s << "</QualityManagerInfos>\n";
@@ -358,9 +397,21 @@ void QualityManager::handlerGetInfo(Event *e, fd_sets_t *fds)
 #endif
 
         infoList_t *i = ((GetInfoEvent *)e)->getInfos();
+        struct REQUEST *req = ((GetInfoEvent *)e)->getReq();
+
+        if (QualityManagerInfo::isRuleInfo(i)) {
+            // pollers of the task list only get a reply when it changed
+            ostringstream etag;
+            etag << "\"" << startTime << "-" << rulm->getVersion() << "\"";
+
+            if (comm->checkETag(req, etag.str(), fds)) {
+                e->setState(EV_DONE);
+                return;
+            }
+        }
 
         // send meter info
-        comm->sendMsg(getQualityManagerInfo(i), ((GetInfoEvent *)e)->getReq(), fds, 0 /* do not html quote */ );
+        comm->sendMsg(getQualityManagerInfo(i), req, fds, 0 /* do not html quote */ );
     }
     catch(Error &err)
     {
@@ -449,21 +500,18 @@ void QualityManager::handlerAddRulesThreaded(Event *e, fd_sets_t *fds)
         // support only XML rules from file
         new_rules = rulm->parseRules(((AddRulesEvent *)e)->getFileName());
 
-        ruleDB_t rules;
-        ruleDBIter_t it;
-        for (it = new_rules->begin(); it != new_rules->end(); ++it)
-        {
-            rules.push_back(*it);
-        }
-
-        // test rule spec
-        Event * evt = new checkRulesQoSProcessorEvent(rules);
+        // test rule spec, the batch takes over the parsed rules
+        Event * evt = new checkRulesQoSProcessorEvent(RuleBatch::adopt(*new_rules));
         evt->setParent(e);
-        e->setState(EV_PROCESSING);
-        unsigned long ival = 1000; // Next revision interval
-        e->setInterval(ival);
 
-        proc->addEvent(evt);
+        if (proc->addEvent(evt) < 0) {
+            // nobody else holds the batch yet, take the rules back
+            new_rules->swap(*((checkRulesQoSProcessorEvent *)evt)->getBatch()->getRules());
+            saveDelete(evt);
+            throw Error("QoS processor queue full");
+        }
+        // parked until the response resumes it
+        e->setState(EV_PROCESSING);
 
         // Delete the container created by the parseRules function.
         saveDelete(new_rules);
@@ -475,15 +523,8 @@ void QualityManager::handlerAddRulesThreaded(Event *e, fd_sets_t *fds)
     {
         // error in rule(s)
         if (new_rules) {
-
             // Delete the memory for the rules objects created.
-            ruleDBIter_t it;
-            for (it = new_rules->begin(); it != new_rules->end(); ++it)
-            {
-                Rule *rule = *it;
-                saveDelete(rule);
-            }
-
+            rulm->discardRules(new_rules);
             saveDelete(new_rules);
         }
         e->setState(EV_DONE);
@@ -503,7 +544,7 @@ void QualityManager::handlerAddRulesCntrlCommNonThreads(Event *e, fd_sets_t *fds
 
         new_rules = rulm->parseRulesBuffer(
                 ((AddRulesCtrlEvent *)e)->getBuf(),
-                ((AddRulesCtrlEvent *)e)->getLen(), ((AddRulesCtrlEvent *)e)->isMAPI());
+                ((AddRulesCtrlEvent *)e)->getLen(), ((AddRulesCtrlEvent *)e)->getFormat());
 
 
     }
@@ -513,7 +554,7 @@ void QualityManager::handlerAddRulesCntrlCommNonThreads(Event *e, fd_sets_t *fds
         if (new_rules) {
             saveDelete(new_rules);
         }
-        comm->sendErrMsg(err.getError(), ((AddRulesCtrlEvent *)e)->getReq(), fds);
+        comm->sendErrMsg(err.getError(), (CtrlCommEvent *) e, fds);
         e->setState(EV_DONE);
         return;
     }
@@ -531,7 +572,7 @@ void QualityManager::handlerAddRulesCntrlCommNonThreads(Event *e, fd_sets_t *fds
 		log->dlog(ch,"rules sucessfully inserted in the rule management");
 
         // Response to the entity triggering the event.
-        comm->sendMsg("rule(s) added", ((AddRulesCtrlEvent *)e)->getReq(), fds);
+        comm->sendMsg("rule(s) added", (CtrlCommEvent *) e, fds);
 
         saveDelete(new_rules);
 
@@ -543,7 +584,7 @@ void QualityManager::handlerAddRulesCntrlCommNonThreads(Event *e, fd_sets_t *fds
         if (new_rules) {
             saveDelete(new_rules);
         }
-        comm->sendErrMsg(err.getError(), ((AddRulesCtrlEvent *)e)->getReq(), fds);
+        comm->sendErrMsg(err.getError(), (CtrlCommEvent *) e, fds);
     }
 
     e->setState(EV_DONE);
@@ -563,13 +604,13 @@ void QualityManager::handlerAddRulesCntrlCommThreaded(Event *e, fd_sets_t *fds)
         // support only XML rules from file
         new_rules = rulm->parseRulesBuffer(
                         ((AddRulesCtrlEvent *)e)->getBuf(),
-                        ((AddRulesCtrlEvent *)e)->getLen(), ((AddRulesCtrlEvent *)e)->isMAPI());
+                        ((AddRulesCtrlEvent *)e)->getLen(), ((AddRulesCtrlEvent *)e)->getFormat());
 
     }
     catch (Error &err)
     {
         e->setState(EV_DONE);
-        comm->sendErrMsg(err.getError(), ((AddRulesCtrlEvent *)e)->getReq(), fds);
+        comm->sendErrMsg(err.getError(), (CtrlCommEvent *) e, fds);
         e->setState(EV_DONE);
         return;
     }
@@ -577,21 +618,25 @@ void QualityManager::handlerAddRulesCntrlCommThreaded(Event *e, fd_sets_t *fds)
     try
     {
 
-        ruleDB_t rules;
-        ruleDBIter_t it;
-        for (it = new_rules->begin(); it != new_rules->end(); ++it)
-        {
-            rules.push_back(*it);
+        if (groupWindow > 0) {
+            // checked together with the requests arriving within the window
+            joinGroupCommit(addGroup, ADD_RULES_CTRLCOMM, (CtrlCommEvent *)e, *new_rules);
+            saveDelete(new_rules);
+            return;
         }
 
-        // test rule spec
-        Event * evt = new checkRulesQoSProcessorEvent(rules);
+        // test rule spec, the batch takes over the parsed rules
+        Event * evt = new checkRulesQoSProcessorEvent(RuleBatch::adopt(*new_rules));
         evt->setParent(e);
-        e->setState(EV_PROCESSING);
-        unsigned long ival = 1000; // Next revision interval
-        e->setInterval(ival);
 
-        proc->addEvent(evt);
+        if (proc->addEvent(evt) < 0) {
+            // nobody else holds the batch yet, take the rules back
+            new_rules->swap(*((checkRulesQoSProcessorEvent *)evt)->getBatch()->getRules());
+            saveDelete(evt);
+            throw Error("QoS processor queue full");
+        }
+        // parked until the response resumes it
+        e->setState(EV_PROCESSING);
 
         // Delete the container created by the parseRules function.
         saveDelete(new_rules);
@@ -601,19 +646,12 @@ void QualityManager::handlerAddRulesCntrlCommThreaded(Event *e, fd_sets_t *fds)
     {
         // error in rule(s)
         if (new_rules) {
-
             // Delete the memory for the rules objects created.
-            ruleDBIter_t it;
-            for (it = new_rules->begin(); it != new_rules->end(); ++it)
-            {
-                Rule *rule = *it;
-                saveDelete(rule);
-            }
-
+            rulm->discardRules(new_rules);
             saveDelete(new_rules);
         }
         e->setState(EV_DONE);
-        comm->sendErrMsg(err.getError(), ((AddRulesCtrlEvent *)e)->getReq(), fds);
+        comm->sendErrMsg(err.getError(), (CtrlCommEvent *) e, fds);
     }
 }
 
@@ -649,15 +687,22 @@ void QualityManager::handlerActivateRulesThreaded(Event *e, fd_sets_t *fds)
 
     try
     {
-        ruleDB_t *rules = ((ActivateRulesEvent *)e)->getRules();
+        // the processor works on the same batch
+        RuleBatch *batch = ((ActivateRulesEvent *)e)->getBatch();
 
-        Event * evt = new addRulesQoSProcesorEvent(*rules);
+        Event * evt = new addRulesQoSProcesorEvent(batch->ref());
         evt->setParent(e);
-        e->setState(EV_PROCESSING);
-        unsigned long ival = 1000; // Next revision interval
-        e->setInterval(ival);
 
-        proc->addEvent(evt);
+        if (proc->addEvent(evt) < 0) {
+            // the activation must not get lost, try again shortly
+            saveDelete(evt);
+            retryEvent(e);
+            log->wlog(ch, "QoS processor busy, activation of %d rule(s) delayed",
+                      batch->size());
+            return;
+        }
+        // parked until the response resumes it
+        e->setState(EV_PROCESSING);
     }
     catch(Error &err)
     {
@@ -697,17 +742,22 @@ void QualityManager::handlerRemoveRulesThreaded(Event *e, fd_sets_t *fds)
 
     try
     {
-        ruleDB_t *rules = ((RemoveRulesEvent *)e)->getRules();
-
+        // the processor works on the same batch
+        RuleBatch *batch = ((RemoveRulesEvent *)e)->getBatch();
 
-        Event *evt = new delRulesQoSProcesorEvent(*rules);
+        Event *evt = new delRulesQoSProcesorEvent(batch->ref());
         evt->setParent(e);
-        e->setState(EV_PROCESSING);
-        unsigned long ival = 1000; // Next revision interval
-        e->setInterval(ival);
-
-        proc->addEvent(evt);
 
+        if (proc->addEvent(evt) < 0) {
+            // the removal must not get lost, try again shortly
+            saveDelete(evt);
+            retryEvent(e);
+            log->wlog(ch, "QoS processor busy, removal of %d rule(s) delayed",
+                      batch->size());
+            return;
+        }
+        // parked until the response resumes it
+        e->setState(EV_PROCESSING);
     }
 
     catch(Error &err)
@@ -755,25 +805,17 @@ void QualityManager::handlerRemoveRulesCntrlCommNonThreaded(Event *e, fd_sets_t
               log->dlog(ch,"Deleting rule set=%s ", r.c_str() );
 #endif
               // delete rule set
-              ruleIndex_t *ruleset = rulm->getRules(r);
-              if (ruleset == NULL) {
-                  throw Error("no such rule set");
-              }
-
-              for (ruleIndexIter_t i = ruleset->begin(); i != ruleset->end(); i++) {
-                  Rule *rptr = rulm->getRule(i->second);
-                  rules.push_back(rptr);
-              }
+              rulm->getRules(r, rules);
            }
 
            proc->delRules(&rules, evnt.get());
            rulm->delRules(&rules, evnt.get());
 
-           comm->sendMsg("rule(s) deleted", ((RemoveRulesCtrlEvent *)e)->getReq(), fds);
+           comm->sendMsg("rule(s) deleted", (CtrlCommEvent *) e, fds);
     }
     catch (Error &err)
     {
-        comm->sendErrMsg(err.getError(), ((RemoveRulesCtrlEvent *)e)->getReq(), fds);
+        comm->sendErrMsg(err.getError(), (CtrlCommEvent *) e, fds);
     }
 
     e->setState(EV_DONE);
@@ -817,31 +859,30 @@ void QualityManager::handlerRemoveRulesCntrlCommThreaded(Event *e, fd_sets_t *fd
               log->dlog(ch,"Deleting rule set=%s ", r.c_str() );
 #endif
               // delete rule set
-              ruleIndex_t *ruleset = rulm->getRules(r);
-              if (ruleset == NULL) {
-                  throw Error("no such rule set");
-              }
-
-              for (ruleIndexIter_t i = ruleset->begin(); i != ruleset->end(); i++) {
-                  Rule *rptr = rulm->getRule(i->second);
-                  rules.push_back(rptr);
-              }
+              rulm->getRules(r, rules);
          }
 
-        Event * evt = new delRulesQoSProcesorEvent(rules) ;
+        if (groupWindow > 0) {
+            // deleted together with the requests arriving within the window
+            joinGroupCommit(removeGroup, REMOVE_RULES_CTRLCOMM, (CtrlCommEvent *)e, rules);
+            return;
+        }
+
+        Event * evt = new delRulesQoSProcesorEvent(RuleBatch::adopt(rules));
         evt->setParent(e);
-        e->setState(EV_PROCESSING);
-        unsigned long ival = 1000; // Next revision interval
-        e->setInterval(ival);
-        e->advance();
 
-        proc->addEvent(evt);
+        if (proc->addEvent(evt) < 0) {
+            saveDelete(evt);
+            throw Error("QoS processor queue full");
+        }
+        // parked until the response resumes it
+        e->setState(EV_PROCESSING);
 
     }
     catch (Error &err)
     {
         e->setState(EV_DONE);
-        comm->sendErrMsg(err.getError(), ((RemoveRulesCtrlEvent *)e)->getReq(), fds);
+        comm->sendErrMsg(err.getError(), (CtrlCommEvent *) e, fds);
     }
 }
 
@@ -856,7 +897,7 @@ void QualityManager::handlerProcTimerNonThreaded(Event *e, fd_sets_t *fds)
     try
     {
         proc->timeout(((ProcTimerEvent *)e)->getRID(), ((ProcTimerEvent *)e)->getAID(),
-                      ((ProcTimerEvent *)e)->getTID());
+                      ((ProcTimerEvent *)e)->getTID(), ((ProcTimerEvent *)e)->getGen());
 
     }
     catch (Error &err)
@@ -875,7 +916,18 @@ void QualityManager::handlerProcTimerThreaded(Event *e, fd_sets_t *fds)
     log->dlog(ch,"processing event proc module timer" );
 #endif
 
-    // FIXME: Code not implemented yet.
+    // module timers are normally kept and expired by the QoS processor
+    // workers; a timer that still ends up here is handled right away,
+    // QOSProcessor::timeout takes the locks it needs
+    try
+    {
+        proc->timeout(((ProcTimerEvent *)e)->getRID(), ((ProcTimerEvent *)e)->getAID(),
+                      ((ProcTimerEvent *)e)->getTID(), ((ProcTimerEvent *)e)->getGen());
+    }
+    catch (Error &err)
+    {
+        log->elog(ch,(string("error processing PROC TIMER") + err.getError()).c_str() );
+    }
 
     e->setState(EV_DONE);
 }
@@ -891,16 +943,14 @@ void QualityManager::handlerResponseAddRulesQoSProcessor(Event *e, fd_sets_t *fd
         // get the parent event and put it on done
         ActivateRulesEvent *evtParent = dynamic_cast<ActivateRulesEvent *>(evt->getParent());
         if (evtParent != NULL){
-            evtParent->setInterval(0);
-            evtParent->setState(EV_DONE);
+            evnt->resumeEvent(evtParent);
         }
     }
     catch (Error &err)
     {
         ActivateRulesEvent *evtParent = dynamic_cast<ActivateRulesEvent *>(evt->getParent());
         if (evtParent != NULL){
-            evtParent->setInterval(0);
-            evtParent->setState(EV_DONE);
+            evnt->resumeEvent(evtParent);
         }
         log->elog(ch, (string("error processing ACTIVATE_RULES") + err.getError()).c_str() );
     }
@@ -918,7 +968,14 @@ void QualityManager::handlerResponseCheckRulesQoSProcessor(Event *e, fd_sets_t *
 
     respCheckRulesQoSProcessorEvent *evt = static_cast<respCheckRulesQoSProcessorEvent *>(e);
 
-    if (dynamic_cast<AddRulesEvent*>(evt->getParent()))
+    if (dynamic_cast<GroupCommitEvent*>(evt->getParent()))
+    {
+        log->dlog(ch,"Previous event group commit event");
+
+        completeAddGroup(dynamic_cast<GroupCommitEvent*>(evt->getParent()), fds);
+    }
+
+    else if (dynamic_cast<AddRulesEvent*>(evt->getParent()))
     {
 
         log->dlog(ch,"Previous event Add rules event");
@@ -932,13 +989,11 @@ void QualityManager::handlerResponseCheckRulesQoSProcessor(Event *e, fd_sets_t *
             // and removal
             rulm->addRules(evt->getRules(), evnt.get());
 
-            evtParent->setInterval(0);
-            evtParent->setState(EV_DONE);
+            evnt->resumeEvent(evtParent);
         }
         catch( Error &err)
         {
-            evtParent->setInterval(0);
-            evtParent->setState(EV_DONE);
+            evnt->resumeEvent(evtParent);
             log->elog(ch, (string("error processing ADD_RULES") + err.getError()).c_str() );
         }
     }
@@ -958,16 +1013,14 @@ void QualityManager::handlerResponseCheckRulesQoSProcessor(Event *e, fd_sets_t *
             rulm->addRules(evt->getRules(), evnt.get());
 
             // Response to the entity triggering the event.
-            comm->sendMsg("rule(s) added", evtParent->getReq(), fds);
+            comm->sendMsg("rule(s) added", evtParent, fds);
 
-            evtParent->setInterval(0);
-            evtParent->setState(EV_DONE);
+            evnt->resumeEvent(evtParent);
         }
         catch( Error &err)
         {
-            evtParent->setInterval(0);
-            evtParent->setState(EV_DONE);
-            comm->sendErrMsg(err.getError(), evtParent->getReq(), fds);
+            comm->sendErrMsg(err.getError(), evtParent, fds);
+            evnt->resumeEvent(evtParent);
         }
     }
 
@@ -988,7 +1041,12 @@ void QualityManager::handlerResponseDelRulesQoSProcessor(Event *e, fd_sets_t *fd
     respDelRulesQoSProcesorEvent *evt = static_cast<respDelRulesQoSProcesorEvent *>(e);
 
 
-    if (dynamic_cast<RemoveRulesEvent*>(evt->getParent()))
+    if (dynamic_cast<GroupCommitEvent*>(evt->getParent()))
+    {
+        completeRemoveGroup(dynamic_cast<GroupCommitEvent*>(evt->getParent()), evt->getRules(), fds);
+    }
+
+    else if (dynamic_cast<RemoveRulesEvent*>(evt->getParent()))
     {
 
         RemoveRulesEvent *evtParent= dynamic_cast<RemoveRulesEvent*>(evt->getParent());
@@ -999,13 +1057,11 @@ void QualityManager::handlerResponseDelRulesQoSProcessor(Event *e, fd_sets_t *fd
             // and removal
             rulm->delRules(evt->getRules(), evnt.get());
 
-            evtParent->setInterval(0);
-            evtParent->setState(EV_DONE);
+            evnt->resumeEvent(evtParent);
         }
         catch( Error &e)
         {
-            evtParent->setInterval(0);
-            evtParent->setState(EV_DONE);
+            evnt->resumeEvent(evtParent);
             log->elog(ch,(string("error processing DELETE_RULES") + e.getError()).c_str() );
         }
     }
@@ -1023,16 +1079,14 @@ void QualityManager::handlerResponseDelRulesQoSProcessor(Event *e, fd_sets_t *fd
             rulm->delRules(evt->getRules(), evnt.get());
 
             // Response to the entity triggering the event.
-            comm->sendMsg("rule(s) deleted", evtParent->getReq(), fds);
+            comm->sendMsg("rule(s) deleted", evtParent, fds);
 
-            evtParent->setInterval(0);
-            evtParent->setState(EV_DONE);
+            evnt->resumeEvent(evtParent);
         }
         catch( Error &e)
         {
-            evtParent->setInterval(0);
-            evtParent->setState(EV_DONE);
-            comm->sendErrMsg(e.getError(), evtParent->getReq(), fds);
+            comm->sendErrMsg(e.getError(), evtParent, fds);
+            evnt->resumeEvent(evtParent);
         }
     }
 
@@ -1045,6 +1099,157 @@ void QualityManager::handlerResponseDelRulesQoSProcessor(Event *e, fd_sets_t *fd
 }
 
 
+/* -------------------- retryEvent -------------------- */
+
+void QualityManager::retryEvent(Event *e)
+{
+    struct timeval now;
+
+    // reschedNextEvent requeues it PROC_QUEUE_RETRY msec from now, the
+    // interval is cleared again by resumeEvent once the work is queued
+    Timeval::gettimeofdayown(&now, NULL);
+    e->setTime(now);
+    e->setInterval(PROC_QUEUE_RETRY);
+}
+
+
+/* -------------------- joinGroupCommit -------------------- */
+
+void QualityManager::joinGroupCommit(GroupCommitEvent *&group, event_t type,
+                                     CtrlCommEvent *e, ruleDB_t &rules)
+{
+    if (group == NULL) {
+        // the first request opens the group and sets its deadline
+        struct timeval now, win;
+
+        Timeval::gettimeofdayown(&now, NULL);
+        win.tv_sec = groupWindow / 1000;
+        win.tv_usec = (groupWindow % 1000) * 1000;
+
+        group = new GroupCommitEvent(type, Timeval::add(now, win));
+        evnt->addEvent(group);
+    }
+
+    group->addMember(e, rules);
+
+    // rules deleted before the group is committed are dropped from it
+    evnt->reindexEvent(group);
+
+    // parked until the response to the group resumes it
+    e->setState(EV_PROCESSING);
+}
+
+
+void QualityManager::handlerGroupCommit(Event *e, fd_sets_t *fds)
+{
+    GroupCommitEvent *group = static_cast<GroupCommitEvent *>(e);
+    GroupCommitEvent::memberList_t *members = group->getMembers();
+    GroupCommitEvent::memberListIter_t m;
+    ruleDB_t rules;
+
+    // the group is closed, later requests open a new one
+    if (group == addGroup) {
+        addGroup = NULL;
+    }
+    if (group == removeGroup) {
+        removeGroup = NULL;
+    }
+
+    // one batch for all requests
+    group->getRules(rules);
+
+    log->dlog(ch,"group commit of %d requests with %d rules",
+              (int) members->size(), (int) rules.size());
+
+    try
+    {
+        Event *evt;
+
+        if (group->getRequestType() == ADD_RULES_CTRLCOMM) {
+            evt = new checkRulesQoSProcessorEvent(RuleBatch::adopt(rules));
+        } else {
+            evt = new delRulesQoSProcesorEvent(RuleBatch::adopt(rules));
+        }
+        evt->setParent(group);
+
+        if (proc->addEvent(evt) < 0) {
+            saveDelete(evt);
+            throw Error("QoS processor queue full");
+        }
+        // parked until the response resumes it
+        group->setState(EV_PROCESSING);
+    }
+    catch (Error &err)
+    {
+        for (m = members->begin(); m != members->end(); m++) {
+            if (group->getRequestType() == ADD_RULES_CTRLCOMM) {
+                // the rules were never stored
+                rulm->discardRules(&m->rules);
+            }
+            comm->sendErrMsg(err.getError(), m->req, fds);
+            evnt->resumeEvent(m->req);
+        }
+        group->setState(EV_DONE);
+    }
+}
+
+
+void QualityManager::completeAddGroup(GroupCommitEvent *group, fd_sets_t *fds)
+{
+    GroupCommitEvent::memberList_t *members = group->getMembers();
+    ruleTimeIndex_t start;
+    ruleTimeIndex_t stop;
+
+    // every request succeeds or fails on its own rules
+    for (GroupCommitEvent::memberListIter_t m = members->begin(); m != members->end(); m++) {
+        try
+        {
+            rulm->storeRules(&m->rules, start, stop);
+
+            comm->sendMsg("rule(s) added", m->req, fds);
+        }
+        catch (Error &err)
+        {
+            comm->sendErrMsg(err.getError(), m->req, fds);
+        }
+        evnt->resumeEvent(m->req);
+    }
+
+    // but the rules are installed in one round
+    rulm->scheduleRules(start, stop, evnt.get());
+
+    evnt->resumeEvent(group);
+}
+
+
+void QualityManager::completeRemoveGroup(GroupCommitEvent *group, ruleDB_t *rules, fd_sets_t *fds)
+{
+    GroupCommitEvent::memberList_t *members = group->getMembers();
+    GroupCommitEvent::memberListIter_t m;
+    string err;
+
+    try
+    {
+        rulm->delRules(rules, evnt.get());
+    }
+    catch (Error &e)
+    {
+        err = e.getError();
+    }
+
+    for (m = members->begin(); m != members->end(); m++) {
+        if (err.empty()) {
+            comm->sendMsg("rule(s) deleted", m->req, fds);
+        } else {
+            comm->sendErrMsg(err, m->req, fds);
+        }
+        evnt->resumeEvent(m->req);
+    }
+
+    evnt->resumeEvent(group);
+}
+
+
 /* -------------------- handleEvent -------------------- */
 void QualityManager::handleEvent(Event *e, fd_sets_t *fds)
 {
@@ -1261,6 +1466,17 @@ void QualityManager::handleEvent(Event *e, fd_sets_t *fds)
       }
       break;
 
+    case GROUP_COMMIT:
+      {
+          log->dlog(ch,"processing event group commit" );
+
+          if (e->getState() == EV_NEW)
+          {
+              handlerGroupCommit(e, fds);
+          }
+      }
+      break;
+
     case RESP_ADD_RULES_QOS_PROCESSOR:
       {
           log->dlog(ch,"processing event response add rule QoS processor" );
@@ -1301,64 +1517,55 @@ void QualityManager::scheduleEvents(eventVec_t *retEvents)
     }
 }
 
-int QualityManager::checkFileDescriptorEvents(eventVec_t *retEvents, fd_set *rset, fd_set *wset, fd_sets_t *fds)
+int QualityManager::checkFileDescriptorEvents(eventVec_t *retEvents, fd_t *ready, int nready, fd_sets_t *fds)
 {
 
-    Event         *e = NULL;
     int            stop = 0;
+    int            i;
 
     log->dlog(ch,"starting checkFileDescriptorEvents");
 
-    if (FD_ISSET( s_sigpipe[0], rset))
-    {
-        // handle sig action
-        char c;
-        if (read(s_sigpipe[0], &c, 1) > 0) {
-            switch (c) {
-                case 'S':
-                    stop = 1;
-                    break;
-                case 'D':
-                    cerr << *this;
-                    break;
-                case 'A':
-                    // next event
-                    // check Event Scheduler events
-                    e = evnt->getNextEvent();
-                    if (e != NULL) {
-                        if (e->getType() == CTRLCOMM_TIMER)
-                        {
-							log->dlog(ch,"handle comm FD event with null read and write file descriptors");
-                            comm->handleFDEvent(retEvents, NULL, NULL, fds);
-                            scheduleEvents(retEvents);
-                        }
-                        else
-                        {
-                            handleEvent(e, fds);
-                        }
-                        // reschedule the event
-                        evnt->reschedNextEvent(e);
-                        e = NULL;
-                    }
-                    break;
-                case 'P':
+    for (i = 0; i < nready; i++) {
+
+        if (ready[i].fd == timerFd)
+        {
+            uint64_t expirations;
+
+            // reset the timer, it is re-armed before the next wait
+            read(timerFd, &expirations, sizeof(expirations));
+            timerArmed.tv_sec = timerArmed.tv_usec = 0;
+
+            processOverdueEvents(retEvents, fds);
+        }
+        else if (ready[i].fd == s_sigpipe[0])
+        {
+            // handle sig action
+            char c;
+            if (read(s_sigpipe[0], &c, 1) > 0) {
+                switch (c) {
+                    case 'S':
+                        stop = 1;
+                        break;
+                    case 'D':
+                        cerr << *this;
+                        break;
+                    case 'P':
 #ifdef ENABLE_THREADS
-                    proc->handleFDEvent(retEvents, NULL, NULL, NULL);
-                    scheduleEvents(retEvents);
-                    log->dlog(ch,"processed handle events from Qos Processor ");
+                        proc->handleFDEvent(retEvents, NULL, 0, NULL);
+                        scheduleEvents(retEvents);
+                        log->dlog(ch,"processed handle events from Qos Processor ");
 #endif
-                    break;
-                default:
-                    throw Error("unknown signal");
+                        break;
+                    default:
+                        throw Error("unknown signal");
+                }
             }
         }
-    }
-    else
-    {
-        if (enableCtrl)
+        else if (enableCtrl)
         {
-            log->dlog(ch,"handle comm FD event with valid read and write file descriptors");
-            comm->handleFDEvent(retEvents, rset, wset, fds);
+            // the listener and all connections registered by httpd
+            log->dlog(ch,"handle comm FD event");
+            comm->handleFDEvent(retEvents, &ready[i], 1, fds);
             scheduleEvents(retEvents);
         }
     }
@@ -1368,32 +1575,94 @@ int QualityManager::checkFileDescriptorEvents(eventVec_t *retEvents, fd_set *rse
     return stop;
 }
 
+/* ------------------------- processOverdueEvents ------------------------- */
+
+int QualityManager::processOverdueEvents(eventVec_t *retEvents, fd_sets_t *fds)
+{
+    struct timeval now;
+    Event *e;
+    int num = 0;
+
+    Timeval::gettimeofdayown(&now, NULL);
+
+    // all events due by now are handled in this one wakeup
+    while ((e = evnt->getNextDueEvent(now)) != NULL) {
+        try {
+            if (e->getType() == CTRLCOMM_TIMER) {
+                log->dlog(ch,"check comm connection timeouts");
+                comm->handleFDEvent(retEvents, NULL, 0, fds);
+                scheduleEvents(retEvents);
+            } else {
+                handleEvent(e, fds);
+            }
+        } catch (Error &err) {
+            saveDelete(e);
+            throw err;
+        }
+
+        // reschedule the event
+        evnt->reschedNextEvent(e);
+        num++;
+    }
+
+    return num;
+}
+
+
+/* ------------------------- armTimer ------------------------- */
+
+void QualityManager::armTimer()
+{
+    struct timeval expiry;
+    struct itimerspec its;
+
+    if (!evnt->getNextEventExpiry(&expiry)) {
+        expiry.tv_sec = expiry.tv_usec = 0;
+    }
+
+    // only touch the timer if the next expiry has changed
+    if (Timeval::cmp(expiry, timerArmed) == 0) {
+        return;
+    }
+
+    memset(&its, 0, sizeof(its));
+    // an all-zero value disarms the timer
+    its.it_value.tv_sec = expiry.tv_sec;
+    its.it_value.tv_nsec = expiry.tv_usec * 1000;
+
+    if (timerfd_settime(timerFd, TFD_TIMER_ABSTIME, &its, NULL) < 0) {
+        throw Error("cannot arm event timer: %s", strerror(errno));
+    }
+    timerArmed = expiry;
+}
+
+
 /* ----------------------- run ----------------------------- */
 
 void QualityManager::run()
 {
     fdListIter_t   iter;
-    fd_set         rset, wset;
     fd_sets_t      fds;
-    struct timeval tv;
+    fd_t           ready[REACTOR_MAX_EVENTS];
     int            cnt = 0;
     int            stop = 0;
     eventVec_t     retEvents;
     Event         *e = NULL;
 
+    fds.epfd = -1;
+
     try {
-        // fill the fd set
-        FD_ZERO(&fds.rset);
-        FD_ZERO(&fds.wset);
+        if (reactor_init(&fds) < 0) {
+            throw Error("cannot create epoll instance: %s", strerror(errno));
+        }
+
+        // our own descriptors are level-triggered, the connections
+        // accepted later are registered edge-triggered by httpd
         for (iter = fdList.begin(); iter != fdList.end(); iter++) {
-            if ((iter->first.mode == FD_RD) || (iter->first.mode == FD_RW)) {
-                FD_SET(iter->first.fd, &fds.rset);
-            }
-            if ((iter->first.mode == FD_WT) || (iter->first.mode == FD_RW)) {
-                FD_SET(iter->first.fd, &fds.wset);
+            if (reactor_add(&fds, iter->first.fd, iter->first.mode, 0) < 0) {
+                throw Error("cannot register fd %d: %s", iter->first.fd, strerror(errno));
             }
         }
-        fds.max = fdList.begin()->first.fd;
 
 
         // register a timer for ctrlcomm (only online capturing)
@@ -1412,30 +1681,26 @@ void QualityManager::run()
 
         do {
 
-			// select
-            rset = fds.rset;
-            wset = fds.wset;
-
-			tv = evnt->getNextEventTime();
+            // the timer fd wakes us up when the next event is due
+            armTimer();
 
-            //cerr << "timeout: " << tv.tv_sec*1e6+tv.tv_usec << endl;
-
-            // note: under most unix the minimal sleep time of select is
-            // 10ms which means an event may be executed 10ms after expiration!
-            if ((cnt = select(fds.max+1, &rset, &wset, NULL, &tv)) < 0)
+            // without a processor thread, do not sleep while events are
+            // still queued in the processor
+            if ((cnt = reactor_wait(&fds, ready, REACTOR_MAX_EVENTS,
+                                    (!pprocThread && !proc->isIdle()) ? 0 : -1)) < 0)
             {
                  if (errno != EINTR) {
-					throw Error("select error: %s", strerror(errno));
+					throw Error("epoll_wait error: %s", strerror(errno));
                  }
             }
 
             // check FD events
             if (cnt > 0)  {
-                stop = checkFileDescriptorEvents(&retEvents, &rset, &wset, &fds);
+                stop = checkFileDescriptorEvents(&retEvents, ready, cnt, &fds);
 	        }
 
             if (!pprocThread) {
-				proc->handleFDEvent(&retEvents, NULL,NULL, NULL);
+				proc->handleFDEvent(&retEvents, NULL, 0, NULL);
             }
 
             // Schedule new events.
@@ -1446,6 +1711,8 @@ void QualityManager::run()
 		// wait for packet processor to handle all remaining packets (if threaded)
 		proc->waitUntilDone();
 
+		reactor_close(&fds);
+
 		log->log(ch,"NetQoS going down on Ctrl-C" );
 
 #ifdef DEBUG
@@ -1455,6 +1722,8 @@ void QualityManager::run()
 
     } catch (Error &err) {
 
+        reactor_close(&fds);
+
         cout << "error in run() method" << err << endl;
         if (log.get()) { // Logger might not be available yet
             log->elog(ch, err);
@@ -37,7 +37,9 @@ char *QualityManagerInfo::INFOS[] = { "all",
                              "use_ssl",
                              "hello",
                              "tasklist",
-                             "task" };
+                             "task",
+                             "qosprocessor",
+                             "ssl_handshakes" };
 
 typeMap_t QualityManagerInfo::typeMap; //std::map< string, infoType_t >();
 
@@ -84,17 +86,17 @@ infoType_t QualityManagerInfo::getInfoType( string item )
 }
 
 
-void QualityManagerInfo::addInfo( infoType_t type, string param )
+void QualityManagerInfo::addInfo( infoType_t type, string param, int limit )
 {
     if (list == NULL) {
         list = new infoList_t();
     }
 
-    list->push_back(info_t(type, param));
+    list->push_back(info_t(type, param, limit));
 }
 
 
-void QualityManagerInfo::addInfo( string item, string param )
+void QualityManagerInfo::addInfo( string item, string param, int limit )
 {
     infoType_t type = getInfoType(item);
 
@@ -114,9 +116,25 @@ void QualityManagerInfo::addInfo( string item, string param )
     case I_TASK:
         addInfo(I_TASK, param );
         break;
+    case I_TASKLIST:
+        addInfo(I_TASKLIST, param, limit );
+        break;
     default: 
         addInfo( type );
         break;
     }
 
 }
+
+
+int QualityManagerInfo::isRuleInfo( infoList_t *l )
+{
+    for (infoListIter_t i = l->begin(); i != l->end(); i++) {
+        if ((i->type != I_TASKLIST) && (i->type != I_TASK) &&
+            (i->type != I_TASKS_STORED)) {
+            return 0;
+        }
+    }
+
+    return !l->empty();
+}
@@ -32,6 +32,9 @@
 #include "ParserFcts.h"
 #include "constants.h"
 
+
+unsigned long Rule::stateChanges = 0;
+
 /* ------------------------- Rule ------------------------- */
 
 Rule::Rule(int _uid, time_t now, string sname, string rname, filterList_t &f, 
@@ -154,6 +157,8 @@ Rule::Rule(int _uid, time_t now, string sname, string rname, filterList_t &f,
             flags |=  RULE_AUTO_FLOWS;
         }
 
+        compileActionParams();
+
     } catch (Error &e) {    
         state = RS_ERROR;
         throw Error("rule %s.%s: %s", sname.c_str(), rname.c_str(), e.getError().c_str());
@@ -184,6 +189,37 @@ string Rule::getMiscVal(string name)
 }
 
 
+void Rule::compileActionParams()
+{
+    for (actionListIter_t a = actionList.begin(); a != actionList.end(); a++) {
+
+        memset(&a->compiled, 0, sizeof(paramBlock_t));
+
+        for (configItemListIter_t i = a->conf.begin(); i != a->conf.end(); i++) {
+            int key;
+
+            for (key = 0; key < PARAM_NUM_KEYS; key++) {
+                if (i->name == PARAM_KEY_NAMES[key]) {
+                    break;
+                }
+            }
+
+            if (key == PARAM_NUM_KEYS) {
+                // only known to the module
+                continue;
+            }
+
+            if (key == PARAM_BIDIR) {
+                a->compiled.value[key] = ParserFcts::parseBool(i->value);
+            } else {
+                a->compiled.value[key] = ParserFcts::parseLLong(i->value);
+            }
+            a->compiled.present |= (1 << key);
+        }
+    }
+}
+
+
 void Rule::parseRuleName(string rname)
 {
     int n;
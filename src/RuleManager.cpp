@@ -35,7 +35,7 @@
 /* ------------------------- RuleManager ------------------------- */
 
 RuleManager::RuleManager( string fdname, string fvname)
-    : tasks(0), filterDefFileName(fdname), filterValFileName(fvname),
+    : tasks(0), version(0), filterDefFileName(fdname), filterValFileName(fvname),
 	  idSource(1)
 {
     log = Logger::getInstance();
@@ -151,31 +151,17 @@ Rule *RuleManager::getRule(int uid)
 
 /* -------------------- getRule -------------------- */
 
-Rule *RuleManager::getRule(string sname, string rname)
+Rule *RuleManager::getRule(const string &sname, const string &rname)
 {
-    ruleSetIndexIter_t iter;
-    ruleIndexIter_t iter2;
+    int uid = nameIndex.find(sname, rname);
 
-    iter = ruleSetIndex.find(sname);
-    if (iter != ruleSetIndex.end()) {
-        iter2 = iter->second.find(rname);
-        if (iter2 != iter->second.end()) {
-            return getRule(iter2->second);
-        }
-        else
-        {
-#ifdef DEBUG
-    log->dlog(ch,"RuleId not found");
-#endif
-
-		}
+    if (uid >= 0) {
+        return getRule(uid);
     }
-    else
-    {
+
 #ifdef DEBUG
-    log->dlog(ch,"Ruleset not found");
+    log->dlog(ch,"Rule %s.%s not found", sname.c_str(), rname.c_str());
 #endif
-	}
 
     return NULL;
 }
@@ -195,6 +181,20 @@ ruleIndex_t *RuleManager::getRules(string sname)
     return NULL;
 }
 
+void RuleManager::getRules(string sname, ruleDB_t &rules)
+{
+    ruleSetIndexIter_t set = ruleSetIndex.find(sname);
+
+    if (set == ruleSetIndex.end()) {
+        throw Error("no such rule set");
+    }
+
+    rules.reserve(rules.size() + set->second.size());
+    for (ruleIndexIter_t i = set->second.begin(); i != set->second.end(); i++) {
+        rules.push_back(ruleDB[i->second]);
+    }
+}
+
 ruleDB_t RuleManager::getRules()
 {
     ruleDB_t ret;
@@ -252,7 +252,7 @@ ruleDB_t *RuleManager::parseRules(string fname)
 
 /* -------------------- parseRulesBuffer -------------------- */
 
-ruleDB_t *RuleManager::parseRulesBuffer(char *buf, int len, int mapi)
+ruleDB_t *RuleManager::parseRulesBuffer(char *buf, int len, int format)
 {
     ruleDB_t *new_rules = new ruleDB_t();
 
@@ -263,7 +263,10 @@ ruleDB_t *RuleManager::parseRulesBuffer(char *buf, int len, int mapi)
         // load the filter val list
         loadFilterVals("");
 
-        if (mapi) {
+        if (format & ADD_RULES_BULK) {
+            BulkRuleParser rfp = BulkRuleParser(buf, len);
+            rfp.parse(&filterDefs, &filterVals, new_rules, &idSource);
+        } else if (format & ADD_RULES_MAPI) {
              MAPIRuleParser rfp = MAPIRuleParser(buf, len);
              rfp.parse(&filterDefs, &filterVals, new_rules, &idSource);
         } else {
@@ -284,15 +287,36 @@ ruleDB_t *RuleManager::parseRulesBuffer(char *buf, int len, int mapi)
 }
 
 
+/* -------------------- discardRules -------------------- */
+
+void RuleManager::discardRules(ruleDB_t *rules)
+{
+    for (ruleDBIter_t i = rules->begin(); i != rules->end(); i++) {
+        idSource.freeId((*i)->getUId());
+        saveDelete(*i);
+    }
+    rules->clear();
+}
+
+
 /* ---------------------------------- addRules ----------------------------- */
 
 void RuleManager::addRules(ruleDB_t *rules, EventScheduler *e)
 {
-    ruleDBIter_t        iter;
     ruleTimeIndex_t     start;
     ruleTimeIndex_t     stop;
-    ruleTimeIndexIter_t iter2;
-    time_t              now = time(NULL);
+
+    storeRules(rules, start, stop);
+
+    scheduleRules(start, stop, e);
+}
+
+
+/* ---------------------------------- storeRules ----------------------------- */
+
+void RuleManager::storeRules(ruleDB_t *rules, ruleTimeIndex_t &start, ruleTimeIndex_t &stop)
+{
+    ruleDBIter_t        iter;
 
     // add valid rules.
     for (iter = rules->begin(); iter != rules->end(); iter++) {
@@ -324,17 +348,26 @@ void RuleManager::addRules(ruleDB_t *rules, EventScheduler *e)
             }
         }
     }
+}
+
+
+/* ---------------------------------- scheduleRules ----------------------------- */
+
+void RuleManager::scheduleRules(ruleTimeIndex_t &start, ruleTimeIndex_t &stop, EventScheduler *e)
+{
+    ruleTimeIndexIter_t iter2;
+    time_t              now = time(NULL);
 
     log->dlog(ch, "Start all rules - it is going to activate them");
 
     // group rules with same start time
     for (iter2 = start.begin(); iter2 != start.end(); iter2++) {
-        e->addEvent(new ActivateRulesEvent(iter2->first-now, iter2->second));
+        e->addEvent(new ActivateRulesEvent(iter2->first-now, RuleBatch::adopt(iter2->second)));
     }
 
     // group rules with same stop time
     for (iter2 = stop.begin(); iter2 != stop.end(); iter2++) {
-        e->addEvent(new RemoveRulesEvent(iter2->first-now, iter2->second));
+        e->addEvent(new RemoveRulesEvent(iter2->first-now, RuleBatch::adopt(iter2->second)));
     }
 
     log->dlog(ch, "Finished adding rules");
@@ -377,10 +410,12 @@ void RuleManager::addRule(Rule *r)
         // insert rule
         ruleDB[r->getUId()] = r;
 
-        // add new entry in index
+        // add new entry in the indexes
+        nameIndex.insert(r->getSetName(), r->getRuleName(), r->getUId());
         ruleSetIndex[r->getSetName()][r->getRuleName()] = r->getUId();
 
         tasks++;
+        version++;
 
 #ifdef DEBUG
     log->dlog(ch, "finish adding new rule with name = '%s'",
@@ -456,7 +491,8 @@ string RuleManager::getInfo(string sname)
 
     if (r != ruleSetIndex.end()) {
         for (ruleIndexIter_t i = r->second.begin(); i != r->second.end(); i++) {
-            s << getInfo(sname, i->first);
+            // indexed rules are always in the database
+            s << getRule(i->second)->getInfo();
         }
     } else {
         s << "No such ruleset" << endl;
@@ -469,12 +505,56 @@ string RuleManager::getInfo(string sname)
 /* ------------------------- getInfo ------------------------- */
 
 string RuleManager::getInfo()
+{
+    string next;
+
+    return getInfo("", 0, next);
+}
+
+
+/* ------------------------- getInfo ------------------------- */
+
+string RuleManager::getInfo(const string &cursor, int limit, string &next)
 {
     ostringstream s;
-    ruleSetIndexIter_t iter;
+    ruleSetIndexIter_t set = ruleSetIndex.begin();
+    ruleIndexIter_t i;
+    string last;
+    int n = 0;
+
+    next = "";
+
+    if (!cursor.empty()) {
+        // continue after the cursor rule, even if it was removed meanwhile
+        int p = cursor.find(".");
+        string sname = (p > 0) ? cursor.substr(0, p) : cursor;
+        string rname = (p > 0) ? cursor.substr(p+1) : "";
+
+        set = ruleSetIndex.lower_bound(sname);
+        if ((set != ruleSetIndex.end()) && (set->first == sname)) {
+            i = set->second.upper_bound(rname);
+        } else if (set != ruleSetIndex.end()) {
+            i = set->second.begin();
+        }
+    } else if (set != ruleSetIndex.end()) {
+        i = set->second.begin();
+    }
+
+    while (set != ruleSetIndex.end()) {
+        for (; i != set->second.end(); i++) {
+            if ((limit > 0) && (n == limit)) {
+                // more rules follow, the last one listed is the cursor
+                next = last;
+                return s.str();
+            }
+            s << getRule(i->second)->getInfo();
+            last = set->first + "." + i->first;
+            n++;
+        }
 
-    for (iter = ruleSetIndex.begin(); iter != ruleSetIndex.end(); iter++) {
-        s << getInfo(iter->first);
+        if (++set != ruleSetIndex.end()) {
+            i = set->second.begin();
+        }
     }
 
     return s.str();
@@ -523,18 +603,6 @@ void RuleManager::delRule(int uid, EventScheduler *e)
 }
 
 
-/* ------------------------- delRules ------------------------- */
-
-void RuleManager::delRules(string sname, EventScheduler *e)
-{
-    if (ruleSetIndex.find(sname) != ruleSetIndex.end()) {
-        for (ruleSetIndexIter_t i = ruleSetIndex.begin(); i != ruleSetIndex.end(); i++) {
-            delRule(getRule(sname, i->first),e);
-        }
-    }
-}
-
-
 /* ------------------------- delRule ------------------------- */
 
 void RuleManager::delRule(Rule *r, EventScheduler *e)
@@ -543,14 +611,19 @@ void RuleManager::delRule(Rule *r, EventScheduler *e)
     log->dlog(ch, "removing rule with name = '%s'", r->getRuleName().c_str());
 #endif
 
-    // remove rule from database and from index
+    // remove rule from database and from the indexes
     storeRuleAsDone(r);
     ruleDB[r->getUId()] = NULL;
-    ruleSetIndex[r->getSetName()].erase(r->getRuleName());
+    nameIndex.erase(r->getSetName(), r->getRuleName());
+
+    ruleSetIndexIter_t set = ruleSetIndex.find(r->getSetName());
+    if (set != ruleSetIndex.end()) {
+        set->second.erase(r->getRuleName());
 
-    // delete rule set if empty
-    if (ruleSetIndex[r->getSetName()].empty()) {
-        ruleSetIndex.erase(r->getSetName());
+        // delete rule set if empty
+        if (set->second.empty()) {
+            ruleSetIndex.erase(set);
+        }
     }
 
     if (e != NULL) {
@@ -558,6 +631,7 @@ void RuleManager::delRule(Rule *r, EventScheduler *e)
     }
 
     tasks--;
+    version++;
 }
 
 
@@ -565,11 +639,68 @@ void RuleManager::delRule(Rule *r, EventScheduler *e)
 
 void RuleManager::delRules(ruleDB_t *rules, EventScheduler *e)
 {
+    ruleDB_t gone;
+    ruleUIdSet_t uids;
+    map<string, unsigned int> perSet;
+    map<string, unsigned int>::iterator ps;
     ruleDBIter_t iter;
+    int partial = 0;
 
+    // remove the rules from the database and the name index
     for (iter = rules->begin(); iter != rules->end(); iter++) {
-        delRule(*iter, e);
+        Rule *r = *iter;
+
+        if (((unsigned int) r->getUId() >= ruleDB.size()) || (ruleDB[r->getUId()] != r)) {
+            // listed twice or deleted already
+            continue;
+        }
+
+        ruleDB[r->getUId()] = NULL;
+        nameIndex.erase(r->getSetName(), r->getRuleName());
+        uids.insert(r->getUId());
+        perSet[r->getSetName()]++;
+        gone.push_back(r);
+    }
+
+    if (gone.empty()) {
+        return;
+    }
+
+    // drop the rule sets that are gone entirely without visiting their rules
+    for (ps = perSet.begin(); ps != perSet.end(); ps++) {
+        ruleSetIndexIter_t set = ruleSetIndex.find(ps->first);
+
+        if (set == ruleSetIndex.end()) {
+            ps->second = 0;
+        } else if (set->second.size() <= ps->second) {
+            ruleSetIndex.erase(set);
+            ps->second = 0;
+        } else {
+            partial++;
+        }
     }
+
+    if (partial > 0) {
+        for (iter = gone.begin(); iter != gone.end(); iter++) {
+            Rule *r = *iter;
+
+            if (perSet[r->getSetName()] > 0) {
+                ruleSetIndex[r->getSetName()].erase(r->getRuleName());
+            }
+        }
+    }
+
+    if (e != NULL) {
+        e->delRuleEvents(uids);
+    }
+
+    // only now, storeRuleAsDone may free rules still referenced above
+    for (iter = gone.begin(); iter != gone.end(); iter++) {
+        storeRuleAsDone(*iter);
+    }
+
+    tasks -= gone.size();
+    version++;
 }
 
 
@@ -65,6 +65,11 @@ const string XSL_PAGE_FILE   = DEF_SYSCONFDIR "/reply.xsl";
 const int    EXPIRY_TIME     = 3600; //!< expiry time for web pages served from cache
 const int    DEF_PORT        = 12244;         //!< default TCP port to connect to
 
+// QOSProcessor.cc
+const int    DEF_EVENT_QUEUE_SIZE = 4096;     //!< default capacity of the QoS processor event queues
+const int    MAX_PROC_SHARDS      = 64;       //!< maximum number of QoS processor workers
+const int    PROC_QUEUE_RETRY     = 100;      //!< retry delay for scheduled work refused by a full queue [msec]
+
 // ConfigParser.h
 const string CONFIGFILE_DTD  = DEF_SYSCONFDIR "/netmate.conf.dtd";
 
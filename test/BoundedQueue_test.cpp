@@ -0,0 +1,234 @@
+/*
+ * Test the BoundedQueue class.
+ *
+ * $Id: BoundedQueue_test.cpp 2016-10-17 10:00:00 amarentes $
+ *      The concurrent test uses the producer/consumer layout of the
+ *      QoS processor: several producers and a single consumer.
+ * $HeadURL: https://./test/BoundedQueue_test.cpp $
+ */
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "BoundedQueue.h"
+
+#ifdef ENABLE_THREADS
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+
+//! number of elements every producer pushes in the concurrent test
+const unsigned long QUEUE_TEST_ITEMS = 200000;
+
+//! number of producer threads in the concurrent test
+const int QUEUE_TEST_PRODUCERS = 2;
+
+
+class BoundedQueue_Test : public CppUnit::TestFixture {
+
+	CPPUNIT_TEST_SUITE( BoundedQueue_Test );
+
+	CPPUNIT_TEST( testCapacity );
+	CPPUNIT_TEST( testFullEmpty );
+	CPPUNIT_TEST( testWraparound );
+	CPPUNIT_TEST( testPopAll );
+#ifdef ENABLE_THREADS
+	CPPUNIT_TEST( testProducerConsumer );
+#endif
+
+	CPPUNIT_TEST_SUITE_END();
+
+  public:
+
+	void testCapacity();
+	void testFullEmpty();
+	void testWraparound();
+	void testPopAll();
+#ifdef ENABLE_THREADS
+	void testProducerConsumer();
+#endif
+
+  private:
+
+#ifdef ENABLE_THREADS
+	struct producer_t
+	{
+		BoundedQueue<unsigned long> *queue;
+		unsigned long id;
+	};
+
+	//! push QUEUE_TEST_ITEMS tagged values, retrying while the queue is full
+	static void *produce(void *arg);
+#endif
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( BoundedQueue_Test );
+
+
+void BoundedQueue_Test::testCapacity()
+{
+	BoundedQueue<int> q1(1);
+	BoundedQueue<int> q5(5);
+	BoundedQueue<int> q8(8);
+
+	// rounded up to a power of two, at least two
+	CPPUNIT_ASSERT_EQUAL( 2UL, q1.capacity() );
+	CPPUNIT_ASSERT_EQUAL( 8UL, q5.capacity() );
+	CPPUNIT_ASSERT_EQUAL( 8UL, q8.capacity() );
+}
+
+
+void BoundedQueue_Test::testFullEmpty()
+{
+	BoundedQueue<int> q(4);
+	int v = -1;
+
+	CPPUNIT_ASSERT( q.empty() );
+	CPPUNIT_ASSERT( !q.pop(v) );
+	CPPUNIT_ASSERT_EQUAL( -1, v );
+
+	for (int i = 0; i < 4; i++) {
+		CPPUNIT_ASSERT( q.push(i) );
+	}
+	CPPUNIT_ASSERT_EQUAL( 4UL, q.size() );
+
+	// a full queue refuses and counts the push, the content is kept
+	CPPUNIT_ASSERT( !q.push(99) );
+	CPPUNIT_ASSERT( !q.push(99) );
+	CPPUNIT_ASSERT_EQUAL( 2UL, q.numRejected() );
+	CPPUNIT_ASSERT_EQUAL( 4UL, q.size() );
+	CPPUNIT_ASSERT_EQUAL( 4UL, q.highWaterMark() );
+
+	for (int i = 0; i < 4; i++) {
+		CPPUNIT_ASSERT( q.pop(v) );
+		CPPUNIT_ASSERT_EQUAL( i, v );
+	}
+	CPPUNIT_ASSERT( q.empty() );
+	CPPUNIT_ASSERT( !q.pop(v) );
+
+	// the high-water mark stays after the queue drained
+	CPPUNIT_ASSERT_EQUAL( 4UL, q.highWaterMark() );
+}
+
+
+void BoundedQueue_Test::testWraparound()
+{
+	BoundedQueue<int> q(4);
+	int next = 0, expect = 0, v;
+
+	// the positions run many times around the ring with changing depths
+	for (int round = 0; round < 1000; round++) {
+		int in = 1 + (round % 4);
+		int out = 1 + ((round * 7) % 4);
+
+		for (int i = 0; i < in; i++) {
+			if (q.size() < q.capacity()) {
+				CPPUNIT_ASSERT( q.push(next++) );
+			} else {
+				CPPUNIT_ASSERT( !q.push(next) );
+			}
+		}
+		for (int i = 0; i < out; i++) {
+			if (q.empty()) {
+				CPPUNIT_ASSERT( !q.pop(v) );
+			} else {
+				CPPUNIT_ASSERT( q.pop(v) );
+				CPPUNIT_ASSERT_EQUAL( expect++, v );
+			}
+		}
+		CPPUNIT_ASSERT_EQUAL( (unsigned long) (next - expect), q.size() );
+	}
+
+	while (q.pop(v)) {
+		CPPUNIT_ASSERT_EQUAL( expect++, v );
+	}
+	CPPUNIT_ASSERT_EQUAL( next, expect );
+	CPPUNIT_ASSERT( q.highWaterMark() <= q.capacity() );
+}
+
+
+void BoundedQueue_Test::testPopAll()
+{
+	BoundedQueue<int> q(8);
+	vector<int> out;
+
+	CPPUNIT_ASSERT_EQUAL( 0UL, q.popAll(out) );
+	CPPUNIT_ASSERT( out.empty() );
+
+	// move the positions past the end of the ring first
+	for (int i = 0; i < 6; i++) {
+		q.push(i);
+	}
+	CPPUNIT_ASSERT_EQUAL( 6UL, q.popAll(out) );
+
+	// appended behind what is already there, in queue order
+	for (int i = 6; i < 14; i++) {
+		CPPUNIT_ASSERT( q.push(i) );
+	}
+	CPPUNIT_ASSERT_EQUAL( 8UL, q.popAll(out) );
+	CPPUNIT_ASSERT_EQUAL( 14, (int) out.size() );
+	for (int i = 0; i < 14; i++) {
+		CPPUNIT_ASSERT_EQUAL( i, out[i] );
+	}
+	CPPUNIT_ASSERT( q.empty() );
+}
+
+
+#ifdef ENABLE_THREADS
+
+void *BoundedQueue_Test::produce(void *arg)
+{
+	producer_t *p = (producer_t *) arg;
+
+	for (unsigned long i = 0; i < QUEUE_TEST_ITEMS; i++) {
+		while (!p->queue->push((p->id << 32) | i)) {
+			sched_yield();
+		}
+	}
+	return NULL;
+}
+
+
+void BoundedQueue_Test::testProducerConsumer()
+{
+	// small enough to be full most of the time
+	BoundedQueue<unsigned long> q(16);
+	pthread_t threads[QUEUE_TEST_PRODUCERS];
+	producer_t prod[QUEUE_TEST_PRODUCERS];
+	unsigned long expect[QUEUE_TEST_PRODUCERS];
+	unsigned long total = QUEUE_TEST_ITEMS * QUEUE_TEST_PRODUCERS;
+	unsigned long received = 0;
+
+	for (int i = 0; i < QUEUE_TEST_PRODUCERS; i++) {
+		prod[i].queue = &q;
+		prod[i].id = i;
+		expect[i] = 0;
+		CPPUNIT_ASSERT_EQUAL( 0, pthread_create(&threads[i], NULL, produce, &prod[i]) );
+	}
+
+	// every value arrives once and in the order of its producer
+	while (received < total) {
+		unsigned long v;
+
+		if (!q.pop(v)) {
+			sched_yield();
+			continue;
+		}
+
+		unsigned long id = v >> 32;
+		CPPUNIT_ASSERT( id < (unsigned long) QUEUE_TEST_PRODUCERS );
+		CPPUNIT_ASSERT_EQUAL( expect[id], v & 0xffffffffUL );
+		expect[id]++;
+		received++;
+	}
+
+	for (int i = 0; i < QUEUE_TEST_PRODUCERS; i++) {
+		pthread_join(threads[i], NULL);
+		CPPUNIT_ASSERT_EQUAL( QUEUE_TEST_ITEMS, expect[i] );
+	}
+
+	CPPUNIT_ASSERT( q.empty() );
+	CPPUNIT_ASSERT( q.highWaterMark() <= q.capacity() );
+}
+
+#endif
@@ -0,0 +1,312 @@
+/*
+ * Test the BulkRuleParser class.
+ *
+ * $Id: BulkRuleParser_test.cpp 2016-10-17 10:00:00 amarentes $
+ *      The buffers are built with putStr/putInt, the filter definitions
+ *      are the installed ones.
+ * $HeadURL: https://./test/BulkRuleParser_test.cpp $
+ */
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "BulkRuleParser.h"
+#include "FilterDefParser.h"
+#include "RuleManager.h"
+#include "Error.h"
+
+
+class BulkRuleParser_Test : public CppUnit::TestFixture {
+
+	CPPUNIT_TEST_SUITE( BulkRuleParser_Test );
+
+	CPPUNIT_TEST( testValidRules );
+	CPPUNIT_TEST( testNoRules );
+	CPPUNIT_TEST( testTruncated );
+	CPPUNIT_TEST( testOversizedLengths );
+	CPPUNIT_TEST( testBadMagicVersion );
+	CPPUNIT_TEST( testParseRulesBuffer );
+
+	CPPUNIT_TEST_SUITE_END();
+
+  public:
+	void setUp();
+	void tearDown();
+
+	void testValidRules();
+	void testNoRules();
+	void testTruncated();
+	void testOversizedLengths();
+	void testBadMagicVersion();
+	void testParseRulesBuffer();
+
+  private:
+
+	filterDefList_t filterDefs;
+	filterValList_t filterVals;
+
+	//! one rule with a SrcIP filter and an htb action
+	static string makeRule(const string &rname, const string &addr);
+
+	//! magic, version and the given rules
+	static string makeBuffer(const vector<string> &rules);
+
+	/*! parse body into rules
+		\returns the number of rules parsed, -1 if an Error was thrown
+	*/
+	int parse(const string &body, ruleDB_t &rules);
+
+	static void freeRules(ruleDB_t &rules);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( BulkRuleParser_Test );
+
+
+void BulkRuleParser_Test::setUp()
+{
+	FilterDefParser f = FilterDefParser(DEF_SYSCONFDIR "/filterdef.xml");
+	f.parse(&filterDefs);
+}
+
+
+void BulkRuleParser_Test::tearDown()
+{
+	filterDefs.clear();
+}
+
+
+string BulkRuleParser_Test::makeRule(const string &rname, const string &addr)
+{
+	string rule, out;
+
+	BulkRuleParser::putStr(rule, "bulk");
+	BulkRuleParser::putStr(rule, rname);
+
+	// filters
+	BulkRuleParser::putInt(rule, 1, 1);
+	BulkRuleParser::putStr(rule, "SrcIP");
+	BulkRuleParser::putStr(rule, addr);
+	BulkRuleParser::putStr(rule, "");
+
+	// actions
+	BulkRuleParser::putInt(rule, 1, 1);
+	BulkRuleParser::putStr(rule, "htb");
+	BulkRuleParser::putInt(rule, 2, 1);
+	BulkRuleParser::putStr(rule, "Rate");
+	BulkRuleParser::putStr(rule, "Float64");
+	BulkRuleParser::putStr(rule, "15000");
+	BulkRuleParser::putStr(rule, "Bidir");
+	BulkRuleParser::putStr(rule, "");
+	BulkRuleParser::putStr(rule, "no");
+
+	// rule preferences
+	BulkRuleParser::putInt(rule, 1, 1);
+	BulkRuleParser::putStr(rule, "Duration");
+	BulkRuleParser::putStr(rule, "");
+	BulkRuleParser::putStr(rule, "1000");
+
+	BulkRuleParser::putInt(out, rule.length(), 4);
+	return out + rule;
+}
+
+
+string BulkRuleParser_Test::makeBuffer(const vector<string> &rules)
+{
+	string out = BULK_RULE_MAGIC;
+
+	BulkRuleParser::putInt(out, BULK_RULE_VERSION, 1);
+	for (unsigned int i = 0; i < rules.size(); i++) {
+		out += rules[i];
+	}
+	return out;
+}
+
+
+int BulkRuleParser_Test::parse(const string &body, ruleDB_t &rules)
+{
+	RuleIdSource ids(1);
+	vector<char> buf(body.begin(), body.end());
+	buf.push_back(0);
+
+	try {
+		BulkRuleParser p = BulkRuleParser(&buf[0], body.length());
+		p.parse(&filterDefs, &filterVals, &rules, &ids);
+	} catch (Error &e) {
+		return -1;
+	}
+	return rules.size();
+}
+
+
+void BulkRuleParser_Test::freeRules(ruleDB_t &rules)
+{
+	for (ruleDBIter_t i = rules.begin(); i != rules.end(); i++) {
+		saveDelete(*i);
+	}
+	rules.clear();
+}
+
+
+void BulkRuleParser_Test::testValidRules()
+{
+	vector<string> in;
+	ruleDB_t rules;
+
+	in.push_back(makeRule("r0", "10.0.0.1"));
+	in.push_back(makeRule("r1", "10.0.0.2"));
+	in.push_back(makeRule("r2", "10.0.0.0-10.0.0.9"));
+
+	CPPUNIT_ASSERT_EQUAL( 3, parse(makeBuffer(in), rules) );
+
+	for (int i = 0; i < 3; i++) {
+		Rule *r = rules[i];
+		ostringstream rname;
+		rname << "r" << i;
+
+		CPPUNIT_ASSERT_EQUAL( string("bulk"), r->getSetName() );
+		CPPUNIT_ASSERT_EQUAL( rname.str(), r->getRuleName() );
+
+		filterList_t *filters = r->getFilter();
+		CPPUNIT_ASSERT_EQUAL( 1, (int) filters->size() );
+		CPPUNIT_ASSERT_EQUAL( string("srcip"), filters->front().name );
+		CPPUNIT_ASSERT( filters->front().mtype == ((i == 2) ? FT_RANGE : FT_EXACT) );
+
+		actionList_t *actions = r->getActions();
+		CPPUNIT_ASSERT_EQUAL( 1, (int) actions->size() );
+		CPPUNIT_ASSERT_EQUAL( string("htb"), actions->front().name );
+		CPPUNIT_ASSERT_EQUAL( 2, (int) actions->front().conf.size() );
+		CPPUNIT_ASSERT_EQUAL( string("Float64"), actions->front().conf.front().type );
+
+		// an empty type is a string
+		CPPUNIT_ASSERT_EQUAL( string("String"), actions->front().conf.back().type );
+
+		if (i > 0) {
+			CPPUNIT_ASSERT( r->getUId() != rules[i-1]->getUId() );
+		}
+	}
+
+	freeRules(rules);
+}
+
+
+void BulkRuleParser_Test::testNoRules()
+{
+	vector<string> in;
+	ruleDB_t rules;
+
+	CPPUNIT_ASSERT_EQUAL( 0, parse(makeBuffer(in), rules) );
+}
+
+
+void BulkRuleParser_Test::testTruncated()
+{
+	vector<string> in;
+	map<unsigned int, int> ends;
+	ruleDB_t rules;
+
+	in.push_back(makeRule("r0", "10.0.0.1"));
+	in.push_back(makeRule("r1", "10.0.0.2"));
+	string body = makeBuffer(in);
+
+	// rules complete at the cuts between the rules
+	ends[sizeof(BULK_RULE_MAGIC)] = 0;
+	ends[body.length() - in[1].length()] = 1;
+
+	// any other cut is an error
+	for (unsigned int l = sizeof(BULK_RULE_MAGIC); l < body.length(); l++) {
+		int n = parse(body.substr(0, l), rules);
+
+		if (ends.count(l) > 0) {
+			CPPUNIT_ASSERT_EQUAL( ends[l], n );
+		} else {
+			CPPUNIT_ASSERT_EQUAL( -1, n );
+		}
+		freeRules(rules);
+	}
+}
+
+
+void BulkRuleParser_Test::testOversizedLengths()
+{
+	vector<string> in;
+	ruleDB_t rules;
+	string rule = makeRule("r0", "10.0.0.1");
+	string body;
+
+	// rule length beyond the buffer
+	in.push_back(rule);
+	body = makeBuffer(in);
+	body[5] = body[6] = body[7] = body[8] = (char) 0xff;
+	CPPUNIT_ASSERT_EQUAL( -1, parse(body, rules) );
+
+	// set name length beyond the rule
+	body = makeBuffer(in);
+	body[9] = (char) 0xff;
+	CPPUNIT_ASSERT_EQUAL( -1, parse(body, rules) );
+
+	// rule length shorter than its content: the rule preference is cut off
+	body = makeBuffer(in);
+	body[8] = (char) (body[8] - 1);
+	CPPUNIT_ASSERT_EQUAL( -1, parse(body, rules) );
+
+	// rule length longer than its content
+	string padded = rule;
+	padded[3] = (char) (padded[3] + 1);
+	padded += '\0';
+	in[0] = padded;
+	CPPUNIT_ASSERT_EQUAL( -1, parse(makeBuffer(in), rules) );
+
+	freeRules(rules);
+}
+
+
+void BulkRuleParser_Test::testBadMagicVersion()
+{
+	vector<string> in;
+	ruleDB_t rules;
+
+	in.push_back(makeRule("r0", "10.0.0.1"));
+	string body = makeBuffer(in);
+
+	string magic = body;
+	magic[3] = 'X';
+	CPPUNIT_ASSERT_EQUAL( -1, parse(magic, rules) );
+
+	string version = body;
+	version[4] = (char) (BULK_RULE_VERSION + 1);
+	CPPUNIT_ASSERT_EQUAL( -1, parse(version, rules) );
+
+	CPPUNIT_ASSERT_EQUAL( -1, parse("NQR", rules) );
+	CPPUNIT_ASSERT_EQUAL( -1, parse("", rules) );
+
+	CPPUNIT_ASSERT( rules.empty() );
+}
+
+
+void BulkRuleParser_Test::testParseRulesBuffer()
+{
+	RuleManager rulm(DEF_SYSCONFDIR "/filterdef.xml", DEF_SYSCONFDIR "/filterval.xml");
+	vector<string> in;
+
+	in.push_back(makeRule("r0", "10.0.0.1"));
+	in.push_back(makeRule("r1", "10.0.0.2"));
+	string body = makeBuffer(in);
+	vector<char> buf(body.begin(), body.end());
+	buf.push_back(0);
+
+	// ADD_RULES_BULK goes to the bulk parser
+	ruleDB_t *rules = rulm.parseRulesBuffer(&buf[0], body.length(), ADD_RULES_BULK);
+	CPPUNIT_ASSERT_EQUAL( 2, (int) rules->size() );
+	CPPUNIT_ASSERT_EQUAL( string("r1"), rules->back()->getRuleName() );
+	rulm.discardRules(rules);
+	saveDelete(rules);
+
+	// the same body is no XML rule file
+	CPPUNIT_ASSERT_THROW( rulm.parseRulesBuffer(&buf[0], body.length(), 0), Error );
+
+	// and an XML rule file is no bulk buffer
+	string xml = "<?xml version =\"1.0\" encoding=\"UTF-8\"?>\n"
+				 "<!DOCTYPE RULESET SYSTEM \"rulefile.dtd\">\n<RULESET ID=\"bulk\"></RULESET>\n";
+	vector<char> xbuf(xml.begin(), xml.end());
+	xbuf.push_back(0);
+	CPPUNIT_ASSERT_THROW( rulm.parseRulesBuffer(&xbuf[0], xml.length(), ADD_RULES_BULK), Error );
+}
@@ -0,0 +1,306 @@
+/*
+ * Test the asynchronous jobs of the CtrlComm class.
+ *
+ * $Id: CtrlCommJobs_test.cpp 2016-10-17 10:00:00 amarentes $
+ *      The requests are handed to processCmd the way the httpd parser
+ *      callback does, still marked busy so the replies are only built
+ *      and not written. The keepalive timer is driven by calling
+ *      handleFDEvent without ready descriptors.
+ * $HeadURL: https://./test/CtrlCommJobs_test.cpp $
+ */
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "ParserFcts.h"
+#include "ConfigManager.h"
+#include "CtrlComm.h"
+#include "Event.h"
+
+
+class CtrlCommJobs_Test : public CppUnit::TestFixture {
+
+	CPPUNIT_TEST_SUITE( CtrlCommJobs_Test );
+
+	CPPUNIT_TEST( testAccept );
+	CPPUNIT_TEST( testStatus );
+	CPPUNIT_TEST( testWaitFinished );
+	CPPUNIT_TEST( testWaitDeadline );
+	CPPUNIT_TEST( testWaitImpossible );
+	CPPUNIT_TEST( testReap );
+
+	CPPUNIT_TEST_SUITE_END();
+
+  public:
+	void setUp();
+	void tearDown();
+
+	void testAccept();
+	void testStatus();
+	void testWaitFinished();
+	void testWaitDeadline();
+	void testWaitImpossible();
+	void testReap();
+
+  private:
+
+	ConfigManager *conf;
+	CtrlComm *comm;
+	eventVec_t events;
+
+	//! hand a request for path and query to the control interface
+	struct REQUEST *request(const char *path, const string &query);
+
+	//! submit an asynchronous /rm_task and return its event
+	CtrlCommEvent *submitJob();
+
+	static string jobId(CtrlCommEvent *e);
+
+	//! run the keepalive timer until req is answered or secs have passed
+	void waitAnswer(struct REQUEST *req, int secs);
+
+	static int answered(struct REQUEST *req);
+
+	static int replyHas(struct REQUEST *req, const string &txt);
+
+	static void freeRequest(struct REQUEST *req);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( CtrlCommJobs_Test );
+
+
+void CtrlCommJobs_Test::setUp()
+{
+	char binary[] = "qualityManager";
+
+	conf = new ConfigManager(DEF_SYSCONFDIR "/netqos_conf.dtd",
+							 DEF_SYSCONFDIR "/netqos_conf_test.xml", binary);
+	comm = new CtrlComm(conf, 0);
+
+	// sets the vector the requests queue their events to
+	comm->handleFDEvent(&events, NULL, 0, NULL);
+}
+
+
+void CtrlCommJobs_Test::tearDown()
+{
+	for (eventVecIter_t i = events.begin(); i != events.end(); i++) {
+		saveDelete(*i);
+	}
+	events.clear();
+
+	saveDelete(comm);
+	saveDelete(conf);
+}
+
+
+struct REQUEST *CtrlCommJobs_Test::request(const char *path, const string &query)
+{
+	struct REQUEST *req = (struct REQUEST *) calloc(1, sizeof(struct REQUEST));
+
+	req->fd = -1;
+	req->bfd = -1;
+	req->busy = 1;
+	strcpy(req->path, path);
+	strcpy(req->query, query.c_str());
+
+	CPPUNIT_ASSERT_EQUAL( 0, comm->processCmd(req) );
+	return req;
+}
+
+
+CtrlCommEvent *CtrlCommJobs_Test::submitJob()
+{
+	unsigned int n = events.size();
+	struct REQUEST *req = request("/rm_task", "RuleID=s1.r1&Async=yes");
+
+	// answered right away, the request is not kept
+	CPPUNIT_ASSERT_EQUAL( 202, req->status );
+	CPPUNIT_ASSERT_EQUAL( n + 1, (unsigned int) events.size() );
+	freeRequest(req);
+
+	return (CtrlCommEvent *) events.back();
+}
+
+
+string CtrlCommJobs_Test::jobId(CtrlCommEvent *e)
+{
+	ostringstream s;
+
+	s << e->getJob();
+	return s.str();
+}
+
+
+void CtrlCommJobs_Test::waitAnswer(struct REQUEST *req, int secs)
+{
+	time_t end = time(NULL) + secs;
+
+	while (!answered(req) && (time(NULL) <= end)) {
+		usleep(100000);
+		comm->handleFDEvent(&events, NULL, 0, NULL);
+	}
+}
+
+
+int CtrlCommJobs_Test::answered(struct REQUEST *req)
+{
+	return (req->body != NULL);
+}
+
+
+int CtrlCommJobs_Test::replyHas(struct REQUEST *req, const string &txt)
+{
+	return answered(req) && (string(req->body).find(txt) != string::npos);
+}
+
+
+void CtrlCommJobs_Test::freeRequest(struct REQUEST *req)
+{
+	free(req->body);
+	free(req->post_body);
+	free(req);
+}
+
+
+void CtrlCommJobs_Test::testAccept()
+{
+	// without Async the event answers the request
+	struct REQUEST *req = request("/rm_task", "RuleID=s1.r1");
+	CtrlCommEvent *e = (CtrlCommEvent *) events.back();
+
+	CPPUNIT_ASSERT( !answered(req) );
+	CPPUNIT_ASSERT( e->getReq() == req );
+	CPPUNIT_ASSERT_EQUAL( 0UL, e->getJob() );
+	freeRequest(req);
+
+	// with Async it is answered with 202 and the job id
+	req = request("/rm_task", "RuleID=s1.r2&Async=yes");
+	e = (CtrlCommEvent *) events.back();
+
+	CPPUNIT_ASSERT_EQUAL( 2, (int) events.size() );
+	CPPUNIT_ASSERT_EQUAL( 202, req->status );
+	CPPUNIT_ASSERT( replyHas(req, "Accepted") );
+	CPPUNIT_ASSERT( e->getJob() != 0 );
+	CPPUNIT_ASSERT( replyHas(req, jobId(e)) );
+	freeRequest(req);
+
+	// every job gets its own id
+	CPPUNIT_ASSERT( submitJob()->getJob() != e->getJob() );
+}
+
+
+void CtrlCommJobs_Test::testStatus()
+{
+	CtrlCommEvent *e = submitJob();
+	struct REQUEST *req;
+
+	req = request("/task_status", "job=" + jobId(e));
+	CPPUNIT_ASSERT( replyHas(req, "Queued") );
+	freeRequest(req);
+
+	comm->sendErrMsg("no such rule", e, NULL);
+	req = request("/task_status", "job=" + jobId(e));
+	CPPUNIT_ASSERT( replyHas(req, "Error") );
+	CPPUNIT_ASSERT( replyHas(req, "no such rule") );
+	freeRequest(req);
+
+	req = request("/task_status", "job=12345");
+	CPPUNIT_ASSERT( replyHas(req, "unknown job") );
+	freeRequest(req);
+
+	req = request("/task_status", "");
+	CPPUNIT_ASSERT( replyHas(req, "missing parameter") );
+	freeRequest(req);
+}
+
+
+void CtrlCommJobs_Test::testWaitFinished()
+{
+	CtrlCommEvent *e = submitJob();
+	struct REQUEST *w1 = request("/task_status", "job=" + jobId(e) + "&wait=30");
+	struct REQUEST *w2 = request("/task_status", "job=" + jobId(e) + "&wait=30");
+
+	// parked until the job finishes
+	comm->handleFDEvent(&events, NULL, 0, NULL);
+	CPPUNIT_ASSERT( !answered(w1) );
+	CPPUNIT_ASSERT( !answered(w2) );
+
+	comm->sendMsg("rule(s) deleted", e, NULL);
+	CPPUNIT_ASSERT_EQUAL( 200, w1->status );
+	CPPUNIT_ASSERT( replyHas(w1, "OK") );
+	CPPUNIT_ASSERT( replyHas(w1, "rule(s) deleted") );
+	CPPUNIT_ASSERT( replyHas(w2, "rule(s) deleted") );
+	freeRequest(w1);
+	freeRequest(w2);
+
+	// a finished job is answered without waiting
+	w1 = request("/task_status", "job=" + jobId(e) + "&wait=30");
+	CPPUNIT_ASSERT( replyHas(w1, "rule(s) deleted") );
+	freeRequest(w1);
+}
+
+
+void CtrlCommJobs_Test::testWaitDeadline()
+{
+	CtrlCommEvent *e = submitJob();
+	struct REQUEST *req = request("/task_status", "job=" + jobId(e) + "&wait=1");
+
+	comm->handleFDEvent(&events, NULL, 0, NULL);
+	CPPUNIT_ASSERT( !answered(req) );
+
+	// the keepalive timer answers with the current state
+	waitAnswer(req, 3);
+	CPPUNIT_ASSERT( replyHas(req, "Queued") );
+	freeRequest(req);
+
+	// the job itself is still there
+	comm->sendMsg("rule(s) deleted", e, NULL);
+	req = request("/task_status", "job=" + jobId(e));
+	CPPUNIT_ASSERT( replyHas(req, "rule(s) deleted") );
+	freeRequest(req);
+}
+
+
+void CtrlCommJobs_Test::testWaitImpossible()
+{
+	int keepalive = httpd_get_keepalive();
+	int timeout = httpd_get_timeout();
+	CtrlCommEvent *e = submitJob();
+
+	// a wait would outlast the network timeout, answer right away
+	httpd_set_limits(0, 0, 0, timeout / 2, timeout);
+	struct REQUEST *req = request("/task_status", "job=" + jobId(e) + "&wait=30");
+	httpd_set_limits(0, 0, 0, keepalive, timeout);
+
+	CPPUNIT_ASSERT( replyHas(req, "Queued") );
+	freeRequest(req);
+}
+
+
+void CtrlCommJobs_Test::testReap()
+{
+	int keep = ParserFcts::parseInt(conf->getValue("JobKeepTime", "CONTROL"));
+	CtrlCommEvent *done = submitJob();
+	CtrlCommEvent *queued = submitJob();
+	struct REQUEST *req;
+
+	comm->sendMsg("rule(s) deleted", done, NULL);
+
+	// kept for JobKeepTime after it finished
+	comm->handleFDEvent(&events, NULL, 0, NULL);
+	req = request("/task_status", "job=" + jobId(done));
+	CPPUNIT_ASSERT( replyHas(req, "rule(s) deleted") );
+	freeRequest(req);
+
+	sleep(keep + 2);
+	comm->handleFDEvent(&events, NULL, 0, NULL);
+
+	req = request("/task_status", "job=" + jobId(done));
+	CPPUNIT_ASSERT( replyHas(req, "unknown job") );
+	freeRequest(req);
+
+	// unfinished jobs are never dropped
+	req = request("/task_status", "job=" + jobId(queued));
+	CPPUNIT_ASSERT( replyHas(req, "Queued") );
+	freeRequest(req);
+}
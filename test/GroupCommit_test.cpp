@@ -0,0 +1,291 @@
+/*
+ * Test the GroupCommitEvent class together with the event scheduler.
+ *
+ * $Id: GroupCommit_test.cpp 2016-10-17 10:00:00 amarentes $
+ *      The groups are built the way QualityManager::joinGroupCommit
+ *      does; the rules are deleted through the rule manager, as after
+ *      their removal event or a previous remove group.
+ * $HeadURL: https://./test/GroupCommit_test.cpp $
+ */
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "RuleManager.h"
+#include "EventScheduler.h"
+#include "Event.h"
+
+
+class GroupCommit_Test : public CppUnit::TestFixture {
+
+	CPPUNIT_TEST_SUITE( GroupCommit_Test );
+
+	CPPUNIT_TEST( testAddGroup );
+	CPPUNIT_TEST( testRemoveGroup );
+	CPPUNIT_TEST( testRuleExpiresInWindow );
+
+	CPPUNIT_TEST_SUITE_END();
+
+  public:
+	void setUp();
+	void tearDown();
+
+	void testAddGroup();
+	void testRemoveGroup();
+	void testRuleExpiresInWindow();
+
+  private:
+
+	RuleManager *rulm;
+	EventScheduler *sched;
+
+	//! parse a rule set with rules r1..rn, the caller owns the rules
+	ruleDB_t *parseRuleSet(const string &sname, int n);
+
+	//! parse a rule set and store it in the rule manager
+	void storeRuleSet(const string &sname, int n);
+
+	//! add req with rules to group, opening it if NULL
+	void join(GroupCommitEvent *&group, event_t type, CtrlCommEvent *req, ruleDB_t &rules);
+
+	//! take the group out of the scheduler as the main loop does when it is due
+	void commit(GroupCommitEvent *group);
+
+	static int contains(ruleDB_t &rules, Rule *r);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( GroupCommit_Test );
+
+
+void GroupCommit_Test::setUp()
+{
+	rulm = new RuleManager(DEF_SYSCONFDIR "/filterdef.xml", DEF_SYSCONFDIR "/filterval.xml");
+	sched = new EventScheduler();
+}
+
+
+void GroupCommit_Test::tearDown()
+{
+	saveDelete(sched);
+	saveDelete(rulm);
+}
+
+
+ruleDB_t *GroupCommit_Test::parseRuleSet(const string &sname, int n)
+{
+	ostringstream xml;
+
+	xml << "<?xml version =\"1.0\" encoding=\"UTF-8\"?>\n"
+		<< "<!DOCTYPE RULESET SYSTEM \"rulefile.dtd\">\n"
+		<< "<RULESET ID=\"" << sname << "\">\n"
+		<< "  <GLOBAL><PREF NAME=\"Duration\">1000</PREF></GLOBAL>\n";
+	for (int i = 1; i <= n; i++) {
+		xml << "  <RULE ID=\"r" << i << "\">\n"
+			<< "    <FILTER NAME=\"SrcIP\">10.0.0." << i << "</FILTER>\n"
+			<< "    <ACTION NAME=\"htb\">\n"
+			<< "      <PREF NAME=\"Rate\" TYPE=\"Float64\">15000</PREF>\n"
+			<< "    </ACTION>\n"
+			<< "  </RULE>\n";
+	}
+	xml << "</RULESET>\n";
+
+	string body = xml.str();
+	vector<char> buf(body.begin(), body.end());
+	buf.push_back(0);
+
+	return rulm->parseRulesBuffer(&buf[0], body.length(), 0);
+}
+
+
+void GroupCommit_Test::storeRuleSet(const string &sname, int n)
+{
+	ruleDB_t *rules = parseRuleSet(sname, n);
+
+	// as checked by the QoS processor
+	for (ruleDBIter_t i = rules->begin(); i != rules->end(); i++) {
+		(*i)->setState(RS_VALID);
+	}
+
+	rulm->addRules(rules, sched);
+	saveDelete(rules);
+}
+
+
+void GroupCommit_Test::join(GroupCommitEvent *&group, event_t type,
+							CtrlCommEvent *req, ruleDB_t &rules)
+{
+	if (group == NULL) {
+		struct timeval now;
+
+		Timeval::gettimeofdayown(&now, NULL);
+		group = new GroupCommitEvent(type, now);
+		sched->addEvent(group);
+	}
+
+	group->addMember(req, rules);
+	sched->reindexEvent(group);
+}
+
+
+void GroupCommit_Test::commit(GroupCommitEvent *group)
+{
+	vector<Event *> later;
+	Event *ev;
+
+	// the rule activation and removal events come before the group
+	while ((ev = sched->getNextEvent()) != group) {
+		CPPUNIT_ASSERT( ev != NULL );
+		later.push_back(ev);
+	}
+
+	for (unsigned int i = 0; i < later.size(); i++) {
+		sched->addEvent(later[i]);
+	}
+}
+
+
+int GroupCommit_Test::contains(ruleDB_t &rules, Rule *r)
+{
+	return (find(rules.begin(), rules.end(), r) != rules.end());
+}
+
+
+void GroupCommit_Test::testAddGroup()
+{
+	GroupCommitEvent *group = NULL;
+	RemoveRulesCtrlEvent reqA("a"), reqB("b");
+	ruleDB_t *a = parseRuleSet("a", 2);
+	ruleDB_t *b = parseRuleSet("b", 1);
+	ruleDB_t rules;
+	vector<int> uids;
+
+	Rule *a1 = a->front();
+	Rule *b1 = b->front();
+
+	join(group, ADD_RULES_CTRLCOMM, &reqA, *a);
+	join(group, ADD_RULES_CTRLCOMM, &reqB, *b);
+
+	// the members took over the rules
+	CPPUNIT_ASSERT( a->empty() );
+	CPPUNIT_ASSERT_EQUAL( 2, (int) group->getMembers()->size() );
+
+	// the rules are not stored yet, nobody can delete them
+	group->getRuleUIds(uids);
+	CPPUNIT_ASSERT( uids.empty() );
+	sched->delRuleEvents(a1->getUId());
+	CPPUNIT_ASSERT_EQUAL( 0, group->deleteRule(b1->getUId()) );
+
+	commit(group);
+	group->getRules(rules);
+	CPPUNIT_ASSERT_EQUAL( 3, (int) rules.size() );
+	CPPUNIT_ASSERT( contains(rules, a1) );
+	CPPUNIT_ASSERT( contains(rules, b1) );
+	CPPUNIT_ASSERT_EQUAL( 0, sched->getNumEvents() );
+
+	for (GroupCommitEvent::memberListIter_t m = group->getMembers()->begin();
+		 m != group->getMembers()->end(); m++) {
+		rulm->discardRules(&m->rules);
+	}
+	saveDelete(group);
+	saveDelete(a);
+	saveDelete(b);
+}
+
+
+void GroupCommit_Test::testRemoveGroup()
+{
+	GroupCommitEvent *group = NULL;
+	RemoveRulesCtrlEvent reqA("s1"), reqB("s1.r2");
+	ruleDB_t all, some, rules;
+	vector<int> uids;
+
+	storeRuleSet("s1", 3);
+	storeRuleSet("s2", 1);
+	int scheduled = sched->getNumEvents();
+
+	rulm->getRules("s1", all);
+	some.push_back(rulm->getRule("s1", "r2"));
+	some.push_back(rulm->getRule("s2", "r1"));
+
+	join(group, REMOVE_RULES_CTRLCOMM, &reqA, all);
+	join(group, REMOVE_RULES_CTRLCOMM, &reqB, some);
+	CPPUNIT_ASSERT_EQUAL( scheduled + 1, sched->getNumEvents() );
+
+	group->getRuleUIds(uids);
+	CPPUNIT_ASSERT_EQUAL( 5, (int) uids.size() );
+
+	// a rule named by two requests is deleted once
+	commit(group);
+	group->getRules(rules);
+	CPPUNIT_ASSERT_EQUAL( 4, (int) rules.size() );
+	CPPUNIT_ASSERT( contains(rules, rulm->getRule("s2", "r1")) );
+
+	// once taken out of the scheduler the rule index no longer reaches it
+	rulm->delRules(&rules, sched);
+	CPPUNIT_ASSERT_EQUAL( 3, (int) group->getMembers()->front().rules.size() );
+	CPPUNIT_ASSERT_EQUAL( 2, (int) group->getMembers()->back().rules.size() );
+	CPPUNIT_ASSERT_EQUAL( 0, sched->getNumEvents() );
+
+	saveDelete(group);
+}
+
+
+void GroupCommit_Test::testRuleExpiresInWindow()
+{
+	GroupCommitEvent *group = NULL;
+	RemoveRulesCtrlEvent reqA("s1"), reqB("s1.r2"), reqC("s2.r1");
+	ruleDB_t all, some, other, rules, gone;
+
+	storeRuleSet("s1", 3);
+	storeRuleSet("s2", 2);
+
+	Rule *r1 = rulm->getRule("s1", "r1");
+	Rule *r2 = rulm->getRule("s1", "r2");
+	Rule *r3 = rulm->getRule("s1", "r3");
+	Rule *s2r1 = rulm->getRule("s2", "r1");
+	Rule *s2r2 = rulm->getRule("s2", "r2");
+
+	rulm->getRules("s1", all);
+	some.push_back(r2);
+	other.push_back(s2r1);
+
+	join(group, REMOVE_RULES_CTRLCOMM, &reqA, all);
+	join(group, REMOVE_RULES_CTRLCOMM, &reqB, some);
+	join(group, REMOVE_RULES_CTRLCOMM, &reqC, other);
+
+	// r2 expires while the group is collecting: it is dropped from both
+	// requests naming it, before the rule manager can free it
+	gone.push_back(r2);
+	rulm->delRules(&gone, sched);
+	CPPUNIT_ASSERT( rulm->getRule("s1", "r2") == NULL );
+
+	GroupCommitEvent::memberListIter_t m = group->getMembers()->begin();
+	CPPUNIT_ASSERT_EQUAL( 2, (int) m->rules.size() );
+	CPPUNIT_ASSERT( !contains(m->rules, r2) );
+	m++;
+	CPPUNIT_ASSERT( m->rules.empty() );
+
+	// the same for a single rule deletion and for the last rule of a request
+	rulm->delRule(s2r1, sched);
+	CPPUNIT_ASSERT( group->getMembers()->back().rules.empty() );
+
+	// the emptied requests are still answered with the group
+	CPPUNIT_ASSERT_EQUAL( 3, (int) group->getMembers()->size() );
+
+	// rules not in the group leave it alone
+	gone.clear();
+	gone.push_back(s2r2);
+	rulm->delRules(&gone, sched);
+
+	commit(group);
+	group->getRules(rules);
+	CPPUNIT_ASSERT_EQUAL( 2, (int) rules.size() );
+	CPPUNIT_ASSERT( contains(rules, r1) );
+	CPPUNIT_ASSERT( contains(rules, r3) );
+
+	// what the QoS processor response hands to completeRemoveGroup
+	rulm->delRules(&rules, sched);
+	CPPUNIT_ASSERT( rulm->getRule("s1", "r1") == NULL );
+	CPPUNIT_ASSERT_EQUAL( 0, sched->getNumEvents() );
+
+	saveDelete(group);
+}
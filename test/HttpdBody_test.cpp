@@ -0,0 +1,272 @@
+/*
+ * Test the decoding of form bodies in the httpd library.
+ *
+ * $Id: HttpdBody_test.cpp 2016-10-17 10:00:00 amarentes $
+ *      The bodies are fed through a pipe or socket pair in chunks of
+ *      every size, so escapes get split across reads.
+ * $HeadURL: https://./test/HttpdBody_test.cpp $
+ */
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <fcntl.h>
+#include <sys/socket.h>
+
+#include "stdincpp.h"
+#include "httpd.h"
+
+
+class HttpdBody_Test : public CppUnit::TestFixture {
+
+	CPPUNIT_TEST_SUITE( HttpdBody_Test );
+
+	CPPUNIT_TEST( testUnquoteBody );
+	CPPUNIT_TEST( testUnquoteBodySplit );
+	CPPUNIT_TEST( testReadBodyChunks );
+	CPPUNIT_TEST( testBodyWithHeader );
+	CPPUNIT_TEST( testBodyTooLarge );
+
+	CPPUNIT_TEST_SUITE_END();
+
+  public:
+
+	void testUnquoteBody();
+	void testUnquoteBodySplit();
+	void testReadBodyChunks();
+	void testBodyWithHeader();
+	void testBodyTooLarge();
+
+  private:
+
+	struct bodyCase_t
+	{
+		const char *body;
+		const char *decoded;
+		int ldecoded;
+	};
+
+	static const bodyCase_t cases[];
+	static const int ncases;
+
+	//! request with room for a decoded body of len bytes
+	static struct REQUEST *newRequest(int len);
+
+	static void freeRequest(struct REQUEST *req);
+
+	//! decode body handing it to unquote_body in the given chunks
+	static string decode(const string &body, const vector<int> &chunks);
+
+	//! send a POST with the given body and content length, return the parsed request
+	static struct REQUEST *postRequest(const string &body, int clen, int fds[2]);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( HttpdBody_Test );
+
+
+#define BODY_CASE(b, d) { b, d, sizeof(d) - 1 }
+
+const HttpdBody_Test::bodyCase_t HttpdBody_Test::cases[] = {
+	BODY_CASE( "a=b&c=d", "a\0b\0c\0d\0" ),
+	BODY_CASE( "Rule=%41%62+c%2b", "Rule\0Ab c+\0" ),
+	BODY_CASE( "%3D=%26&x=a=b", "=\0&\0x\0a=b\0" ),
+	// fields without a value are dropped, empty values are kept
+	BODY_CASE( "a&b=&c=1&", "b\0\0c\0" "1\0" ),
+	// broken escapes are taken as they are
+	BODY_CASE( "x=%zz&y=%4", "x\0%zz\0y\0%4\0" ),
+	BODY_CASE( "y=%", "y\0%\0" ),
+	BODY_CASE( "", "" ),
+};
+
+const int HttpdBody_Test::ncases = sizeof(cases) / sizeof(cases[0]);
+
+
+struct REQUEST *HttpdBody_Test::newRequest(int len)
+{
+	struct REQUEST *req = (struct REQUEST *) calloc(1, sizeof(struct REQUEST));
+
+	req->fd = -1;
+	req->post_body = (char *) malloc(len + 1);
+	return req;
+}
+
+
+void HttpdBody_Test::freeRequest(struct REQUEST *req)
+{
+	list_free(&req->header);
+	free(req->post_body);
+	free(req);
+}
+
+
+string HttpdBody_Test::decode(const string &body, const vector<int> &chunks)
+{
+	struct REQUEST *req = newRequest(body.length());
+	vector<char> src(body.begin(), body.end());
+	int pos = 0;
+
+	src.push_back(0);
+	for (unsigned int i = 0; i < chunks.size(); i++) {
+		unquote_body(req, &src[pos], chunks[i]);
+		pos += chunks[i];
+	}
+	unquote_body_end(req);
+
+	string out(req->post_body, req->lpost);
+	freeRequest(req);
+	return out;
+}
+
+
+struct REQUEST *HttpdBody_Test::postRequest(const string &body, int clen, int fds[2])
+{
+	ostringstream msg;
+	struct REQUEST *req = newRequest(0);
+
+	free(req->post_body);
+	req->post_body = NULL;
+
+	CPPUNIT_ASSERT_EQUAL( 0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds) );
+	fcntl(fds[0], F_SETFL, O_NONBLOCK);
+	req->fd = fds[0];
+	req->state = STATE_READ_HEADER;
+
+	msg << "POST /addRule HTTP/1.1\r\n"
+		<< "Content-Type: application/x-www-form-urlencoded\r\n"
+		<< "Content-Length: " << clen << "\r\n\r\n"
+		<< body;
+	CPPUNIT_ASSERT_EQUAL( (ssize_t) msg.str().length(),
+						  write(fds[1], msg.str().c_str(), msg.str().length()) );
+
+	CPPUNIT_ASSERT( read_header(req, 0) >= 0 );
+	CPPUNIT_ASSERT_EQUAL( STATE_PARSE_HEADER, req->state );
+	parse_request(req, (char *) "localhost");
+	return req;
+}
+
+
+void HttpdBody_Test::testUnquoteBody()
+{
+	for (int i = 0; i < ncases; i++) {
+		vector<int> chunks(1, strlen(cases[i].body));
+
+		CPPUNIT_ASSERT_EQUAL( string(cases[i].decoded, cases[i].ldecoded),
+							  decode(cases[i].body, chunks) );
+	}
+}
+
+
+void HttpdBody_Test::testUnquoteBodySplit()
+{
+	for (int i = 0; i < ncases; i++) {
+		string body = cases[i].body;
+		string expect(cases[i].decoded, cases[i].ldecoded);
+		int len = body.length();
+
+		// every cut, so escapes and '+' are split at every position
+		for (int cut = 0; cut <= len; cut++) {
+			vector<int> chunks;
+			chunks.push_back(cut);
+			chunks.push_back(len - cut);
+			CPPUNIT_ASSERT_EQUAL( expect, decode(body, chunks) );
+		}
+
+		// a byte at a time
+		vector<int> bytes(len, 1);
+		CPPUNIT_ASSERT_EQUAL( expect, decode(body, bytes) );
+	}
+}
+
+
+void HttpdBody_Test::testReadBodyChunks()
+{
+	for (int i = 0; i < ncases; i++) {
+		string body = cases[i].body;
+		string expect(cases[i].decoded, cases[i].ldecoded);
+		int len = body.length();
+
+		for (int chunk = 1; chunk <= len; chunk++) {
+			struct REQUEST *req = newRequest(len);
+			int fds[2];
+
+			CPPUNIT_ASSERT_EQUAL( 0, pipe(fds) );
+			req->fd = fds[0];
+			req->clen = len;
+			req->state = STATE_READ_BODY;
+
+			// the body is decoded in place as it arrives
+			for (int pos = 0; pos < len; pos += chunk) {
+				int n = min(chunk, len - pos);
+				CPPUNIT_ASSERT_EQUAL( (ssize_t) n, write(fds[1], body.c_str() + pos, n) );
+				CPPUNIT_ASSERT_EQUAL( STATE_READ_BODY, req->state );
+				read_body(req, 0);
+			}
+
+			CPPUNIT_ASSERT_EQUAL( STATE_PARSE_BODY, req->state );
+			CPPUNIT_ASSERT_EQUAL( expect, string(req->post_body, req->lpost) );
+
+			close(fds[0]);
+			close(fds[1]);
+			freeRequest(req);
+		}
+	}
+}
+
+
+void HttpdBody_Test::testBodyWithHeader()
+{
+	string body = "Rule=%41%62+c%2b&a=b";
+	string expect("Rule\0Ab c+\0a\0b\0", 15);
+
+	// part of the body comes with the header, the rest later
+	for (unsigned int cut = 0; cut <= body.length(); cut++) {
+		int fds[2];
+		struct REQUEST *req = postRequest(body.substr(0, cut), body.length(), fds);
+
+		if (cut < body.length()) {
+			CPPUNIT_ASSERT_EQUAL( STATE_READ_BODY, req->state );
+			CPPUNIT_ASSERT_EQUAL( (ssize_t) (body.length() - cut),
+								  write(fds[1], body.c_str() + cut, body.length() - cut) );
+			read_body(req, 0);
+			CPPUNIT_ASSERT_EQUAL( STATE_PARSE_BODY, req->state );
+		} else {
+			CPPUNIT_ASSERT_EQUAL( STATE_PROCESS, req->state );
+		}
+		CPPUNIT_ASSERT_EQUAL( expect, string(req->post_body, req->lpost) );
+
+		close(fds[0]);
+		close(fds[1]);
+		freeRequest(req);
+	}
+}
+
+
+void HttpdBody_Test::testBodyTooLarge()
+{
+	int lens[] = { MAX_BODY + 1, -1 };
+
+	for (int i = 0; i < 2; i++) {
+		int fds[2];
+		struct REQUEST *req = postRequest("a=b", lens[i], fds);
+
+		// refused before any body memory is allocated
+		CPPUNIT_ASSERT_EQUAL( 413, req->status );
+		CPPUNIT_ASSERT_EQUAL( STATE_WRITE_HEADER, req->state );
+		CPPUNIT_ASSERT( req->post_body == NULL );
+		CPPUNIT_ASSERT_EQUAL( 0, req->keep_alive );
+
+		close(fds[0]);
+		close(fds[1]);
+		freeRequest(req);
+	}
+
+	// the largest body allowed is accepted
+	int fds[2];
+	struct REQUEST *req = postRequest("a=b", MAX_BODY, fds);
+	CPPUNIT_ASSERT( req->status != 413 );
+	CPPUNIT_ASSERT_EQUAL( STATE_READ_BODY, req->state );
+	CPPUNIT_ASSERT( req->post_body != NULL );
+
+	close(fds[0]);
+	close(fds[1]);
+	freeRequest(req);
+}
@@ -159,7 +159,7 @@ void QosProcessorThreaded::testCheckOkRules()
         log->log(ch, "testCheckOkRules before  obtaining the events");
                 
         eventVec_t e;
-        qosProcessorPtr->handleFDEvent(&e, NULL, NULL, NULL);
+        qosProcessorPtr->handleFDEvent(&e, NULL, 0, NULL);
 
         log->log(ch, "testCheckOkRules After obtaining the events");
         
@@ -218,7 +218,7 @@ void QosProcessorThreaded::testCheckNonOkRules()
         usleep(microseconds);
                 
         eventVec_t e;
-        qosProcessorPtr->handleFDEvent(&e, NULL, NULL, NULL);
+        qosProcessorPtr->handleFDEvent(&e, NULL, 0, NULL);
         
         // We just have to have 1 new event.
         CPPUNIT_ASSERT( e.size() == 1 );
@@ -286,7 +286,7 @@ void QosProcessorThreaded::testAddDeleteRules()
         // sleep waiting to execute the check method.
         usleep(microseconds);
                 
-        qosProcessorPtr->handleFDEvent(&eVec, NULL, NULL, NULL);
+        qosProcessorPtr->handleFDEvent(&eVec, NULL, 0, NULL);
         
         // We just have to have 1 new event.
         // One of the events corresponds to the answer, the other three correspond to activate events.
@@ -308,7 +308,7 @@ void QosProcessorThreaded::testAddDeleteRules()
         // sleep waiting to execute the check method.
         usleep(microseconds);
                 
-        qosProcessorPtr->handleFDEvent(&eVec, NULL, NULL, NULL);
+        qosProcessorPtr->handleFDEvent(&eVec, NULL, 0, NULL);
         
         // We just have to have 1 new event.
         CPPUNIT_ASSERT( eVec.size() == 5);
@@ -138,11 +138,12 @@ void QualityManagerThreaded_test::test()
             // Wait to bring back again the response event.
             usleep(microseconds);
 
-            qualitymanagerPtr->proc->handleFDEvent(&eVec, NULL, NULL, NULL);
+            qualitymanagerPtr->proc->handleFDEvent(&eVec, NULL, 0, NULL);
 
             qualitymanagerPtr->scheduleEvents(&eVec);
 
-            CPPUNIT_ASSERT( qualitymanagerPtr->evnt.get()->getNumEvents() == 2 );
+            // the add rules event is parked until the response resumes it
+            CPPUNIT_ASSERT( qualitymanagerPtr->evnt.get()->getNumEvents() == 1 );
 
 			evt = qualitymanagerPtr->evnt.get()->getNextEvent();
 
@@ -175,7 +176,7 @@ void QualityManagerThreaded_test::test()
             usleep(microseconds);
 
             // Bring the response from QoS processor.
-            qualitymanagerPtr->proc->handleFDEvent(&eVec, NULL, NULL, NULL);
+            qualitymanagerPtr->proc->handleFDEvent(&eVec, NULL, 0, NULL);
 
             // Put the response in the event scheduler.
             qualitymanagerPtr->scheduleEvents(&eVec);
@@ -237,7 +238,7 @@ void QualityManagerThreaded_test::test()
             usleep(microseconds);
 
             // Bring the response from QoS processor.
-            qualitymanagerPtr->proc->handleFDEvent(&eVec, NULL, NULL, NULL);
+            qualitymanagerPtr->proc->handleFDEvent(&eVec, NULL, 0, NULL);
 
             // Put the response in the event scheduler.
             qualitymanagerPtr->scheduleEvents(&eVec);
@@ -0,0 +1,124 @@
+/*
+ * Test the RuleActionTable class.
+ *
+ * $Id: RuleActionTable_test.cpp 2016-10-17 10:00:00 amarentes $
+ *      A timer is stale when the generation it was armed with differs
+ *      from the one of the entry stored under its uid, as checked by
+ *      QOSProcessor::expireTimers and QOSProcessor::timeout.
+ * $HeadURL: https://./test/RuleActionTable_test.cpp $
+ */
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "QOSProcessor.h"
+
+
+class RuleActionTable_Test : public CppUnit::TestFixture {
+
+	CPPUNIT_TEST_SUITE( RuleActionTable_Test );
+
+	CPPUNIT_TEST( testInsertErase );
+	CPPUNIT_TEST( testReuseAfterErase );
+	CPPUNIT_TEST( testReuseAfterFailedRule );
+
+	CPPUNIT_TEST_SUITE_END();
+
+  public:
+
+	void testInsertErase();
+	void testReuseAfterErase();
+	void testReuseAfterFailedRule();
+
+  private:
+
+	//! whether a timer armed with gen would still fire for uid
+	static bool timerMatches(RuleActionTable &table, int uid, unsigned int gen);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( RuleActionTable_Test );
+
+
+bool RuleActionTable_Test::timerMatches(RuleActionTable &table, int uid, unsigned int gen)
+{
+	ruleActions_t *ra = table.find(uid);
+
+	return (ra != NULL) && (ra->gen == gen);
+}
+
+
+void RuleActionTable_Test::testInsertErase()
+{
+	RuleActionTable table;
+	ruleActions_t entry;
+
+	CPPUNIT_ASSERT( table.find(3) == NULL );
+	CPPUNIT_ASSERT( table.find(-1) == NULL );
+	CPPUNIT_ASSERT_EQUAL( 0, table.erase(3) );
+
+	CPPUNIT_ASSERT( table.insert(3, entry) != NULL );
+	CPPUNIT_ASSERT_EQUAL( 1, table.size() );
+	CPPUNIT_ASSERT( table.find(3) != NULL );
+	CPPUNIT_ASSERT_THROW( table.insert(3, entry), Error );
+	CPPUNIT_ASSERT_THROW( table.insert(-1, entry), Error );
+
+	CPPUNIT_ASSERT_EQUAL( 1, table.erase(3) );
+	CPPUNIT_ASSERT_EQUAL( 0, table.size() );
+	CPPUNIT_ASSERT( table.find(3) == NULL );
+}
+
+
+void RuleActionTable_Test::testReuseAfterErase()
+{
+	RuleActionTable table;
+	ruleActions_t entry;
+
+	unsigned int g1 = table.nextGeneration(7);
+	CPPUNIT_ASSERT_EQUAL( g1, table.insert(7, entry)->gen );
+	CPPUNIT_ASSERT( timerMatches(table, 7, g1) );
+
+	// timers of the deleted rule do not fire for the next one
+	table.erase(7);
+	CPPUNIT_ASSERT( !timerMatches(table, 7, g1) );
+
+	unsigned int g2 = table.nextGeneration(7);
+	CPPUNIT_ASSERT( g2 != g1 );
+	CPPUNIT_ASSERT_EQUAL( g2, table.insert(7, entry)->gen );
+	CPPUNIT_ASSERT( !timerMatches(table, 7, g1) );
+	CPPUNIT_ASSERT( timerMatches(table, 7, g2) );
+}
+
+
+void RuleActionTable_Test::testReuseAfterFailedRule()
+{
+	RuleActionTable table;
+	ruleActions_t entry;
+
+	// a rule armed timers for one action, then another action failed
+	unsigned int failed = table.nextGeneration(9);
+	table.skipGeneration(9);
+	CPPUNIT_ASSERT( table.find(9) == NULL );
+
+	// the next rule with the uid must not be hit by those timers
+	unsigned int gen = table.nextGeneration(9);
+	CPPUNIT_ASSERT( gen != failed );
+	CPPUNIT_ASSERT_EQUAL( gen, table.insert(9, entry)->gen );
+	CPPUNIT_ASSERT( !timerMatches(table, 9, failed) );
+	CPPUNIT_ASSERT( timerMatches(table, 9, gen) );
+
+	// a failed attempt on an active uid leaves the active rule alone
+	table.skipGeneration(9);
+	CPPUNIT_ASSERT( timerMatches(table, 9, gen) );
+
+	// the same for a uid that was never stored and one of an erased rule
+	unsigned int fresh = table.nextGeneration(100);
+	table.skipGeneration(100);
+	CPPUNIT_ASSERT( table.nextGeneration(100) != fresh );
+
+	table.erase(9);
+	unsigned int erased = table.nextGeneration(9);
+	table.skipGeneration(9);
+	CPPUNIT_ASSERT( table.insert(9, entry)->gen != erased );
+
+	table.skipGeneration(-1);
+	CPPUNIT_ASSERT_EQUAL( 1, table.size() );
+}
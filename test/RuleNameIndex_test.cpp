@@ -0,0 +1,205 @@
+/*
+ * Test the RuleNameIndex class.
+ *
+ * $Id: RuleNameIndex_test.cpp 2016-10-17 10:00:00 amarentes $
+ *      The index is checked against a std::map holding the same names.
+ * $HeadURL: https://./test/RuleNameIndex_test.cpp $
+ */
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include <cstdlib>
+
+#include "RuleNameIndex.h"
+
+
+typedef map<pair<string, string>, int>            nameModel_t;
+typedef map<pair<string, string>, int>::iterator  nameModelIter_t;
+
+
+class RuleNameIndex_Test : public CppUnit::TestFixture {
+
+	CPPUNIT_TEST_SUITE( RuleNameIndex_Test );
+
+	CPPUNIT_TEST( testInsertLookup );
+	CPPUNIT_TEST( testEraseTombstones );
+	CPPUNIT_TEST( testRehash );
+	CPPUNIT_TEST( testAgainstMap );
+
+	CPPUNIT_TEST_SUITE_END();
+
+  public:
+
+	void testInsertLookup();
+	void testEraseTombstones();
+	void testRehash();
+	void testAgainstMap();
+
+  private:
+
+	static string name(const char *prefix, int i);
+
+	//! every name of the model has to be found with its uid
+	void checkModel(RuleNameIndex &index, nameModel_t &model);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( RuleNameIndex_Test );
+
+
+string RuleNameIndex_Test::name(const char *prefix, int i)
+{
+	ostringstream s;
+
+	s << prefix << i;
+	return s.str();
+}
+
+
+void RuleNameIndex_Test::checkModel(RuleNameIndex &index, nameModel_t &model)
+{
+	map<string, int> setSizes;
+
+	for (nameModelIter_t i = model.begin(); i != model.end(); i++) {
+		CPPUNIT_ASSERT_EQUAL( i->second, index.find(i->first.first, i->first.second) );
+		setSizes[i->first.first]++;
+	}
+
+	for (map<string, int>::iterator s = setSizes.begin(); s != setSizes.end(); s++) {
+		CPPUNIT_ASSERT_EQUAL( s->second, index.getSetSize(s->first) );
+	}
+}
+
+
+void RuleNameIndex_Test::testInsertLookup()
+{
+	RuleNameIndex index;
+
+	CPPUNIT_ASSERT_EQUAL( -1, index.find("set1", "r1") );
+	CPPUNIT_ASSERT_EQUAL( -1, index.findSet("set1") );
+
+	CPPUNIT_ASSERT_EQUAL( 1, index.insert("set1", "r1", 10) );
+	CPPUNIT_ASSERT_EQUAL( 1, index.insert("set1", "r2", 11) );
+	CPPUNIT_ASSERT_EQUAL( 1, index.insert("set2", "r1", 12) );
+
+	// a name is only taken once, the first uid stays
+	CPPUNIT_ASSERT_EQUAL( 0, index.insert("set1", "r1", 13) );
+
+	CPPUNIT_ASSERT_EQUAL( 10, index.find("set1", "r1") );
+	CPPUNIT_ASSERT_EQUAL( 11, index.find("set1", "r2") );
+	CPPUNIT_ASSERT_EQUAL( 12, index.find("set2", "r1") );
+	CPPUNIT_ASSERT_EQUAL( -1, index.find("set2", "r2") );
+	CPPUNIT_ASSERT_EQUAL( -1, index.find("set3", "r1") );
+
+	CPPUNIT_ASSERT_EQUAL( 2, index.getSetSize("set1") );
+	CPPUNIT_ASSERT_EQUAL( 1, index.getSetSize("set2") );
+	CPPUNIT_ASSERT_EQUAL( 0, index.getSetSize("set3") );
+}
+
+
+void RuleNameIndex_Test::testEraseTombstones()
+{
+	RuleNameIndex index;
+	nameModel_t model;
+	int uid = 0;
+
+	for (int i = 0; i < 40; i++) {
+		CPPUNIT_ASSERT_EQUAL( 1, index.insert("set1", name("r", i), uid) );
+		model[make_pair(string("set1"), name("r", i))] = uid++;
+	}
+
+	// the remaining names have to be found past the deleted slots
+	for (int i = 0; i < 40; i += 2) {
+		CPPUNIT_ASSERT_EQUAL( model[make_pair(string("set1"), name("r", i))],
+							  index.erase("set1", name("r", i)) );
+		model.erase(make_pair(string("set1"), name("r", i)));
+	}
+	CPPUNIT_ASSERT_EQUAL( -1, index.erase("set1", "r0") );
+	CPPUNIT_ASSERT_EQUAL( -1, index.find("set1", "r0") );
+	checkModel(index, model);
+
+	// churn: the deleted slots fill the table until it is rebuilt
+	for (int round = 0; round < 200; round++) {
+		for (int i = 0; i < 40; i += 2) {
+			CPPUNIT_ASSERT_EQUAL( 1, index.insert("set1", name("r", i), uid) );
+			CPPUNIT_ASSERT_EQUAL( uid, index.erase("set1", name("r", i)) );
+			uid++;
+		}
+	}
+	checkModel(index, model);
+	CPPUNIT_ASSERT_EQUAL( 20, index.getSetSize("set1") );
+
+	// a set losing its last rule is gone, its name can be used again
+	for (int i = 1; i < 40; i += 2) {
+		index.erase("set1", name("r", i));
+	}
+	CPPUNIT_ASSERT_EQUAL( -1, index.findSet("set1") );
+	CPPUNIT_ASSERT_EQUAL( 1, index.insert("set1", "r1", 99) );
+	CPPUNIT_ASSERT_EQUAL( 99, index.find("set1", "r1") );
+	CPPUNIT_ASSERT_EQUAL( 1, index.getSetSize("set1") );
+}
+
+
+void RuleNameIndex_Test::testRehash()
+{
+	RuleNameIndex index;
+	nameModel_t model;
+	int uid = 0;
+
+	// grows both tables several times
+	for (int s = 0; s < 200; s++) {
+		for (int r = 0; r < 50; r++) {
+			CPPUNIT_ASSERT_EQUAL( 1, index.insert(name("set", s), name("rule", r), uid) );
+			model[make_pair(name("set", s), name("rule", r))] = uid++;
+		}
+	}
+	checkModel(index, model);
+
+	// the same rule name in another set is another rule
+	CPPUNIT_ASSERT( index.find("set1", "rule7") != index.find("set2", "rule7") );
+	CPPUNIT_ASSERT_EQUAL( -1, index.find("set200", "rule0") );
+	CPPUNIT_ASSERT_EQUAL( -1, index.find("set0", "rule50") );
+}
+
+
+void RuleNameIndex_Test::testAgainstMap()
+{
+	RuleNameIndex index;
+	nameModel_t model;
+	int uid = 0;
+
+	srand(4711);
+
+	for (int op = 0; op < 200000; op++) {
+		pair<string, string> key(name("set", rand() % 30), name("rule", rand() % 300));
+		nameModelIter_t m = model.find(key);
+
+		switch (rand() % 3) {
+		case 0:
+			if (m == model.end()) {
+				CPPUNIT_ASSERT_EQUAL( 1, index.insert(key.first, key.second, uid) );
+				model[key] = uid++;
+			} else {
+				CPPUNIT_ASSERT_EQUAL( 0, index.insert(key.first, key.second, uid) );
+			}
+			break;
+		case 1:
+			if (m == model.end()) {
+				CPPUNIT_ASSERT_EQUAL( -1, index.erase(key.first, key.second) );
+			} else {
+				CPPUNIT_ASSERT_EQUAL( m->second, index.erase(key.first, key.second) );
+				model.erase(m);
+			}
+			break;
+		default:
+			CPPUNIT_ASSERT_EQUAL( (m == model.end()) ? -1 : m->second,
+								  index.find(key.first, key.second) );
+			break;
+		}
+
+		if ((op % 20000) == 0) {
+			checkModel(index, model);
+		}
+	}
+
+	checkModel(index, model);
+}
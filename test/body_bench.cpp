@@ -0,0 +1,302 @@
+/*! \file   body_bench.cpp
+
+    Copyright 2014-2015 Universidad de los Andes, Bogotá, Colombia
+
+    This file is part of Network Quality Manager System (NETQoS).
+
+    NETQoS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    NETQoS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this software; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    Description:
+    parsing of 1 MB and 10 MB /add_task bodies: the streaming decoder
+    of the httpd against the former copy/unquote/substr scheme, and a
+    full POST through the embedded httpd
+
+    $Id: body_bench.cpp 748 2016-10-17 10:00:00 amarentes $
+*/
+
+#include "stdincpp.h"
+#include "httpd.h"
+#include "Error.h"
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+
+
+//! normally defined by the quality manager main loop
+int g_timeout = 0;
+
+//! port of the benchmark server
+const int BENCH_PORT = 18092;
+
+//! runs per body size
+const int BENCH_RUNS = 5;
+
+//! size of the socket reads the httpd sees
+const int BENCH_CHUNK = 65536;
+
+static fd_sets_t srvFds;
+static volatile int srvStop = 0;
+static volatile int ruleLen = 0;
+static vector<struct REQUEST *> pending;
+
+
+// remember the length of the decoded rule, reply once handled
+static int parseRequest(struct REQUEST *req)
+{
+    char *p = req->post_body;
+    char *end = req->post_body + req->lpost;
+
+    while (p != NULL && p < end) {
+        char *val = p + strlen(p) + 1;
+        if (strcmp(p, "Rule") == 0) {
+            ruleLen = strlen(val);
+        }
+        p = val + strlen(val) + 1;
+    }
+
+    pending.push_back(req);
+    return 0;
+}
+
+
+static int logError(int eno, int loglevel, char *txt, char *peerhost)
+{
+    return 0;
+}
+
+
+static void *serverLoop(void *arg)
+{
+    fd_t ready[REACTOR_MAX_EVENTS];
+    int listenFd = *(int *) arg;
+    int i, n;
+
+    reactor_add(&srvFds, listenFd, FD_RD, 0);
+
+    while (!srvStop) {
+        n = reactor_wait(&srvFds, ready, REACTOR_MAX_EVENTS, 100);
+        for (i = 0; i < n; i++) {
+            httpd_handle_event(&ready[i], &srvFds);
+        }
+        for (i = 0; i < (int) pending.size(); i++) {
+            pending[i]->body = strdup("ok\n");
+            pending[i]->mime = (char *) "text/plain";
+            httpd_send_response(pending[i], &srvFds);
+        }
+        pending.clear();
+    }
+
+    return NULL;
+}
+
+
+static double elapsedMs(struct timeval start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_usec - start.tv_usec) / 1e3;
+}
+
+
+// url-encoded rule set of about size bytes
+static string makeBody(int size)
+{
+    string rule = "<rule id=\"r1\"><filter name=\"SrcIP\">10.0.0.1</filter>"
+                  "<action name=\"bw\"><pref name=\"Rate\">100</pref></action></rule>\n";
+    string body = "Rule=%3C%3Fxml+version%3D%221.0%22%3F%3E%3CRULESET%3E";
+    string enc;
+
+    for (string::iterator i = rule.begin(); i != rule.end(); i++) {
+        char hex[4];
+        if (isalnum(*i)) {
+            enc += *i;
+        } else if (*i == ' ') {
+            enc += '+';
+        } else {
+            sprintf(hex, "%%%02X", (unsigned char) *i);
+            enc += hex;
+        }
+    }
+
+    while ((int) body.length() < size) {
+        body += enc;
+    }
+    return body + "%3C%2FRULESET%3E";
+}
+
+
+// the parsing done before: read, unquote all, split with substr, copy the rule
+static int oldParse(const string &body)
+{
+    char *hreq = (char *) malloc(body.length() + 1);
+    char *post = (char *) malloc(body.length() + 1);
+    map<string,string> params;
+
+    memcpy(hreq, body.c_str(), body.length() + 1);
+    unquote2((unsigned char *) post, (unsigned char *) hreq);
+
+    string q = post;
+    int p1 = 0, p2 = q.length(), p3 = 0;
+    while((p2 = q.find("&",p1)) > 0) {
+        p3 = q.find("=",p1);
+        if (p3 > 0) {
+            params[q.substr(p1,p3-p1)] = q.substr(p3+1, p2-p3-1);
+        }
+        p1 = p2+1;
+    }
+    p3 = q.find("=",p1);
+    if (p3 > 0) {
+        params[q.substr(p1,p3-p1)] = q.substr(p3+1, p2-p3-1);
+    }
+
+    string &rule = params["Rule"];
+    char *buf = new char[rule.size() + 1];
+    memcpy(buf, rule.c_str(), rule.size() + 1);
+    int len = strlen(buf);
+
+    delete[] buf;
+    free(post);
+    free(hreq);
+    return len;
+}
+
+
+// the streaming decoder fed with socket sized chunks, in place
+static int newParse(const string &body)
+{
+    struct REQUEST *req = (struct REQUEST *) calloc(1, sizeof(struct REQUEST));
+    int off, n;
+
+    req->post_body = (char *) malloc(body.length() + 1);
+    for (off = 0; off < (int) body.length(); off += n) {
+        n = min(BENCH_CHUNK, (int) body.length() - off);
+        memcpy(req->post_body + off, body.data() + off, n);
+        unquote_body(req, req->post_body + off, n);
+    }
+    unquote_body_end(req);
+
+    int len = strlen(req->post_body + strlen(req->post_body) + 1);
+
+    free(req->post_body);
+    free(req);
+    return len;
+}
+
+
+static void runParse(int size)
+{
+    string body = makeBody(size);
+    struct timeval start;
+    int i, l1 = 0, l2 = 0;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < BENCH_RUNS; i++) {
+        l1 = oldParse(body);
+    }
+    double tOld = elapsedMs(start) / BENCH_RUNS;
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < BENCH_RUNS; i++) {
+        l2 = newParse(body);
+    }
+    double tNew = elapsedMs(start) / BENCH_RUNS;
+
+    cout << setw(9) << body.length() << " bytes  copy/substr " << setw(8) << fixed
+         << setprecision(2) << tOld << " ms  streaming " << setw(8) << tNew << " ms"
+         << ((l1 == l2) ? "" : "  (rule length differs!)") << endl;
+}
+
+
+static void runPost(int size)
+{
+    string body = makeBody(size);
+    char hdr[256], buf[4096];
+    struct sockaddr_in addr;
+    struct timeval start;
+    int i, fd;
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    sprintf(hdr, "POST /add_task HTTP/1.1\r\nHost: localhost\r\n"
+            "Content-Type: application/x-www-form-urlencoded\r\n"
+            "Content-Length: %d\r\n\r\n", (int) body.length());
+
+    gettimeofday(&start, NULL);
+    for (i = 0; i < BENCH_RUNS; i++) {
+        if ((fd = socket(AF_INET, SOCK_STREAM, 0)) < 0 ||
+            connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+            throw Error("cannot connect to the benchmark server");
+        }
+        write(fd, hdr, strlen(hdr));
+        for (size_t off = 0; off < body.length(); ) {
+            int n = write(fd, body.data() + off, body.length() - off);
+            if (n <= 0) {
+                throw Error("cannot send the body");
+            }
+            off += n;
+        }
+        if (read(fd, buf, sizeof(buf)) <= 0) {
+            throw Error("no reply from the benchmark server");
+        }
+        close(fd);
+    }
+    double tPost = elapsedMs(start) / BENCH_RUNS;
+
+    cout << setw(9) << body.length() << " bytes  POST /add_task " << setw(8) << fixed
+         << setprecision(2) << tPost << " ms  (rule " << ruleLen << " bytes)" << endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int sizes[] = { 1 << 20, 10 << 20 };
+    unsigned int i;
+    pthread_t srv;
+    int listenFd;
+
+    signal(SIGPIPE, SIG_IGN);
+    httpd_register_parse_request(parseRequest);
+    httpd_register_log_error(logError);
+
+    try {
+        for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            runParse(sizes[i]);
+        }
+
+        listenFd = httpd_init(BENCH_PORT, (char *) "localhost", 0, NULL, NULL, 0);
+        if (listenFd < 0 || reactor_init(&srvFds) < 0) {
+            throw Error("cannot start the benchmark server");
+        }
+        pthread_create(&srv, NULL, serverLoop, &listenFd);
+
+        for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            runPost(sizes[i]);
+        }
+
+        srvStop = 1;
+        pthread_join(srv, NULL);
+        httpd_shutdown();
+        reactor_close(&srvFds);
+    } catch (Error &e) {
+        cerr << "benchmark failed: " << e.getError() << endl;
+        exit(1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,175 @@
+/*! \file   bulk_bench.cpp
+
+    Copyright 2014-2015 Universidad de los Andes, Bogotá, Colombia
+
+    This file is part of Network Quality Manager System (NETQoS).
+
+    NETQoS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    NETQoS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this software; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    Description:
+    rules/s parsed and queued for a /add_tasks_bulk body against the
+    same rules sent as XML to /add_task
+
+    $Id: bulk_bench.cpp 748 2016-10-17 10:00:00 amarentes $
+*/
+
+#include "stdincpp.h"
+#include "Event.h"
+#include "EventScheduler.h"
+#include "RuleManager.h"
+#include "Error.h"
+
+
+//! rules per request, rule ids are 16 bit so stay below 64k
+const int BENCH_RULES = 50000;
+
+//! runs per format
+const int BENCH_RUNS = 3;
+
+
+static double elapsedMs(struct timeval start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_usec - start.tv_usec) / 1e3;
+}
+
+
+static string ruleAddr(int i)
+{
+    char addr[32];
+
+    sprintf(addr, "10.%d.%d.%d", (i >> 16) & 0xff, (i >> 8) & 0xff, i & 0xff);
+    return addr;
+}
+
+
+static void putPref(string &out, const string &name, const string &type, const string &value)
+{
+    BulkRuleParser::putStr(out, name);
+    BulkRuleParser::putStr(out, type);
+    BulkRuleParser::putStr(out, value);
+}
+
+
+// num rules with one filter and one htb action as in example_rules1.xml
+static string makeBulk(int num)
+{
+    string out = BULK_RULE_MAGIC;
+    char name[16];
+
+    BulkRuleParser::putInt(out, BULK_RULE_VERSION, 1);
+
+    for (int i = 0; i < num; i++) {
+        string rule;
+
+        sprintf(name, "%d", i);
+        BulkRuleParser::putStr(rule, "bench");
+        BulkRuleParser::putStr(rule, name);
+
+        BulkRuleParser::putInt(rule, 1, 1);
+        BulkRuleParser::putStr(rule, "SrcIP");
+        BulkRuleParser::putStr(rule, ruleAddr(i));
+        BulkRuleParser::putStr(rule, "");
+
+        BulkRuleParser::putInt(rule, 1, 1);
+        BulkRuleParser::putStr(rule, "htb");
+        BulkRuleParser::putInt(rule, 4, 1);
+        putPref(rule, "Bidir", "", "no");
+        putPref(rule, "Rate", "Float64", "15000");
+        putPref(rule, "Burst", "UInt32", "1500");
+        putPref(rule, "Priority", "UInt32", "2");
+
+        BulkRuleParser::putInt(rule, 1, 1);
+        putPref(rule, "Duration", "", "1000");
+
+        BulkRuleParser::putInt(out, rule.length(), 4);
+        out += rule;
+    }
+
+    return out;
+}
+
+
+static string makeXML(int num)
+{
+    ostringstream out;
+
+    out << "<?xml version =\"1.0\" encoding=\"UTF-8\"?>\n"
+        << "<!DOCTYPE RULESET SYSTEM \"rulefile.dtd\">\n"
+        << "<RULESET ID=\"bench\"><GLOBAL><PREF NAME=\"Duration\">1000</PREF></GLOBAL>\n";
+
+    for (int i = 0; i < num; i++) {
+        out << "<RULE ID=\"" << i << "\"><FILTER NAME=\"SrcIP\">" << ruleAddr(i)
+            << "</FILTER><ACTION NAME=\"htb\"><PREF NAME=\"Bidir\">no</PREF>"
+            << "<PREF NAME=\"Rate\" TYPE=\"Float64\">15000</PREF>"
+            << "<PREF NAME=\"Burst\" TYPE=\"UInt32\">1500</PREF>"
+            << "<PREF NAME=\"Priority\" TYPE=\"UInt32\">2</PREF></ACTION></RULE>\n";
+    }
+    out << "</RULESET>\n";
+
+    return out.str();
+}
+
+
+// parse the buffer and queue the rules for activation as the ctrlcomm handler does
+static void runBench(const char *label, const string &body, int format, int num)
+{
+    struct timeval start;
+    double tParse = 0, tAdd = 0;
+
+    for (int r = 0; r < BENCH_RUNS; r++) {
+        RuleManager rulm("", "");
+        EventScheduler sched;
+        vector<char> buf(body.begin(), body.end());
+        buf.push_back(0);
+
+        gettimeofday(&start, NULL);
+        ruleDB_t *rules = rulm.parseRulesBuffer(&buf[0], body.length(), format);
+        tParse += elapsedMs(start);
+
+        gettimeofday(&start, NULL);
+        rulm.addRules(rules, &sched);
+        tAdd += elapsedMs(start);
+
+        if ((int) rules->size() != num) {
+            throw Error("%s: %d rules parsed, %d expected", label, (int) rules->size(), num);
+        }
+        saveDelete(rules);
+    }
+
+    tParse /= BENCH_RUNS;
+    tAdd /= BENCH_RUNS;
+
+    cout << setw(5) << label << setw(7) << num << " rules " << setw(9) << body.length()
+         << " bytes  parse " << setw(8) << fixed << setprecision(1) << tParse << " ms"
+         << "  queue " << setw(8) << tAdd << " ms  " << setw(8) << setprecision(0)
+         << num / ((tParse + tAdd) / 1e3) << " rules/s" << endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    try {
+        runBench("bulk", makeBulk(BENCH_RULES), ADD_RULES_BULK, BENCH_RULES);
+        runBench("xml", makeXML(BENCH_RULES), 0, BENCH_RULES);
+    } catch (Error &e) {
+        cerr << "benchmark failed: " << e.getError() << endl;
+        exit(1);
+    }
+
+    return 0;
+}
@@ -0,0 +1,247 @@
+/*! \file   httpd_bench.cpp
+
+    Copyright 2014-2015 Universidad de los Andes, Bogotá, Colombia
+
+    This file is part of Network Quality Manager System (NETQoS).
+
+    NETQoS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    NETQoS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this software; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    Description:
+    load test of the control server: 1k concurrent keepalive clients
+    against the embedded httpd with the CONTROL default limits
+
+    $Id: httpd_bench.cpp 748 2016-10-17 10:00:00 amarentes $
+*/
+
+#include "stdincpp.h"
+#include "httpd.h"
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+
+//! normally defined by the quality manager main loop
+int g_timeout = 0;
+
+//! port of the benchmark server
+const int BENCH_PORT = 18090;
+
+//! number of concurrent clients
+const int BENCH_CLIENTS = 1000;
+
+//! requests sent by every client
+const int BENCH_REQUESTS = 50;
+
+static const char *BENCH_REQ = "GET /bench HTTP/1.1\r\nHost: localhost\r\n\r\n";
+static const char *BENCH_BODY = "bench-ok\n";
+
+static fd_sets_t srvFds;
+static volatile int srvStop = 0;
+static vector<struct REQUEST *> pending;
+
+
+// answer every request once the ready descriptors are handled
+static int parseRequest(struct REQUEST *req)
+{
+    pending.push_back(req);
+    return 0;
+}
+
+
+static int logError(int eno, int loglevel, char *txt, char *peerhost)
+{
+    return 0;
+}
+
+
+static void *serverLoop(void *arg)
+{
+    fd_t ready[REACTOR_MAX_EVENTS];
+    int listenFd = *(int *) arg;
+    int i, n;
+
+    reactor_add(&srvFds, listenFd, FD_RD, 0);
+
+    while (!srvStop) {
+        n = reactor_wait(&srvFds, ready, REACTOR_MAX_EVENTS, 100);
+        if (n == 0) {
+            httpd_handle_event(NULL, &srvFds);
+            continue;
+        }
+        for (i = 0; i < n; i++) {
+            httpd_handle_event(&ready[i], &srvFds);
+        }
+        for (i = 0; i < (int) pending.size(); i++) {
+            pending[i]->body = strdup(BENCH_BODY);
+            pending[i]->mime = (char *) "text/plain";
+            httpd_send_response(pending[i], &srvFds);
+        }
+        pending.clear();
+    }
+
+    return NULL;
+}
+
+
+typedef struct
+{
+    int fd;
+    int sent;       //!< requests sent
+    int done;       //!< responses received
+    string in;      //!< partial response
+} client_t;
+
+
+static int connectClient()
+{
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+
+    if (fd < 0) {
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(BENCH_PORT);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+    if (connect(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+        close(fd);
+        return -1;
+    }
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+
+static double elapsedMs(struct timeval start)
+{
+    struct timeval now;
+
+    gettimeofday(&now, NULL);
+    return (now.tv_sec - start.tv_sec) * 1e3 + (now.tv_usec - start.tv_usec) / 1e3;
+}
+
+
+int main(int argc, char *argv[])
+{
+    struct rlimit rl;
+    pthread_t srv;
+    struct timeval start;
+    struct epoll_event ev, evs[256];
+    vector<client_t> clients(BENCH_CLIENTS);
+    int listenFd, epfd, i, n, active = 0, refused = 0, closed = 0;
+    long total = 0;
+    char buf[4096];
+
+    // every client needs two descriptors in this process
+    getrlimit(RLIMIT_NOFILE, &rl);
+    if (rl.rlim_cur < (rlim_t) (2 * BENCH_CLIENTS + 64)) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    httpd_register_parse_request(parseRequest);
+    httpd_register_log_error(logError);
+    httpd_set_limits(1024, 1024, 1024, 5, 60);
+
+    listenFd = httpd_init(BENCH_PORT, (char *) "localhost", 0, NULL, NULL, 0);
+    if (listenFd < 0 || reactor_init(&srvFds) < 0) {
+        cerr << "benchmark failed: cannot start the server" << endl;
+        exit(1);
+    }
+    pthread_create(&srv, NULL, serverLoop, &listenFd);
+
+    epfd = epoll_create1(0);
+    gettimeofday(&start, NULL);
+
+    for (i = 0; i < BENCH_CLIENTS; i++) {
+        clients[i].fd = connectClient();
+        clients[i].sent = clients[i].done = 0;
+        if (clients[i].fd < 0) {
+            refused++;
+            continue;
+        }
+        ev.events = EPOLLIN;
+        ev.data.u32 = i;
+        epoll_ctl(epfd, EPOLL_CTL_ADD, clients[i].fd, &ev);
+        if (write(clients[i].fd, BENCH_REQ, strlen(BENCH_REQ)) > 0) {
+            clients[i].sent++;
+        }
+        active++;
+    }
+    double tConn = elapsedMs(start);
+
+    // every client sends its next request when the previous response arrived
+    while (active > 0) {
+        n = epoll_wait(epfd, evs, 256, 5000);
+        if (n <= 0) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            client_t &c = clients[evs[i].data.u32];
+            int r = read(c.fd, buf, sizeof(buf));
+
+            if (r <= 0) {
+                if (r < 0 && errno == EAGAIN) {
+                    continue;
+                }
+                close(c.fd);
+                active--;
+                closed++;
+                continue;
+            }
+
+            c.in.append(buf, r);
+            size_t end;
+            while ((end = c.in.find(BENCH_BODY)) != string::npos) {
+                c.in.erase(0, end + strlen(BENCH_BODY));
+                c.done++;
+                total++;
+                if (c.sent < BENCH_REQUESTS) {
+                    if (write(c.fd, BENCH_REQ, strlen(BENCH_REQ)) > 0) {
+                        c.sent++;
+                    }
+                } else {
+                    close(c.fd);
+                    active--;
+                }
+            }
+        }
+    }
+    double tAll = elapsedMs(start);
+
+    cout << "clients " << BENCH_CLIENTS << "  refused " << refused
+         << "  dropped " << closed << "  unfinished " << active << endl;
+    cout << "connect " << fixed << setprecision(1) << tConn << " ms"
+         << "  requests " << total << " in " << tAll << " ms"
+         << "  (" << setprecision(0) << total / (tAll / 1e3) << " req/s)" << endl;
+
+    srvStop = 1;
+    pthread_join(srv, NULL);
+    httpd_shutdown();
+    reactor_close(&srvFds);
+    close(epfd);
+
+    return (refused || closed || active) ? 1 : 0;
+}
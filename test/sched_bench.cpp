@@ -0,0 +1,106 @@
+/*! \file   sched_bench.cpp
+
+    Copyright 2014-2015 Universidad de los Andes, Bogotá, Colombia
+
+    This file is part of Network Quality Manager System (NETQoS).
+
+    NETQoS is free software; you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation; either version 2 of the License, or
+    (at your option) any later version.
+
+    NETQoS is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with this software; if not, write to the Free Software
+    Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307  USA
+
+    Description:
+    compares the EventScheduler event list with the timing wheel for
+    10k, 100k and 1M pending events (insert, reschedule, drain)
+
+    $Id: sched_bench.cpp 748 2016-10-17 10:00:00 amarentes $
+*/
+
+#include "stdincpp.h"
+#include "Event.h"
+#include "EventScheduler.h"
+#include "Timeval.h"
+#include "Error.h"
+
+
+//! spread of the expiry times of the generated events [ms]
+const unsigned long BENCH_SPREAD_MS = 600000;
+
+
+static double elapsedMs(struct timeval start)
+{
+    struct timeval now;
+
+    Timeval::gettimeofdayown(&now, NULL);
+    struct timeval d = Timeval::sub0(now, start);
+    return d.tv_sec * 1e3 + d.tv_usec / 1e3;
+}
+
+
+static void runBench(int useWheel, int num)
+{
+    EventScheduler sched(useWheel);
+    struct timeval start, base;
+    int i;
+
+    srand(4711);
+    Timeval::gettimeofdayown(&base, NULL);
+
+    // insert
+    Timeval::gettimeofdayown(&start, NULL);
+    for (i = 0; i < num; i++) {
+        unsigned long offs = rand() % BENCH_SPREAD_MS;
+        struct timeval d = { (time_t) (offs / 1000), (suseconds_t) ((offs % 1000) * 1000) };
+        struct timeval t = Timeval::add(base, d);
+        sched.addEvent(new Event(TEST, t, 1000 + rand() % 9000));
+    }
+    double tIns = elapsedMs(start);
+
+    // reschedule the earliest events as the main loop does
+    Timeval::gettimeofdayown(&start, NULL);
+    for (i = 0; i < num; i++) {
+        sched.reschedNextEvent(sched.getNextEvent());
+    }
+    double tResched = elapsedMs(start);
+
+    // drain
+    Timeval::gettimeofdayown(&start, NULL);
+    Event *ev;
+    while ((ev = sched.getNextEvent()) != NULL) {
+        saveDelete(ev);
+    }
+    double tDrain = elapsedMs(start);
+
+    cout << setw(8) << num << "  " << setw(10) << (useWheel ? "wheel" : "multimap")
+         << "  insert " << setw(9) << fixed << setprecision(1) << tIns << " ms"
+         << "  resched " << setw(9) << tResched << " ms"
+         << "  drain " << setw(9) << tDrain << " ms" << endl;
+}
+
+
+int main(int argc, char *argv[])
+{
+    int sizes[] = { 10000, 100000, 1000000 };
+    unsigned int i;
+
+    try {
+        for (i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++) {
+            runBench(0, sizes[i]);
+            runBench(1, sizes[i]);
+        }
+    } catch (Error &e) {
+        cerr << "benchmark failed: " << e.getError() << endl;
+        exit(1);
+    }
+
+    return 0;
+}
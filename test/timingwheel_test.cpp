@@ -0,0 +1,272 @@
+/*
+ * Test the TimingWheel class and the removal of rule events.
+ *
+ * $Id: timingwheel_test.cpp 2016-10-17 10:00:00 amarentes $
+ *      The wheel is driven with synthetic ticks, so the tests do not
+ *      depend on the wall clock.
+ * $HeadURL: https://./test/timingwheel_test.cpp $
+ */
+#include <cppunit/TestCase.h>
+#include <cppunit/extensions/HelperMacros.h>
+
+#include "EventScheduler.h"
+#include "Rule.h"
+
+
+class TimingWheel_Test : public CppUnit::TestFixture {
+
+	CPPUNIT_TEST_SUITE( TimingWheel_Test );
+
+	CPPUNIT_TEST( testCascade );
+	CPPUNIT_TEST( testOverflow );
+	CPPUNIT_TEST( testSameTickOrder );
+	CPPUNIT_TEST( testDeleteWhileArmed );
+	CPPUNIT_TEST( testDelRuleEvents );
+
+	CPPUNIT_TEST_SUITE_END();
+
+  public:
+
+	void testCascade();
+	void testOverflow();
+	void testSameTickOrder();
+	void testDeleteWhileArmed();
+	void testDelRuleEvents();
+
+  private:
+
+	//! event due at the given tick [msec]
+	static Event *tickEvent(unsigned long long tick);
+
+	static Rule *makeRule(int uid, string rname);
+
+	void delRuleEvents(int useWheel);
+};
+
+CPPUNIT_TEST_SUITE_REGISTRATION( TimingWheel_Test );
+
+
+Event *TimingWheel_Test::tickEvent(unsigned long long tick)
+{
+	struct timeval tv;
+
+	tv.tv_sec = tick / 1000;
+	tv.tv_usec = (tick % 1000) * 1000;
+
+	return new Event(TEST, tv);
+}
+
+
+Rule *TimingWheel_Test::makeRule(int uid, string rname)
+{
+	filterList_t filters;
+	filter_t filter;
+	filter.name = "DstIP";
+	filters.push_back(filter);
+
+	actionList_t actions;
+	action_t action;
+	action.name = "htb";
+	actions.push_back(action);
+
+	miscList_t misc;
+
+	return new Rule(uid, time(NULL), "set1", rname, filters, actions, misc);
+}
+
+
+void TimingWheel_Test::testCascade()
+{
+	// inner level, every outer level and the boundaries between them
+	unsigned long long ticks[] = { 5, 255, 256, 300, 16383, 16384, 20000,
+								   1048575, 1048576, 3000000, 70000000,
+								   1500000000ULL };
+	int n = sizeof(ticks) / sizeof(ticks[0]);
+	vector<Event *> evs;
+
+	TimingWheel wheel(0);
+
+	for (int i = 0; i < n; i++) {
+		evs.push_back(tickEvent(ticks[i]));
+		wheel.add(evs[i]);
+	}
+	CPPUNIT_ASSERT_EQUAL( n, wheel.size() );
+
+	for (int i = 0; i < n; i++) {
+		// never delivered early
+		wheel.advance(ticks[i] - 1);
+		CPPUNIT_ASSERT( wheel.popReady() == NULL );
+		CPPUNIT_ASSERT( wheel.nextBound() <= ticks[i] );
+
+		wheel.advance(ticks[i]);
+		Event *ev = wheel.popReady();
+		CPPUNIT_ASSERT( ev == evs[i] );
+		CPPUNIT_ASSERT( wheel.popReady() == NULL );
+		saveDelete(ev);
+	}
+
+	CPPUNIT_ASSERT_EQUAL( 0, wheel.size() );
+	CPPUNIT_ASSERT( wheel.nextBound() == WHEEL_NO_TICK );
+}
+
+
+void TimingWheel_Test::testOverflow()
+{
+	// the outermost level ends after 2^32 ticks
+	unsigned long long range = 1ULL << (WHEEL_ROOT_BITS + WHEEL_LEVELS * WHEEL_LEVEL_BITS);
+	unsigned long long near = range + 1000;
+	unsigned long long far = 3 * range + 7;
+
+	TimingWheel wheel(0);
+	Event *evFar = tickEvent(far);
+	Event *evNear = tickEvent(near);
+
+	wheel.add(evFar);
+	wheel.add(evNear);
+	CPPUNIT_ASSERT_EQUAL( 2, wheel.size() );
+
+	// the overflow list is looked at again when the outermost level wraps
+	CPPUNIT_ASSERT( wheel.nextBound() <= range );
+
+	wheel.advance(near - 1);
+	CPPUNIT_ASSERT( wheel.popReady() == NULL );
+	wheel.advance(near);
+	CPPUNIT_ASSERT( wheel.popReady() == evNear );
+
+	wheel.advance(far - 1);
+	CPPUNIT_ASSERT( wheel.popReady() == NULL );
+	wheel.advance(far);
+	CPPUNIT_ASSERT( wheel.popReady() == evFar );
+	CPPUNIT_ASSERT_EQUAL( 0, wheel.size() );
+
+	saveDelete(evNear);
+	saveDelete(evFar);
+}
+
+
+void TimingWheel_Test::testSameTickOrder()
+{
+	vector<Event *> evs;
+
+	TimingWheel wheel(0);
+
+	// one in the inner level, the others cascaded from an outer one
+	for (int i = 0; i < 5; i++) {
+		evs.push_back(tickEvent(42));
+		wheel.add(evs[i]);
+	}
+	for (int i = 0; i < 5; i++) {
+		evs.push_back(tickEvent(40000));
+		wheel.add(evs[5 + i]);
+	}
+
+	wheel.advance(40000);
+	for (int i = 0; i < 10; i++) {
+		Event *ev = wheel.popReady();
+		CPPUNIT_ASSERT( ev == evs[i] );
+		saveDelete(ev);
+	}
+	CPPUNIT_ASSERT( wheel.popReady() == NULL );
+}
+
+
+void TimingWheel_Test::testDeleteWhileArmed()
+{
+	TimingWheel wheel(0);
+
+	Event *a = tickEvent(10);
+	Event *b = tickEvent(10);
+	Event *c = tickEvent(5000);
+	Event *d = tickEvent(1ULL << 33);
+	Event *e = tickEvent(20);
+
+	wheel.add(a);
+	wheel.add(b);
+	wheel.add(c);
+	wheel.add(d);
+	CPPUNIT_ASSERT_EQUAL( 4, wheel.size() );
+
+	// from the inner level, an outer level and the overflow list
+	wheel.remove(b);
+	wheel.remove(c);
+	wheel.remove(d);
+	CPPUNIT_ASSERT_EQUAL( 1, wheel.size() );
+
+	// removing twice does nothing
+	wheel.remove(c);
+	CPPUNIT_ASSERT_EQUAL( 1, wheel.size() );
+
+	// the emptied slots are not reported as pending
+	CPPUNIT_ASSERT( wheel.nextBound() <= 10 );
+
+	wheel.advance(1ULL << 34);
+	CPPUNIT_ASSERT( wheel.popReady() == a );
+	CPPUNIT_ASSERT( wheel.popReady() == NULL );
+
+	// an event that is due but not dequeued yet
+	wheel.add(e);
+	wheel.advance((1ULL << 34) + 20);
+	CPPUNIT_ASSERT( wheel.hasReady() );
+	wheel.remove(e);
+	CPPUNIT_ASSERT( !wheel.hasReady() );
+	CPPUNIT_ASSERT( wheel.popReady() == NULL );
+	CPPUNIT_ASSERT_EQUAL( 0, wheel.size() );
+
+	saveDelete(a);
+	saveDelete(b);
+	saveDelete(c);
+	saveDelete(d);
+	saveDelete(e);
+}
+
+
+void TimingWheel_Test::delRuleEvents(int useWheel)
+{
+	Rule *r1 = makeRule(1, "r1");
+	Rule *r2 = makeRule(2, "r2");
+	Rule *r3 = makeRule(3, "r3");
+
+	{
+		EventScheduler sched(useWheel);
+		ruleDB_t both, first, third;
+
+		both.push_back(r1);
+		both.push_back(r2);
+		first.push_back(r1);
+		third.push_back(r3);
+
+		ActivateRulesEvent *act = new ActivateRulesEvent(3600, both);
+		sched.addEvent(act);
+		sched.addEvent(new RemoveRulesEvent(7200, first));
+		sched.addEvent(new RemoveRulesEvent(7200, third));
+		CPPUNIT_ASSERT_EQUAL( 3, sched.getNumEvents() );
+
+		// the removal of r1 is empty now and goes, the activation keeps r2
+		sched.delRuleEvents(1);
+		CPPUNIT_ASSERT_EQUAL( 2, sched.getNumEvents() );
+		CPPUNIT_ASSERT_EQUAL( 1, (int) act->getRules()->size() );
+		CPPUNIT_ASSERT( act->getRules()->front() == r2 );
+
+		// unknown rules are ignored
+		sched.delRuleEvents(1);
+		sched.delRuleEvents(42);
+		CPPUNIT_ASSERT_EQUAL( 2, sched.getNumEvents() );
+
+		ruleUIdSet_t uids;
+		uids.insert(2);
+		uids.insert(3);
+		sched.delRuleEvents(uids);
+		CPPUNIT_ASSERT_EQUAL( 0, sched.getNumEvents() );
+	}
+
+	saveDelete(r1);
+	saveDelete(r2);
+	saveDelete(r3);
+}
+
+
+void TimingWheel_Test::testDelRuleEvents()
+{
+	delRuleEvents(1);
+	delRuleEvents(0);
+}